@@ -40,6 +40,23 @@
  * @date 2010
  */
 #include "fcl.h"
+#include "fcl_internal.h"
+
+#include <glib/gstdio.h>
+
+/**
+ * @struct open_job_t
+ * A file to be openned by fcl_open_files()
+ */
+typedef struct
+{
+    gchar *path;             /**< Path of the file                      */
+    gint mode;               /**< Mode in which it is openned           */
+    fcl_file_t *a_file;      /**< The file openned                      */
+    gint64 start;            /**< When the openning began (recorder)    */
+    gint64 end;              /**< When it ended                         */
+} open_job_t;
+
 
 /** Private intern functions (please have a look at fcl.h for the public API
  *  functions definitions)
@@ -47,28 +64,44 @@
 static fcl_buf_t *new_fcl_buf_t(void);
 static void destroy_fcl_buf_t(gpointer data);
 
-static fcl_file_t *new_fcl_file_t(gchar *path, gint mode);
-static goffset get_gfile_file_size(GFile *the_file);
+static fcl_file_t *new_fcl_file_t(gchar *path, fcl_backend_t *backend);
+static void open_lazily(gpointer data, gpointer user_data);
 static gint cmp_offset_value(gconstpointer a, gconstpointer b, gpointer user_data);
 static gint buffers_overlaps(fcl_buf_t *buffer1, fcl_buf_t *buffer2);
 
 static goffset buf_number(goffset position);
 static goffset position_in_buffer(goffset position);
+static goffset block_file_offset(fcl_file_t *a_file, goffset block);
+static gsize orig_block_size(fcl_file_t *a_file, goffset block);
+static gssize read_from_file(fcl_file_t *a_file, goffset offset, guchar *data, gsize size, fcl_perf_t *perf);
+static void count_allocation(fcl_file_t *a_file, gsize size);
 static gboolean fcl_buffer_exists(fcl_buf_t *a_buffer);
-static void print_buffer(gpointer data, gpointer user_data);
-static void print_buffers_situation_in_sequence(GSequence *sequence);
 
-static fcl_buf_t *read_buffer_at_position(fcl_file_t *a_file, goffset position, gsize *gap);
-static guchar *read_bytes_at_position(fcl_file_t *a_file, goffset position, gsize *size_pointer, gsize *in_data);
+static fcl_buf_t *read_buffer_at_position(fcl_file_t *a_file, goffset position);
+static guchar *read_bytes_at_position(fcl_file_t *a_file, goffset position, gsize *size_pointer);
 static void overwrite_data_at_position(fcl_file_t *a_file, guchar *data, goffset position, gsize *size_pointer);
 static void inserts_data_at_position(fcl_file_t *a_file, guchar *data, goffset position, gsize size);
+static gboolean inserts_pieces_at_position(fcl_file_t *a_file, fcl_buf_t *range, goffset position);
+static fcl_buf_t *collect_range(fcl_file_t *a_file, goffset position, gsize size);
+static fcl_source_t *file_origin(fcl_file_t *a_file);
+static gboolean file_reads_from(fcl_file_t *a_file, guint64 device, guint64 inode);
+static gboolean insert_source_range(fcl_file_t *a_file, goffset position, fcl_source_t *source, goffset offset, gsize length, gint64 start);
 static gboolean delete_bytes_at_position(fcl_file_t *a_file, goffset position, gsize *size_pointer);
+static void replace_matches(fcl_file_t *a_file, fcl_view_t *view, GArray *matches, gsize len, const guchar *replacement, gsize replacement_len);
 
 static gboolean save_the_file(fcl_file_t *a_file);
 
 static void insert_buffer_in_sequence(fcl_file_t *a_file, fcl_buf_t *a_buffer);
+static void buffer_modified(fcl_file_t *a_file, fcl_buf_t *a_buffer);
+static void update_stats(fcl_file_t *a_file, fcl_buf_t *a_buffer, gboolean counted);
+static void count_buffer(fcl_file_t *a_file, gsize size, gsize orig_size, gint sign);
+static gint view_find_buffer(fcl_view_t *view, goffset position);
+static gsize view_fill_window_buffer(fcl_view_t *view, gint i, goffset position, gsize size);
+static gboolean view_window_has(fcl_view_t *view, goffset position);
+static void set_clipboard(fcl_buf_t *range);
 
-static void print_message(const char *format, ...);
+static GMutex clipboard_lock;        /** Protects clipboard                           */
+static fcl_buf_t *clipboard = NULL;  /** Bytes of the clipboard (a buffer of pieces)  */
 
 
 /******************************************************************************/
@@ -80,7 +113,46 @@ static void print_message(const char *format, ...);
  */
 void libfcl_initialize(void)
 {
+    const gchar *trace_path = g_getenv("LIBFCL_RECORD");
+    const gchar *budget = g_getenv("LIBFCL_MEMORY_BUDGET");
+    const gchar *compression = g_getenv("LIBFCL_COMPRESSION");
+    const gchar *max_open = g_getenv("LIBFCL_MAX_OPEN_FILES");
+    const gchar *backend = g_getenv("LIBFCL_BACKEND");
+
     g_type_init();
+
+    if (trace_path != NULL && trace_path[0] != '\0')
+        {
+            fcl_record_start(trace_path);
+        }
+
+    if (budget != NULL && budget[0] != '\0')
+        {
+            fcl_set_memory_budget((gsize) g_ascii_strtoull(budget, NULL, 10));
+        }
+
+    if (compression != NULL && g_strcmp0(compression, "1") == 0)
+        {
+            fcl_set_compression(TRUE);
+        }
+
+    if (max_open != NULL && max_open[0] != '\0')
+        {
+            fcl_set_max_open_files((guint) g_ascii_strtoull(max_open, NULL, 10));
+        }
+
+    if (g_strcmp0(backend, "posix") == 0)
+        {
+            fcl_set_default_backend(LIBFCL_BACKEND_POSIX);
+        }
+    else if (g_strcmp0(backend, "mmap") == 0)
+        {
+            fcl_set_default_backend(LIBFCL_BACKEND_MMAP);
+        }
+    else if (g_strcmp0(backend, "memory") == 0)
+        {
+            fcl_set_default_backend(LIBFCL_BACKEND_MEMORY);
+        }
 }
 
 
@@ -95,82 +167,209 @@ fcl_file_t *fcl_open_file(gchar *path, gint mode)
 {
 
     fcl_file_t *a_file = NULL;
+    gint64 start = g_get_monotonic_time();
 
     switch (mode)
         {
             case LIBFCL_MODE_READ:
-                a_file = new_fcl_file_t(path, mode);
-                a_file->out_stream = NULL;
-                a_file->in_stream = g_file_read(a_file->the_file, NULL, NULL);
-                return a_file;
-            break;
-
             case LIBFCL_MODE_WRITE:
-                a_file = new_fcl_file_t(path, mode);
-                a_file->out_stream = g_file_append_to(a_file->the_file, G_FILE_CREATE_NONE, NULL, NULL);
-                a_file->in_stream = g_file_read(a_file->the_file, NULL, NULL);
-                return a_file;
-            break;
-
             case LIBFCL_MODE_CREATE:
-                a_file = new_fcl_file_t(path, mode);
-                a_file->out_stream = g_file_replace(a_file->the_file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, NULL);
-                a_file->in_stream = g_file_read(a_file->the_file, NULL, NULL);
-                return a_file;
+                a_file = new_fcl_file_t(path, fcl_backend_for_path(path, mode));
             break;
 
             default:
                 return NULL;
             break;
         }
+
+    if (a_file->backend->open(a_file->backend) == TRUE && a_file->backend->release != NULL)
+        {
+            g_rw_lock_reader_lock(&a_file->backend_lock);
+            fcl_pool_use(a_file);
+            g_rw_lock_reader_unlock(&a_file->backend_lock);
+        }
+
+    fcl_record_open(a_file, start, g_get_monotonic_time());
+
+    return a_file;
 }
 
 
 /**
- * This function closes a fcl_file_t
- * @param the fcl_file_t to close
+ * Opens a file lazily (see fcl.h) : only its size is queried, the streams are
+ * openned the first time they are needed
+ * @param path : the path of the file to be opened
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ, LIBFCL_MODE_WRITE,
+ *               LIBFCL_MODE_CREATE).
+ * @return a correctly filled fcl_file_t structure that represents the file
+ *         or NULL if mode is not a mode
  */
-void fcl_close_file(fcl_file_t *a_file, gboolean save)
+fcl_file_t *fcl_open_file_lazy(gchar *path, gint mode)
 {
+    fcl_file_t *a_file = NULL;
+    gint64 start = g_get_monotonic_time();
 
-    /* printing statistics on the file and its sequence */
-    print_buffers_situation_in_sequence(a_file->sequence);
-    fcl_print_buffer_stats(a_file);
+    if (path == NULL || (mode != LIBFCL_MODE_READ && mode != LIBFCL_MODE_WRITE && mode != LIBFCL_MODE_CREATE))
+        {
+            return NULL;
+        }
 
-    g_free(a_file->name);
+    a_file = new_fcl_file_t(path, fcl_backend_for_path(path, mode));
+    fcl_record_open(a_file, start, g_get_monotonic_time());
 
-    if (save == TRUE)
+    return a_file;
+}
+
+
+/**
+ * Opens many files lazily at once (see fcl.h)
+ * @param paths : the paths of the files (NULL terminated)
+ * @param mode : the mode to open the files
+ * @param n_threads : maximum number of threads (0 means one per processor)
+ * @return a GPtrArray of the fcl_file_t files in the order of paths or NULL
+ *         if mode is not a mode
+ */
+GPtrArray *fcl_open_files(gchar **paths, gint mode, guint n_threads)
+{
+    GPtrArray *files = NULL;
+    open_job_t *jobs = NULL;
+    gpointer *job_pointers = NULL;
+    guint n_jobs = 0;
+    guint i = 0;
+
+    if (paths == NULL || (mode != LIBFCL_MODE_READ && mode != LIBFCL_MODE_WRITE && mode != LIBFCL_MODE_CREATE))
+        {
+            return NULL;
+        }
+
+    n_jobs = g_strv_length(paths);
+    files = g_ptr_array_sized_new(n_jobs);
+
+    if (n_jobs > 0)
+        {
+            jobs = (open_job_t *) g_malloc0(n_jobs * sizeof(open_job_t));
+            job_pointers = (gpointer *) g_malloc(n_jobs * sizeof(gpointer));
+
+            for (i = 0; i < n_jobs; i++)
+                {
+                    jobs[i].path = paths[i];
+                    jobs[i].mode = mode;
+                    job_pointers[i] = &jobs[i];
+                }
+
+            /* The size queries are independent : on a slow or cold file
+             * system they are waited for in parallel */
+            fcl_run_jobs(open_lazily, job_pointers, n_jobs, n_threads);
+
+            for (i = 0; i < n_jobs; i++)
+                {
+                    g_ptr_array_add(files, jobs[i].a_file);
+                    fcl_record_open(jobs[i].a_file, jobs[i].start, jobs[i].end);
+                }
+
+            g_free(job_pointers);
+            g_free(jobs);
+        }
+
+    return files;
+}
+
+
+/**
+ * Opens a file lazily in a session (see fcl.h)
+ * @param session : the session
+ * @param path : the path of the file to be opened
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ, LIBFCL_MODE_WRITE,
+ *               LIBFCL_MODE_CREATE).
+ * @return a correctly filled fcl_file_t structure that represents the file
+ *         or NULL if mode is not a mode
+ */
+fcl_file_t *fcl_session_open_file(fcl_session_t *session, gchar *path, gint mode)
+{
+    fcl_file_t *a_file = NULL;
+
+    a_file = fcl_open_file_lazy(path, mode);
+
+    if (a_file != NULL && session != NULL)
         {
-           /* save_the_file(a_file); */
+            fcl_spill_join(a_file, session);
         }
 
-    if (a_file->in_stream != NULL)
+    return a_file;
+}
+
+
+/**
+ * Opens a file on a backend (see fcl.h)
+ * @param backend : the backend (owned by the file from now on)
+ * @param name : name of the file (may be NULL)
+ * @return a correctly filled fcl_file_t structure that represents the file
+ *         or NULL if backend is NULL
+ */
+fcl_file_t *fcl_open_backend(fcl_backend_t *backend, const gchar *name)
+{
+    fcl_file_t *a_file = NULL;
+    gint64 start = g_get_monotonic_time();
+
+    if (backend == NULL)
         {
-            print_message("Closing the input stream \n");
-            g_input_stream_close(G_INPUT_STREAM(a_file->in_stream), NULL, NULL);
+            return NULL;
         }
 
-    if (a_file->out_stream != NULL)
+    a_file = new_fcl_file_t(NULL, backend);
+    a_file->name = g_strdup(name);
+
+    fcl_record_open(a_file, start, g_get_monotonic_time());
+
+    return a_file;
+}
+
+
+/**
+ * This function closes a fcl_file_t
+ * @param the fcl_file_t to close
+ */
+void fcl_close_file(fcl_file_t *a_file, gboolean save)
+{
+    gint64 start = g_get_monotonic_time();
+
+    LIBFCL_TRACE(LIBFCL_TRACE_FILE_CLOSED, a_file, a_file->sequence != NULL ? g_sequence_get_length(a_file->sequence) : 0, a_file->real_size, a_file->mode);
+
+    if (save == TRUE)
         {
-            print_message("Closing the output stream\n");
-            g_output_stream_close(G_OUTPUT_STREAM(a_file->out_stream), NULL, NULL);
+            save_the_file(a_file);
         }
 
+    g_free(a_file->name);
+
+    fcl_pool_leave(a_file);
+    fcl_backend_free(a_file->backend);
+
     if (a_file->the_file != NULL)
         {
-            print_message("Unreference the file\n");
             g_object_unref(a_file->the_file);
         }
 
+    fcl_spill_free(a_file);
+
     if (a_file->sequence != NULL)
         {
-            print_message("Freeing the sequence\n");
             g_sequence_free(a_file->sequence);   /* Here the buffers in the sequence are freed with destroy_fcl_buf_t */
         }
 
-    g_free(a_file);
+    fcl_checksums_free(a_file->checksums);
+    fcl_histograms_free(a_file->histograms);
+    fcl_source_unref(a_file->origin);
+    g_free(a_file->stats);
+    g_hash_table_destroy(a_file->buf_sizes);
+    g_free(a_file->perf);
+    g_mutex_clear(&a_file->perf_lock);
+    g_rw_lock_clear(&a_file->backend_lock);
+    g_rw_lock_clear(&a_file->buffers_lock);
 
-    print_message("The file is closed.\n");
+    fcl_record_close(a_file, save, start);
+
+    g_free(a_file);
 }
 
 
@@ -186,13 +385,16 @@ void fcl_close_file(fcl_file_t *a_file, gboolean save)
  */
 guchar *fcl_read_bytes(fcl_file_t *a_file, goffset position, gsize *size_pointer)
 {
-    gsize in_data = 0;
+    gsize asked = 0;
     guchar *data = NULL;
+    gint64 start = g_get_monotonic_time();
 
     if (a_file != NULL && position >= 0 && *size_pointer > 0)
         {
-            data = read_bytes_at_position(a_file, position, size_pointer, &in_data);
-            *size_pointer = in_data;
+            asked = *size_pointer;
+            data = read_bytes_at_position(a_file, position, size_pointer);
+            fcl_perf_record(a_file->perf, LIBFCL_PERF_READ, start);
+            fcl_record_call(LIBFCL_RECORD_READ, a_file, start, 3, (guint64) position, asked, *size_pointer);
         }
 
     return data;
@@ -213,6 +415,7 @@ guchar *fcl_read_bytes(fcl_file_t *a_file, goffset position, gsize *size_pointer
 extern gboolean fcl_overwrite_bytes(fcl_file_t *a_file, guchar *data, goffset position, gsize *size_pointer)
 {
     gsize size = 0;  /** Because I do not like *size_pointer everywhere !  */
+    gint64 start = g_get_monotonic_time();
 
     if (a_file->mode != LIBFCL_MODE_READ)
         {
@@ -220,6 +423,8 @@ extern gboolean fcl_overwrite_bytes(fcl_file_t *a_file, guchar *data, goffset po
 
             overwrite_data_at_position(a_file, data, position, &size);
 
+            fcl_perf_record(a_file->perf, LIBFCL_PERF_OVERWRITE, start);
+            fcl_record_call(LIBFCL_RECORD_OVERWRITE, a_file, start, 3, (guint64) position, *size_pointer, size);
             *size_pointer = size;
 
             return TRUE;
@@ -247,9 +452,13 @@ extern gboolean fcl_overwrite_bytes(fcl_file_t *a_file, guchar *data, goffset po
  */
 extern gboolean fcl_insert_bytes(fcl_file_t *a_file, guchar *data, goffset position, gsize size)
 {
+    gint64 start = g_get_monotonic_time();
+
     if (a_file->mode != LIBFCL_MODE_READ)
         {
             inserts_data_at_position(a_file, data, position, size);
+            fcl_perf_record(a_file->perf, LIBFCL_PERF_INSERT, start);
+            fcl_record_call(LIBFCL_RECORD_INSERT, a_file, start, 2, (guint64) position, size, 0);
             return TRUE;
         }
     else
@@ -262,772 +471,2199 @@ extern gboolean fcl_insert_bytes(fcl_file_t *a_file, guchar *data, goffset posit
 
 
 /**
- * Deletes bytes in the buffers.
- * @param a_file : the fcl_file_t file to which we want to deleted size bytes
- * @param position : position where to delete size_pointer bytes in the file
- * @param[in,out] size_pointer : number of bytes to be deleted. Returns the
- * number of bytes effectively deleted (may be less than requested)
- * @return True if everything is ok, false otherwise.
+ * Inserts a range of another file without reading it (see fcl.h)
+ * @param a_file : the fcl_file_t file where to insert the range
+ * @param position : position of the insertion in the edited file
+ * @param path : path of the file that holds the range
+ * @param offset : offset of the range in that file
+ * @param length : number of bytes of the range
+ * @return TRUE if the range was inserted, FALSE otherwise
  */
-extern gboolean fcl_delete_bytes(fcl_file_t *a_file, goffset position, gsize *size_pointer)
+extern gboolean fcl_insert_file_range(fcl_file_t *a_file, goffset position, const gchar *path, goffset offset, gsize length)
 {
-    gsize size = 0;  /** Because I do not like *size_pointer everywhere !  */
+    fcl_source_t *source = NULL;
+    gboolean result = FALSE;
+    gint64 start = g_get_monotonic_time();
 
-    /* we can not delete bytes in a read-only file ! */
-    if (a_file->mode != LIBFCL_MODE_READ)
+    if (a_file == NULL || path == NULL)
         {
-            size = *size_pointer;
+            return FALSE;
+        }
 
-            return delete_bytes_at_position(a_file, position, &size);
+    source = fcl_source_open(path, -1);
 
-            *size_pointer = size;
+    if (source != NULL)
+        {
+            result = insert_source_range(a_file, position, source, offset, length, start);
+            fcl_source_unref(source);
         }
     else
         {
-            fprintf(stderr, Q_("File is read-only, deleting is prohibited\n"));
-            return FALSE;
+            fprintf(stderr, Q_("Unable to open %s\n"), path);
         }
-}
-
 
-
-
-/******************************************************************************/
-/*********************************** Buffers **********************************/
+    return result;
+}
 
 
 /**
- * Prints a buffer data (exactly 'size' bytes)
- * @todo : print UTF8 encoded values ?
- * @param data : buffer data to be printed
- * @param size : number of bytes to prints (from data)
- * @param EOL : prints an End Of Line if TRUE, nothing if FALSE
+ * Inserts a range of an openned file descriptor without reading it (see
+ * fcl.h)
+ * @param a_file : the fcl_file_t file where to insert the range
+ * @param position : position of the insertion in the edited file
+ * @param fd : the file descriptor (it is duplicated, the caller keeps it)
+ * @param offset : offset of the range in that file
+ * @param length : number of bytes of the range
+ * @return TRUE if the range was inserted, FALSE otherwise
  */
-extern void fcl_print_data(guchar *data, gsize size, gboolean EOL)
+extern gboolean fcl_insert_fd_range(fcl_file_t *a_file, goffset position, gint fd, goffset offset, gsize length)
 {
-    gsize i = 0;
-    gunichar c;   /** a character to test */
+    fcl_source_t *source = NULL;
+    gboolean result = FALSE;
+    gint64 start = g_get_monotonic_time();
 
-    if (data != NULL)
+    if (a_file == NULL || fd < 0)
         {
-            for (i = 0; i < size ; i++)
-                {
-                    c = data[i];
+            return FALSE;
+        }
 
-                    if (g_unichar_isprint(c))
-                        {
-                            g_print("%c", c);
-                        }
-                    else
-                        {
-                            g_print(".");
-                        }
-                }
+    source = fcl_source_open(NULL, fd);
 
-            if (EOL == TRUE)
-                {
-                    g_print("\n");
-                }
+    if (source != NULL)
+        {
+            result = insert_source_range(a_file, position, source, offset, length, start);
+            fcl_source_unref(source);
+        }
+    else
+        {
+            fprintf(stderr, Q_("Unable to use file descriptor %d\n"), fd);
         }
+
+    return result;
 }
 
 
-/******************************************************************************/
-/****************************** Intern functions ******************************/
-/******************************************************************************/
 
 /**
- * Prints a message in case we are in debug stage
- * @param format the message to print in a vprintf format
- * @param ... the va_list : list of arguments to fill in the format
+ * Copies a range of the edited file elsewhere in it by reference (see fcl.h)
+ * @param a_file : the fcl_file_t file
+ * @param src_position : position of the range
+ * @param size : number of bytes of the range
+ * @param dst_position : position where the copy is inserted
+ * @return TRUE if the range was copied, FALSE otherwise
  */
-static void print_message(const char *format, ...)
+extern gboolean fcl_copy_range(fcl_file_t *a_file, goffset src_position, gsize size, goffset dst_position)
 {
-    va_list args;
-    gchar *str = NULL;
+    fcl_buf_t *range = NULL;
+    gboolean result = FALSE;
+    gint64 start = g_get_monotonic_time();
+
+    if (a_file == NULL)
+        {
+            return FALSE;
+        }
+
+    if (a_file->mode == LIBFCL_MODE_READ)
+        {
+            fprintf(stderr, Q_("File is read-only, copying is prohibited\n"));
+            return FALSE;
+        }
+
+    if (dst_position < 0 || dst_position > MAX(a_file->real_size, 0) + a_file->stats->real_edit_size)
+        {
+            fprintf(stderr, Q_("Inserting bytes outside of the file is not possible !\n"));
+            return FALSE;
+        }
+
+    range = collect_range(a_file, src_position, size);
 
-    if (ENABLE_DEBUG)
+    if (range == NULL)
         {
-            va_start(args, format);
-            str = g_strdup_vprintf(format, args);
-            va_end(args);
-            fprintf(stdout, "%s", str);
+            return FALSE;
         }
+
+    result = size == 0 || inserts_pieces_at_position(a_file, range, dst_position);
+    destroy_fcl_buf_t((gpointer) range);
+
+    fcl_perf_record(a_file->perf, LIBFCL_PERF_INSERT, start);
+    fcl_record_call(LIBFCL_RECORD_COPY, a_file, start, 3, (guint64) src_position, size, (guint64) dst_position);
+
+    return result;
 }
 
 
 /**
- * Prints the buffer state (if debug is enabled)
- * @param data a fcl_buf_t buffer is expected
- * @param user_data : not used so may be NULL
+ * Moves a range of the edited file elsewhere in it by reference (see fcl.h)
+ * @param a_file : the fcl_file_t file
+ * @param src_position : position of the range
+ * @param size : number of bytes of the range
+ * @param dst_position : position, before the move, where the range goes. It
+ *                       can not be inside the range.
+ * @return TRUE if the range was moved, FALSE otherwise
  */
-static void print_buffer(gpointer data, gpointer user_data)
+extern gboolean fcl_move_range(fcl_file_t *a_file, goffset src_position, gsize size, goffset dst_position)
 {
-    fcl_buf_t *a_buffer = (fcl_buf_t *) data;
+    fcl_buf_t *range = NULL;
+    gsize deleted = size;
+    goffset source = src_position;  /** src_position once the copy is inserted */
+    gboolean result = FALSE;
+    gint64 start = g_get_monotonic_time();
 
-    if (ENABLE_DEBUG)
+    if (a_file == NULL)
         {
-            fprintf(stdout, "Offset      : %Ld\n", a_buffer->offset);
-            fprintf(stdout, "Real offset : %Ld\n", a_buffer->real_offset);
-            fprintf(stdout, "Size        : %d\n", a_buffer->size);
+            return FALSE;
+        }
 
-            if (a_buffer->in_seq == TRUE)
-                {
-                    fprintf(stdout, "In sequence : TRUE\n\n");
-                }
-            else
-                {
-                     fprintf(stdout, "In sequence : FALSE\n\n");
-                }
+    if (a_file->mode == LIBFCL_MODE_READ)
+        {
+            fprintf(stderr, Q_("File is read-only, moving is prohibited\n"));
+            return FALSE;
         }
-}
 
+    if (dst_position < 0 || dst_position > MAX(a_file->real_size, 0) + a_file->stats->real_edit_size || (dst_position > src_position && dst_position < src_position + (goffset) size))
+        {
+            fprintf(stderr, Q_("A range can not be moved inside itself or outside of the file\n"));
+            return FALSE;
+        }
 
-static void print_buffers_situation_in_sequence(GSequence *sequence)
-{
+    range = collect_range(a_file, src_position, size);
 
-    if (ENABLE_DEBUG && sequence != NULL)
+    if (range == NULL)
         {
-            fprintf(stdout, "\nBuffers in the sequence :\n");
-            g_sequence_foreach(sequence, print_buffer, NULL);
+            return FALSE;
+        }
+
+    /* The copy is inserted before the range is deleted so that a failure
+     * leaves the bytes in the file
+     */
+    result = size == 0;
+
+    if (size > 0 && inserts_pieces_at_position(a_file, range, dst_position) == TRUE)
+        {
+            if (dst_position <= src_position)
+                {
+                    source = src_position + (goffset) size;
+                }
 
+            result = delete_bytes_at_position(a_file, source, &deleted);
         }
-}
 
+    destroy_fcl_buf_t((gpointer) range);
+
+    fcl_perf_record(a_file->perf, LIBFCL_PERF_MOVE, start);
+    fcl_record_call(LIBFCL_RECORD_MOVE, a_file, start, 3, (guint64) src_position, size, (guint64) dst_position);
+
+    return result;
+}
 
 
-/****************************** Buffers management ****************************/
 
 /**
- * Says wether the buffer structure exists and that the data buffer exists also
- * @param a_buffer the buffer to check
+ * Copies a range of the edited file to the clipboard (see fcl.h)
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the range
+ * @param size : number of bytes of the range
+ * @return TRUE if the range was copied, FALSE otherwise
  */
-static gboolean fcl_buffer_exists(fcl_buf_t *a_buffer)
+extern gboolean fcl_clipboard_copy(fcl_file_t *a_file, goffset position, gsize size)
 {
-    if (a_buffer != NULL && a_buffer->data != NULL)
+    fcl_buf_t *range = NULL;
+
+    if (a_file == NULL)
         {
-            return TRUE;
+            return FALSE;
         }
-    else
+
+    range = collect_range(a_file, position, size);
+
+    if (range == NULL)
         {
             return FALSE;
         }
+
+    set_clipboard(range);
+
+    return TRUE;
 }
 
 
 /**
- * Calculates the number of the buffer which depends of the position in the file
- * @param position : position in the file
- * @return an offset that indicates the number of the buffer. The buffer itself
- * may then begin at LIBFCL_BUF_SIZE * returned number
+ * Moves a range of the edited file to the clipboard (see fcl.h)
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the range
+ * @param size : number of bytes of the range
+ * @return TRUE if the range was cut, FALSE otherwise
  */
-static goffset buf_number(goffset position)
+extern gboolean fcl_clipboard_cut(fcl_file_t *a_file, goffset position, gsize size)
 {
-    return (goffset) (position / LIBFCL_BUF_SIZE);
+    gsize deleted = size;
+    gboolean result = FALSE;
+    gint64 start = g_get_monotonic_time();
+
+    if (a_file == NULL)
+        {
+            return FALSE;
+        }
+
+    if (a_file->mode == LIBFCL_MODE_READ)
+        {
+            fprintf(stderr, Q_("File is read-only, cutting is prohibited\n"));
+            return FALSE;
+        }
+
+    if (fcl_clipboard_copy(a_file, position, size) == FALSE)
+        {
+            return FALSE;
+        }
+
+    result = delete_bytes_at_position(a_file, position, &deleted);
+
+    fcl_perf_record(a_file->perf, LIBFCL_PERF_DELETE, start);
+    fcl_record_call(LIBFCL_RECORD_DELETE, a_file, start, 3, (guint64) position, size, deleted);
+
+    return result;
 }
 
 
 /**
- * Returns the position in the buffer
- * @param position : position in the file
- * @return an offset in the buffer
+ * Puts bytes in the clipboard (see fcl.h)
+ * @param data : the bytes
+ * @param size : number of bytes
  */
-static goffset position_in_buffer(goffset position)
+extern void fcl_clipboard_set(const guchar *data, gsize size)
 {
-    return (goffset) (position - buf_number(position) * LIBFCL_BUF_SIZE);
+    fcl_buf_t *range = NULL;
+
+    range = new_fcl_buf_t();
+    range->size = 0;
+    fcl_pieces_insert(range, 0, NULL, 0, data, size);
+
+    set_clipboard(range);
 }
 
 
 /**
- * Creates a new empty buffer
+ * Inserts the bytes of the clipboard in a file (see fcl.h)
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the insertion
+ * @return TRUE if the clipboard was pasted, FALSE otherwise
  */
-static fcl_buf_t *new_fcl_buf_t(void)
+extern gboolean fcl_clipboard_paste(fcl_file_t *a_file, goffset position)
 {
-    fcl_buf_t *a_buffer = NULL;  /**< the fcl_buf_t structure that will be returned */
+    gsize size = 0;
+    gboolean result = TRUE;
+    gint64 start = g_get_monotonic_time();
+
+    if (a_file == NULL)
+        {
+            return FALSE;
+        }
+
+    if (a_file->mode == LIBFCL_MODE_READ)
+        {
+            fprintf(stderr, Q_("File is read-only, pasting is prohibited\n"));
+            return FALSE;
+        }
+
+    g_mutex_lock(&clipboard_lock);
+
+    if (clipboard != NULL && clipboard->size > 0)
+        {
+            size = clipboard->size;
+            result = inserts_pieces_at_position(a_file, clipboard, position);
+        }
+
+    g_mutex_unlock(&clipboard_lock);
+
+    fcl_perf_record(a_file->perf, LIBFCL_PERF_INSERT, start);
+    fcl_record_call(LIBFCL_RECORD_INSERT, a_file, start, 2, (guint64) position, size, 0);
+
+    return result;
+}
+
+
+/**
+ * Gets the size of the clipboard
+ * @return the number of bytes in the clipboard
+ */
+extern gsize fcl_clipboard_size(void)
+{
+    gsize size = 0;
+
+    g_mutex_lock(&clipboard_lock);
+
+    if (clipboard != NULL)
+        {
+            size = clipboard->size;
+        }
+
+    g_mutex_unlock(&clipboard_lock);
+
+    return size;
+}
+
+
+/**
+ * Empties the clipboard
+ */
+extern void fcl_clipboard_clear(void)
+{
+    set_clipboard(NULL);
+}
+
+
+
+/**
+ * Deletes bytes in the buffers.
+ * @param a_file : the fcl_file_t file to which we want to deleted size bytes
+ * @param position : position where to delete size_pointer bytes in the file
+ * @param[in,out] size_pointer : number of bytes to be deleted. Returns the
+ * number of bytes effectively deleted (may be less than requested)
+ * @return True if everything is ok, false otherwise.
+ */
+extern gboolean fcl_delete_bytes(fcl_file_t *a_file, goffset position, gsize *size_pointer)
+{
+    gsize size = 0;  /** Because I do not like *size_pointer everywhere !  */
+    gboolean result = FALSE;
+    gint64 start = g_get_monotonic_time();
+
+    /* we can not delete bytes in a read-only file ! */
+    if (a_file->mode != LIBFCL_MODE_READ)
+        {
+            size = *size_pointer;
+
+            result = delete_bytes_at_position(a_file, position, &size);
+            fcl_perf_record(a_file->perf, LIBFCL_PERF_DELETE, start);
+            fcl_record_call(LIBFCL_RECORD_DELETE, a_file, start, 3, (guint64) position, *size_pointer, size);
+
+            *size_pointer = size;
+
+            return result;
+        }
+    else
+        {
+            fprintf(stderr, Q_("File is read-only, deleting is prohibited\n"));
+            return FALSE;
+        }
+}
+
+
+/**
+ * Replaces every occurrence of a pattern (see fcl.h)
+ * @param a_file : the fcl_file_t file where to replace the pattern
+ * @param pattern : the bytes to look for
+ * @param len : the number of bytes in pattern
+ * @param replacement : the bytes that replace each occurrence
+ * @param replacement_len : the number of bytes in replacement (may be 0)
+ * @return the number of occurrences replaced or -1 on error
+ */
+extern goffset fcl_replace_all(fcl_file_t *a_file, const guchar *pattern, gsize len, const guchar *replacement, gsize replacement_len)
+{
+    fcl_view_t *view = NULL;
+    GArray *matches = NULL;
+    goffset count = 0;
+    gint64 start = g_get_monotonic_time();
+
+    if (a_file == NULL || pattern == NULL || len == 0 || (replacement == NULL && replacement_len > 0))
+        {
+            return -1;
+        }
+
+    if (a_file->mode != LIBFCL_MODE_READ)
+        {
+            view = fcl_view_new(a_file);
+            matches = fcl_view_find_all(view, pattern, len, 0);
+
+            if (matches->len > 0)
+                {
+                    replace_matches(a_file, view, matches, len, replacement, replacement_len);
+                }
+
+            count = matches->len;
+
+            g_array_free(matches, TRUE);
+            fcl_view_free(view);
+
+            fcl_record_replace_all(a_file, start, pattern, len, replacement, replacement_len, count);
+
+            return count;
+        }
+    else
+        {
+            fprintf(stderr, Q_("File is read-only, replacing is prohibited\n"));
+            return -1;
+        }
+}
+
+
+/**
+ * Saves the edited file to another file (see fcl.h)
+ * @param a_file : the fcl_file_t file to be saved
+ * @param path : path of the file to write
+ * @return TRUE if the whole edited file was written, FALSE otherwise
+ */
+extern gboolean fcl_save_as(fcl_file_t *a_file, const gchar *path)
+{
+    GFile *target_file = NULL;
+    fcl_backend_t *target = NULL;
+    GStatBuf status;
+    gint kind = LIBFCL_BACKEND_GIO;
+    gboolean ok = TRUE;
+
+    if (a_file == NULL || path == NULL)
+        {
+            return FALSE;
+        }
+
+    target_file = fcl_backend_gfile(path);
+    ok = a_file->the_file == NULL || g_file_equal(target_file, a_file->the_file) == FALSE;
+    g_object_unref(target_file);
+
+    /* Another name of the file (link, other spelling) or of a file read by
+     * its pieces : it would be emptied before being read */
+    if (ok == TRUE && g_stat(path, &status) == 0)
+        {
+            ok = file_reads_from(a_file, (guint64) status.st_dev, (guint64) status.st_ino) == FALSE;
+        }
+
+    if (ok == FALSE)
+        {
+            fprintf(stderr, Q_("Can not save a file over itself, use another path\n"));
+            return FALSE;
+        }
+
+    /* The file is written to the disk whatever the backend of the files */
+    kind = fcl_get_default_backend();
+
+    if (kind == LIBFCL_BACKEND_MEMORY)
+        {
+            kind = LIBFCL_BACKEND_GIO;
+        }
+
+    target = fcl_backend_new(kind, path, LIBFCL_MODE_CREATE);
+
+    if (target->open(target) == FALSE)
+        {
+            fprintf(stderr, Q_("Unable to create %s\n"), path);
+            fcl_backend_free(target);
+            return FALSE;
+        }
+
+    ok = fcl_save_to_backend(a_file, target);
+
+    fcl_backend_free(target);
+
+    return ok;
+}
+
+
+/**
+ * Writes the edited file to a backend (see fcl.h)
+ * @param a_file : the fcl_file_t file to be saved
+ * @param target : an empty backend that is not the one of a_file
+ * @return TRUE if the whole edited file was written, FALSE otherwise
+ */
+extern gboolean fcl_save_to_backend(fcl_file_t *a_file, fcl_backend_t *target)
+{
+    fcl_view_t *view = NULL;
+    const guchar *run = NULL;
+    gsize run_size = 0;
+    goffset position = 0;
+    gboolean ok = TRUE;
+    guint64 device = 0;
+    guint64 inode = 0;
+    gint64 start = g_get_monotonic_time();
+
+    if (a_file == NULL || target == NULL || target == a_file->backend)
+        {
+            return FALSE;
+        }
+
+    if (fcl_backend_identity(target, &device, &inode) == TRUE && file_reads_from(a_file, device, inode) == TRUE)
+        {
+            fprintf(stderr, Q_("Can not save a file over itself, use another path\n"));
+            return FALSE;
+        }
+
+    view = fcl_view_new(a_file);
+
+    while (ok == TRUE && position < view->size && (run = fcl_view_get_run(view, position, &run_size)) != NULL)
+        {
+            ok = target->write_at(target, position, run, run_size) == (gssize) run_size;
+            position = position + run_size;
+        }
+
+    ok = ok && position >= view->size;
+
+    fcl_view_free(view);
+
+    ok = target->sync(target) && ok;
+
+    fcl_perf_record(a_file->perf, LIBFCL_PERF_SAVE, start);
+
+    return ok;
+}
+
+
+
+
+/******************************************************************************/
+/*********************************** Buffers **********************************/
+
+
+/**
+ * Prints a buffer data (exactly 'size' bytes). The bytes that are not
+ * printable ASCII characters are printed as '.'.
+ * @todo : print UTF8 encoded values ?
+ * @param data : buffer data to be printed
+ * @param size : number of bytes to prints (from data)
+ * @param EOL : prints an End Of Line if TRUE, nothing if FALSE
+ */
+extern void fcl_print_data(guchar *data, gsize size, gboolean EOL)
+{
+    gchar ascii[4096];   /** the characters printed at once */
+    gsize i = 0;
+    gsize n = 0;
+
+    if (data != NULL)
+        {
+            for (i = 0; i < size ; i = i + n)
+                {
+                    n = MIN(size - i, sizeof(ascii));
+                    fcl_render_ascii(data + i, n, ascii);
+                    g_print("%.*s", (gint) n, ascii);
+                }
+
+            if (EOL == TRUE)
+                {
+                    g_print("\n");
+                }
+        }
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/****************************** Buffers management ****************************/
+
+/**
+ * Says wether the buffer structure exists and that the data buffer exists also
+ * @param a_buffer the buffer to check
+ */
+static gboolean fcl_buffer_exists(fcl_buf_t *a_buffer)
+{
+    if (a_buffer != NULL && a_buffer->data != NULL)
+        {
+            return TRUE;
+        }
+    else
+        {
+            return FALSE;
+        }
+}
+
+
+/**
+ * Calculates the number of the buffer which depends of the position in the file
+ * @param position : position in the file
+ * @return an offset that indicates the number of the buffer. The buffer itself
+ * may then begin at LIBFCL_BUF_SIZE * returned number
+ */
+static goffset buf_number(goffset position)
+{
+    return (goffset) (position / LIBFCL_BUF_SIZE);
+}
+
+
+/**
+ * Returns the position in the buffer
+ * @param position : position in the file
+ * @return an offset in the buffer
+ */
+static goffset position_in_buffer(goffset position)
+{
+    return (goffset) (position - buf_number(position) * LIBFCL_BUF_SIZE);
+}
+
+
+/**
+ * Returns the offset, in the file on disk, where a buffer begins. Buffers
+ * beyond the end of the file (when bytes are appended) all begin at the end
+ * of the file.
+ * @param a_file : the fcl_file_t file the buffer belongs to
+ * @param block : the number of the buffer (fcl_buf_t->offset)
+ * @return the offset of the buffer in the original file
+ */
+static goffset block_file_offset(fcl_file_t *a_file, goffset block)
+{
+    goffset file_size = MAX(a_file->real_size, 0);
+
+    return MIN(block * LIBFCL_BUF_SIZE, file_size);
+}
+
+
+/**
+ * Returns the size that a buffer has in the file on disk (ie before any
+ * edition). This is LIBFCL_BUF_SIZE except for the last buffer of the file
+ * and 0 for buffers beyond the end of the file.
+ * @param a_file : the fcl_file_t file the buffer belongs to
+ * @param block : the number of the buffer (fcl_buf_t->offset)
+ * @return the original size of the buffer
+ */
+static gsize orig_block_size(fcl_file_t *a_file, goffset block)
+{
+    return (gsize) (block_file_offset(a_file, block + 1) - block_file_offset(a_file, block));
+}
+
+
+/**
+ * Reads size bytes from the file on disk at offset through its backend (that
+ * opens it if needed). There is nothing to read in an empty or missing file.
+ * @param a_file : the fcl_file_t file
+ * @param offset : offset in the file on disk
+ * @param data : buffer where to put the read bytes (at least size bytes)
+ * @param size : number of bytes to read
+ * @param perf : the counters where to count the seek and the read
+ * @return the number of bytes read (may be less than size at the end of the
+ *         file) or -1 if an error occured
+ */
+static gssize read_from_file(fcl_file_t *a_file, goffset offset, guchar *data, gsize size, fcl_perf_t *perf)
+{
+    fcl_backend_t *backend = a_file->backend;
+    gboolean was_open = FALSE;
+    gssize read = 0;
+
+    if (a_file->real_size <= 0)
+        {
+            return -1;
+        }
+
+    /* The pool of open files does not release the backend meanwhile */
+    g_rw_lock_reader_lock(&a_file->backend_lock);
+
+    perf->disk_seeks = perf->disk_seeks + 1;
+    was_open = backend->is_open;
+    read = backend->read_at(backend, offset, data, size);
+
+    /* The pool is only changed when the backend is openned again */
+    if (backend->is_open == TRUE && backend->release != NULL)
+        {
+            if (was_open == FALSE)
+                {
+                    fcl_pool_use(a_file);
+                }
+            else
+                {
+                    fcl_pool_touch(a_file);
+                }
+        }
+
+    g_rw_lock_reader_unlock(&a_file->backend_lock);
+
+    if (read < 0)
+        {
+            return -1;
+        }
+
+    perf->disk_reads = perf->disk_reads + 1;
+    perf->disk_bytes_read = perf->disk_bytes_read + (guint64) read;
+
+    return read;
+}
+
+
+/**
+ * Counts an allocation done by an edit or a read of a file
+ * @param a_file : the fcl_file_t file
+ * @param size : number of bytes allocated
+ */
+static void count_allocation(fcl_file_t *a_file, gsize size)
+{
+    a_file->perf->allocations = a_file->perf->allocations + 1;
+    a_file->perf->allocated_bytes = a_file->perf->allocated_bytes + size;
+}
+
+
+/**
+ * Creates a new empty buffer
+ */
+static fcl_buf_t *new_fcl_buf_t(void)
+{
+    fcl_buf_t *a_buffer = NULL;  /**< the fcl_buf_t structure that will be returned */
+
+    a_buffer = (fcl_buf_t *) g_malloc0 (sizeof(fcl_buf_t));
+
+    a_buffer->offset = 0;
+    a_buffer->real_offset = 0;
+    a_buffer->size = LIBFCL_BUF_SIZE;
+    a_buffer->data = (guchar *) g_malloc0 (LIBFCL_BUF_SIZE * sizeof(guchar));
+    a_buffer->in_seq = FALSE;
+
+    return a_buffer;
+}
+
+
+/**
+ * This function cares to calculate the buffer->real_offset and all the values
+ * of the buffer which should be considerated as valid when generating a new
+ * buffer.
+ *
+ * The buffers in the sequence are walked from the begining, summing the size
+ * differences they introduce (the gap), until the buffer that contains
+ * position is found. If position falls between two buffers of the sequence,
+ * the untouched buffer of the file that contains it is read from the disk.
+ * @param a_file : the fcl_file_t file from which we want the buffer
+ * @param position : the position (in the edited file) we want to reach
+ * @return the buffer containing position. Its real_offset is the position
+ *         of its first byte in the edited file. If the buffer is not in the
+ *         sequence (in_seq is FALSE) it has to be destroyed by the caller.
+ */
+static fcl_buf_t *read_buffer_at_position(fcl_file_t *a_file, goffset position)
+{
+    fcl_buf_t *a_buffer = NULL;  /** Buffer to be read                                   */
+    gssize read  = 0;            /** Number of bytes effectively read                    */
+    goffset real_position = 0;   /** Position in the edited file of the buffer           */
+    goffset gap = 0;             /** gap between the edited buffers and the file         */
+    GSequenceIter *iter = NULL;  /** to iterate over the sequence, from the begining     */
+    fcl_buf_t *seq_buf = NULL;
+    goffset file_position = 0;   /** position in the file on disk                        */
+
+    a_file->perf->lookups = a_file->perf->lookups + 1;
+
+    if (a_file->sequence != NULL)
+        {
+            iter = g_sequence_get_begin_iter(a_file->sequence);
+
+            while (g_sequence_iter_is_end(iter) == FALSE)
+                {
+                    seq_buf = g_sequence_get(iter);
+                    a_file->perf->lookup_steps = a_file->perf->lookup_steps + 1;
+                    real_position = block_file_offset(a_file, seq_buf->offset) + gap;
+
+                    if (position < real_position)
+                        {
+                            /* position is in an untouched part of the file */
+                            break;
+                        }
+                    else if (position < real_position + (goffset) seq_buf->size)
+                        {
+                            /* buffer exists */
+                            seq_buf->real_offset = real_position;
+                            a_file->perf->cache_hits = a_file->perf->cache_hits + 1;
+                            LIBFCL_TRACE(LIBFCL_TRACE_LOOKUP_HIT, a_file, position, seq_buf->offset, real_position);
+                            return seq_buf;
+                        }
+
+                    gap = gap + (goffset) seq_buf->size - (goffset) orig_block_size(a_file, seq_buf->offset);
+                    iter = g_sequence_iter_next(iter);
+
+                    /* Appending at the end of the file whose last buffer is
+                     * already in the sequence : that buffer has to be used
+                     */
+                    if (g_sequence_iter_is_end(iter) == TRUE && position == real_position + (goffset) seq_buf->size && position - gap == MAX(a_file->real_size, 0))
+                        {
+                            seq_buf->real_offset = real_position;
+                            a_file->perf->cache_hits = a_file->perf->cache_hits + 1;
+                            LIBFCL_TRACE(LIBFCL_TRACE_LOOKUP_HIT, a_file, position, seq_buf->offset, real_position);
+                            return seq_buf;
+                        }
+                }
+        }
+
+    /* buffer does not exists or is not found in the sequence */
+    file_position = position - gap;
+
+    a_file->perf->cache_misses = a_file->perf->cache_misses + 1;
+
+    a_buffer = new_fcl_buf_t();
+    count_allocation(a_file, sizeof(fcl_buf_t));
+    count_allocation(a_file, LIBFCL_BUF_SIZE);
+    a_buffer->offset = buf_number(file_position);
+    a_buffer->real_offset = position - position_in_buffer(file_position);
+
+    read = read_from_file(a_file, a_buffer->offset * LIBFCL_BUF_SIZE, a_buffer->data, LIBFCL_BUF_SIZE, a_file->perf);
+
+    /* size of what was read (it may be less than LIBFCL_BUF_SIZE) */
+    a_buffer->size = MAX(read, 0);
+
+    LIBFCL_TRACE(LIBFCL_TRACE_LOOKUP_MISS, a_file, position, a_buffer->offset, read);
+
+    return a_buffer;
+}
+
+
+/**
+ * Reads bytes from the buffers that hold them, one buffer after the other
+ * @param a_file : the fcl_file_t file from which we want to read size bytes
+ * @param position : the position where we want to read bytes
+ * @param[in,out] size_pointer : the number of bytes we want to read. Returns
+ *                               the number of bytes read (less than asked for
+ *                               at the end of the file or when a read of the
+ *                               file, of a source or of the scratch file comes
+ *                               back short)
+ * @return a newly allocated buffer with the bytes read or NULL if there is no
+ *         byte at position
+ */
+static guchar *read_bytes_at_position(fcl_file_t *a_file, goffset position, gsize *size_pointer)
+{
+    fcl_buf_t *a_buffer = NULL;  /** Buffer holding the next byte to be read          */
+    guchar *data = NULL;         /** The data that is claimed (size bytes at position) */
+    goffset offset = 0;          /** The offset in a_buffer                            */
+    goffset available = 0;       /** Bytes of the edited file from position            */
+    gsize size = 0;              /** Because I do not like *size_pointer everywhere !  */
+    gsize done = 0;              /** Bytes already read                                */
+    gsize n = 0;
+    gsize got = 0;               /** Bytes of a_buffer effectively read                */
+    gboolean last = FALSE;       /** a_buffer is the last block of the file            */
+
+    g_rw_lock_reader_lock(&a_file->buffers_lock);
+
+    available = MAX(a_file->real_size, 0) + a_file->stats->real_edit_size - position;
+    size = (gsize) MIN((goffset) *size_pointer, MAX(available, 0));
+
+    if (size > 0)
+        {
+            data = (guchar *) g_malloc(size * sizeof(guchar));
+            count_allocation(a_file, size);
+        }
+
+    while (done < size && last == FALSE)
+        {
+            LIBFCL_TRACE(LIBFCL_TRACE_READ, a_file, position + done, size - done, done);
+
+            a_buffer = read_buffer_at_position(a_file, position + (goffset) done);
+
+            /* offset is viewed as the offset in the buffer a_buffer just read above */
+            offset = position + (goffset) done - a_buffer->real_offset;
+
+            if (offset >= 0 && offset < (goffset) a_buffer->size)
+                {
+                    n = MIN(size - done, a_buffer->size - (gsize) offset);
+                    got = fcl_spill_read(a_file, a_buffer, (gsize) offset, data + done, n, a_file->perf);
+                    done = done + got;
+
+                    if (got < n)
+                        {
+                            /* The scratch file or a source of the buffer
+                             * was cut : only the bytes before are returned */
+                            fprintf(stderr, Q_("Unable to read the edited file at %" G_GOFFSET_FORMAT "\n"), position + (goffset) done);
+                            last = TRUE;
+                        }
+                }
+            else
+                {
+                    last = TRUE;
+                }
+
+            if (a_buffer->in_seq == FALSE)
+                {
+                    /* Not all the buffer was filled but the buffer is not in
+                     * the sequence : this is the end of the file */
+                    last = last || a_buffer->size < LIBFCL_BUF_SIZE;
+                    destroy_fcl_buf_t((gpointer) a_buffer);
+                }
+        }
+
+    if (done == 0)
+        {
+            g_free(data);
+            data = NULL;
+        }
+    else if (done < size)
+        {
+            data = (guchar *) g_realloc(data, done * sizeof(guchar));
+        }
+
+    g_rw_lock_reader_unlock(&a_file->buffers_lock);
+
+    *size_pointer = done;
+
+    return data;
+}
+
+
+/**
+ * Inserts a buffer in the sequence (only if it is not already in it !)
+ */
+static void insert_buffer_in_sequence(fcl_file_t *a_file, fcl_buf_t *a_buffer)
+{
+
+    if (a_file != NULL && a_buffer != NULL)
+        {
+            if (a_file->sequence == NULL)
+                {
+                    a_buffer->in_seq = TRUE;
+                    a_file->sequence = g_sequence_new(destroy_fcl_buf_t);
+                    g_sequence_append(a_file->sequence, a_buffer);
+                    LIBFCL_TRACE(LIBFCL_TRACE_BUFFER_INSERTED, a_buffer, a_buffer->offset, a_buffer->real_offset, a_buffer->size);
+                }
+            else
+                {
+                    if (a_buffer->in_seq == FALSE)
+                        {
+                            a_buffer->in_seq = TRUE;
+                            g_sequence_insert_sorted(a_file->sequence, a_buffer, cmp_offset_value, NULL);
+                            LIBFCL_TRACE(LIBFCL_TRACE_BUFFER_INSERTED, a_buffer, a_buffer->offset, a_buffer->real_offset, a_buffer->size);
+                        }
+                }
+        }
+}
+
+
+/**
+ * To be called each time the data of a buffer is modified : the buffer is
+ * inserted in the sequence (if it is not already in it) and what is kept
+ * about the content of the file (statistics, hash trees, histograms, memory
+ * budget) is told about the change. Its data may be spilled right away.
+ * @param a_file : the fcl_file_t file
+ * @param a_buffer : the buffer that was modified
+ */
+static void buffer_modified(fcl_file_t *a_file, fcl_buf_t *a_buffer)
+{
+    gboolean counted = a_buffer->in_seq;  /** Already in the statistics */
+
+    insert_buffer_in_sequence(a_file, a_buffer);
+    update_stats(a_file, a_buffer, counted);
+    fcl_checksums_invalidate(a_file, a_buffer->offset);
+    fcl_histograms_invalidate(a_file, a_buffer->offset);
+    fcl_spill_touch(a_file, a_buffer);
+}
+
+
+/**
+ * Overwites bytes in place, one buffer after the other
+ * @param a_file : the fcl_file_t file
+ * @param data : the bytes to be written
+ * @param position : position of the first byte to be overwritten
+ * @param[in,out] size_pointer : number of bytes to be overwritten. Returns
+ *                               the number of bytes overwritten (less than
+ *                               asked for at the end of the file)
+ */
+static void overwrite_data_at_position(fcl_file_t *a_file, guchar *data, goffset position, gsize *size_pointer)
+{
+    fcl_buf_t *a_buffer = NULL;  /** Buffer to be overwritten  */
+    goffset buf_position = 0;    /** Position in the buffer    */
+    gsize size = 0;
+    gsize done = 0;              /** Bytes already overwritten */
+    gsize n = 0;
+
+    size = *size_pointer;
+
+    g_rw_lock_reader_lock(&a_file->buffers_lock);
+
+    while (done < size)
+        {
+            a_buffer = read_buffer_at_position(a_file, position + (goffset) done);
+
+            buf_position = position + (goffset) done - a_buffer->real_offset;
+            LIBFCL_TRACE(LIBFCL_TRACE_OVERWRITE, a_file, position + done, size - done, buf_position);
+
+            if (buf_position < 0 || buf_position >= (goffset) a_buffer->size)
+                {
+                    /* This is the end of the file */
+                    if (a_buffer->in_seq == FALSE)
+                        {
+                            destroy_fcl_buf_t((gpointer) a_buffer);
+                        }
+
+                    fprintf(stderr, Q_("Overwritting outside of the file is not possible !\n"));
+                    break;
+                }
+
+            n = MIN(size - done, a_buffer->size - (gsize) buf_position);
+
+            if (a_buffer->pieces != NULL)
+                {
+                    /* The new bytes go in front of the ones they replace */
+                    fcl_pieces_insert(a_buffer, (gsize) buf_position, NULL, 0, data + done, n);
+                    fcl_pieces_delete(a_buffer, (gsize) buf_position + n, n);
+                }
+            else
+                {
+                    fcl_spill_load(a_file, a_buffer);
+                    memcpy(a_buffer->data + buf_position, data + done, n);
+                }
+
+            buffer_modified(a_file, a_buffer);
+            done = done + n;
+        }
+
+    g_rw_lock_reader_unlock(&a_file->buffers_lock);
+
+    *size_pointer = done;
+}
+
+
+/**
+ * Inserts data into a buffer in place
+ * @warning this function is recursive
+ */
+static void inserts_data_at_position(fcl_file_t *a_file, guchar *data, goffset position, gsize size)
+{
+    fcl_buf_t *a_buffer = NULL;  /** Buffer where to insert datas             */
+    goffset buf_position = 0;    /** Position in the buffer                   */
+    guchar *new_data = NULL;     /** new buffer that will replace the old one */
+    gsize new_size = 0;          /** new size for the buffer                  */
+
+    g_rw_lock_reader_lock(&a_file->buffers_lock);
+
+    a_buffer = read_buffer_at_position(a_file, position);
+
+    buf_position = (position - a_buffer->real_offset);
+
+    LIBFCL_TRACE(LIBFCL_TRACE_INSERT, a_file, position, size, buf_position);
+
+    if (buf_position >= 0 && buf_position <= a_buffer->size && a_buffer->pieces != NULL)
+        {
+            fcl_pieces_insert(a_buffer, (gsize) buf_position, NULL, 0, data, size);
+            buffer_modified(a_file, a_buffer);
+        }
+    else if (buf_position >= 0 && buf_position <= a_buffer->size)
+        {
+            new_size = size + a_buffer->size;
+            new_data = (guchar *) g_malloc0(new_size * sizeof(guchar));
+            count_allocation(a_file, new_size);
+            fcl_spill_load(a_file, a_buffer);
+
+            memcpy(new_data, a_buffer->data, buf_position);
+            memcpy(new_data + buf_position, data, size);
+            memcpy(new_data + buf_position + size, a_buffer->data + buf_position, a_buffer->size - buf_position);
+
+            g_free(a_buffer->data);
+            a_buffer->data = new_data;
+            a_buffer->size = new_size;
+
+            buffer_modified(a_file, a_buffer);
+        }
+
+    g_rw_lock_reader_unlock(&a_file->buffers_lock);
+}
+
+
+/**
+ * Inserts the bytes of a range (a buffer made of pieces that is not in the
+ * sequence) into the buffer that holds position. The bytes that the range
+ * references are not read (see fcl_piece.c).
+ * @param a_file : the fcl_file_t file
+ * @param range : the bytes to insert (left as they are)
+ * @param position : position of the insertion in the edited file
+ * @return FALSE if position is beyond the end of the edited file
+ */
+static gboolean inserts_pieces_at_position(fcl_file_t *a_file, fcl_buf_t *range, goffset position)
+{
+    fcl_buf_t *a_buffer = NULL;  /** Buffer where to insert the range */
+    goffset buf_position = 0;    /** Position in the buffer           */
+    gboolean inserted = FALSE;
+
+    g_rw_lock_reader_lock(&a_file->buffers_lock);
+
+    a_buffer = read_buffer_at_position(a_file, position);
+
+    buf_position = (position - a_buffer->real_offset);
+
+    LIBFCL_TRACE(LIBFCL_TRACE_INSERT, a_file, position, range->size, buf_position);
+
+    if (buf_position >= 0 && buf_position <= (goffset) a_buffer->size)
+        {
+            fcl_spill_load(a_file, a_buffer);
+            fcl_pieces_splice(a_buffer, (gsize) buf_position, range);
+            buffer_modified(a_file, a_buffer);
+            inserted = TRUE;
+        }
+    else if (a_buffer->in_seq == FALSE)
+        {
+            destroy_fcl_buf_t((gpointer) a_buffer);
+        }
+
+    g_rw_lock_reader_unlock(&a_file->buffers_lock);
+
+    return inserted;
+}
+
+
+/**
+ * Collects a range of the edited file as pieces : the untouched parts of the
+ * file are referenced (see file_origin()), as are the ranges of other files
+ * in buffers made of pieces. Only the bytes of the edited buffers are copied,
+ * and those of the untouched parts of a file that has no local path (they
+ * are read through the view).
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the range in the edited file
+ * @param size : number of bytes of the range
+ * @return a newly allocated buffer made of pieces (not in the sequence) or
+ *         NULL if the range is not in the edited file or can not be read
+ */
+static fcl_buf_t *collect_range(fcl_file_t *a_file, goffset position, gsize size)
+{
+    fcl_view_t *view = NULL;
+    fcl_buf_t *range = NULL;
+    fcl_buf_t *seq_buf = NULL;
+    fcl_source_t *origin = NULL;
+    guchar *data = NULL;         /** bytes of a spilled or compressed buffer    */
+    goffset end = position + (goffset) size;
+    goffset next = 0;            /** end of the part of the range being collected */
+    goffset gap = 0;
+    gsize offset = 0;
+    gsize read = 0;
+    gint i = 0;
+
+    view = fcl_view_new(a_file);
+
+    if (position < 0 || end > view->size)
+        {
+            fprintf(stderr, Q_("Range is beyond the end of the file\n"));
+            fcl_view_free(view);
+            return NULL;
+        }
+
+    range = new_fcl_buf_t();
+    range->size = 0;
+
+    while (position < end && range != NULL)
+        {
+            i = view_find_buffer(view, position);
+
+            if (i >= 0 && position < view->starts[i] + (goffset) view->bufs[i]->size)
+                {
+                    /* position is in a buffer of the sequence */
+                    seq_buf = view->bufs[i];
+                    next = MIN(end, view->starts[i] + (goffset) seq_buf->size);
+                    offset = (gsize) (position - view->starts[i]);
+
+                    if (seq_buf->pieces != NULL)
+                        {
+                            fcl_pieces_copy(range, seq_buf, offset, (gsize) (next - position));
+                        }
+                    else if (LIBFCL_BUF_IN_MEMORY(seq_buf) == TRUE)
+                        {
+                            fcl_pieces_insert(range, range->size, NULL, 0, seq_buf->data + offset, (gsize) (next - position));
+                        }
+                    else
+                        {
+                            data = (guchar *) g_malloc((gsize) (next - position) * sizeof(guchar));
+                            fcl_spill_read(a_file, seq_buf, offset, data, (gsize) (next - position), &view->perf);
+                            fcl_pieces_insert(range, range->size, NULL, 0, data, (gsize) (next - position));
+                            g_free(data);
+                        }
+                }
+            else
+                {
+                    /* position is in an untouched part of the file */
+                    gap = i >= 0 ? view->gaps[i] : 0;
+                    next = i + 1 < (gint) view->n_bufs ? MIN(end, view->starts[i + 1]) : end;
+                    origin = file_origin(a_file);
 
-    a_buffer = (fcl_buf_t *) g_malloc0 (sizeof(fcl_buf_t));
+                    if (origin != NULL)
+                        {
+                            fcl_pieces_insert(range, range->size, origin, position - gap, NULL, (gsize) (next - position));
+                        }
+                    else
+                        {
+                            /* No file on disk to reference : the bytes are copied */
+                            data = (guchar *) g_malloc((gsize) (next - position) * sizeof(guchar));
+                            read = fcl_view_read_original(view, position - gap, data, (gsize) (next - position));
 
-    a_buffer->offset = 0;
-    a_buffer->real_offset = 0;
-    a_buffer->size = LIBFCL_BUF_SIZE;
-    a_buffer->data = (guchar *) g_malloc0 (LIBFCL_BUF_SIZE * sizeof(guchar));
-    a_buffer->in_seq = FALSE;
+                            if (read == (gsize) (next - position))
+                                {
+                                    fcl_pieces_insert(range, range->size, NULL, 0, data, read);
+                                }
+                            else
+                                {
+                                    fprintf(stderr, Q_("Unable to read the edited file at %" G_GOFFSET_FORMAT "\n"), position - gap);
+                                    destroy_fcl_buf_t((gpointer) range);
+                                    range = NULL;
+                                }
 
-    return a_buffer;
+                            g_free(data);
+                        }
+                }
+
+            position = next;
+        }
+
+    fcl_view_free(view);
+
+    return range;
 }
 
 
 /**
- * This function cares to calculate the buffer->real_offset and all the values
- * of the buffer which should be considerated as valid when generating a new
- * buffer.
+ * Replaces the bytes of the clipboard
+ * @param range : the new bytes (a buffer that is not in a sequence) or NULL
+ *                to empty the clipboard
  */
-static fcl_buf_t *read_buffer_at_position(fcl_file_t *a_file, goffset position, gsize *the_gap)
+static void set_clipboard(fcl_buf_t *range)
 {
-    fcl_buf_t *a_buffer = NULL;  /** Buffer to be read                                   */
-    gssize read  = 0;            /** Number of bytes effectively read                    */
-    goffset real_position = 0;   /** Position in the file (in number of LIBFCL_BUF_SIZE) */
-    gsize gap = 0;               /** gap between the edited buffers and the file         */
-    GSequenceIter *begin = NULL; /** to iterate over the sequence, from the begining     */
-    fcl_buf_t * seq_buf = NULL;
-    gboolean ok = TRUE;
+    fcl_buf_t *old = NULL;
+
+    g_mutex_lock(&clipboard_lock);
+    old = clipboard;
+    clipboard = range;
+    g_mutex_unlock(&clipboard_lock);
 
-    print_message("read_buffer_at_position(%p, %ld, %ld) : ", a_file, position, *the_gap);
+    if (old != NULL)
+        {
+            destroy_fcl_buf_t((gpointer) old);
+        }
+}
+
+
+/**
+ * Gets the file on disk as a source of pieces, openning it the first time
+ * @param a_file : the fcl_file_t file
+ * @return the source (owned by a_file) or NULL if the file can not be openned
+ */
+static fcl_source_t *file_origin(fcl_file_t *a_file)
+{
+    gchar *path = NULL;
 
-    if (a_file->sequence == NULL)
+    if (a_file->origin == NULL && a_file->the_file != NULL)
         {
-             a_buffer = new_fcl_buf_t();
+            path = g_file_get_path(a_file->the_file);
 
-            /* No offset correction here because the sequence is empty */
-            /* calculating the aligned real_position in the file       */
-            real_position = (goffset) position / LIBFCL_BUF_SIZE;
+            if (path != NULL)
+                {
+                    a_file->origin = fcl_source_open(path, -1);
+                    g_free(path);
+                }
+        }
 
-            a_buffer->offset = real_position;
-            a_buffer->real_offset = real_position * LIBFCL_BUF_SIZE;
+    return a_file->origin;
+}
 
-            g_seekable_seek(G_SEEKABLE(a_file->in_stream), a_buffer->real_offset, G_SEEK_SET, NULL, NULL);
-            read = g_input_stream_read(G_INPUT_STREAM(a_file->in_stream), a_buffer->data, LIBFCL_BUF_SIZE, NULL, NULL);
 
-            a_buffer->size = read; /* size of what was read (it may be less than LIBFCL_BUF_SIZE) */
+/**
+ * Says wether the edited file reads a file on disk : its own file or the
+ * source file of one of its pieces
+ * @param a_file : the fcl_file_t file
+ * @param device : device of the file on disk
+ * @param inode : inode of the file on disk
+ * @return TRUE if the bytes of a_file are read from that file
+ */
+static gboolean file_reads_from(fcl_file_t *a_file, guint64 device, guint64 inode)
+{
+    GSequenceIter *iter = NULL;
+    fcl_buf_t *seq_buf = NULL;
+    guint64 file_device = 0;
+    guint64 file_inode = 0;
 
-            print_message("%ld\n", read);
+    if (fcl_backend_identity(a_file->backend, &file_device, &file_inode) == TRUE && file_device == device && file_inode == inode)
+        {
+            return TRUE;
         }
-    else
+
+    if (a_file->sequence != NULL)
         {
-            /**
-             * Calculate the gap beetween file and buffers in the sequence
-             * begining at 0 until the corresponding buffer has been found or
-             * the value is higher then the position we want to read
-             */
-            gap = 0;
-            real_position = 0;
-            ok = TRUE;
-            begin = g_sequence_get_begin_iter(a_file->sequence);
+            iter = g_sequence_get_begin_iter(a_file->sequence);
+
+            while (g_sequence_iter_is_end(iter) == FALSE)
+                {
+                    seq_buf = g_sequence_get(iter);
 
-            seq_buf = g_sequence_get(begin);
+                    if (seq_buf->pieces != NULL && fcl_pieces_in_file(seq_buf, device, inode) == TRUE)
+                        {
+                            return TRUE;
+                        }
+
+                    iter = g_sequence_iter_next(iter);
+                }
+        }
+
+    return FALSE;
+}
 
-            print_message("\nreal_position + seq_buf->size < position ? %ld + %ld < %ld\n", real_position,  seq_buf->size, position);
 
-            while ((real_position + seq_buf->size) <= position && ok == TRUE)
-                {
-                    real_position = real_position + seq_buf->size;
-                    gap = gap + (seq_buf->size - LIBFCL_BUF_SIZE);
+/**
+ * Deletes bytes at position in the file, one buffer after the other : once
+ * the end of a buffer is deleted, the next bytes to be deleted are at the
+ * same position.
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the first byte to be deleted
+ * @param[in,out] size_pointer : number of bytes to be deleted. Returns the
+ *                               number of bytes deleted (less than asked for
+ *                               at the end of the file)
+ * @return FALSE if there is no byte at position, TRUE otherwise
+ */
+static gboolean delete_bytes_at_position(fcl_file_t *a_file, goffset position, gsize *size_pointer)
+{
+    fcl_buf_t *a_buffer = NULL;  /** Buffer where to delete bytes */
+    goffset buf_position = 0;    /** Position in the buffer       */
+    guchar *new_data = NULL;
+    gsize size = 0;
+    gsize done = 0;              /** Bytes already deleted        */
+    gsize n = 0;
+
+    size = *size_pointer;
+
+    g_rw_lock_reader_lock(&a_file->buffers_lock);
+
+    while (done < size)
+        {
+            a_buffer = read_buffer_at_position(a_file, position);
 
-                    print_message("real_position : %ld ; gap : %ld\n", real_position, gap);
+            buf_position = position - a_buffer->real_offset;
 
-                    if (g_sequence_iter_is_end(begin) == TRUE)
+            LIBFCL_TRACE(LIBFCL_TRACE_DELETE, a_file, position, size - done, buf_position);
+
+            if (buf_position < 0 || buf_position >= (goffset) a_buffer->size)
+                {
+                    /* This is the end of the file */
+                    if (a_buffer->in_seq == FALSE)
                         {
-                            ok = FALSE;
+                            destroy_fcl_buf_t((gpointer) a_buffer);
                         }
-                    else
-                        {
-                            begin = g_sequence_iter_next(begin);
 
-                            if (g_sequence_iter_is_end(begin) != TRUE)
-                                {
-                                    seq_buf = g_sequence_get(begin);
-                                }
-                            else
-                                {
-                                    ok = FALSE;
-                                }
+                    if (done > 0)
+                        {
+                            fprintf(stderr, Q_("Deleting bytes outside of the file is not possible !\n"));
                         }
+
+                    break;
                 }
 
-            print_message("real_position : %ld; seq_buf->size : %ld; position : %ld; gap : %ld\n", real_position,  seq_buf->size, position, gap);
+            /* bytes of this buffer to be deleted */
+            n = MIN(size - done, a_buffer->size - (gsize) buf_position);
 
-            *the_gap = gap;
-            if ((ok == TRUE) && ((real_position + seq_buf->size) > position))
+            if (a_buffer->pieces != NULL)
                 {
-                    /* buffer exists */
-                    print_message("%ld == %ld ?\n", seq_buf->real_offset, real_position);
-                    seq_buf->real_offset = real_position;
-                    a_buffer = seq_buf;
+                    fcl_pieces_delete(a_buffer, (gsize) buf_position, n);
                 }
             else
                 {
-                    /* buffer does not exists or is not found in the sequence */
-                    a_buffer = new_fcl_buf_t();
+                    new_data = (guchar *) g_malloc0((a_buffer->size - n) * sizeof(guchar));
+                    count_allocation(a_file, a_buffer->size - n);
+                    fcl_spill_load(a_file, a_buffer);
 
-                    a_buffer->offset = (position - gap) / LIBFCL_BUF_SIZE;
-                    a_buffer->real_offset = (position - gap);
-
-                    g_seekable_seek(G_SEEKABLE(a_file->in_stream), a_buffer->real_offset, G_SEEK_SET, NULL, NULL);
-                    read = g_input_stream_read(G_INPUT_STREAM(a_file->in_stream), a_buffer->data, LIBFCL_BUF_SIZE, NULL, NULL);
+                    memcpy(new_data, a_buffer->data, buf_position);
+                    memcpy(new_data + buf_position, a_buffer->data + buf_position + n, a_buffer->size - (buf_position + n));
 
-                    a_buffer->size = read;
+                    g_free(a_buffer->data);
+                    a_buffer->data = new_data;
+                    a_buffer->size = a_buffer->size - n;
                 }
+
+            /* The buffer has been modified we must put it in the sequence (if it is not allready in it) */
+            buffer_modified(a_file, a_buffer);
+
+            done = done + n;
         }
 
-    print_buffer(a_buffer, NULL);
+    g_rw_lock_reader_unlock(&a_file->buffers_lock);
 
-    return a_buffer;
+    *size_pointer = done;
+
+    return done > 0 || size == 0;
 }
 
 
+
 /**
- * This function reads an fcl_buf_t buffer from an fcl_file_t
- * @warning this function is recursive.
- * @param a_file : the fcl_file_t file from which we want to read size bytes
- * @param position : the position where we want to read bytes
- * @param[in,out] size_pointer : the number of bytes we want to read. The value
- *                               indicates thereal size of the data read hence,
- *                               the real size of the returned gchar * buffer
- * @param[in,out] in_data : number of bytes in the buffer to be returned. It
- *                          also indicates the position in the buffer.
- * @return If everything is ok a filled guchar *buffer (may be less than
- *         requested)
+ * Replaces matches of a pattern in one pass over the blocks that they touch.
+ * The new content of each block is built once (a match that spans blocks is
+ * replaced in the block where it begins and removed from the next ones) and
+ * the sequence is only changed once every block is built, as the view (and
+ * the positions of the matches) refer to the file before the replacement.
+ * @param a_file : the fcl_file_t file
+ * @param view : a view on a_file (as it was when the matches were found)
+ * @param matches : positions (goffset) of the matches, in order and not
+ *                  overlapping
+ * @param len : size of a match
+ * @param replacement : the bytes that replace each match
+ * @param replacement_len : the number of bytes in replacement
  */
-static guchar *read_bytes_at_position(fcl_file_t *a_file, goffset position, gsize *size_pointer, gsize *in_data)
+static void replace_matches(fcl_file_t *a_file, fcl_view_t *view, GArray *matches, gsize len, const guchar *replacement, gsize replacement_len)
 {
-    fcl_buf_t *a_buffer = NULL;  /** the fcl_buf_t structure that will be returned     */
-    guchar *data = NULL;         /** The data that is claimed (size bytes at position) */
-    guchar *next_data = NULL;
-    guchar *new_data = NULL;
-    goffset offset = 0;          /** The offset in the data buffer                     */
-    gsize real_size = 0;         /** Real size returned by the recursive call          */
-    gsize size = 0;              /** Because I do not like *size_pointer everywhere !  */
-    gsize gap = 0;
+    GPtrArray *new_bufs = NULL;  /** new content of the blocks (not in the sequence)  */
+    GPtrArray *seq_bufs = NULL;  /** buffers of the sequence they replace (or NULL)   */
+    GByteArray *content = NULL;  /** new content of the block being built             */
+    fcl_buf_t *seq_buf = NULL;
+    fcl_buf_t *a_buffer = NULL;
+    const guchar *data = NULL;   /** bytes of the block before the replacement        */
+    guchar *read = NULL;
+    guchar *spilled = NULL;      /** bytes of a block that are not in memory          */
+    goffset position = 0;        /** a position in the block to be built              */
+    goffset start = 0;           /** position of the block in the edited file         */
+    goffset end = 0;             /** position just after the block                    */
+    goffset cursor = 0;          /** bytes of the block before cursor are done        */
+    goffset match = 0;
+    goffset block = 0;
+    goffset gap = 0;
+    gsize size = 0;
+    guint m = 0;
+    gint i = 0;
 
-    size = *size_pointer;
+    new_bufs = g_ptr_array_new();
+    seq_bufs = g_ptr_array_new();
+    read = (guchar *) g_malloc(LIBFCL_BUF_SIZE * sizeof(guchar));
+
+    position = g_array_index(matches, goffset, 0);
+
+    while (m < matches->len)
+        {
+            /* Finding the block at position and its bytes */
+            i = view_find_buffer(view, position);
+
+            if (i >= 0 && position < view->starts[i] + (goffset) view->bufs[i]->size)
+                {
+                    seq_buf = view->bufs[i];
+                    block = seq_buf->offset;
+                    start = view->starts[i];
+                    size = seq_buf->size;
+                    data = seq_buf->data;
+
+                    if (LIBFCL_BUF_IN_MEMORY(seq_buf) == FALSE)
+                        {
+                            spilled = (guchar *) g_malloc(size * sizeof(guchar));
+                            fcl_spill_read(a_file, seq_buf, 0, spilled, size, a_file->perf);
+                            data = spilled;
+                        }
+                }
+            else
+                {
+                    gap = i >= 0 ? view->gaps[i] : 0;
+                    seq_buf = NULL;
+                    block = buf_number(position - gap);
+                    start = block_file_offset(a_file, block) + gap;
+                    size = orig_block_size(a_file, block);
+                    data = read;
+                    fcl_view_read(view, start, read, size);
+                }
+
+            end = start + (goffset) size;
+
+            /* Building its new content */
+            content = g_byte_array_sized_new((guint) size);
+            cursor = start;
+
+            while (m < matches->len && (match = g_array_index(matches, goffset, m)) < end)
+                {
+                    if (match >= cursor)
+                        {
+                            g_byte_array_append(content, data + (cursor - start), (guint) (match - cursor));
+                        }
+
+                    if (match >= start)
+                        {
+                            g_byte_array_append(content, replacement, (guint) replacement_len);
+                        }
+
+                    cursor = MIN(match + (goffset) len, end);
+
+                    if (match + (goffset) len > end)
+                        {
+                            /* The match goes on in the next block */
+                            break;
+                        }
+
+                    m++;
+                }
+
+            g_byte_array_append(content, data + (cursor - start), (guint) (end - cursor));
+            g_free(spilled);
+            spilled = NULL;
+
+            a_buffer = (fcl_buf_t *) g_malloc0(sizeof(fcl_buf_t));
+            count_allocation(a_file, sizeof(fcl_buf_t));
+            count_allocation(a_file, content->len);
+            a_buffer->offset = block;
+            a_buffer->size = content->len;
+            a_buffer->data = g_byte_array_free(content, FALSE);
+            a_buffer->in_seq = FALSE;
+
+            g_ptr_array_add(new_bufs, a_buffer);
+            g_ptr_array_add(seq_bufs, seq_buf);
+
+            if (m < matches->len)
+                {
+                    position = MAX(end, g_array_index(matches, goffset, m));
+                }
+        }
 
-    print_message("read_bytes_at_position(%p, %ld, %ld, %ld)\n", a_file, position, size, *in_data);
+    /* Now changing the sequence */
+    for (m = 0; m < new_bufs->len; m++)
+        {
+            a_buffer = (fcl_buf_t *) g_ptr_array_index(new_bufs, m);
+            seq_buf = (fcl_buf_t *) g_ptr_array_index(seq_bufs, m);
 
-    data = (guchar *) g_malloc0 (size * sizeof(guchar));
+            if (seq_buf != NULL)
+                {
+                    fcl_spill_release(a_file, seq_buf);
+                    seq_buf->data = a_buffer->data;
+                    seq_buf->size = a_buffer->size;
+                    g_free(a_buffer);
+                    buffer_modified(a_file, seq_buf);
+                }
+            else
+                {
+                    buffer_modified(a_file, a_buffer);
+                }
+        }
 
-    a_buffer = read_buffer_at_position(a_file, position, &gap);
+    g_ptr_array_free(new_bufs, TRUE);
+    g_ptr_array_free(seq_bufs, TRUE);
+    g_free(read);
+}
 
-    /* offset is viewed as the offset in the buffer a_buffer just read above */
-    offset = position - a_buffer->real_offset;
 
-    print_message("offset : %ld; size : %ld\n", offset, size);
+/**
+ * Destroys a buffer (and the data in it !)
+ */
+static void destroy_fcl_buf_t(gpointer data)
+{
+    fcl_buf_t *buffer = (fcl_buf_t *) data ;
 
-    /* If the offset is below 0 or upper than a_buffer->size we need to correct it with gap */
-    if (offset < 0 || offset >= a_buffer->size)
+    if (buffer != NULL)
         {
-            offset = offset - gap;
+            LIBFCL_TRACE(LIBFCL_TRACE_BUFFER_DESTROYED, buffer, buffer->offset, buffer->real_offset, buffer->size);
+            if (buffer->data != NULL)
+                {
+                    g_free(buffer->data);
+                }
+
+            fcl_pieces_free(buffer);
+            g_free(buffer);
         }
+}
+
 
-    print_message("offset : %ld; size : %ld\n", offset, size);
+/******************************** Logical view ********************************/
 
-    if (offset >= 0 && offset <= a_buffer->size) /* The offset is within the buffer data */
+/**
+ * Creates a view on the edited file (see fcl_internal.h)
+ * @param a_file : an openned fcl_file_t file
+ * @return a newly allocated fcl_view_t or NULL if a_file is NULL
+ */
+fcl_view_t *fcl_view_new(fcl_file_t *a_file)
+{
+    fcl_view_t *view = NULL;
+    GSequenceIter *iter = NULL;
+    fcl_buf_t *seq_buf = NULL;
+    goffset gap = 0;           /** size difference introduced by the buffers */
+    guint i = 0;
+
+    if (a_file != NULL)
         {
-            if (a_buffer->size >= offset + size) /* The claimed data is all in the buffer */
+            view = (fcl_view_t *) g_malloc0(sizeof(fcl_view_t));
+
+            /* Its buffers are not spilled by another file while it exists */
+            g_rw_lock_reader_lock(&a_file->buffers_lock);
+
+            view->a_file = a_file;
+            view->real_size = MAX(a_file->real_size, 0);
+
+            if (a_file->backend->map != NULL)
                 {
-                    print_message("1. g_mem_dup(%p, %ld)\n", a_buffer->data + offset, size);
-                    data = (guchar *) g_memdup(a_buffer->data + offset, size);
-                    print_message("size : %ld\n", size);
-                    *in_data = *in_data + size;
+                    view->map = a_file->backend->map(a_file->backend, &view->map_size);
                 }
-            else if (a_buffer->size < LIBFCL_BUF_SIZE && a_buffer->in_seq == FALSE)
-                { /* Not all the buffer was filled but the buffer is not in the sequence. The buffer was read in the file hence this is the end of the file */
 
-                    size = a_buffer->size - offset;
-                    if (size  > 0)
+            view->window = (guchar *) g_malloc(LIBFCL_VIEW_WINDOW_SIZE * sizeof(guchar));
+            view->window_position = -1;
+            view->window_size = 0;
+
+            if (a_file->sequence != NULL)
+                {
+                    view->n_bufs = g_sequence_get_length(a_file->sequence);
+                    view->bufs = (fcl_buf_t **) g_malloc0(view->n_bufs * sizeof(fcl_buf_t *));
+                    view->starts = (goffset *) g_malloc0(view->n_bufs * sizeof(goffset));
+                    view->gaps = (goffset *) g_malloc0(view->n_bufs * sizeof(goffset));
+
+                    iter = g_sequence_get_begin_iter(a_file->sequence);
+
+                    while (g_sequence_iter_is_end(iter) == FALSE)
                         {
-                            print_message("2. g_mem_dup(%p, %ld)\n", a_buffer->data + offset, size);
-                            data = (guchar *) g_memdup(a_buffer->data + offset, size);
-                            *in_data = *in_data + size;
+                            seq_buf = g_sequence_get(iter);
+
+                            view->bufs[i] = seq_buf;
+                            view->starts[i] = block_file_offset(a_file, seq_buf->offset) + gap;
+                            gap = gap + (goffset) seq_buf->size - (goffset) orig_block_size(a_file, seq_buf->offset);
+                            view->gaps[i] = gap;
+
+                            i = i + 1;
+                            iter = g_sequence_iter_next(iter);
                         }
                 }
+
+            view->size = view->real_size + gap;
+        }
+
+    return view;
+}
+
+
+/**
+ * Frees a view
+ * @param view : the view to be freed
+ */
+void fcl_view_free(fcl_view_t *view)
+{
+    if (view != NULL)
+        {
+            fcl_perf_merge(view->a_file, &view->perf);
+            g_rw_lock_reader_unlock(&view->a_file->buffers_lock);
+
+            g_free(view->bufs);
+            g_free(view->starts);
+            g_free(view->gaps);
+            g_free(view->window);
+            g_free(view);
+        }
+}
+
+
+/**
+ * Finds the last buffer of the view that begins at or before position
+ * @param view : the view
+ * @param position : position in the edited file
+ * @return the index of the buffer in the view or -1 if position is before
+ *         the first buffer
+ */
+static gint view_find_buffer(fcl_view_t *view, goffset position)
+{
+    gint low = 0;
+    gint high = (gint) view->n_bufs - 1;
+    gint middle = 0;
+    gint found = -1;
+
+    while (low <= high)
+        {
+            middle = low + (high - low) / 2;
+
+            if (view->starts[middle] <= position)
+                {
+                    found = middle;
+                    low = middle + 1;
+                }
             else
                 {
-                    /* claimed data is located in two different buffers at least */
-                    /** @todo may be a bug here in memory allocations ?? */
-                    print_message("3. g_mem_dup(%p, %ld)\n", a_buffer->data + offset, a_buffer->size - offset);
+                    high = middle - 1;
+                }
+        }
+
+    return found;
+}
 
-                    new_data = (guchar *) g_memdup(a_buffer->data + offset, a_buffer->size - offset);
 
-                    real_size = size - (a_buffer->size - offset);
-                    *in_data = *in_data + (a_buffer->size - offset);
+/**
+ * Reads an untouched part of the file into the window of the view
+ * @param view : the view
+ * @param position : position in the edited file of the first byte to read
+ * @param gap : size difference introduced by the buffers before position
+ * @param size : number of bytes to read (at most LIBFCL_VIEW_WINDOW_SIZE)
+ * @return the number of bytes read
+ */
+static gsize view_fill_window(fcl_view_t *view, goffset position, goffset gap, gsize size)
+{
+    gssize read = 0;
 
-                    next_data = read_bytes_at_position(a_file, position + (a_buffer->size - offset), &real_size, in_data);
+    read = read_from_file(view->a_file, position - gap, view->window, size, &view->perf);
 
-                    if (next_data != NULL)
-                        {
-                            size = real_size + (a_buffer->size - offset);
+    if (read > 0)
+        {
+            view->window_position = position;
+            view->window_size = (gsize) read;
+        }
+    else
+        {
+            view->window_position = -1;
+            view->window_size = 0;
+        }
 
-                            print_message("size : %ld; real_size : %ld; in_data : %ld\n", size, real_size, *in_data);
+    return view->window_size;
+}
 
-                            data = (guchar *) g_malloc0(size * sizeof(guchar));
-                            memcpy(data, new_data, a_buffer->size - offset);
-                            memcpy(data + (a_buffer->size - offset), next_data, real_size);
 
-                            g_free(new_data);
-                            g_free(next_data);
-                        }
-                    else
-                        {
-                            data = (guchar *) g_malloc0(size * sizeof(guchar));
-                            memcpy(data, new_data, a_buffer->size - offset);
-                            g_free(new_data);
-                        }
+/**
+ * Reads bytes of a buffer of the view whose bytes are not all in memory
+ * (spilled or made of pieces) into the window of the view
+ * @param view : the view
+ * @param i : index of the buffer in the view
+ * @param position : position in the edited file of the first byte to read
+ * @param size : number of bytes to read (at most LIBFCL_VIEW_WINDOW_SIZE)
+ * @return the number of bytes read
+ */
+static gsize view_fill_window_buffer(fcl_view_t *view, gint i, goffset position, gsize size)
+{
+    view->window_position = position;
+    view->window_size = fcl_spill_read(view->a_file, view->bufs[i], (gsize) (position - view->starts[i]), view->window, size, &view->perf);
+
+    return view->window_size;
+}
+
+
+/**
+ * Says wether a byte is in the window of a view
+ * @param view : the view
+ * @param position : position of the byte in the edited file
+ * @return TRUE if the window holds the byte at position
+ */
+static gboolean view_window_has(fcl_view_t *view, goffset position)
+{
+    return view->window_position >= 0 && position >= view->window_position && position < view->window_position + (goffset) view->window_size;
+}
+
+
+/**
+ * Gets the run of bytes that begins at position (see fcl_internal.h)
+ * @param view : the view
+ * @param position : position in the edited file
+ * @param[out] size_pointer : number of bytes available in the returned run
+ * @return a pointer to the bytes or NULL at the end of the edited file
+ */
+const guchar *fcl_view_get_run(fcl_view_t *view, goffset position, gsize *size_pointer)
+{
+    gint i = 0;
+    goffset gap = 0;
+    goffset end = 0;    /** end of the untouched part of the file */
+
+    *size_pointer = 0;
+
+    if (view == NULL || position < 0 || position >= view->size)
+        {
+            return NULL;
+        }
+
+    i = view_find_buffer(view, position);
+
+    if (i >= 0 && position < view->starts[i] + (goffset) view->bufs[i]->size)
+        {
+            /* position is in a buffer of the sequence */
+            end = view->starts[i] + (goffset) view->bufs[i]->size;
+
+            if (LIBFCL_BUF_IN_MEMORY(view->bufs[i]) == TRUE)
+                {
+                    *size_pointer = (gsize) (end - position);
+                    return view->bufs[i]->data + (position - view->starts[i]);
+                }
+
+            if (view_window_has(view, position) == FALSE && view_fill_window_buffer(view, i, position, (gsize) MIN(end - position, LIBFCL_VIEW_WINDOW_SIZE)) == 0)
+                {
+                    return NULL;
                 }
+
+            *size_pointer = (gsize) (MIN(view->window_position + (goffset) view->window_size, end) - position);
+            return view->window + (position - view->window_position);
+        }
+
+    if (i >= 0)
+        {
+            gap = view->gaps[i];
+        }
+
+    if (i + 1 < (gint) view->n_bufs)
+        {
+            end = view->starts[i + 1];
         }
     else
         {
-            data = NULL;
+            end = view->size;
         }
 
-    if (a_buffer->in_seq == FALSE)
+    if (view->map != NULL && end - gap <= (goffset) view->map_size)
         {
-            destroy_fcl_buf_t((gpointer) a_buffer);
+            /* The untouched part is read in place */
+            *size_pointer = (gsize) (end - position);
+            return view->map + (position - gap);
+        }
+
+    if (view_window_has(view, position) == FALSE)
+        {
+            if (view_fill_window(view, position, gap, (gsize) MIN(end - position, LIBFCL_VIEW_WINDOW_SIZE)) == 0)
+                {
+                    return NULL;
+                }
         }
 
-    *size_pointer = size;
+    *size_pointer = (gsize) MIN(view->window_position + (goffset) view->window_size, end) - position;
 
-    return data;
+    return view->window + (position - view->window_position);
 }
 
 
 /**
- * Inserts a buffer in the sequence (only if it is not already in it !)
+ * Gets the run of bytes that ends just before position (see fcl_internal.h)
+ * @param view : the view
+ * @param position : position in the edited file (the run ends at
+ *                   position - 1)
+ * @param[out] size_pointer : number of bytes available in the returned run
+ * @return a pointer to the first byte of the run or NULL
  */
-static void insert_buffer_in_sequence(fcl_file_t *a_file, fcl_buf_t *a_buffer)
+const guchar *fcl_view_get_run_before(fcl_view_t *view, goffset position, gsize *size_pointer)
 {
+    gint i = 0;
+    goffset gap = 0;
+    goffset begin = 0;    /** begining of the untouched part of the file */
+    goffset last = position - 1;
 
-    if (a_file != NULL && a_buffer != NULL)
+    *size_pointer = 0;
+
+    if (view == NULL || position <= 0 || position > view->size)
         {
-            if (a_file->sequence == NULL)
+            return NULL;
+        }
+
+    i = view_find_buffer(view, last);
+
+    if (i >= 0 && last < view->starts[i] + (goffset) view->bufs[i]->size)
+        {
+            /* the last byte is in a buffer of the sequence */
+            if (LIBFCL_BUF_IN_MEMORY(view->bufs[i]) == TRUE)
                 {
-                    a_buffer->in_seq = TRUE;
-                    a_file->sequence = g_sequence_new(destroy_fcl_buf_t);
-                    g_sequence_append(a_file->sequence, a_buffer);
-                    print_message("Inserted buffer : %p (%ld, %ld, %ld)\n", a_buffer, a_buffer->offset, a_buffer->real_offset, a_buffer->size);
+                    *size_pointer = position - view->starts[i];
+                    return view->bufs[i]->data;
                 }
-            else
+
+            if (view_window_has(view, last) == FALSE)
                 {
-                    if (a_buffer->in_seq == FALSE)
+                    begin = MAX(view->starts[i], position - LIBFCL_VIEW_WINDOW_SIZE);
+
+                    if (view_fill_window_buffer(view, i, begin, (gsize) (position - begin)) < (gsize) (position - begin))
                         {
-                            a_buffer->in_seq = TRUE;
-                            g_sequence_insert_sorted(a_file->sequence, a_buffer, cmp_offset_value, NULL);
-                            print_message("Inserted buffer : %p (%ld, %ld, %ld)\n", a_buffer, a_buffer->offset, a_buffer->real_offset, a_buffer->size);
+                            return NULL;
                         }
                 }
-        }
-}
-
 
-/**
- * Overwite a buffer in place
- * @warning this function is recursive
- */
-static void overwrite_data_at_position(fcl_file_t *a_file, guchar *data, goffset position, gsize *size_pointer)
-{
-    fcl_buf_t *a_buffer = NULL;  /** Buffer to be overwritten  */
-    goffset buf_position = 0;    /** Position in the buffer    */
-    gsize reste = 0;
-    gsize size = 0;
-    gsize gap = 0;
-
-    size = *size_pointer;
-
-    print_message("overwrite_data_at_position(%p, %p, %ld, %ld)\n", a_file, data, position, size);
-
-    a_buffer = read_buffer_at_position(a_file, position, &gap);
-
-    buf_position = (position - a_buffer->real_offset);
-    print_message("buf_position : %ld (position : %ld, real_offset : %ld)\n", buf_position, position, a_buffer->real_offset);
+            *size_pointer = position - view->window_position;
+            return view->window;
+        }
 
-    if (buf_position >= 0 && (buf_position + size) <= a_buffer->size)
+    if (i >= 0)
         {
-            memcpy(a_buffer->data + buf_position, data, size);
-            insert_buffer_in_sequence(a_file, a_buffer);
+            gap = view->gaps[i];
+            begin = view->starts[i] + view->bufs[i]->size;
         }
-    else if (buf_position + size > a_buffer->size && a_buffer->size < LIBFCL_BUF_SIZE) /* This last test is here to detect the end of the file */
+
+    if (view->map != NULL && position - gap <= (goffset) view->map_size)
         {
-            fprintf(stderr, Q_("Overwritting outside of the file is not possible !\n"));
-            memcpy(a_buffer->data + buf_position, data, a_buffer->size - buf_position);
-            insert_buffer_in_sequence(a_file, a_buffer);
-            size = a_buffer->size - buf_position;
+            /* The untouched part is read in place */
+            *size_pointer = (gsize) (position - begin);
+            return view->map + (begin - gap);
         }
-    else if (buf_position + size > a_buffer->size)
-        {
-            /* we are at the end of the buffer and only want to overwrite bytes */
-            memcpy(a_buffer->data + buf_position, data, a_buffer->size - buf_position);
-            insert_buffer_in_sequence(a_file, a_buffer);
 
-            /* so overwrite the next buffer ! */
-            reste = size - (a_buffer->size - buf_position);
-            overwrite_data_at_position(a_file, data + (a_buffer->size - buf_position), 0, &reste);
+    if (view_window_has(view, last) == FALSE)
+        {
+            begin = MAX(begin, position - LIBFCL_VIEW_WINDOW_SIZE);
 
-            size = a_buffer->size - buf_position + reste;
+            if (view_fill_window(view, begin, gap, (gsize) (position - begin)) < (gsize) (position - begin))
+                {
+                    return NULL;
+                }
         }
 
-    *size_pointer = size;
+    *size_pointer = position - view->window_position;
 
-    if (a_buffer->in_seq == FALSE)
-        {
-            destroy_fcl_buf_t((gpointer) a_buffer);
-        }
+    return view->window;
 }
 
 
 /**
- * Inserts data into a buffer in place
- * @warning this function is recursive
+ * Copies size bytes at position from the edited file (see fcl_internal.h)
+ * @param view : the view
+ * @param position : position in the edited file
+ * @param data : buffer (of at least size bytes) where to copy the bytes
+ * @param size : number of bytes wanted
+ * @return the number of bytes copied
  */
-static void inserts_data_at_position(fcl_file_t *a_file, guchar *data, goffset position, gsize size)
+gsize fcl_view_read(fcl_view_t *view, goffset position, guchar *data, gsize size)
 {
-    fcl_buf_t *a_buffer = NULL;  /** Buffer where to insert datas             */
-    goffset buf_position = 0;    /** Position in the buffer                   */
-    guchar *new_data = NULL;     /** new buffer that will replace the old one */
-    gsize new_size = 0;          /** new size for the buffer                  */
-    gsize gap = 0;
-
-    a_buffer = read_buffer_at_position(a_file, position, &gap);
-
-    buf_position = (position - a_buffer->real_offset);
+    const guchar *run = NULL;
+    gsize run_size = 0;
+    gsize copied = 0;
 
-    if (buf_position >= 0 && buf_position <= a_buffer->size)
+    while (copied < size)
         {
-            new_size = size + a_buffer->size;
-            new_data = (guchar *) g_malloc0(new_size * sizeof(guchar));
-
-            memcpy(new_data, a_buffer->data, buf_position);
-            memcpy(new_data + buf_position, data, size);
-            memcpy(new_data + buf_position + size, a_buffer->data + buf_position, a_buffer->size - buf_position);
-
-            g_free(a_buffer->data);
-            a_buffer->data = new_data;
-            a_buffer->size = new_size;
+            run = fcl_view_get_run(view, position + copied, &run_size);
 
-            if (a_buffer->in_seq == FALSE)
+            if (run == NULL)
                 {
-                    insert_buffer_in_sequence(a_file, a_buffer);
+                    break;
                 }
+
+            run_size = MIN(run_size, size - copied);
+            memcpy(data + copied, run, run_size);
+            copied = copied + run_size;
         }
+
+    return copied;
 }
 
 
 /**
- * Deletes bytes at position in the file
- * @warning this function is recursive
+ * Reads bytes of the file on disk (see fcl_internal.h)
+ * @param view : the view
+ * @param offset : offset in the file on disk
+ * @param data : buffer (of at least size bytes) where to copy the bytes
+ * @param size : number of bytes wanted
+ * @return the number of bytes copied
  */
-static gboolean delete_bytes_at_position(fcl_file_t *a_file, goffset position, gsize *size_pointer)
+gsize fcl_view_read_original(fcl_view_t *view, goffset offset, guchar *data, gsize size)
 {
+    gssize read = 0;
 
-    fcl_buf_t *a_buffer = NULL;  /** Buffer where to insert datas             */
-    goffset buf_position = 0;    /** Position in the buffer                   */
-    guchar *new_data = NULL;
-    gsize size = 0;
-    gsize old_buffer_size = 0;
-    gsize to_delete_size = 0;
-    gboolean result = TRUE;
-    gsize gap = 0;
-
-    size = *size_pointer;
-
-    print_message("delete_bytes_at_position(%p, %ld, %ld)\n", a_file, position, size);
-
-    a_buffer = read_buffer_at_position(a_file, position, &gap);
-
-    buf_position = (position - a_buffer->real_offset);
-
-    print_message("buf_position : %ld <? %ld : a_buffer->size\n", buf_position, a_buffer->size);
-
-    /* Adding this because there is no reason that the behavior will be different
-     * than read_bytes_at_position. If the offset is below 0 or upper than
-     * a_buffer->size we need to correct it with gap
-     */
-    if (buf_position < 0 || buf_position >= a_buffer->size)
+    if (view->map != NULL && offset >= 0 && (gsize) offset < view->map_size)
         {
-            buf_position = buf_position - gap;
+            size = MIN(size, view->map_size - (gsize) offset);
+            memcpy(data, view->map + offset, size);
+            return size;
         }
 
-    print_message("buf_position : %ld <? %ld : a_buffer->size\n", buf_position, a_buffer->size);
+    read = read_from_file(view->a_file, offset, data, size, &view->perf);
 
-    if (buf_position >= 0 && buf_position <= a_buffer->size)
-        {
-            /* Is this always the case ? ie may we fall in the case that the
-             * buffer size is so small that the position is not in the
-             * retrieved buffer but in the next one ?
-             */
+    return read > 0 ? (gsize) read : 0;
+}
 
-            if (buf_position + size <= a_buffer->size)
-                {
-                    /* All bytes to be deleted are in the same buffer */
-                    new_data = (guchar *) g_malloc0((a_buffer->size - size) * sizeof(guchar));
 
-                    memcpy(new_data, a_buffer->data, buf_position);
-                    memcpy(new_data + buf_position, a_buffer->data + (buf_position + size), a_buffer->size - (buf_position + size) );
+/**
+ * Gets the position in the edited file of a block (see fcl_internal.h)
+ * @param view : the view
+ * @param block : the number of the block
+ * @return the position of the first byte of the block in the edited file
+ */
+goffset fcl_view_block_position(fcl_view_t *view, goffset block)
+{
+    gint low = 0;
+    gint high = (gint) view->n_bufs - 1;
+    gint middle = 0;
+    gint found = -1;    /** last buffer of the sequence before the block */
 
-                    g_free(a_buffer->data);
-                    a_buffer->data = new_data;
-                    a_buffer->size = a_buffer->size - size;
-                }
-            else if (buf_position + size > a_buffer->size && a_buffer->size < LIBFCL_BUF_SIZE) /* This last test is here to detect the end of the file */
-                {
-                    fprintf(stderr, Q_("Deleting bytes outside of the file is not possible !\n"));
-                    new_data = (guchar *) g_malloc0((buf_position) * sizeof(guchar));
-                    memcpy(new_data, a_buffer->data, (buf_position));
-                    g_free(a_buffer->data);
-                    a_buffer->data = new_data;
-                    a_buffer->size = buf_position;
+    while (low <= high)
+        {
+            middle = low + (high - low) / 2;
 
-                    /* Here the _real_ size is different ! */
-                    size = a_buffer->size - buf_position;
-                }
-            else
+            if (view->bufs[middle]->offset < block)
                 {
-                    /* saving read buffer size */
-                    old_buffer_size = a_buffer->size;
-
-                    /* Bytes to be deleted are in at least two buffers */
-                    new_data = (guchar *) g_malloc0((buf_position) * sizeof(guchar));
-                    memcpy(new_data, a_buffer->data, (buf_position));
-                    g_free(a_buffer->data);
-                    a_buffer->data = new_data;
-                    a_buffer->size = buf_position;
-
-                    /* new size to be deleted in the next buffer */
-                    to_delete_size = size - (LIBFCL_BUF_SIZE - buf_position);
-
-                    /* deletes bytes in the other buffers */
-                    result = delete_bytes_at_position(a_file, position + (old_buffer_size - buf_position), &to_delete_size);
-
-                    /* to reflect what was effectively deleted */
-                    size = to_delete_size + (LIBFCL_BUF_SIZE - buf_position);
-
+                    found = middle;
+                    low = middle + 1;
                 }
-
-            /* The buffer has been modified we must put it in the sequence (if it is not allready in it) */
-
-             if (a_buffer->in_seq == FALSE)
+            else
                 {
-                    insert_buffer_in_sequence(a_file, a_buffer);
+                    high = middle - 1;
                 }
+        }
 
-            *size_pointer = size;
-
-            return result;
+    if (found >= 0)
+        {
+            return block_file_offset(view->a_file, block) + view->gaps[found];
         }
     else
         {
-            *size_pointer = size;
-            return FALSE;
+            return block_file_offset(view->a_file, block);
         }
 }
 
 
+/********************************** Threads ***********************************/
 
 /**
- * Destroys a buffer (and the data in it !)
+ * Runs func on each job with a pool of threads and waits for all of them
+ * (see fcl_internal.h)
+ * @param func : the function to run (called with a job and NULL)
+ * @param jobs : the jobs
+ * @param n_jobs : number of jobs
+ * @param n_threads : maximum number of threads (0 means one per processor)
  */
-static void destroy_fcl_buf_t(gpointer data)
+void fcl_run_jobs(GFunc func, gpointer *jobs, guint n_jobs, guint n_threads)
 {
-    fcl_buf_t *buffer = (fcl_buf_t *) data ;
+    GThreadPool *pool = NULL;
+    GError *error = NULL;
+    guint i = 0;
 
-    if (buffer != NULL)
+    if (n_threads == 0)
         {
-            print_message("Destroyed buffer : %p\n", buffer);
-            if (buffer->data != NULL)
+            n_threads = g_get_num_processors();
+        }
+
+    n_threads = MIN(n_threads, n_jobs);
+
+    if (n_threads > 1)
+        {
+            pool = g_thread_pool_new(func, NULL, (gint) n_threads, TRUE, &error);
+
+            if (pool == NULL)
                 {
-                    g_free(buffer->data);
+                    fprintf(stderr, Q_("Unable to create a pool of threads : %s\n"), error->message);
+                    g_error_free(error);
                 }
+        }
 
-            g_free(buffer);
+    if (pool == NULL)
+        {
+            for (i = 0; i < n_jobs; i++)
+                {
+                    func(jobs[i], NULL);
+                }
+        }
+    else
+        {
+            for (i = 0; i < n_jobs; i++)
+                {
+                    g_thread_pool_push(pool, jobs[i], NULL);
+                }
+
+            /* Waits for every job to be done */
+            g_thread_pool_free(pool, FALSE, TRUE);
         }
 }
 
 
+
 /****************************** File management *******************************/
 
 /**
  * Creates a new fcl_file_t structure from parameters
- * @param path : path to the file (filename included).
- * @param mode : mode in which one wants to open the file
+ * @param path : path to the file (filename included) or NULL
+ * @param backend : storage of the file (owned by the file from now on). Its
+ *                  mode is the mode in which one wants to open the file.
  * @return a newly initialiazed empty fcl_file_t structure
  */
-static fcl_file_t *new_fcl_file_t(gchar *path, gint mode)
+static fcl_file_t *new_fcl_file_t(gchar *path, fcl_backend_t *backend)
 {
 
     fcl_file_t *a_file = NULL;
 
     a_file = (fcl_file_t *) g_malloc0 (sizeof(fcl_file_t));
 
-    a_file->the_file = g_file_new_for_path(path);
+    a_file->the_file = path != NULL ? fcl_backend_gfile(path) : NULL;
     a_file->name = g_strdup(path);
-    a_file->mode = mode;
-    a_file->real_size = get_gfile_file_size(a_file->the_file);
-    a_file->in_stream = NULL;
-    a_file->out_stream = NULL;
+    a_file->mode = backend->mode;
+    a_file->backend = backend;
+    a_file->real_size = backend->size(backend);
     a_file->sequence = NULL;
+    a_file->checksums = NULL;
+    a_file->histograms = NULL;
+    a_file->spill = NULL;
+    a_file->session = NULL;
+    a_file->pool = NULL;
+    a_file->used = 0;
+    a_file->origin = NULL;
+    a_file->stats = fcl_init_buffer_stats();
+    a_file->buf_sizes = g_hash_table_new(g_direct_hash, g_direct_equal);
+    a_file->perf = (fcl_perf_t *) g_malloc0 (sizeof(fcl_perf_t));
+    g_mutex_init(&a_file->perf_lock);
+    g_rw_lock_init(&a_file->backend_lock);
+    g_rw_lock_init(&a_file->buffers_lock);
 
     return a_file;
 }
 
 
 /**
- * Gets the file size of a Gfile object throught the GFileInfo query
- * @param the_file : a GFile object
- * @return a positive goffset number that represents the file size or -1 if
- *         something went wrong
+ * Opens a file lazily : a job of fcl_open_files()
+ * @param data : the job (an open_job_t)
+ * @param user_data : unused
+ */
+static void open_lazily(gpointer data, gpointer user_data)
+{
+    open_job_t *job = (open_job_t *) data;
+
+    job->start = g_get_monotonic_time();
+    job->a_file = new_fcl_file_t(job->path, fcl_backend_for_path(job->path, job->mode));
+    job->end = g_get_monotonic_time();
+}
+
+/**
+ * Updates the statistics of a file after the size of a buffer changed
+ * @param a_file : the fcl_file_t file
+ * @param a_buffer : the buffer (in the sequence)
+ * @param counted : TRUE if the buffer was already counted (with the size
+ *                  saved in stat_size)
  */
-static goffset get_gfile_file_size(GFile *the_file)
+static void update_stats(fcl_file_t *a_file, fcl_buf_t *a_buffer, gboolean counted)
 {
-    GFileInfo *file_info = NULL;
-    goffset size = -1;
+    gsize orig_size = orig_block_size(a_file, a_buffer->offset);
 
-    if (the_file != NULL)
+    if (counted == TRUE)
         {
-            file_info = g_file_query_info(the_file, "*", G_FILE_QUERY_INFO_NONE, NULL, NULL);
-            if (file_info != NULL)
-                {
-                    size = g_file_info_get_size(file_info);
-                    g_object_unref(file_info);
-                    return size;
-                }
-            else
+            if (a_buffer->stat_size == a_buffer->size)
                 {
-                    return -1;
+                    return;
                 }
+
+            count_buffer(a_file, a_buffer->stat_size, orig_size, -1);
         }
-    else
-        {
-            return -1;
-        }
+
+    count_buffer(a_file, a_buffer->size, orig_size, 1);
+    a_buffer->stat_size = a_buffer->size;
 }
 
+
 /**
- * Sums the stats within a foreach function
- * @param data must be a buffer as found in a sequence
- * @param user_data must be the fcl_stat_buf_t* statistics structure
+ * Adds a buffer to the statistics or removes it from them
+ * @param a_file : the fcl_file_t file
+ * @param size : size of the buffer
+ * @param orig_size : size of its block in the file on disk
+ * @param sign : 1 to add it, -1 to remove it
  */
-static void sum_stats(gpointer data, gpointer user_data)
+static void count_buffer(fcl_file_t *a_file, gsize size, gsize orig_size, gint sign)
 {
-    fcl_buf_t *seq_buf = (fcl_buf_t *) data;
-    fcl_stat_buf_t *stats = (fcl_stat_buf_t *) user_data;
-    gssize gap = 0;
-
-    if (seq_buf != NULL && stats != NULL)
+    fcl_stat_buf_t *stats = a_file->stats;
+    GHashTableIter iter;
+    gpointer key = NULL;
+    gssize gap = (gssize) size - (gssize) orig_size;
+    guint count = 0;
+    guint class = 0;
+
+    /* class of the histogram : 1 + the position of the highest bit set */
+    while (class + 1 < LIBFCL_STATS_HISTOGRAM_SIZE && (size >> class) != 0)
         {
+            class++;
+        }
 
-            /* Number of buffers in the sequence */
+    count = GPOINTER_TO_UINT(g_hash_table_lookup(a_file->buf_sizes, GSIZE_TO_POINTER(size)));
+
+    if (sign > 0)
+        {
             stats->n_bufs = stats->n_bufs + 1;
+            stats->histogram[class] = stats->histogram[class] + 1;
+            count = count + 1;
+        }
+    else
+        {
+            stats->n_bufs = stats->n_bufs - 1;
+            stats->histogram[class] = stats->histogram[class] - 1;
+            count = count - 1;
+        }
 
-            /* Maximum size of one buffer */
-            if (seq_buf->size > stats->max_buf_size)
-                {
-                    stats->max_buf_size = seq_buf->size;
-                }
+    stats->real_edit_size = stats->real_edit_size + sign * gap;
 
-            /* Minimum size of one buffer */
-            if (seq_buf->size < stats->min_buf_size)
-                {
-                    stats->min_buf_size = seq_buf->size;
-                }
+    if (gap > 0)
+        {
+            stats->add_size = stats->add_size + sign * gap;
+        }
+    else
+        {
+            stats->del_size = stats->del_size - sign * gap;
+        }
+
+    if (count > 0)
+        {
+            g_hash_table_replace(a_file->buf_sizes, GSIZE_TO_POINTER(size), GUINT_TO_POINTER(count));
+        }
+    else
+        {
+            g_hash_table_remove(a_file->buf_sizes, GSIZE_TO_POINTER(size));
+        }
 
-            /* gap represents additions or deletions in the buffers */
-            gap = seq_buf->size - LIBFCL_BUF_SIZE;
+    if (sign > 0)
+        {
+            stats->min_buf_size = MIN(stats->min_buf_size, (gssize) size);
+            stats->max_buf_size = MAX(stats->max_buf_size, (gssize) size);
+        }
+    else if (count == 0 && ((gssize) size == stats->min_buf_size || (gssize) size == stats->max_buf_size))
+        {
+            /* The last buffer of this size is gone : looking for the new
+             * extreme sizes among the sizes of the buffers (there are only a
+             * few different ones) */
+            stats->min_buf_size = G_MAXSSIZE;
+            stats->max_buf_size = 0;
 
-            /* Total edition size */
-            stats->real_edit_size = stats->real_edit_size + gap;
+            g_hash_table_iter_init(&iter, a_file->buf_sizes);
 
-            /* Here we do track additions only */
-            if (gap > 0)
+            while (g_hash_table_iter_next(&iter, &key, NULL) == TRUE)
                 {
-                    stats->add_size = stats->add_size + gap;
+                    stats->min_buf_size = MIN(stats->min_buf_size, (gssize) GPOINTER_TO_SIZE(key));
+                    stats->max_buf_size = MAX(stats->max_buf_size, (gssize) GPOINTER_TO_SIZE(key));
                 }
         }
 }
@@ -1043,13 +2679,19 @@ fcl_stat_buf_t *fcl_init_buffer_stats()
 {
     fcl_stat_buf_t *stats = NULL;
 
-    stats = (fcl_stat_buf_t *) g_malloc0 (sizeof(fcl_file_t));
+    stats = (fcl_stat_buf_t *) g_malloc0 (sizeof(fcl_stat_buf_t));
 
     stats->min_buf_size = G_MAXSSIZE;
     stats->max_buf_size = 0;
     stats->add_size = 0;
     stats->real_edit_size = 0;
     stats->n_bufs = 0;
+    stats->del_size = 0;
+    stats->logical_size = 0;
+    stats->resident_size = 0;
+    stats->spilled_size = 0;
+    stats->compressed_size = 0;
+    stats->packed_size = 0;
 
     return stats;
 }
@@ -1058,19 +2700,28 @@ fcl_stat_buf_t *fcl_init_buffer_stats()
 /**
  * Gets the statistics of the buffers of a fcl_file_t file.
  * @param a_file : an openned fcl_file_t file.
- * @return A newly allocated fcl_stat_buf_t filled with the statistics about
- *         the sequence structure of the fcl_file_t structure. Returns NULL if
- *         the structure does not exists or does not have any buffers.
+ * @return A newly allocated copy of the statistics kept on the sequence of
+ *         the fcl_file_t structure. Returns NULL if the structure does not
+ *         exists.
  */
 fcl_stat_buf_t *fcl_get_buffer_stats(fcl_file_t *a_file)
 {
     fcl_stat_buf_t *stats = NULL;
 
-    if (a_file != NULL && a_file->sequence != NULL)
+    if (a_file != NULL && a_file->stats != NULL)
         {
-            stats = fcl_init_buffer_stats();
+            stats = (fcl_stat_buf_t *) g_memdup(a_file->stats, sizeof(fcl_stat_buf_t));
+            stats->logical_size = MAX(a_file->real_size, 0) + stats->real_edit_size;
 
-            g_sequence_foreach(a_file->sequence, sum_stats, stats);
+            /* Another file of its session may be spilling its buffers */
+            g_rw_lock_reader_lock(&a_file->buffers_lock);
+            fcl_spill_sizes(a_file, stats);
+            g_rw_lock_reader_unlock(&a_file->buffers_lock);
+
+            if (stats->n_bufs == 0)
+                {
+                    stats->min_buf_size = 0;
+                }
         }
 
     return stats;
@@ -1084,6 +2735,7 @@ fcl_stat_buf_t *fcl_get_buffer_stats(fcl_file_t *a_file)
 void fcl_print_buffer_stats(fcl_file_t *a_file)
 {
     fcl_stat_buf_t *stats = NULL;
+    guint class = 0;
 
     if (a_file != NULL)
         {
@@ -1093,12 +2745,25 @@ void fcl_print_buffer_stats(fcl_file_t *a_file)
                 {
                     fprintf(stdout, "\n");
                     fprintf(stdout, "Buffer statistics on %s :\n", a_file->name);
-                    fprintf(stdout, " Number of buffers : %Ld\n", stats->n_bufs);
-                    fprintf(stdout, " Min buffer size   : %d\n", stats->min_buf_size);
-                    fprintf(stdout, " Max buffer size   : %d\n", stats->max_buf_size);
-                    fprintf(stdout, " Additions size    : %d\n", stats->add_size);
-                    fprintf(stdout, " Deletion size     : %d\n", stats->add_size - stats->real_edit_size);
-                    fprintf(stdout, " Real buffer edition sizes : %d\n", stats->real_edit_size);
+                    fprintf(stdout, " Number of buffers : %" G_GUINT64_FORMAT "\n", stats->n_bufs);
+                    fprintf(stdout, " Min buffer size   : %" G_GSSIZE_FORMAT "\n", stats->min_buf_size);
+                    fprintf(stdout, " Max buffer size   : %" G_GSSIZE_FORMAT "\n", stats->max_buf_size);
+                    fprintf(stdout, " Additions size    : %" G_GSSIZE_FORMAT "\n", stats->add_size);
+                    fprintf(stdout, " Deletion size     : %" G_GSSIZE_FORMAT "\n", stats->del_size);
+                    fprintf(stdout, " Real buffer edition sizes : %" G_GSSIZE_FORMAT "\n", stats->real_edit_size);
+                    fprintf(stdout, " Size of the edited file   : %" G_GOFFSET_FORMAT "\n", stats->logical_size);
+                    fprintf(stdout, " Bytes in memory           : %" G_GSIZE_FORMAT "\n", stats->resident_size);
+                    fprintf(stdout, " Bytes in the scratch file : %" G_GSIZE_FORMAT "\n", stats->spilled_size);
+                    fprintf(stdout, " Bytes compressed          : %" G_GSIZE_FORMAT " in %" G_GSIZE_FORMAT " (ratio %.2f)\n", stats->compressed_size, stats->packed_size, stats->packed_size > 0 ? (gdouble) stats->compressed_size / (gdouble) stats->packed_size : 1.0);
+
+                    for (class = 0; class < LIBFCL_STATS_HISTOGRAM_SIZE; class++)
+                        {
+                            if (stats->histogram[class] > 0)
+                                {
+                                    fprintf(stdout, " Buffers of less than 2^%u bytes : %" G_GUINT64_FORMAT "\n", class, stats->histogram[class]);
+                                }
+                        }
+
                     fprintf(stdout, "\n");
 
                     g_free(stats);
@@ -1109,90 +2774,127 @@ void fcl_print_buffer_stats(fcl_file_t *a_file)
 
 
 /**
- * @warning Still to be built !
+ * Saves the edited file over itself. Its pieces still read the file while it
+ * is written : the edited file is written to a temporary file next to it that
+ * then replaces it.
+ * @param a_file : the fcl_file_t file to be saved
+ * @return TRUE if the file was replaced by the edited one, FALSE otherwise
  */
 static gboolean save_the_file(fcl_file_t *a_file)
 {
-    fcl_buf_t *a_buffer = NULL;  /** Buffer to be read                                   */
-    gssize read = 0;             /** Number of bytes effectively read                    */
-    goffset real_position = 0;   /** Position in the file (in number of LIBFCL_BUF_SIZE) */
-    goffset gap = 0;             /** gap between the edited buffers and the file         */
-    GSequenceIter *iter = NULL;
-    GSequenceIter *end = NULL;
-    fcl_buf_t * seq_buf = NULL;
-    gboolean ok = TRUE;          /** TRUE until we reach the end */
-    guchar *in_gap = NULL;
-    guchar *to_write = NULL;
+    fcl_backend_t *target = NULL;
+    GStatBuf status;
+    gchar *path = NULL;
+    gchar *temp = NULL;
+    gint fd = -1;
+    gboolean ok = FALSE;
+
+    if (a_file->mode == LIBFCL_MODE_READ)
+        {
+            fprintf(stderr, Q_("File is read-only, saving it prohibited\n"));
+            return FALSE;
+        }
+
+    path = a_file->the_file != NULL ? g_file_get_path(a_file->the_file) : NULL;
 
+    if (path == NULL)
+        {
+            fprintf(stderr, Q_("File has no local path, use fcl_save_to_backend() to save it\n"));
+            return FALSE;
+        }
 
+    temp = g_strdup_printf("%s.XXXXXX", path);
+    fd = g_mkstemp(temp);
 
-    if (a_file->mode != LIBFCL_MODE_READ)
+    if (fd < 0)
         {
-            if (a_file->sequence != NULL)
-                {
-                    /* Saving the file in place */
-                    gap = 0;
-                    real_position = 0;
-                    ok = TRUE;
-                    iter = g_sequence_get_begin_iter(a_file->sequence); /* Begin of the first modification of the file */
-                    end = g_sequence_get_end_iter(a_file->sequence);     /* end of the modification */
+            fprintf(stderr, Q_("Unable to create a temporary file to save %s\n"), path);
+            g_free(temp);
+            g_free(path);
+            return FALSE;
+        }
 
-                    seq_buf = g_sequence_get(iter);
+    g_close(fd, NULL);
 
-                    while (ok == TRUE)
-                        {
-                            gap = gap + (seq_buf->size - LIBFCL_BUF_SIZE);
+    /* The saved file keeps the permissions of the original one */
+    if (g_stat(path, &status) == 0)
+        {
+            g_chmod(temp, status.st_mode & 07777);
+        }
 
-                            if (gap > 0)
-                                {
-                                    /* reading the gap */
-                                    in_gap = (guchar *) g_malloc0(gap * sizeof(guchar));
+    target = fcl_backend_new(LIBFCL_BACKEND_POSIX, temp, LIBFCL_MODE_CREATE);
 
-                                    g_seekable_seek(G_SEEKABLE(a_file->in_stream), seq_buf->real_offset + LIBFCL_BUF_SIZE, G_SEEK_SET, NULL, NULL);
-                                    read = g_input_stream_read(G_INPUT_STREAM(a_file->in_stream), in_gap, gap, NULL, NULL);
-                                }
+    if (target->open(target) == TRUE)
+        {
+            ok = fcl_save_to_backend(a_file, target);
+        }
 
-                            /* Writing the buffer */
-                            g_seekable_seek(G_SEEKABLE(a_file->in_stream), seq_buf->real_offset, G_SEEK_SET, NULL, NULL);
-                            g_output_stream_write(G_OUTPUT_STREAM(a_file->out_stream), seq_buf->data, seq_buf->size, NULL, NULL);
+    fcl_backend_free(target);
 
-                            if (gap > 0)
-                                {
-                                    to_write = g_memdup(in_gap, gap);
-                                }
+    if (ok == TRUE && g_rename(temp, path) != 0)
+        {
+            ok = FALSE;
+        }
 
-                            if (iter == end)
-                                {
-                                    ok = FALSE;
-                                }
-                            else
-                                {
-                                    iter = g_sequence_iter_next(iter);
-                                    seq_buf = g_sequence_get(iter);
-                                    /* if the offset of this buffer is not the
-                                     * following of the previous buffer, we have
-                                     * to "iterate" into the file to "report" the
-                                     * gap
-                                     */
+    if (ok == FALSE)
+        {
+            fprintf(stderr, Q_("Unable to save %s\n"), path);
+            g_unlink(temp);
+        }
 
+    g_free(temp);
+    g_free(path);
 
-                                }
-                        }
+    return ok;
+}
 
-                    /* now we should go to the end of the file  ... */
 
 
 
-                }
+/**
+ * Inserts a range of a source file once it is openned : checks the mode and
+ * the range then records the call as an insertion
+ * @param a_file : the fcl_file_t file where to insert the range
+ * @param position : position of the insertion in the edited file
+ * @param source : the openned source file
+ * @param offset : offset of the range in the source file
+ * @param length : number of bytes of the range
+ * @param start : time when the public call began
+ * @return TRUE if the range was inserted, FALSE otherwise
+ */
+static gboolean insert_source_range(fcl_file_t *a_file, goffset position, fcl_source_t *source, goffset offset, gsize length, gint64 start)
+{
+    fcl_buf_t *range = NULL;
+    gboolean result = FALSE;
 
-            return TRUE;
+    if (a_file->mode == LIBFCL_MODE_READ)
+        {
+            fprintf(stderr, Q_("File is read-only, inserting is prohibited\n"));
+            return FALSE;
         }
-    else
+
+    if (offset < 0 || offset > fcl_source_size(source) || (goffset) length > fcl_source_size(source) - offset)
         {
-            fprintf(stderr, Q_("File is read-only, saving it prohibited\n"));
+            fprintf(stderr, Q_("Range is beyond the end of the inserted file\n"));
             return FALSE;
         }
 
+    if (length == 0)
+        {
+            return TRUE;
+        }
+
+    range = new_fcl_buf_t();
+    range->size = 0;
+    fcl_pieces_insert(range, 0, source, offset, NULL, length);
+
+    result = inserts_pieces_at_position(a_file, range, position);
+    destroy_fcl_buf_t((gpointer) range);
+
+    fcl_perf_record(a_file->perf, LIBFCL_PERF_INSERT, start);
+    fcl_record_call(LIBFCL_RECORD_INSERT, a_file, start, 2, (guint64) position, length, 0);
+
+    return result;
 }
 
 
@@ -0,0 +1,1175 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_backend.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_backend.c
+ * Storage backends : the functions through which a file is read and written
+ * (fcl_backend_t).
+ *
+ * - GIO : streams of a GFile, thus any path or URI that GIO knows. The
+ *   streams are positionned : the reads are serialized by a mutex and the
+ *   writes are sequential.
+ * - POSIX : a file descriptor read and written with pread() and pwrite(). The
+ *   reads of many threads go on at once.
+ * - mmap : a POSIX backend whose file is mapped in memory (GMappedFile) and
+ *   read in place. The mapping does not use a file descriptor.
+ * - memory : the bytes in a GByteArray.
+ *
+ * The GIO and POSIX backends open their file the first time it is read or
+ * written and close it when released (by the pool of open files, see
+ * fcl_pool.c) : it is openned again at the next read.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @struct gio_backend_t
+ * A GIO backend
+ */
+typedef struct
+{
+    fcl_backend_t backend;         /**< The functions (first)                  */
+    GFile *the_file;               /**< The file                               */
+    GFileInputStream *in_stream;   /**< Stream used for reading (or NULL)      */
+    GFileOutputStream *out_stream; /**< Stream used for writing (or NULL)      */
+    goffset out_position;          /**< Position of out_stream in the file     */
+    gboolean emptied;              /**< LIBFCL_MODE_CREATE file emptied        */
+    gboolean replacing;            /**< out_stream replaces the file           */
+    GMutex lock;                   /**< Protects the streams                   */
+} gio_backend_t;
+
+
+/**
+ * @struct posix_backend_t
+ * A POSIX or mmap backend
+ */
+typedef struct
+{
+    fcl_backend_t backend;         /**< The functions (first)                  */
+    gchar *path;                   /**< Path of the file                       */
+    gint fd;                       /**< File descriptor (-1 when closed)       */
+    gboolean emptied;              /**< LIBFCL_MODE_CREATE file emptied        */
+    gboolean replacing;            /**< out_stream replaces the file           */
+    GMappedFile *mapped;           /**< The file in memory (mmap, or NULL)     */
+    GMutex lock;                   /**< Protects fd and mapped                 */
+} posix_backend_t;
+
+
+/**
+ * @struct memory_backend_t
+ * A memory backend
+ */
+typedef struct
+{
+    fcl_backend_t backend;         /**< The functions (first)                  */
+    GByteArray *bytes;             /**< The bytes                              */
+} memory_backend_t;
+
+
+static gboolean gio_open(fcl_backend_t *backend);
+static GFileOutputStream *gio_out_stream(gio_backend_t *gio);
+static gssize gio_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size);
+static gssize gio_write_at(fcl_backend_t *backend, goffset offset, const guchar *data, gsize size);
+static goffset gio_size(fcl_backend_t *backend);
+static gboolean gio_sync(fcl_backend_t *backend);
+static void gio_release(fcl_backend_t *backend);
+static void gio_free(fcl_backend_t *backend);
+
+static gint posix_fd(posix_backend_t *posix, gboolean writing);
+static gboolean posix_open(fcl_backend_t *backend);
+static gssize posix_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size);
+static gssize posix_write_at(fcl_backend_t *backend, goffset offset, const guchar *data, gsize size);
+static goffset posix_size(fcl_backend_t *backend);
+static gboolean posix_sync(fcl_backend_t *backend);
+static void posix_release(fcl_backend_t *backend);
+static void posix_free(fcl_backend_t *backend);
+
+static gssize mmap_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size);
+static const guchar *mmap_map(fcl_backend_t *backend, gsize *size_pointer);
+
+static gboolean memory_open(fcl_backend_t *backend);
+static gssize memory_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size);
+static gssize memory_write_at(fcl_backend_t *backend, goffset offset, const guchar *data, gsize size);
+static goffset memory_size(fcl_backend_t *backend);
+static gboolean memory_sync(fcl_backend_t *backend);
+static const guchar *memory_map(fcl_backend_t *backend, gsize *size_pointer);
+static void memory_free(fcl_backend_t *backend);
+static gboolean memory_fits(guint64 size);
+
+static fcl_backend_t *gio_backend_new(const gchar *path, gint mode);
+static fcl_backend_t *posix_backend_new(const gchar *path, gint mode, gboolean mapped);
+static fcl_backend_t *memory_backend_new(gint mode);
+
+static GMutex default_lock;                      /** Protects default_kind       */
+static gint default_kind = LIBFCL_BACKEND_GIO;   /** Backend of the files openned */
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Creates a backend for a file (see fcl.h)
+ * @param kind : LIBFCL_BACKEND_GIO, LIBFCL_BACKEND_POSIX, LIBFCL_BACKEND_MMAP
+ *               or LIBFCL_BACKEND_MEMORY
+ * @param path : path (or URI with LIBFCL_BACKEND_GIO) of the file
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ...)
+ * @return a new backend or NULL if kind is not a backend
+ */
+fcl_backend_t *fcl_backend_new(gint kind, const gchar *path, gint mode)
+{
+    fcl_backend_t *backend = NULL;
+    gchar *contents = NULL;
+    gsize length = 0;
+    GStatBuf status;
+
+    if (path == NULL)
+        {
+            return NULL;
+        }
+
+    switch (kind)
+        {
+            case LIBFCL_BACKEND_GIO:
+                backend = gio_backend_new(path, mode);
+            break;
+
+            case LIBFCL_BACKEND_POSIX:
+                backend = posix_backend_new(path, mode, FALSE);
+            break;
+
+            case LIBFCL_BACKEND_MMAP:
+                backend = posix_backend_new(path, mode, TRUE);
+            break;
+
+            case LIBFCL_BACKEND_MEMORY:
+                if (mode != LIBFCL_MODE_CREATE && g_stat(path, &status) == 0 && memory_fits((guint64) status.st_size) == FALSE)
+                    {
+                        return NULL;
+                    }
+
+                backend = memory_backend_new(mode);
+
+                /* A created file begins empty, the others are loaded at once */
+                if (mode != LIBFCL_MODE_CREATE && g_file_get_contents(path, &contents, &length, NULL) == TRUE)
+                    {
+                        if (memory_fits((guint64) length) == FALSE)
+                            {
+                                g_free(contents);
+                                memory_free(backend);
+                                return NULL;
+                            }
+
+                        g_byte_array_append(((memory_backend_t *) backend)->bytes, (const guint8 *) contents, (guint) length);
+                        g_free(contents);
+                    }
+            break;
+
+            default:
+                return NULL;
+            break;
+        }
+
+    return backend;
+}
+
+
+/**
+ * Creates a memory backend holding a copy of some bytes (see fcl.h)
+ * @param data : the bytes (may be NULL if size is 0)
+ * @param size : number of bytes
+ * @return a new backend in LIBFCL_MODE_WRITE mode or NULL if there are too
+ *         many bytes
+ */
+fcl_backend_t *fcl_backend_new_from_data(const guchar *data, gsize size)
+{
+    fcl_backend_t *backend = NULL;
+
+    if (memory_fits((guint64) size) == FALSE)
+        {
+            return NULL;
+        }
+
+    backend = memory_backend_new(LIBFCL_MODE_WRITE);
+
+    if (data != NULL && size > 0)
+        {
+            g_byte_array_append(((memory_backend_t *) backend)->bytes, (const guint8 *) data, (guint) size);
+        }
+
+    return backend;
+}
+
+
+/**
+ * Frees a backend, closing its file (see fcl.h)
+ * @param backend : the backend (may be NULL)
+ */
+void fcl_backend_free(fcl_backend_t *backend)
+{
+    if (backend != NULL)
+        {
+            backend->free(backend);
+        }
+}
+
+
+/**
+ * Sets the backend of the files openned by path (see fcl.h)
+ * @param kind : LIBFCL_BACKEND_GIO, LIBFCL_BACKEND_POSIX, LIBFCL_BACKEND_MMAP
+ *               or LIBFCL_BACKEND_MEMORY
+ */
+void fcl_set_default_backend(gint kind)
+{
+    if (kind >= LIBFCL_BACKEND_GIO && kind <= LIBFCL_BACKEND_MEMORY)
+        {
+            g_mutex_lock(&default_lock);
+            default_kind = kind;
+            g_mutex_unlock(&default_lock);
+        }
+}
+
+
+/**
+ * Gets the backend of the files openned by path
+ * @return LIBFCL_BACKEND_GIO, LIBFCL_BACKEND_POSIX, LIBFCL_BACKEND_MMAP or
+ *         LIBFCL_BACKEND_MEMORY
+ */
+gint fcl_get_default_backend(void)
+{
+    gint kind = LIBFCL_BACKEND_GIO;
+
+    g_mutex_lock(&default_lock);
+    kind = default_kind;
+    g_mutex_unlock(&default_lock);
+
+    return kind;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Creates the backend of a file openned by path (see fcl_internal.h)
+ * @param path : path or URI of the file
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ...)
+ * @return a new backend of the default kind
+ */
+fcl_backend_t *fcl_backend_for_path(const gchar *path, gint mode)
+{
+    fcl_backend_t *backend = NULL;
+    gchar *scheme = NULL;
+    gint kind = fcl_get_default_backend();
+
+    scheme = g_uri_parse_scheme(path);
+
+    if (scheme != NULL)
+        {
+            /* Only GIO knows the URIs */
+            kind = LIBFCL_BACKEND_GIO;
+            g_free(scheme);
+        }
+
+    backend = fcl_backend_new(kind, path, mode);
+
+    if (backend == NULL && kind == LIBFCL_BACKEND_MEMORY)
+        {
+            /* Too big to be held in memory : it is read from the disk */
+            backend = fcl_backend_new(LIBFCL_BACKEND_POSIX, path, mode);
+        }
+
+    return backend;
+}
+
+
+/**
+ * Gets the GFile of a path or of a URI (see fcl_internal.h)
+ * @param path : path or URI of the file
+ * @return a new GFile
+ */
+GFile *fcl_backend_gfile(const gchar *path)
+{
+    gchar *scheme = NULL;
+
+    scheme = g_uri_parse_scheme(path);
+
+    if (scheme != NULL)
+        {
+            g_free(scheme);
+            return g_file_new_for_uri(path);
+        }
+    else
+        {
+            return g_file_new_for_path(path);
+        }
+}
+
+
+/**
+ * Gets the device and the inode of the file of a backend (see fcl_internal.h)
+ * @param backend : the backend
+ * @param[out] device : device of the file
+ * @param[out] inode : inode of the file
+ * @return TRUE if the backend is a file that exists
+ */
+gboolean fcl_backend_identity(fcl_backend_t *backend, guint64 *device, guint64 *inode)
+{
+    posix_backend_t *posix = NULL;
+    gchar *path = NULL;
+    struct stat status;
+    gint result = -1;
+
+    if (backend->free == gio_free)
+        {
+            path = g_file_get_path(((gio_backend_t *) backend)->the_file);
+
+            if (path != NULL)
+                {
+                    result = g_stat(path, &status);
+                    g_free(path);
+                }
+        }
+    else if (backend->free == posix_free)
+        {
+            posix = (posix_backend_t *) backend;
+
+            g_mutex_lock(&posix->lock);
+            result = posix->fd >= 0 ? fstat(posix->fd, &status) : g_stat(posix->path, &status);
+            g_mutex_unlock(&posix->lock);
+        }
+
+    if (result != 0)
+        {
+            return FALSE;
+        }
+
+    *device = (guint64) status.st_dev;
+    *inode = (guint64) status.st_ino;
+
+    return TRUE;
+}
+
+
+/************************************ GIO *************************************/
+
+/**
+ * Creates a GIO backend
+ * @param path : path or URI of the file
+ * @param mode : the mode to open the file
+ * @return a new backend
+ */
+static fcl_backend_t *gio_backend_new(const gchar *path, gint mode)
+{
+    gio_backend_t *gio = NULL;
+
+    gio = (gio_backend_t *) g_malloc0(sizeof(gio_backend_t));
+
+    gio->backend.open = gio_open;
+    gio->backend.read_at = gio_read_at;
+    gio->backend.write_at = gio_write_at;
+    gio->backend.size = gio_size;
+    gio->backend.sync = gio_sync;
+    gio->backend.map = NULL;
+    gio->backend.release = gio_release;
+    gio->backend.free = gio_free;
+    gio->backend.mode = mode;
+    gio->backend.is_open = FALSE;
+
+    gio->the_file = fcl_backend_gfile(path);
+    gio->in_stream = NULL;
+    gio->out_stream = NULL;
+    gio->out_position = 0;
+    gio->emptied = FALSE;
+    gio->replacing = FALSE;
+    g_mutex_init(&gio->lock);
+
+    return (fcl_backend_t *) gio;
+}
+
+
+/**
+ * Opens the input stream of a GIO backend. The output stream is only opened
+ * by the first write (a replaced file takes its place when it is closed) or,
+ * unless the mode is LIBFCL_MODE_READ, to create a file that does not exist.
+ * @param backend : the backend
+ * @return TRUE if a stream is open
+ */
+static gboolean gio_open(fcl_backend_t *backend)
+{
+    gio_backend_t *gio = (gio_backend_t *) backend;
+
+    g_mutex_lock(&gio->lock);
+
+    if (gio->in_stream == NULL)
+        {
+            gio->in_stream = g_file_read(gio->the_file, NULL, NULL);
+        }
+
+    if (gio->in_stream == NULL && backend->mode != LIBFCL_MODE_READ)
+        {
+            gio_out_stream(gio);
+        }
+
+    backend->is_open = gio->in_stream != NULL || gio->out_stream != NULL;
+
+    g_mutex_unlock(&gio->lock);
+
+    return backend->is_open;
+}
+
+
+/**
+ * Gets the stream used to write the file. A LIBFCL_MODE_CREATE file is
+ * replaced the first time (the old one stays readable until the stream is
+ * closed) and appended to the next ones.
+ * @param gio : the backend (its lock is held)
+ * @return the stream or NULL if the file can not be written
+ */
+static GFileOutputStream *gio_out_stream(gio_backend_t *gio)
+{
+    if (gio->out_stream == NULL && gio->backend.mode == LIBFCL_MODE_CREATE && gio->emptied == FALSE)
+        {
+            gio->out_stream = g_file_replace(gio->the_file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, NULL);
+            gio->out_position = 0;
+            gio->emptied = TRUE;
+            gio->replacing = gio->out_stream != NULL;
+        }
+    else if (gio->out_stream == NULL && gio->backend.mode != LIBFCL_MODE_READ)
+        {
+            /* A created file is only emptied once */
+            gio->out_stream = g_file_append_to(gio->the_file, G_FILE_CREATE_NONE, NULL, NULL);
+            gio->out_position = MAX(gio_size((fcl_backend_t *) gio), 0);
+        }
+
+    if (gio->out_stream != NULL)
+        {
+            gio->backend.is_open = TRUE;
+        }
+
+    return gio->out_stream;
+}
+
+
+/**
+ * Reads bytes of the file of a GIO backend
+ * @param backend : the backend
+ * @param offset : offset in the file
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to read
+ * @return the number of bytes read or -1 if an error occured
+ */
+static gssize gio_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size)
+{
+    gio_backend_t *gio = (gio_backend_t *) backend;
+    gsize read = 0;
+    gboolean ok = FALSE;
+
+    g_mutex_lock(&gio->lock);
+
+    if (gio->in_stream == NULL)
+        {
+            gio->in_stream = g_file_read(gio->the_file, NULL, NULL);
+            backend->is_open = gio->in_stream != NULL || gio->out_stream != NULL;
+        }
+
+    if (gio->in_stream != NULL && g_seekable_seek(G_SEEKABLE(gio->in_stream), offset, G_SEEK_SET, NULL, NULL) == TRUE)
+        {
+            ok = g_input_stream_read_all(G_INPUT_STREAM(gio->in_stream), data, size, &read, NULL, NULL);
+        }
+
+    g_mutex_unlock(&gio->lock);
+
+    return ok == TRUE ? (gssize) read : -1;
+}
+
+
+/**
+ * Writes bytes to the file of a GIO backend. The stream is only seeked when
+ * offset is not where the last write ended.
+ * @param backend : the backend
+ * @param offset : offset in the file
+ * @param data : the bytes
+ * @param size : number of bytes to write
+ * @return the number of bytes written or -1 if an error occured
+ */
+static gssize gio_write_at(fcl_backend_t *backend, goffset offset, const guchar *data, gsize size)
+{
+    gio_backend_t *gio = (gio_backend_t *) backend;
+    GFileOutputStream *out = NULL;
+    gsize written = 0;
+    gboolean ok = FALSE;
+
+    g_mutex_lock(&gio->lock);
+
+    out = gio_out_stream(gio);
+
+    if (out != NULL && offset != gio->out_position)
+        {
+            if (g_seekable_can_seek(G_SEEKABLE(out)) == TRUE && g_seekable_seek(G_SEEKABLE(out), offset, G_SEEK_SET, NULL, NULL) == TRUE)
+                {
+                    gio->out_position = offset;
+                }
+            else
+                {
+                    out = NULL;
+                }
+        }
+
+    if (out != NULL)
+        {
+            ok = g_output_stream_write_all(G_OUTPUT_STREAM(out), data, size, &written, NULL, NULL);
+            gio->out_position = gio->out_position + (goffset) written;
+        }
+
+    g_mutex_unlock(&gio->lock);
+
+    return ok == TRUE ? (gssize) written : -1;
+}
+
+
+/**
+ * Gets the size of the file of a GIO backend (only the size is queried : "*"
+ * would also sniff the content type)
+ * @param backend : the backend
+ * @return the size or -1 if the file does not exist
+ */
+static goffset gio_size(fcl_backend_t *backend)
+{
+    gio_backend_t *gio = (gio_backend_t *) backend;
+    GFileInfo *file_info = NULL;
+    goffset size = -1;
+
+    file_info = g_file_query_info(gio->the_file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+
+    if (file_info != NULL)
+        {
+            size = g_file_info_get_size(file_info);
+            g_object_unref(file_info);
+        }
+
+    return size;
+}
+
+
+/**
+ * Flushes what was written to the file of a GIO backend. A replaced file
+ * only takes its place when the stream is closed (release or free). A
+ * LIBFCL_MODE_CREATE file is emptied if nothing was written to it.
+ * @param backend : the backend
+ * @return TRUE if nothing went wrong
+ */
+static gboolean gio_sync(fcl_backend_t *backend)
+{
+    gio_backend_t *gio = (gio_backend_t *) backend;
+    gboolean ok = TRUE;
+
+    g_mutex_lock(&gio->lock);
+
+    if (backend->mode != LIBFCL_MODE_READ)
+        {
+            ok = gio_out_stream(gio) != NULL;
+        }
+
+    if (ok == TRUE && gio->out_stream != NULL)
+        {
+            ok = g_output_stream_flush(G_OUTPUT_STREAM(gio->out_stream), NULL, NULL);
+        }
+
+    g_mutex_unlock(&gio->lock);
+
+    return ok;
+}
+
+
+/**
+ * Closes the streams of a GIO backend. A stream that replaces the file is
+ * kept open : closing it would put the file in place before it is written
+ * to the end (it is closed by gio_free()).
+ * @param backend : the backend
+ */
+static void gio_release(fcl_backend_t *backend)
+{
+    gio_backend_t *gio = (gio_backend_t *) backend;
+
+    g_mutex_lock(&gio->lock);
+
+    if (gio->in_stream != NULL)
+        {
+            g_input_stream_close(G_INPUT_STREAM(gio->in_stream), NULL, NULL);
+            g_object_unref(gio->in_stream);
+            gio->in_stream = NULL;
+        }
+
+    if (gio->out_stream != NULL && gio->replacing == FALSE)
+        {
+            g_output_stream_close(G_OUTPUT_STREAM(gio->out_stream), NULL, NULL);
+            g_object_unref(gio->out_stream);
+            gio->out_stream = NULL;
+        }
+
+    backend->is_open = gio->out_stream != NULL;
+
+    g_mutex_unlock(&gio->lock);
+}
+
+
+/**
+ * Frees a GIO backend
+ * @param backend : the backend
+ */
+static void gio_free(fcl_backend_t *backend)
+{
+    gio_backend_t *gio = (gio_backend_t *) backend;
+
+    /* The replaced file takes its place */
+    gio->replacing = FALSE;
+    gio_release(backend);
+    g_object_unref(gio->the_file);
+    g_mutex_clear(&gio->lock);
+    g_free(gio);
+}
+
+
+/*********************************** POSIX ************************************/
+
+/**
+ * Creates a POSIX or a mmap backend
+ * @param path : path of the file
+ * @param mode : the mode to open the file
+ * @param mapped : TRUE for a mmap backend
+ * @return a new backend
+ */
+static fcl_backend_t *posix_backend_new(const gchar *path, gint mode, gboolean mapped)
+{
+    posix_backend_t *posix = NULL;
+
+    posix = (posix_backend_t *) g_malloc0(sizeof(posix_backend_t));
+
+    posix->backend.open = posix_open;
+    posix->backend.read_at = mapped == TRUE ? mmap_read_at : posix_read_at;
+    posix->backend.write_at = posix_write_at;
+    posix->backend.size = posix_size;
+    posix->backend.sync = posix_sync;
+    posix->backend.map = mapped == TRUE ? mmap_map : NULL;
+    posix->backend.release = posix_release;
+    posix->backend.free = posix_free;
+    posix->backend.mode = mode;
+    posix->backend.is_open = FALSE;
+
+    posix->path = g_strdup(path);
+    posix->fd = -1;
+    posix->emptied = FALSE;
+    posix->mapped = NULL;
+    g_mutex_init(&posix->lock);
+
+    return (fcl_backend_t *) posix;
+}
+
+
+/**
+ * Gets the file descriptor of a POSIX backend, openning the file if needed.
+ * A LIBFCL_MODE_CREATE file is emptied the first time it is written.
+ * @param posix : the backend
+ * @param writing : TRUE if the descriptor is used to write
+ * @return the file descriptor or -1 if the file can not be openned
+ */
+static gint posix_fd(posix_backend_t *posix, gboolean writing)
+{
+    gint fd = -1;
+    gint flags = O_RDONLY;
+
+    if (writing == TRUE && posix->backend.mode == LIBFCL_MODE_READ)
+        {
+            return -1;
+        }
+
+    g_mutex_lock(&posix->lock);
+
+    if (posix->fd < 0)
+        {
+            if (posix->backend.mode != LIBFCL_MODE_READ)
+                {
+                    flags = O_RDWR | O_CREAT;
+                }
+
+            posix->fd = g_open(posix->path, flags, 0666);
+            posix->backend.is_open = posix->fd >= 0;
+        }
+
+    if (writing == TRUE && posix->fd >= 0 && posix->backend.mode == LIBFCL_MODE_CREATE && posix->emptied == FALSE)
+        {
+            if (ftruncate(posix->fd, 0) == 0)
+                {
+                    posix->emptied = TRUE;
+                }
+        }
+
+    fd = posix->fd;
+
+    g_mutex_unlock(&posix->lock);
+
+    return fd;
+}
+
+
+/**
+ * Opens the file of a POSIX backend
+ * @param backend : the backend
+ * @return TRUE if the file is open
+ */
+static gboolean posix_open(fcl_backend_t *backend)
+{
+    return posix_fd((posix_backend_t *) backend, FALSE) >= 0;
+}
+
+
+/**
+ * Reads bytes of the file of a POSIX backend (pread : the descriptor is
+ * shared by the threads)
+ * @param backend : the backend
+ * @param offset : offset in the file
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to read
+ * @return the number of bytes read or -1 if an error occured
+ */
+static gssize posix_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size)
+{
+    gint fd = posix_fd((posix_backend_t *) backend, FALSE);
+    gssize read = 0;
+    gsize done = 0;
+
+    if (fd < 0)
+        {
+            return -1;
+        }
+
+    while (done < size)
+        {
+            read = pread(fd, data + done, size - done, (off_t) (offset + done));
+
+            if (read < 0)
+                {
+                    return -1;
+                }
+            else if (read == 0)
+                {
+                    break;
+                }
+
+            done = done + (gsize) read;
+        }
+
+    return (gssize) done;
+}
+
+
+/**
+ * Writes bytes to the file of a POSIX or a mmap backend (pwrite). The mapping
+ * of a mmap backend is dropped : it is done again at the next read.
+ * @param backend : the backend
+ * @param offset : offset in the file
+ * @param data : the bytes
+ * @param size : number of bytes to write
+ * @return the number of bytes written or -1 if an error occured
+ */
+static gssize posix_write_at(fcl_backend_t *backend, goffset offset, const guchar *data, gsize size)
+{
+    posix_backend_t *posix = (posix_backend_t *) backend;
+    gint fd = posix_fd(posix, TRUE);
+    gssize written = 0;
+    gsize done = 0;
+
+    if (fd < 0)
+        {
+            return -1;
+        }
+
+    while (done < size)
+        {
+            written = pwrite(fd, data + done, size - done, (off_t) (offset + done));
+
+            if (written <= 0)
+                {
+                    return -1;
+                }
+
+            done = done + (gsize) written;
+        }
+
+    g_mutex_lock(&posix->lock);
+
+    if (posix->mapped != NULL)
+        {
+            g_mapped_file_unref(posix->mapped);
+            posix->mapped = NULL;
+        }
+
+    g_mutex_unlock(&posix->lock);
+
+    return (gssize) done;
+}
+
+
+/**
+ * Gets the size of the file of a POSIX backend (fstat when it is open)
+ * @param backend : the backend
+ * @return the size or -1 if the file does not exist
+ */
+static goffset posix_size(fcl_backend_t *backend)
+{
+    posix_backend_t *posix = (posix_backend_t *) backend;
+    struct stat status;
+    gint result = -1;
+
+    g_mutex_lock(&posix->lock);
+
+    if (posix->fd >= 0)
+        {
+            result = fstat(posix->fd, &status);
+        }
+    else
+        {
+            result = g_stat(posix->path, &status);
+        }
+
+    g_mutex_unlock(&posix->lock);
+
+    return result == 0 ? (goffset) status.st_size : -1;
+}
+
+
+/**
+ * Writes what was written to the file of a POSIX backend to the disk. A
+ * LIBFCL_MODE_CREATE file is emptied if nothing was written to it.
+ * @param backend : the backend
+ * @return TRUE if nothing went wrong
+ */
+static gboolean posix_sync(fcl_backend_t *backend)
+{
+    gint fd = -1;
+
+    if (backend->mode == LIBFCL_MODE_READ)
+        {
+            return TRUE;
+        }
+
+    fd = posix_fd((posix_backend_t *) backend, TRUE);
+
+    return fd >= 0 && fsync(fd) == 0;
+}
+
+
+/**
+ * Closes the file descriptor of a POSIX backend. The mapping of a mmap
+ * backend is kept (it needs no descriptor).
+ * @param backend : the backend
+ */
+static void posix_release(fcl_backend_t *backend)
+{
+    posix_backend_t *posix = (posix_backend_t *) backend;
+
+    g_mutex_lock(&posix->lock);
+
+    if (posix->fd >= 0)
+        {
+            g_close(posix->fd, NULL);
+            posix->fd = -1;
+        }
+
+    backend->is_open = FALSE;
+
+    g_mutex_unlock(&posix->lock);
+}
+
+
+/**
+ * Frees a POSIX or a mmap backend
+ * @param backend : the backend
+ */
+static void posix_free(fcl_backend_t *backend)
+{
+    posix_backend_t *posix = (posix_backend_t *) backend;
+
+    posix_release(backend);
+
+    if (posix->mapped != NULL)
+        {
+            g_mapped_file_unref(posix->mapped);
+        }
+
+    g_mutex_clear(&posix->lock);
+    g_free(posix->path);
+    g_free(posix);
+}
+
+
+/************************************ mmap ************************************/
+
+/**
+ * Maps the file of a mmap backend in memory the first time
+ * @param backend : the backend
+ * @param[out] size_pointer : size of the file mapped
+ * @return the bytes of the file (valid until the next write or the backend
+ *         is freed) or NULL if the file can not be mapped or is empty
+ */
+static const guchar *mmap_map(fcl_backend_t *backend, gsize *size_pointer)
+{
+    posix_backend_t *posix = (posix_backend_t *) backend;
+    const guchar *map = NULL;
+
+    *size_pointer = 0;
+
+    g_mutex_lock(&posix->lock);
+
+    if (posix->mapped == NULL)
+        {
+            posix->mapped = g_mapped_file_new(posix->path, FALSE, NULL);
+        }
+
+    if (posix->mapped != NULL)
+        {
+            map = (const guchar *) g_mapped_file_get_contents(posix->mapped);
+            *size_pointer = g_mapped_file_get_length(posix->mapped);
+        }
+
+    g_mutex_unlock(&posix->lock);
+
+    return map;
+}
+
+
+/**
+ * Reads bytes of the file of a mmap backend : they are copied from the
+ * mapping (pread when the file can not be mapped)
+ * @param backend : the backend
+ * @param offset : offset in the file
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to read
+ * @return the number of bytes read or -1 if an error occured
+ */
+static gssize mmap_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size)
+{
+    const guchar *map = NULL;
+    gsize map_size = 0;
+
+    map = mmap_map(backend, &map_size);
+
+    if (map == NULL)
+        {
+            return posix_read_at(backend, offset, data, size);
+        }
+
+    if (offset < 0)
+        {
+            return -1;
+        }
+
+    if ((gsize) offset >= map_size)
+        {
+            return 0;
+        }
+
+    size = MIN(size, map_size - (gsize) offset);
+    memcpy(data, map + offset, size);
+
+    return (gssize) size;
+}
+
+
+/*********************************** Memory ***********************************/
+
+/**
+ * Creates an empty memory backend
+ * @param mode : the mode of the file (LIBFCL_MODE_READ...)
+ * @return a new backend
+ */
+static fcl_backend_t *memory_backend_new(gint mode)
+{
+    memory_backend_t *memory = NULL;
+
+    memory = (memory_backend_t *) g_malloc0(sizeof(memory_backend_t));
+
+    memory->backend.open = memory_open;
+    memory->backend.read_at = memory_read_at;
+    memory->backend.write_at = memory_write_at;
+    memory->backend.size = memory_size;
+    memory->backend.sync = memory_sync;
+    memory->backend.map = memory_map;
+    memory->backend.release = NULL;
+    memory->backend.free = memory_free;
+    memory->backend.mode = mode;
+    memory->backend.is_open = TRUE;
+
+    memory->bytes = g_byte_array_new();
+
+    return (fcl_backend_t *) memory;
+}
+
+
+/**
+ * Opens a memory backend (it always is)
+ * @param backend : the backend
+ * @return TRUE
+ */
+static gboolean memory_open(fcl_backend_t *backend)
+{
+    return TRUE;
+}
+
+
+/**
+ * Reads bytes of a memory backend
+ * @param backend : the backend
+ * @param offset : offset of the first byte
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to read
+ * @return the number of bytes read or -1 if offset is negative
+ */
+static gssize memory_read_at(fcl_backend_t *backend, goffset offset, guchar *data, gsize size)
+{
+    GByteArray *bytes = ((memory_backend_t *) backend)->bytes;
+
+    if (offset < 0)
+        {
+            return -1;
+        }
+
+    if ((gsize) offset >= bytes->len)
+        {
+            return 0;
+        }
+
+    size = MIN(size, bytes->len - (gsize) offset);
+    memcpy(data, bytes->data + offset, size);
+
+    return (gssize) size;
+}
+
+
+/**
+ * Writes bytes to a memory backend. Writing after its end fills the hole
+ * with zeros.
+ * @param backend : the backend
+ * @param offset : offset of the first byte
+ * @param data : the bytes
+ * @param size : number of bytes to write
+ * @return the number of bytes written or -1 if the backend is read only or
+ *         would be too big
+ */
+static gssize memory_write_at(fcl_backend_t *backend, goffset offset, const guchar *data, gsize size)
+{
+    GByteArray *bytes = ((memory_backend_t *) backend)->bytes;
+    guint len = bytes->len;
+
+    if (backend->mode == LIBFCL_MODE_READ || offset < 0 || memory_fits((guint64) offset + size) == FALSE)
+        {
+            return -1;
+        }
+
+    if ((gsize) offset + size > len)
+        {
+            g_byte_array_set_size(bytes, (guint) ((gsize) offset + size));
+
+            if ((gsize) offset > len)
+                {
+                    memset(bytes->data + len, 0, (gsize) offset - len);
+                }
+        }
+
+    memcpy(bytes->data + offset, data, size);
+
+    return (gssize) size;
+}
+
+
+/**
+ * Gets the size of a memory backend
+ * @param backend : the backend
+ * @return the number of bytes
+ */
+static goffset memory_size(fcl_backend_t *backend)
+{
+    return (goffset) ((memory_backend_t *) backend)->bytes->len;
+}
+
+
+/**
+ * Syncs a memory backend (nothing to do)
+ * @param backend : the backend
+ * @return TRUE
+ */
+static gboolean memory_sync(fcl_backend_t *backend)
+{
+    return TRUE;
+}
+
+
+/**
+ * Gets the bytes of a memory backend
+ * @param backend : the backend
+ * @param[out] size_pointer : number of bytes
+ * @return the bytes (valid until the next write or the backend is freed)
+ */
+static const guchar *memory_map(fcl_backend_t *backend, gsize *size_pointer)
+{
+    GByteArray *bytes = ((memory_backend_t *) backend)->bytes;
+
+    *size_pointer = bytes->len;
+
+    return bytes->data;
+}
+
+
+/**
+ * Frees a memory backend
+ * @param backend : the backend
+ */
+static void memory_free(fcl_backend_t *backend)
+{
+    g_byte_array_free(((memory_backend_t *) backend)->bytes, TRUE);
+    g_free(backend);
+}
+
+
+/**
+ * Says wether a memory backend may hold some bytes : its GByteArray holds at
+ * most G_MAXUINT bytes
+ * @param size : number of bytes
+ * @return TRUE if they fit, FALSE otherwise
+ */
+static gboolean memory_fits(guint64 size)
+{
+    if (size > G_MAXUINT)
+        {
+            fprintf(stderr, Q_("A memory backend can not hold more than %u bytes\n"), G_MAXUINT);
+            return FALSE;
+        }
+
+    return TRUE;
+}
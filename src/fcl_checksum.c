@@ -0,0 +1,1046 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_checksum.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_checksum.c
+ * Checksums of the edited file kept in hash trees.
+ *
+ * The blocks of the file are grouped into leaves of about
+ * LIBFCL_CHECKSUM_LEAF_SIZE bytes. The content of a leaf is the content of
+ * its blocks in the edited file (whatever their size is now) so an edit only
+ * changes the leaf of the block edited : the leaf and its ancestors are
+ * invalidated and only them are hashed again when the checksum is asked for.
+ * The leaves to be hashed are shared between a pool of threads.
+ *
+ * A tree is built (and then kept up to date) for an algorithm the first time
+ * a checksum with this algorithm is asked for. Two nodes are combined as
+ * follows :
+ *  - CRC32C : the CRC of the concatenation is computed from the two CRCs and
+ *    the size of the right part, thus the root is the CRC32C of the whole
+ *    edited file.
+ *  - xxHash (XXH64) and SHA-256 : the node is the hash of the digests of its
+ *    children. When the file has only one leaf the root is the hash of the
+ *    file, otherwise it is a tree hash (that is not the one that xxhsum or
+ *    sha256sum would print).
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LIBFCL_HAVE_SSE42 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @def LIBFCL_CHECKSUM_LEAF_SIZE
+ * Number of bytes of the file on disk covered by a leaf of the tree
+ *
+ * @def LIBFCL_CHECKSUM_LEAF_BLOCKS
+ * Number of blocks in a leaf
+ *
+ * @def LIBFCL_CHECKSUM_N_ALGOS
+ * Number of algorithms (LIBFCL_CHECKSUM_*)
+ *
+ * @def LIBFCL_CHECKSUM_DIGEST_SIZE
+ * Maximum size of a digest (SHA-256)
+ */
+#define LIBFCL_CHECKSUM_LEAF_SIZE 65536
+#define LIBFCL_CHECKSUM_LEAF_BLOCKS MAX(1, LIBFCL_CHECKSUM_LEAF_SIZE / LIBFCL_BUF_SIZE)
+#define LIBFCL_CHECKSUM_N_ALGOS 3
+#define LIBFCL_CHECKSUM_DIGEST_SIZE 32
+
+#define CRC32C_POLY 0x82F63B78
+
+#define XXH_PRIME64_1 G_GUINT64_CONSTANT(0x9E3779B185EBCA87)
+#define XXH_PRIME64_2 G_GUINT64_CONSTANT(0xC2B2AE3D27D4EB4F)
+#define XXH_PRIME64_3 G_GUINT64_CONSTANT(0x165667B19E3779F9)
+#define XXH_PRIME64_4 G_GUINT64_CONSTANT(0x85EBCA77C2B2AE63)
+#define XXH_PRIME64_5 G_GUINT64_CONSTANT(0x27D4EB2F165667C5)
+
+
+/**
+ * @struct checksum_node_t
+ * A node of a hash tree
+ */
+typedef struct
+{
+    guint8 digest[LIBFCL_CHECKSUM_DIGEST_SIZE];  /**< The digest (CRC and XXH64 in host order)  */
+    guint64 size;                                /**< Number of bytes covered by the node       */
+    gboolean valid;                              /**< FALSE when it has to be computed again     */
+    gboolean used;                               /**< FALSE for the leaves after the last one    */
+} checksum_node_t;
+
+
+/**
+ * @struct fcl_checksums_t
+ * The hash trees of a file. The trees are complete binary trees stored in
+ * arrays (the children of node i are 2i and 2i + 1, the root is node 1).
+ */
+struct _fcl_checksums_t
+{
+    goffset n_blocks;                                  /**< Blocks covered by the leaves     */
+    guint n_leaves;                                    /**< Number of leaves used            */
+    guint capacity;                                    /**< Number of leaves (a power of 2)  */
+    checksum_node_t *trees[LIBFCL_CHECKSUM_N_ALGOS];   /**< One tree per algorithm or NULL   */
+};
+
+
+/**
+ * @struct xxh64_state_t
+ * State of an XXH64 computation
+ */
+typedef struct
+{
+    guint64 v[4];        /**< Accumulators                   */
+    guint64 total_size;  /**< Number of bytes hashed          */
+    guint8 memory[32];   /**< Bytes not yet consumed          */
+    gsize memory_size;   /**< Number of bytes in memory       */
+} xxh64_state_t;
+
+
+/**
+ * @struct checksum_job_t
+ * Leaves to be hashed by a thread
+ */
+typedef struct
+{
+    fcl_file_t *a_file;          /**< The file                           */
+    fcl_checksums_t *checksums;  /**< Its trees                          */
+    gint algo;                   /**< Algorithm of the tree              */
+    guint *leaves;               /**< Numbers of the leaves to hash      */
+    guint n;                     /**< Number of leaves                   */
+} checksum_job_t;
+
+
+static fcl_checksums_t *new_checksums(fcl_file_t *a_file);
+static void collect_invalid_leaves(fcl_checksums_t *checksums, checksum_node_t *tree, guint node, GArray *leaves);
+static void hash_leaves(gpointer data, gpointer user_data);
+static void hash_range(fcl_view_t *view, gint algo, goffset begin, goffset end, checksum_node_t *node);
+static void compute_node(checksum_node_t *tree, gint algo, guint node);
+
+static guint32 crc32c_update(guint32 crc, const guchar *data, gsize size);
+static guint32 crc32c_combine(guint32 crc1, guint32 crc2, guint64 size2);
+static void xxh64_init(xxh64_state_t *state);
+static void xxh64_update(xxh64_state_t *state, const guchar *data, gsize size);
+static guint64 xxh64_digest(xxh64_state_t *state);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Computes the checksum of the edited file (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param algo : LIBFCL_CHECKSUM_CRC32C, LIBFCL_CHECKSUM_XXH64 or
+ *               LIBFCL_CHECKSUM_SHA256
+ * @return a newly allocated string with the checksum in hexadecimal or NULL
+ */
+gchar *fcl_checksum(fcl_file_t *a_file, gint algo)
+{
+    fcl_checksums_t *checksums = NULL;
+    checksum_node_t *tree = NULL;
+    checksum_job_t *jobs = NULL;
+    gpointer *job_pointers = NULL;
+    GArray *leaves = NULL;
+    GString *hex = NULL;
+    guint32 crc = 0;
+    guint64 hash = 0;
+    guint n_jobs = 0;
+    guint per_job = 0;
+    guint i = 0;
+
+    if (a_file == NULL || algo < 0 || algo >= LIBFCL_CHECKSUM_N_ALGOS)
+        {
+            return NULL;
+        }
+
+    if (a_file->checksums == NULL)
+        {
+            a_file->checksums = new_checksums(a_file);
+        }
+
+    checksums = a_file->checksums;
+
+    if (checksums->trees[algo] == NULL)
+        {
+            tree = (checksum_node_t *) g_malloc0(2 * checksums->capacity * sizeof(checksum_node_t));
+
+            /* The leaves after the last one are valid and empty */
+            for (i = checksums->n_leaves; i < checksums->capacity; i++)
+                {
+                    tree[checksums->capacity + i].valid = TRUE;
+                    tree[checksums->capacity + i].used = FALSE;
+                }
+
+            checksums->trees[algo] = tree;
+        }
+
+    tree = checksums->trees[algo];
+
+    /* Hashing the invalid leaves */
+    leaves = g_array_new(FALSE, FALSE, sizeof(guint));
+    collect_invalid_leaves(checksums, tree, 1, leaves);
+
+    if (leaves->len > 0)
+        {
+            n_jobs = MIN(leaves->len, g_get_num_processors() * 4);
+            per_job = (leaves->len + n_jobs - 1) / n_jobs;
+            n_jobs = (leaves->len + per_job - 1) / per_job;
+
+            jobs = (checksum_job_t *) g_malloc0(n_jobs * sizeof(checksum_job_t));
+            job_pointers = (gpointer *) g_malloc0(n_jobs * sizeof(gpointer));
+
+            for (i = 0; i < n_jobs; i++)
+                {
+                    jobs[i].a_file = a_file;
+                    jobs[i].checksums = checksums;
+                    jobs[i].algo = algo;
+                    jobs[i].leaves = &g_array_index(leaves, guint, i * per_job);
+                    jobs[i].n = MIN(per_job, leaves->len - i * per_job);
+                    job_pointers[i] = &jobs[i];
+                }
+
+            fcl_run_jobs(hash_leaves, job_pointers, n_jobs, 0);
+
+            g_free(job_pointers);
+            g_free(jobs);
+        }
+
+    g_array_free(leaves, TRUE);
+
+    /* Then their ancestors */
+    compute_node(tree, algo, 1);
+
+    switch (algo)
+        {
+            case LIBFCL_CHECKSUM_CRC32C:
+                memcpy(&crc, tree[1].digest, sizeof(guint32));
+                return g_strdup_printf("%08x", crc);
+            break;
+
+            case LIBFCL_CHECKSUM_XXH64:
+                memcpy(&hash, tree[1].digest, sizeof(guint64));
+                return g_strdup_printf("%016" G_GINT64_MODIFIER "x", hash);
+            break;
+
+            default:
+                hex = g_string_sized_new(2 * LIBFCL_CHECKSUM_DIGEST_SIZE);
+
+                for (i = 0; i < LIBFCL_CHECKSUM_DIGEST_SIZE; i++)
+                    {
+                        g_string_append_printf(hex, "%02x", tree[1].digest[i]);
+                    }
+
+                return g_string_free(hex, FALSE);
+            break;
+        }
+}
+
+
+/**
+ * Invalidates the leaf of a block that was edited (see fcl_internal.h)
+ * @param a_file : the file
+ * @param block : the number of the block (offset of the fcl_buf_t)
+ */
+void fcl_checksums_invalidate(fcl_file_t *a_file, goffset block)
+{
+    fcl_checksums_t *checksums = a_file->checksums;
+    checksum_node_t *tree = NULL;
+    guint node = 0;
+    gint algo = 0;
+
+    if (checksums == NULL)
+        {
+            return;
+        }
+
+    if (block < 0 || block >= checksums->n_blocks)
+        {
+            /* A block after the end of the file : the trees are too small */
+            fcl_checksums_free(checksums);
+            a_file->checksums = NULL;
+            return;
+        }
+
+    for (algo = 0; algo < LIBFCL_CHECKSUM_N_ALGOS; algo++)
+        {
+            tree = checksums->trees[algo];
+
+            if (tree != NULL)
+                {
+                    /* The ancestors of an invalid node are invalid */
+                    node = checksums->capacity + (guint) (block / LIBFCL_CHECKSUM_LEAF_BLOCKS);
+
+                    while (node >= 1 && tree[node].valid == TRUE)
+                        {
+                            tree[node].valid = FALSE;
+                            node = node / 2;
+                        }
+                }
+        }
+}
+
+
+/**
+ * Finds the SHA-256 leaf that holds a position (see fcl_internal.h)
+ * @param view : a view on the file
+ * @param position : position in the edited file
+ * @param[out] end_pointer : end of the leaf
+ * @param[out] digest_pointer : digest of the leaf or NULL if it is not valid
+ * @return the position of the leaf or G_MAXINT64 if there is none
+ */
+goffset fcl_checksums_leaf_at(fcl_view_t *view, goffset position, goffset *end_pointer, const guint8 **digest_pointer)
+{
+    fcl_checksums_t *checksums = view->a_file->checksums;
+    checksum_node_t *tree = NULL;
+    guint low = 0;
+    guint high = 0;
+    guint middle = 0;
+
+    if (checksums == NULL || checksums->trees[LIBFCL_CHECKSUM_SHA256] == NULL || position >= view->size)
+        {
+            return G_MAXINT64;
+        }
+
+    tree = checksums->trees[LIBFCL_CHECKSUM_SHA256];
+
+    /* The last leaf ends at the end of the file : the first leaf that ends
+     * after position is the one that holds it (empty leaves are skipped) */
+    low = 0;
+    high = checksums->n_leaves - 1;
+
+    while (low < high)
+        {
+            middle = low + (high - low) / 2;
+
+            if (fcl_view_block_position(view, (goffset) (middle + 1) * LIBFCL_CHECKSUM_LEAF_BLOCKS) <= position)
+                {
+                    low = middle + 1;
+                }
+            else
+                {
+                    high = middle;
+                }
+        }
+
+    if (low + 1 < checksums->n_leaves)
+        {
+            *end_pointer = fcl_view_block_position(view, (goffset) (low + 1) * LIBFCL_CHECKSUM_LEAF_BLOCKS);
+        }
+    else
+        {
+            *end_pointer = view->size;
+        }
+
+    if (tree[checksums->capacity + low].valid == TRUE)
+        {
+            *digest_pointer = tree[checksums->capacity + low].digest;
+        }
+    else
+        {
+            *digest_pointer = NULL;
+        }
+
+    return fcl_view_block_position(view, (goffset) low * LIBFCL_CHECKSUM_LEAF_BLOCKS);
+}
+
+
+/**
+ * Updates a CRC32C (see fcl_internal.h)
+ * @param crc : the CRC32C so far
+ * @param data : the bytes
+ * @param size : number of bytes
+ * @return the new CRC32C
+ */
+guint32 fcl_crc32c_update(guint32 crc, const guchar *data, gsize size)
+{
+    return crc32c_update(crc ^ 0xFFFFFFFF, data, size) ^ 0xFFFFFFFF;
+}
+
+
+/**
+ * Frees the hash trees of a file (see fcl_internal.h)
+ * @param checksums : the trees to be freed
+ */
+void fcl_checksums_free(fcl_checksums_t *checksums)
+{
+    gint algo = 0;
+
+    if (checksums != NULL)
+        {
+            for (algo = 0; algo < LIBFCL_CHECKSUM_N_ALGOS; algo++)
+                {
+                    g_free(checksums->trees[algo]);
+                }
+
+            g_free(checksums);
+        }
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Creates the (empty) hash trees of a file. The leaves cover every block of
+ * the file on disk and the blocks appended after it.
+ * @param a_file : the file
+ * @return a newly allocated fcl_checksums_t without any tree
+ */
+static fcl_checksums_t *new_checksums(fcl_file_t *a_file)
+{
+    fcl_checksums_t *checksums = NULL;
+    fcl_buf_t *last = NULL;
+    goffset n_blocks = 0;
+
+    n_blocks = (MAX(a_file->real_size, 0) + LIBFCL_BUF_SIZE - 1) / LIBFCL_BUF_SIZE;
+
+    if (a_file->sequence != NULL && g_sequence_get_length(a_file->sequence) > 0)
+        {
+            last = g_sequence_get(g_sequence_iter_prev(g_sequence_get_end_iter(a_file->sequence)));
+            n_blocks = MAX(n_blocks, last->offset + 1);
+        }
+
+    checksums = (fcl_checksums_t *) g_malloc0(sizeof(fcl_checksums_t));
+
+    checksums->n_leaves = (guint) MAX(1, (n_blocks + LIBFCL_CHECKSUM_LEAF_BLOCKS - 1) / LIBFCL_CHECKSUM_LEAF_BLOCKS);
+    checksums->n_blocks = (goffset) checksums->n_leaves * LIBFCL_CHECKSUM_LEAF_BLOCKS;
+    checksums->capacity = 1;
+
+    while (checksums->capacity < checksums->n_leaves)
+        {
+            checksums->capacity = checksums->capacity * 2;
+        }
+
+    return checksums;
+}
+
+
+/**
+ * Collects the invalid leaves under a node (only the invalid nodes are
+ * visited)
+ * @param checksums : the trees
+ * @param tree : the tree
+ * @param node : the node
+ * @param leaves : a GArray of guint where the numbers of the leaves are added
+ */
+static void collect_invalid_leaves(fcl_checksums_t *checksums, checksum_node_t *tree, guint node, GArray *leaves)
+{
+    guint leaf = 0;
+
+    if (tree[node].valid == FALSE)
+        {
+            if (node >= checksums->capacity)
+                {
+                    leaf = node - checksums->capacity;
+                    g_array_append_val(leaves, leaf);
+                }
+            else
+                {
+                    collect_invalid_leaves(checksums, tree, 2 * node, leaves);
+                    collect_invalid_leaves(checksums, tree, 2 * node + 1, leaves);
+                }
+        }
+}
+
+
+/**
+ * Hashes the leaves of a job (run by a thread of the pool)
+ * @param data : the checksum_job_t to do
+ * @param user_data : unused
+ */
+static void hash_leaves(gpointer data, gpointer user_data)
+{
+    checksum_job_t *job = (checksum_job_t *) data;
+    fcl_checksums_t *checksums = job->checksums;
+    checksum_node_t *tree = checksums->trees[job->algo];
+    fcl_view_t *view = NULL;
+    goffset begin = 0;
+    goffset end = 0;
+    guint leaf = 0;
+    guint i = 0;
+
+    view = fcl_view_new(job->a_file);
+
+    for (i = 0; i < job->n; i++)
+        {
+            leaf = job->leaves[i];
+
+            begin = fcl_view_block_position(view, (goffset) leaf * LIBFCL_CHECKSUM_LEAF_BLOCKS);
+
+            if (leaf + 1 < checksums->n_leaves)
+                {
+                    end = fcl_view_block_position(view, (goffset) (leaf + 1) * LIBFCL_CHECKSUM_LEAF_BLOCKS);
+                }
+            else
+                {
+                    end = view->size;
+                }
+
+            hash_range(view, job->algo, begin, end, &tree[checksums->capacity + leaf]);
+        }
+
+    fcl_view_free(view);
+}
+
+
+/**
+ * Hashes bytes of the edited file into a leaf
+ * @param view : a view on the edited file
+ * @param algo : the algorithm
+ * @param begin : position of the first byte
+ * @param end : position after the last byte
+ * @param node : the leaf
+ */
+static void hash_range(fcl_view_t *view, gint algo, goffset begin, goffset end, checksum_node_t *node)
+{
+    GChecksum *checksum = NULL;
+    xxh64_state_t state;
+    const guchar *run = NULL;
+    goffset position = begin;
+    gsize size = 0;
+    gsize digest_size = LIBFCL_CHECKSUM_DIGEST_SIZE;
+    guint32 crc = 0xFFFFFFFF;
+    guint64 hash = 0;
+
+    xxh64_init(&state);
+
+    if (algo == LIBFCL_CHECKSUM_SHA256)
+        {
+            checksum = g_checksum_new(G_CHECKSUM_SHA256);
+        }
+
+    while (position < end && (run = fcl_view_get_run(view, position, &size)) != NULL)
+        {
+            size = (gsize) MIN((goffset) size, end - position);
+
+            switch (algo)
+                {
+                    case LIBFCL_CHECKSUM_CRC32C:
+                        crc = crc32c_update(crc, run, size);
+                    break;
+
+                    case LIBFCL_CHECKSUM_XXH64:
+                        xxh64_update(&state, run, size);
+                    break;
+
+                    default:
+                        g_checksum_update(checksum, run, size);
+                    break;
+                }
+
+            position = position + size;
+        }
+
+    memset(node->digest, 0, LIBFCL_CHECKSUM_DIGEST_SIZE);
+
+    switch (algo)
+        {
+            case LIBFCL_CHECKSUM_CRC32C:
+                crc = crc ^ 0xFFFFFFFF;
+                memcpy(node->digest, &crc, sizeof(guint32));
+            break;
+
+            case LIBFCL_CHECKSUM_XXH64:
+                hash = xxh64_digest(&state);
+                memcpy(node->digest, &hash, sizeof(guint64));
+            break;
+
+            default:
+                g_checksum_get_digest(checksum, node->digest, &digest_size);
+                g_checksum_free(checksum);
+            break;
+        }
+
+    node->size = (guint64) (position - begin);
+    node->used = TRUE;
+    node->valid = TRUE;
+}
+
+
+/**
+ * Computes a node from its children (computing them first if they are not
+ * valid)
+ * @param tree : the tree
+ * @param algo : the algorithm
+ * @param node : the node
+ */
+static void compute_node(checksum_node_t *tree, gint algo, guint node)
+{
+    checksum_node_t *left = &tree[2 * node];
+    checksum_node_t *right = &tree[2 * node + 1];
+    GChecksum *checksum = NULL;
+    xxh64_state_t state;
+    gsize digest_size = LIBFCL_CHECKSUM_DIGEST_SIZE;
+    guint32 crc1 = 0;
+    guint32 crc2 = 0;
+    guint64 hash = 0;
+
+    if (tree[node].valid == TRUE)
+        {
+            return;
+        }
+
+    compute_node(tree, algo, 2 * node);
+    compute_node(tree, algo, 2 * node + 1);
+
+    if (right->used == FALSE)
+        {
+            /* The right subtree is after the last leaf */
+            tree[node] = *left;
+            return;
+        }
+
+    switch (algo)
+        {
+            case LIBFCL_CHECKSUM_CRC32C:
+                memcpy(&crc1, left->digest, sizeof(guint32));
+                memcpy(&crc2, right->digest, sizeof(guint32));
+                crc1 = crc32c_combine(crc1, crc2, right->size);
+                memcpy(tree[node].digest, &crc1, sizeof(guint32));
+            break;
+
+            case LIBFCL_CHECKSUM_XXH64:
+                xxh64_init(&state);
+                xxh64_update(&state, left->digest, sizeof(guint64));
+                xxh64_update(&state, right->digest, sizeof(guint64));
+                hash = xxh64_digest(&state);
+                memcpy(tree[node].digest, &hash, sizeof(guint64));
+            break;
+
+            default:
+                checksum = g_checksum_new(G_CHECKSUM_SHA256);
+                g_checksum_update(checksum, left->digest, LIBFCL_CHECKSUM_DIGEST_SIZE);
+                g_checksum_update(checksum, right->digest, LIBFCL_CHECKSUM_DIGEST_SIZE);
+                g_checksum_get_digest(checksum, tree[node].digest, &digest_size);
+                g_checksum_free(checksum);
+            break;
+        }
+
+    tree[node].size = left->size + right->size;
+    tree[node].used = TRUE;
+    tree[node].valid = TRUE;
+}
+
+
+/********************************** CRC32C ************************************/
+
+static guint32 crc32c_table[8][256];
+
+
+/**
+ * Builds (once) the tables of the slicing-by-8 CRC32C
+ */
+static void crc32c_init_table(void)
+{
+    static gsize ready = 0;
+    guint32 crc = 0;
+    guint i = 0;
+    guint j = 0;
+
+    if (g_once_init_enter(&ready))
+        {
+            for (i = 0; i < 256; i++)
+                {
+                    crc = i;
+
+                    for (j = 0; j < 8; j++)
+                        {
+                            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+                        }
+
+                    crc32c_table[0][i] = crc;
+                }
+
+            for (i = 0; i < 256; i++)
+                {
+                    for (j = 1; j < 8; j++)
+                        {
+                            crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+                        }
+                }
+
+            g_once_init_leave(&ready, 1);
+        }
+}
+
+
+#ifdef LIBFCL_HAVE_SSE42
+/**
+ * Says (once) whether the processor has the SSE4.2 CRC32 instruction
+ */
+static gboolean cpu_has_sse42(void)
+{
+    static gint has_sse42 = -1;
+
+    if (has_sse42 < 0)
+        {
+            __builtin_cpu_init();
+            has_sse42 = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+        }
+
+    return has_sse42 == 1;
+}
+
+
+/**
+ * CRC32C with the SSE4.2 instruction, 8 bytes at a time
+ */
+__attribute__((target("sse4.2")))
+static guint32 crc32c_update_sse42(guint32 crc, const guchar *data, gsize size)
+{
+    guint64 crc64 = crc;
+    guint64 word = 0;
+
+    while (size >= 8)
+        {
+            memcpy(&word, data, sizeof(guint64));
+            crc64 = _mm_crc32_u64(crc64, word);
+            data = data + 8;
+            size = size - 8;
+        }
+
+    crc = (guint32) crc64;
+
+    while (size > 0)
+        {
+            crc = _mm_crc32_u8(crc, *data);
+            data++;
+            size--;
+        }
+
+    return crc;
+}
+#endif /* LIBFCL_HAVE_SSE42 */
+
+
+/**
+ * Updates a CRC32C (the CRC is neither inverted at the begining nor at the end)
+ * @param crc : the CRC so far
+ * @param data : the bytes
+ * @param size : number of bytes
+ * @return the new CRC
+ */
+static guint32 crc32c_update(guint32 crc, const guchar *data, gsize size)
+{
+    guint32 low = 0;
+    guint32 high = 0;
+
+#ifdef LIBFCL_HAVE_SSE42
+    if (cpu_has_sse42())
+        {
+            return crc32c_update_sse42(crc, data, size);
+        }
+#endif
+
+    crc32c_init_table();
+
+    while (size >= 8)
+        {
+            memcpy(&low, data, sizeof(guint32));
+            memcpy(&high, data + 4, sizeof(guint32));
+            low = GUINT32_FROM_LE(low) ^ crc;
+            high = GUINT32_FROM_LE(high);
+
+            crc = crc32c_table[7][low & 0xFF] ^ crc32c_table[6][(low >> 8) & 0xFF] ^
+                  crc32c_table[5][(low >> 16) & 0xFF] ^ crc32c_table[4][low >> 24] ^
+                  crc32c_table[3][high & 0xFF] ^ crc32c_table[2][(high >> 8) & 0xFF] ^
+                  crc32c_table[1][(high >> 16) & 0xFF] ^ crc32c_table[0][high >> 24];
+
+            data = data + 8;
+            size = size - 8;
+        }
+
+    while (size > 0)
+        {
+            crc = crc32c_table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+            data++;
+            size--;
+        }
+
+    return crc;
+}
+
+
+/**
+ * Multiplies a 32x32 matrix over GF(2) by a vector
+ */
+static guint32 gf2_matrix_times(const guint32 *matrix, guint32 vector)
+{
+    guint32 sum = 0;
+
+    while (vector != 0)
+        {
+            if (vector & 1)
+                {
+                    sum = sum ^ *matrix;
+                }
+
+            vector = vector >> 1;
+            matrix++;
+        }
+
+    return sum;
+}
+
+
+/**
+ * Squares a 32x32 matrix over GF(2)
+ */
+static void gf2_matrix_square(guint32 *square, const guint32 *matrix)
+{
+    gint n = 0;
+
+    for (n = 0; n < 32; n++)
+        {
+            square[n] = gf2_matrix_times(matrix, matrix[n]);
+        }
+}
+
+
+/**
+ * Computes the CRC32C of the concatenation of two parts from their CRCs (as
+ * zlib's crc32_combine does)
+ * @param crc1 : CRC32C of the first part
+ * @param crc2 : CRC32C of the second part
+ * @param size2 : size of the second part
+ * @return the CRC32C of both parts
+ */
+static guint32 crc32c_combine(guint32 crc1, guint32 crc2, guint64 size2)
+{
+    guint32 even[32];    /** even power of two zeros operator */
+    guint32 odd[32];     /** odd power of two zeros operator  */
+    guint32 row = 1;
+    gint n = 0;
+
+    if (size2 == 0)
+        {
+            return crc1;
+        }
+
+    /* Operator for one zero bit */
+    odd[0] = CRC32C_POLY;
+
+    for (n = 1; n < 32; n++)
+        {
+            odd[n] = row;
+            row = row << 1;
+        }
+
+    gf2_matrix_square(even, odd);   /* two zero bits  */
+    gf2_matrix_square(odd, even);   /* four zero bits */
+
+    /* Applying size2 zero bytes to crc1 */
+    do
+        {
+            gf2_matrix_square(even, odd);
+
+            if (size2 & 1)
+                {
+                    crc1 = gf2_matrix_times(even, crc1);
+                }
+
+            size2 = size2 >> 1;
+
+            if (size2 == 0)
+                {
+                    break;
+                }
+
+            gf2_matrix_square(odd, even);
+
+            if (size2 & 1)
+                {
+                    crc1 = gf2_matrix_times(odd, crc1);
+                }
+
+            size2 = size2 >> 1;
+        }
+    while (size2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+
+/*********************************** XXH64 ************************************/
+
+static guint64 xxh64_rotl(guint64 x, gint r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+
+static guint64 xxh64_round(guint64 acc, guint64 input)
+{
+    acc = acc + input * XXH_PRIME64_2;
+    acc = xxh64_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+
+static guint64 xxh64_merge_round(guint64 acc, guint64 value)
+{
+    acc = acc ^ xxh64_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+
+static guint64 xxh64_read64(const guchar *data)
+{
+    guint64 value = 0;
+
+    memcpy(&value, data, sizeof(guint64));
+
+    return GUINT64_FROM_LE(value);
+}
+
+
+static guint32 xxh64_read32(const guchar *data)
+{
+    guint32 value = 0;
+
+    memcpy(&value, data, sizeof(guint32));
+
+    return GUINT32_FROM_LE(value);
+}
+
+
+/**
+ * Inits an XXH64 computation (seed 0)
+ */
+static void xxh64_init(xxh64_state_t *state)
+{
+    memset(state, 0, sizeof(xxh64_state_t));
+
+    state->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    state->v[1] = XXH_PRIME64_2;
+    state->v[2] = 0;
+    state->v[3] = 0 - XXH_PRIME64_1;
+}
+
+
+/**
+ * Consumes stripes of 32 bytes
+ */
+static void xxh64_stripe(xxh64_state_t *state, const guchar *data)
+{
+    state->v[0] = xxh64_round(state->v[0], xxh64_read64(data));
+    state->v[1] = xxh64_round(state->v[1], xxh64_read64(data + 8));
+    state->v[2] = xxh64_round(state->v[2], xxh64_read64(data + 16));
+    state->v[3] = xxh64_round(state->v[3], xxh64_read64(data + 24));
+}
+
+
+/**
+ * Adds bytes to an XXH64 computation
+ */
+static void xxh64_update(xxh64_state_t *state, const guchar *data, gsize size)
+{
+    gsize n = 0;
+
+    state->total_size = state->total_size + size;
+
+    if (state->memory_size > 0)
+        {
+            n = MIN(size, 32 - state->memory_size);
+            memcpy(state->memory + state->memory_size, data, n);
+            state->memory_size = state->memory_size + n;
+            data = data + n;
+            size = size - n;
+
+            if (state->memory_size < 32)
+                {
+                    return;
+                }
+
+            xxh64_stripe(state, state->memory);
+            state->memory_size = 0;
+        }
+
+    while (size >= 32)
+        {
+            xxh64_stripe(state, data);
+            data = data + 32;
+            size = size - 32;
+        }
+
+    memcpy(state->memory, data, size);
+    state->memory_size = size;
+}
+
+
+/**
+ * Ends an XXH64 computation
+ * @return the hash
+ */
+static guint64 xxh64_digest(xxh64_state_t *state)
+{
+    const guchar *data = state->memory;
+    const guchar *end = state->memory + state->memory_size;
+    guint64 hash = 0;
+
+    if (state->total_size >= 32)
+        {
+            hash = xxh64_rotl(state->v[0], 1) + xxh64_rotl(state->v[1], 7) + xxh64_rotl(state->v[2], 12) + xxh64_rotl(state->v[3], 18);
+            hash = xxh64_merge_round(hash, state->v[0]);
+            hash = xxh64_merge_round(hash, state->v[1]);
+            hash = xxh64_merge_round(hash, state->v[2]);
+            hash = xxh64_merge_round(hash, state->v[3]);
+        }
+    else
+        {
+            hash = XXH_PRIME64_5;
+        }
+
+    hash = hash + state->total_size;
+
+    while (data + 8 <= end)
+        {
+            hash = hash ^ xxh64_round(0, xxh64_read64(data));
+            hash = xxh64_rotl(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+            data = data + 8;
+        }
+
+    if (data + 4 <= end)
+        {
+            hash = hash ^ ((guint64) xxh64_read32(data) * XXH_PRIME64_1);
+            hash = xxh64_rotl(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+            data = data + 4;
+        }
+
+    while (data < end)
+        {
+            hash = hash ^ ((guint64) *data * XXH_PRIME64_5);
+            hash = xxh64_rotl(hash, 11) * XXH_PRIME64_1;
+            data++;
+        }
+
+    hash = hash ^ (hash >> 33);
+    hash = hash * XXH_PRIME64_2;
+    hash = hash ^ (hash >> 29);
+    hash = hash * XXH_PRIME64_3;
+    hash = hash ^ (hash >> 32);
+
+    return hash;
+}
@@ -0,0 +1,554 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_diff.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_diff.c
+ * Differences between two edited files.
+ *
+ * Both files are walked together through views, run by run. Equal bytes are
+ * skipped by comparing the runs 16 or 32 bytes at a time (SSE2 or AVX2 when
+ * available). When the SHA-256 trees of both files are known (see
+ * fcl_checksum()) and the two positions are at the begining of leaves with
+ * the same digest, the whole leaf is skipped without being read.
+ *
+ * At the first difference, the two files are synchronized again : the next
+ * bytes of both files are read into windows, the positions of the anchors
+ * (LIBFCL_DIFF_ANCHOR_SIZE bytes) of the second window are put into a hash
+ * table with a rolling hash and the anchors of the first window are looked
+ * for in it. The pair of positions (i, j) where both files are equal again
+ * with the smallest i + j ends the difference : bytes inserted or deleted in
+ * one of the files do not make the rest of the files differ. The windows
+ * begin small and grow up to LIBFCL_DIFF_MAX_WINDOW_SIZE bytes until an
+ * anchor is found.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define LIBFCL_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define LIBFCL_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/**
+ * @def LIBFCL_DIFF_ANCHOR_SIZE
+ * Number of equal bytes needed to say that the two files are synchronized
+ *
+ * @def LIBFCL_DIFF_MIN_WINDOW_SIZE
+ * Size of the windows when looking for an anchor for the first time
+ *
+ * @def LIBFCL_DIFF_MAX_WINDOW_SIZE
+ * Size of the windows after which a difference is given up (and the two
+ * windows are said to differ)
+ *
+ * @def LIBFCL_DIFF_MAX_ANCHORS
+ * Maximum number of anchors put into the hash table (in big windows only one
+ * position out of a few is an anchor)
+ *
+ * @def LIBFCL_DIFF_HASH_BASE
+ * Base of the rolling hash
+ */
+#define LIBFCL_DIFF_ANCHOR_SIZE 32
+#define LIBFCL_DIFF_MIN_WINDOW_SIZE 256
+#define LIBFCL_DIFF_MAX_WINDOW_SIZE 16777216
+#define LIBFCL_DIFF_MAX_ANCHORS 65536
+#define LIBFCL_DIFF_HASH_BASE G_GUINT64_CONSTANT(0x100000001B3)
+
+
+/**
+ * @struct fcl_differ_t
+ * State of the comparison of two files
+ */
+typedef struct
+{
+    fcl_view_t *view_a;     /**< View on the first file                      */
+    fcl_view_t *view_b;     /**< View on the second file                     */
+    guchar *window_a;       /**< Next bytes of the first file                */
+    guchar *window_b;       /**< Next bytes of the second file               */
+    gsize capacity;         /**< Size of the windows                         */
+    guint64 *keys;          /**< Hash table : rolling hashes of the anchors  */
+    guint32 *values;        /**< Hash table : position + 1 (0 : empty slot)  */
+    guint table_size;       /**< Number of slots of the table (a power of 2) */
+    GArray *diffs;          /**< The differences found (fcl_diff_t)          */
+} fcl_differ_t;
+
+
+static gsize first_difference(const guchar *a, const guchar *b, gsize size);
+static void resynchronize(fcl_differ_t *differ, goffset *a_pointer, goffset *b_pointer);
+static gboolean find_anchor(fcl_differ_t *differ, gsize size_a, gsize size_b, gsize *i_pointer, gsize *j_pointer);
+static void add_diff(GArray *diffs, goffset a_position, gsize a_size, goffset b_position, gsize b_size);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Finds the differences between two edited files (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param b_file : another openned fcl_file_t file
+ * @return a newly allocated GArray of fcl_diff_t or NULL on error
+ */
+GArray *fcl_diff(fcl_file_t *a_file, fcl_file_t *b_file)
+{
+    fcl_differ_t differ;
+    const guchar *run_a = NULL;
+    const guchar *run_b = NULL;
+    const guint8 *digest_a = NULL;
+    const guint8 *digest_b = NULL;
+    goffset leaf_a = G_MAXINT64;
+    goffset leaf_b = G_MAXINT64;
+    goffset leaf_a_end = 0;
+    goffset leaf_b_end = 0;
+    goffset pa = 0;
+    goffset pb = 0;
+    gsize size_a = 0;
+    gsize size_b = 0;
+    gsize size = 0;
+    gsize equal = 0;
+
+    if (a_file == NULL || b_file == NULL)
+        {
+            return NULL;
+        }
+
+    differ.view_a = fcl_view_new(a_file);
+    differ.view_b = fcl_view_new(b_file);
+    differ.window_a = NULL;
+    differ.window_b = NULL;
+    differ.capacity = 0;
+    differ.keys = NULL;
+    differ.values = NULL;
+    differ.table_size = 0;
+    differ.diffs = g_array_new(FALSE, FALSE, sizeof(fcl_diff_t));
+
+    while (pa < differ.view_a->size && pb < differ.view_b->size)
+        {
+            /* Leaves of the SHA-256 trees where we are (if any) */
+            if (pa >= leaf_a_end)
+                {
+                    leaf_a = fcl_checksums_leaf_at(differ.view_a, pa, &leaf_a_end, &digest_a);
+
+                    if (leaf_a == G_MAXINT64)
+                        {
+                            leaf_a_end = G_MAXINT64;
+                        }
+                }
+
+            if (pb >= leaf_b_end)
+                {
+                    leaf_b = fcl_checksums_leaf_at(differ.view_b, pb, &leaf_b_end, &digest_b);
+
+                    if (leaf_b == G_MAXINT64)
+                        {
+                            leaf_b_end = G_MAXINT64;
+                        }
+                }
+
+            if (leaf_a == pa && leaf_b == pb && digest_a != NULL && digest_b != NULL
+                && leaf_a_end - pa == leaf_b_end - pb && memcmp(digest_a, digest_b, LIBFCL_CHECKSUM_SHA256_SIZE) == 0)
+                {
+                    /* Same digest : the leaves are equal */
+                    pa = leaf_a_end;
+                    pb = leaf_b_end;
+                }
+            else
+                {
+                    run_a = fcl_view_get_run(differ.view_a, pa, &size_a);
+                    run_b = fcl_view_get_run(differ.view_b, pb, &size_b);
+                    size = MIN(size_a, size_b);
+
+                    equal = first_difference(run_a, run_b, size);
+                    pa = pa + equal;
+                    pb = pb + equal;
+
+                    if (equal < size)
+                        {
+                            resynchronize(&differ, &pa, &pb);
+                        }
+                }
+        }
+
+    /* What remains in one of the files was inserted or deleted */
+    if (pa < differ.view_a->size || pb < differ.view_b->size)
+        {
+            add_diff(differ.diffs, pa, (gsize) (differ.view_a->size - pa), pb, (gsize) (differ.view_b->size - pb));
+        }
+
+    fcl_view_free(differ.view_a);
+    fcl_view_free(differ.view_b);
+    g_free(differ.window_a);
+    g_free(differ.window_b);
+    g_free(differ.keys);
+    g_free(differ.values);
+
+    return differ.diffs;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+#ifdef LIBFCL_HAVE_AVX2
+/**
+ * Says (once) whether the processor can run AVX2 instructions
+ */
+static gboolean cpu_has_avx2(void)
+{
+    static gint has_avx2 = -1;
+
+    if (has_avx2 < 0)
+        {
+            __builtin_cpu_init();
+            has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        }
+
+    return has_avx2 == 1;
+}
+
+
+/**
+ * Compares 32 bytes at a time
+ * @param[out] i_pointer : offset of the first difference or of the first
+ *                         byte that was not compared
+ * @return TRUE if a difference was found
+ */
+__attribute__((target("avx2")))
+static gboolean first_difference_avx2(const guchar *a, const guchar *b, gsize size, gsize *i_pointer)
+{
+    __m256i block_a;
+    __m256i block_b;
+    guint mask = 0;
+    gsize i = 0;
+
+    while (i + 32 <= size)
+        {
+            block_a = _mm256_loadu_si256((const __m256i *) (a + i));
+            block_b = _mm256_loadu_si256((const __m256i *) (b + i));
+            mask = (guint) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block_a, block_b));
+
+            if (mask != 0xFFFFFFFF)
+                {
+                    *i_pointer = i + (gsize) __builtin_ctz(~mask);
+                    return TRUE;
+                }
+
+            i = i + 32;
+        }
+
+    *i_pointer = i;
+
+    return FALSE;
+}
+#endif /* LIBFCL_HAVE_AVX2 */
+
+
+/**
+ * Finds the first byte that differs between two runs
+ * @param a : the first run
+ * @param b : the second run
+ * @param size : number of bytes to compare
+ * @return the offset of the first difference or size if the runs are equal
+ */
+static gsize first_difference(const guchar *a, const guchar *b, gsize size)
+{
+    gsize i = 0;
+#ifdef LIBFCL_HAVE_SSE2
+    __m128i block_a;
+    __m128i block_b;
+    guint mask = 0;
+
+#ifdef LIBFCL_HAVE_AVX2
+    if (cpu_has_avx2() && first_difference_avx2(a, b, size, &i) == TRUE)
+        {
+            return i;
+        }
+#endif
+
+    while (i + 16 <= size)
+        {
+            block_a = _mm_loadu_si128((const __m128i *) (a + i));
+            block_b = _mm_loadu_si128((const __m128i *) (b + i));
+            mask = (guint) _mm_movemask_epi8(_mm_cmpeq_epi8(block_a, block_b));
+
+            if (mask != 0xFFFF)
+                {
+                    return i + (gsize) __builtin_ctz(~mask);
+                }
+
+            i = i + 16;
+        }
+#endif
+
+    while (i < size && a[i] == b[i])
+        {
+            i++;
+        }
+
+    return i;
+}
+
+
+/**
+ * Synchronizes the two files again after a difference and records it. The
+ * windows grow until an anchor is found, the end of both files is reached
+ * or they are LIBFCL_DIFF_MAX_WINDOW_SIZE bytes long (then the two windows
+ * are said to differ).
+ * @param differ : the comparison
+ * @param[in,out] a_pointer : position of the difference in the first file,
+ *                            returns the position where the files are equal
+ *                            again
+ * @param[in,out] b_pointer : the same in the second file
+ */
+static void resynchronize(fcl_differ_t *differ, goffset *a_pointer, goffset *b_pointer)
+{
+    gsize window_size = LIBFCL_DIFF_MIN_WINDOW_SIZE;
+    gsize size_a = 0;
+    gsize size_b = 0;
+    gsize i = 0;
+    gsize j = 0;
+
+    while (TRUE)
+        {
+            if (window_size > differ->capacity)
+                {
+                    differ->capacity = window_size;
+                    differ->window_a = (guchar *) g_realloc(differ->window_a, differ->capacity * sizeof(guchar));
+                    differ->window_b = (guchar *) g_realloc(differ->window_b, differ->capacity * sizeof(guchar));
+                }
+
+            size_a = fcl_view_read(differ->view_a, *a_pointer, differ->window_a, window_size);
+            size_b = fcl_view_read(differ->view_b, *b_pointer, differ->window_b, window_size);
+
+            if (find_anchor(differ, size_a, size_b, &i, &j) == TRUE)
+                {
+                    break;
+                }
+
+            if (window_size >= LIBFCL_DIFF_MAX_WINDOW_SIZE || (size_a < window_size && size_b < window_size))
+                {
+                    /* No anchor : both windows differ but for the bytes
+                     * that are equal at their ends */
+                    i = size_a;
+                    j = size_b;
+
+                    while (i > 0 && j > 0 && differ->window_a[i - 1] == differ->window_b[j - 1])
+                        {
+                            i--;
+                            j--;
+                        }
+
+                    break;
+                }
+
+            window_size = window_size * 2;
+        }
+
+    add_diff(differ->diffs, *a_pointer, i, *b_pointer, j);
+
+    *a_pointer = *a_pointer + i;
+    *b_pointer = *b_pointer + j;
+}
+
+
+/**
+ * Finds where the two windows are equal again
+ * @param differ : the comparison (its windows are filled)
+ * @param size_a : number of bytes in the first window
+ * @param size_b : number of bytes in the second window
+ * @param[out] i_pointer : offset in the first window where both windows are
+ *                         equal again
+ * @param[out] j_pointer : offset in the second window
+ * @return TRUE if an anchor was found
+ */
+static gboolean find_anchor(fcl_differ_t *differ, gsize size_a, gsize size_b, gsize *i_pointer, gsize *j_pointer)
+{
+    const guchar *a = differ->window_a;
+    const guchar *b = differ->window_b;
+    gsize anchor = MIN(LIBFCL_DIFF_ANCHOR_SIZE, MIN(size_a, size_b));
+    gsize n_a = 0;
+    gsize n_b = 0;
+    gsize step = 0;
+    gsize best = G_MAXSIZE;
+    gsize best_i = 0;
+    gsize best_j = 0;
+    gsize i = 0;
+    gsize j = 0;
+    guint64 power = 1;
+    guint64 hash = 0;
+    guint table_size = 16;
+    guint mask = 0;
+    guint slot = 0;
+
+    if (anchor == 0)
+        {
+            return FALSE;
+        }
+
+    n_a = size_a - anchor + 1;
+    n_b = size_b - anchor + 1;
+    step = MAX(1, (n_b + LIBFCL_DIFF_MAX_ANCHORS - 1) / LIBFCL_DIFF_MAX_ANCHORS);
+
+    while (table_size < 2 * (n_b / step + 1))
+        {
+            table_size = table_size * 2;
+        }
+
+    if (table_size > differ->table_size)
+        {
+            differ->table_size = table_size;
+            differ->keys = (guint64 *) g_realloc(differ->keys, table_size * sizeof(guint64));
+            differ->values = (guint32 *) g_realloc(differ->values, table_size * sizeof(guint32));
+        }
+
+    memset(differ->values, 0, table_size * sizeof(guint32));
+    mask = table_size - 1;
+
+    for (i = 1; i < anchor; i++)
+        {
+            power = power * LIBFCL_DIFF_HASH_BASE;
+        }
+
+    /* The anchors of the second window (the first position of each hash) */
+    hash = 0;
+
+    for (j = 0; j < anchor; j++)
+        {
+            hash = hash * LIBFCL_DIFF_HASH_BASE + b[j];
+        }
+
+    for (j = 0; j < n_b; j++)
+        {
+            if (j % step == 0)
+                {
+                    slot = (guint) ((hash * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32) & mask;
+
+                    while (differ->values[slot] != 0 && differ->keys[slot] != hash)
+                        {
+                            slot = (slot + 1) & mask;
+                        }
+
+                    if (differ->values[slot] == 0)
+                        {
+                            differ->keys[slot] = hash;
+                            differ->values[slot] = (guint32) (j + 1);
+                        }
+                }
+
+            if (j + 1 < n_b)
+                {
+                    hash = (hash - b[j] * power) * LIBFCL_DIFF_HASH_BASE + b[j + anchor];
+                }
+        }
+
+    /* Looking for them in the first window, i + j being as small as
+     * possible */
+    hash = 0;
+
+    for (i = 0; i < anchor; i++)
+        {
+            hash = hash * LIBFCL_DIFF_HASH_BASE + a[i];
+        }
+
+    for (i = 0; i < n_a && i < best; i++)
+        {
+            slot = (guint) ((hash * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)) >> 32) & mask;
+
+            while (differ->values[slot] != 0 && differ->keys[slot] != hash)
+                {
+                    slot = (slot + 1) & mask;
+                }
+
+            if (differ->values[slot] != 0)
+                {
+                    j = differ->values[slot] - 1;
+
+                    if (i + j < best && memcmp(a + i, b + j, anchor) == 0)
+                        {
+                            best = i + j;
+                            best_i = i;
+                            best_j = j;
+                        }
+                }
+
+            if (i + 1 < n_a)
+                {
+                    hash = (hash - a[i] * power) * LIBFCL_DIFF_HASH_BASE + a[i + anchor];
+                }
+        }
+
+    if (best == G_MAXSIZE)
+        {
+            return FALSE;
+        }
+
+    /* Only one position out of step is an anchor : the equal bytes just
+     * before it are not part of the difference */
+    while (best_i > 0 && best_j > 0 && a[best_i - 1] == b[best_j - 1])
+        {
+            best_i--;
+            best_j--;
+        }
+
+    *i_pointer = best_i;
+    *j_pointer = best_j;
+
+    return TRUE;
+}
+
+
+/**
+ * Records a difference (merged with the previous one when they touch)
+ * @param diffs : the differences found so far
+ * @param a_position : position of the difference in the first file
+ * @param a_size : number of bytes in the first file
+ * @param b_position : position of the difference in the second file
+ * @param b_size : number of bytes in the second file
+ */
+static void add_diff(GArray *diffs, goffset a_position, gsize a_size, goffset b_position, gsize b_size)
+{
+    fcl_diff_t *last = NULL;
+    fcl_diff_t diff;
+
+    if (diffs->len > 0)
+        {
+            last = &g_array_index(diffs, fcl_diff_t, diffs->len - 1);
+
+            if (last->a_position + (goffset) last->a_size == a_position && last->b_position + (goffset) last->b_size == b_position)
+                {
+                    last->a_size = last->a_size + a_size;
+                    last->b_size = last->b_size + b_size;
+                    return;
+                }
+        }
+
+    diff.a_position = a_position;
+    diff.a_size = a_size;
+    diff.b_position = b_position;
+    diff.b_size = b_size;
+
+    g_array_append_val(diffs, diff);
+}
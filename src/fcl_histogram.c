@@ -0,0 +1,617 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_histogram.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_histogram.c
+ * Distribution of the bytes of the edited file : histograms and entropy.
+ *
+ * As for the checksums, the blocks of the file are grouped : into leaves of
+ * about LIBFCL_HISTOGRAM_LEAF_SIZE bytes whose histograms are kept, and into
+ * the blocks of the entropy map whose entropies are kept. The content of a
+ * group is the content of its blocks in the edited file so an edit only
+ * invalidates the group of the block edited and only the invalid groups are
+ * counted again. The groups to be counted are shared between a pool of
+ * threads, each one walking the file through its own view.
+ *
+ * The bytes are counted 8 at a time into four histograms of 32 bits that are
+ * added together at the end : two bytes in a row that are equal do not wait
+ * for each other's increment.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#include <math.h>
+
+/**
+ * @def LIBFCL_HISTOGRAM_LEAF_SIZE
+ * Number of bytes of the file on disk covered by a leaf
+ *
+ * @def LIBFCL_HISTOGRAM_LEAF_BLOCKS
+ * Number of blocks in a leaf
+ *
+ * @def LIBFCL_HISTOGRAM_FLUSH_SIZE
+ * Number of bytes counted in the histograms of 32 bits before they are added
+ * to the result (so that they never overflow)
+ */
+#define LIBFCL_HISTOGRAM_LEAF_SIZE 1048576
+#define LIBFCL_HISTOGRAM_LEAF_BLOCKS MAX(1, LIBFCL_HISTOGRAM_LEAF_SIZE / LIBFCL_BUF_SIZE)
+#define LIBFCL_HISTOGRAM_FLUSH_SIZE 1073741824
+
+
+/**
+ * @struct fcl_histograms_t
+ * What is kept about the distribution of the bytes of a file
+ */
+struct _fcl_histograms_t
+{
+    goffset n_blocks;      /**< Blocks covered by the leaves and the map    */
+    guint n_leaves;        /**< Number of leaves                            */
+    guint64 *counts;       /**< The 256 counts of each leaf                 */
+    gboolean *valid;       /**< FALSE when a leaf has to be counted again   */
+    goffset map_blocks;    /**< Blocks in a block of the map (0 : no map)   */
+    guint n_map;           /**< Number of blocks of the map                 */
+    gdouble *entropies;    /**< Entropy of each block of the map            */
+    gboolean *map_valid;   /**< FALSE when a block has to be counted again  */
+};
+
+
+/**
+ * @struct histogram_range_t
+ * Bytes of the edited file to be counted
+ */
+typedef struct
+{
+    goffset begin;       /**< Position of the first byte                     */
+    goffset end;         /**< Position after the last byte                   */
+    guint64 *counts;     /**< Where the 256 counts go (or NULL)              */
+    gdouble *entropy;    /**< Where the entropy of the bytes goes (or NULL)  */
+} histogram_range_t;
+
+
+/**
+ * @struct histogram_job_t
+ * Ranges to be counted by a thread
+ */
+typedef struct
+{
+    fcl_file_t *a_file;           /**< The file                    */
+    histogram_range_t *ranges;    /**< The ranges                  */
+    guint n;                      /**< Number of ranges            */
+} histogram_job_t;
+
+
+static fcl_histograms_t *get_histograms(fcl_file_t *a_file);
+static goffset group_position(fcl_histograms_t *histograms, fcl_view_t *view, goffset block);
+static guint first_group(fcl_histograms_t *histograms, fcl_view_t *view, goffset group_blocks, guint n_groups, goffset position);
+static void count_ranges(fcl_file_t *a_file, GArray *ranges);
+static void count_job(gpointer data, gpointer user_data);
+static void count_range(fcl_view_t *view, histogram_range_t *range);
+static void count_bytes(const guchar *data, gsize size, guint32 sub[4][256]);
+static gdouble entropy_of(const guint64 *counts);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Counts each byte value in a range of the edited file (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param position : position of the first byte of the range
+ * @param size : number of bytes of the range
+ * @param histogram : array of 256 counts where the result is written
+ * @return the number of bytes counted
+ */
+goffset fcl_byte_histogram(fcl_file_t *a_file, goffset position, goffset size, guint64 *histogram)
+{
+    fcl_histograms_t *histograms = NULL;
+    fcl_view_t *view = NULL;
+    GArray *ranges = NULL;
+    GArray *leaves = NULL;      /** leaves that are in the range */
+    histogram_range_t range;
+    guint64 *partials = NULL;   /** counts of the leaves partly in the range */
+    guint64 *counts = NULL;
+    goffset end = 0;
+    goffset total = 0;
+    guint leaf = 0;
+    guint i = 0;
+    guint j = 0;
+
+    if (a_file == NULL || histogram == NULL || position < 0 || size < 0)
+        {
+            return 0;
+        }
+
+    memset(histogram, 0, 256 * sizeof(guint64));
+
+    histograms = get_histograms(a_file);
+    view = fcl_view_new(a_file);
+    end = position + MIN(size, MAX(view->size - position, 0));
+
+    /* Only the first and the last leaves may be partly in the range */
+    partials = (guint64 *) g_malloc0(2 * 256 * sizeof(guint64));
+    ranges = g_array_new(FALSE, FALSE, sizeof(histogram_range_t));
+    leaves = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    leaf = first_group(histograms, view, LIBFCL_HISTOGRAM_LEAF_BLOCKS, histograms->n_leaves, position);
+
+    while (leaf < histograms->n_leaves)
+        {
+            range.begin = group_position(histograms, view, (goffset) leaf * LIBFCL_HISTOGRAM_LEAF_BLOCKS);
+            range.end = group_position(histograms, view, (goffset) (leaf + 1) * LIBFCL_HISTOGRAM_LEAF_BLOCKS);
+            range.entropy = NULL;
+
+            if (range.begin >= end)
+                {
+                    break;
+                }
+
+            if (range.begin >= position && range.end <= end)
+                {
+                    g_array_append_val(leaves, leaf);
+
+                    if (histograms->valid[leaf] == FALSE)
+                        {
+                            range.counts = &histograms->counts[256 * leaf];
+                            g_array_append_val(ranges, range);
+                            histograms->valid[leaf] = TRUE;
+                        }
+                }
+            else
+                {
+                    range.counts = &partials[range.begin < position ? 0 : 256];
+                    range.begin = MAX(range.begin, position);
+                    range.end = MIN(range.end, end);
+                    g_array_append_val(ranges, range);
+                }
+
+            leaf = leaf + 1;
+        }
+
+    fcl_view_free(view);
+
+    count_ranges(a_file, ranges);
+
+    /* The leaves in the range (counted now or before) */
+    for (i = 0; i < leaves->len; i++)
+        {
+            counts = &histograms->counts[256 * g_array_index(leaves, guint, i)];
+
+            for (j = 0; j < 256; j++)
+                {
+                    histogram[j] = histogram[j] + counts[j];
+                }
+        }
+
+    for (j = 0; j < 256; j++)
+        {
+            histogram[j] = histogram[j] + partials[j] + partials[256 + j];
+            total = total + (goffset) histogram[j];
+        }
+
+    g_array_free(leaves, TRUE);
+    g_array_free(ranges, TRUE);
+    g_free(partials);
+
+    return total;
+}
+
+
+/**
+ * Computes the entropy of each block of the edited file (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param block_size : size of the blocks of the map
+ * @return a newly allocated GArray of fcl_entropy_t or NULL on error
+ */
+GArray *fcl_entropy_map(fcl_file_t *a_file, gsize block_size)
+{
+    fcl_histograms_t *histograms = NULL;
+    fcl_view_t *view = NULL;
+    GArray *ranges = NULL;
+    GArray *map = NULL;
+    GArray *numbers = NULL;     /** number of each block of the map */
+    histogram_range_t range;
+    fcl_entropy_t entropy;
+    goffset map_blocks = 0;
+    guint i = 0;
+
+    if (a_file == NULL || block_size == 0)
+        {
+            return NULL;
+        }
+
+    histograms = get_histograms(a_file);
+    map_blocks = (goffset) MAX(1, (block_size + LIBFCL_BUF_SIZE - 1) / LIBFCL_BUF_SIZE);
+
+    if (histograms->map_blocks != map_blocks)
+        {
+            g_free(histograms->entropies);
+            g_free(histograms->map_valid);
+
+            histograms->map_blocks = map_blocks;
+            histograms->n_map = (guint) ((histograms->n_blocks + map_blocks - 1) / map_blocks);
+            histograms->entropies = (gdouble *) g_malloc0(histograms->n_map * sizeof(gdouble));
+            histograms->map_valid = (gboolean *) g_malloc0(histograms->n_map * sizeof(gboolean));
+        }
+
+    view = fcl_view_new(a_file);
+    ranges = g_array_new(FALSE, FALSE, sizeof(histogram_range_t));
+    map = g_array_new(FALSE, FALSE, sizeof(fcl_entropy_t));
+    numbers = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    for (i = 0; i < histograms->n_map; i++)
+        {
+            range.begin = group_position(histograms, view, (goffset) i * map_blocks);
+            range.end = group_position(histograms, view, (goffset) (i + 1) * map_blocks);
+
+            if (range.begin < range.end)
+                {
+                    if (histograms->map_valid[i] == FALSE)
+                        {
+                            range.counts = NULL;
+                            range.entropy = &histograms->entropies[i];
+                            g_array_append_val(ranges, range);
+                            histograms->map_valid[i] = TRUE;
+                        }
+
+                    entropy.position = range.begin;
+                    entropy.size = (gsize) (range.end - range.begin);
+                    entropy.entropy = 0.0;
+                    g_array_append_val(map, entropy);
+                    g_array_append_val(numbers, i);
+                }
+        }
+
+    fcl_view_free(view);
+
+    count_ranges(a_file, ranges);
+
+    for (i = 0; i < map->len; i++)
+        {
+            g_array_index(map, fcl_entropy_t, i).entropy = histograms->entropies[g_array_index(numbers, guint, i)];
+        }
+
+    g_array_free(numbers, TRUE);
+    g_array_free(ranges, TRUE);
+
+    return map;
+}
+
+
+/**
+ * Tells the histograms of a file that a block was edited (see
+ * fcl_internal.h)
+ * @param a_file : the file
+ * @param block : the number of the block (offset of the fcl_buf_t)
+ */
+void fcl_histograms_invalidate(fcl_file_t *a_file, goffset block)
+{
+    fcl_histograms_t *histograms = a_file->histograms;
+
+    if (histograms == NULL)
+        {
+            return;
+        }
+
+    if (block < 0 || block >= histograms->n_blocks)
+        {
+            /* A block after the end of the file : the groups are too few */
+            fcl_histograms_free(histograms);
+            a_file->histograms = NULL;
+            return;
+        }
+
+    histograms->valid[block / LIBFCL_HISTOGRAM_LEAF_BLOCKS] = FALSE;
+
+    if (histograms->map_blocks > 0)
+        {
+            histograms->map_valid[block / histograms->map_blocks] = FALSE;
+        }
+}
+
+
+/**
+ * Frees the histograms of a file (see fcl_internal.h)
+ * @param histograms : the histograms to be freed
+ */
+void fcl_histograms_free(fcl_histograms_t *histograms)
+{
+    if (histograms != NULL)
+        {
+            g_free(histograms->counts);
+            g_free(histograms->valid);
+            g_free(histograms->entropies);
+            g_free(histograms->map_valid);
+            g_free(histograms);
+        }
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Gets the histograms of a file, creating them (nothing counted) the first
+ * time. The groups cover every block of the file on disk and the blocks
+ * appended after it.
+ * @param a_file : the file
+ * @return the fcl_histograms_t of the file
+ */
+static fcl_histograms_t *get_histograms(fcl_file_t *a_file)
+{
+    fcl_histograms_t *histograms = NULL;
+    fcl_buf_t *last = NULL;
+    goffset n_blocks = 0;
+
+    if (a_file->histograms == NULL)
+        {
+            n_blocks = (MAX(a_file->real_size, 0) + LIBFCL_BUF_SIZE - 1) / LIBFCL_BUF_SIZE;
+
+            if (a_file->sequence != NULL && g_sequence_get_length(a_file->sequence) > 0)
+                {
+                    last = g_sequence_get(g_sequence_iter_prev(g_sequence_get_end_iter(a_file->sequence)));
+                    n_blocks = MAX(n_blocks, last->offset + 1);
+                }
+
+            histograms = (fcl_histograms_t *) g_malloc0(sizeof(fcl_histograms_t));
+
+            histograms->n_leaves = (guint) MAX(1, (n_blocks + LIBFCL_HISTOGRAM_LEAF_BLOCKS - 1) / LIBFCL_HISTOGRAM_LEAF_BLOCKS);
+            histograms->n_blocks = (goffset) histograms->n_leaves * LIBFCL_HISTOGRAM_LEAF_BLOCKS;
+            histograms->counts = (guint64 *) g_malloc0(256 * histograms->n_leaves * sizeof(guint64));
+            histograms->valid = (gboolean *) g_malloc0(histograms->n_leaves * sizeof(gboolean));
+
+            a_file->histograms = histograms;
+        }
+
+    return a_file->histograms;
+}
+
+
+/**
+ * Gets the position in the edited file of the begining of a group of blocks
+ * @param histograms : the histograms of the file
+ * @param view : a view on the file
+ * @param block : the first block of the group
+ * @return the position (the end of the file for the groups after the last
+ *         block)
+ */
+static goffset group_position(fcl_histograms_t *histograms, fcl_view_t *view, goffset block)
+{
+    if (block >= histograms->n_blocks)
+        {
+            return view->size;
+        }
+
+    return MIN(fcl_view_block_position(view, block), view->size);
+}
+
+
+/**
+ * Finds the first group of blocks that ends after a position
+ * @param histograms : the histograms of the file
+ * @param view : a view on the file
+ * @param group_blocks : number of blocks in a group
+ * @param n_groups : number of groups
+ * @param position : position in the edited file
+ * @return the number of the group (n_groups if there is none)
+ */
+static guint first_group(fcl_histograms_t *histograms, fcl_view_t *view, goffset group_blocks, guint n_groups, goffset position)
+{
+    guint low = 0;
+    guint high = n_groups;
+    guint middle = 0;
+
+    while (low < high)
+        {
+            middle = low + (high - low) / 2;
+
+            if (group_position(histograms, view, (goffset) (middle + 1) * group_blocks) <= position)
+                {
+                    low = middle + 1;
+                }
+            else
+                {
+                    high = middle;
+                }
+        }
+
+    return low;
+}
+
+
+/**
+ * Counts ranges of the edited file with a pool of threads
+ * @param a_file : the file
+ * @param ranges : a GArray of histogram_range_t
+ */
+static void count_ranges(fcl_file_t *a_file, GArray *ranges)
+{
+    histogram_job_t *jobs = NULL;
+    gpointer *job_pointers = NULL;
+    guint n_jobs = 0;
+    guint per_job = 0;
+    guint i = 0;
+
+    if (ranges->len == 0)
+        {
+            return;
+        }
+
+    n_jobs = MIN(ranges->len, g_get_num_processors() * 4);
+    per_job = (ranges->len + n_jobs - 1) / n_jobs;
+    n_jobs = (ranges->len + per_job - 1) / per_job;
+
+    jobs = (histogram_job_t *) g_malloc0(n_jobs * sizeof(histogram_job_t));
+    job_pointers = (gpointer *) g_malloc0(n_jobs * sizeof(gpointer));
+
+    for (i = 0; i < n_jobs; i++)
+        {
+            jobs[i].a_file = a_file;
+            jobs[i].ranges = &g_array_index(ranges, histogram_range_t, i * per_job);
+            jobs[i].n = MIN(per_job, ranges->len - i * per_job);
+            job_pointers[i] = &jobs[i];
+        }
+
+    fcl_run_jobs(count_job, job_pointers, n_jobs, 0);
+
+    g_free(job_pointers);
+    g_free(jobs);
+}
+
+
+/**
+ * Counts the ranges of a job (run by a thread of the pool)
+ * @param data : the histogram_job_t to do
+ * @param user_data : unused
+ */
+static void count_job(gpointer data, gpointer user_data)
+{
+    histogram_job_t *job = (histogram_job_t *) data;
+    fcl_view_t *view = NULL;
+    guint i = 0;
+
+    view = fcl_view_new(job->a_file);
+
+    for (i = 0; i < job->n; i++)
+        {
+            count_range(view, &job->ranges[i]);
+        }
+
+    fcl_view_free(view);
+}
+
+
+/**
+ * Counts the bytes of a range into its counts and its entropy
+ * @param view : a view on the edited file
+ * @param range : the range
+ */
+static void count_range(fcl_view_t *view, histogram_range_t *range)
+{
+    guint32 sub[4][256];
+    guint64 counts[256];
+    const guchar *run = NULL;
+    goffset position = range->begin;
+    gsize size = 0;
+    gsize pending = 0;   /** bytes counted in sub since the last flush */
+    guint j = 0;
+
+    memset(sub, 0, sizeof(sub));
+    memset(counts, 0, sizeof(counts));
+
+    while (position < range->end && (run = fcl_view_get_run(view, position, &size)) != NULL)
+        {
+            size = (gsize) MIN((goffset) size, range->end - position);
+
+            count_bytes(run, size, sub);
+
+            pending = pending + size;
+            position = position + size;
+
+            if (pending >= LIBFCL_HISTOGRAM_FLUSH_SIZE || position >= range->end)
+                {
+                    for (j = 0; j < 256; j++)
+                        {
+                            counts[j] = counts[j] + sub[0][j] + sub[1][j] + sub[2][j] + sub[3][j];
+                        }
+
+                    memset(sub, 0, sizeof(sub));
+                    pending = 0;
+                }
+        }
+
+    if (range->counts != NULL)
+        {
+            memcpy(range->counts, counts, sizeof(counts));
+        }
+
+    if (range->entropy != NULL)
+        {
+            *range->entropy = entropy_of(counts);
+        }
+}
+
+
+/**
+ * Counts bytes 8 at a time into four histograms
+ * @param data : the bytes
+ * @param size : number of bytes
+ * @param sub : the four histograms
+ */
+static void count_bytes(const guchar *data, gsize size, guint32 sub[4][256])
+{
+    guint64 word = 0;
+    gsize i = 0;
+
+    while (i + 8 <= size)
+        {
+            memcpy(&word, data + i, sizeof(guint64));
+
+            sub[0][word & 0xFF]++;
+            sub[1][(word >> 8) & 0xFF]++;
+            sub[2][(word >> 16) & 0xFF]++;
+            sub[3][(word >> 24) & 0xFF]++;
+            sub[0][(word >> 32) & 0xFF]++;
+            sub[1][(word >> 40) & 0xFF]++;
+            sub[2][(word >> 48) & 0xFF]++;
+            sub[3][word >> 56]++;
+
+            i = i + 8;
+        }
+
+    while (i < size)
+        {
+            sub[i & 3][data[i]]++;
+            i++;
+        }
+}
+
+
+/**
+ * Computes the Shannon entropy of bytes from their histogram
+ * @param counts : the 256 counts
+ * @return the entropy in bits per byte (0 to 8, 0 when there is no byte)
+ */
+static gdouble entropy_of(const guint64 *counts)
+{
+    guint64 total = 0;
+    gdouble entropy = 0.0;
+    gdouble p = 0.0;
+    guint j = 0;
+
+    for (j = 0; j < 256; j++)
+        {
+            total = total + counts[j];
+        }
+
+    for (j = 0; j < 256 && total > 0; j++)
+        {
+            if (counts[j] > 0)
+                {
+                    p = (gdouble) counts[j] / (gdouble) total;
+                    entropy = entropy - p * log2(p);
+                }
+        }
+
+    return entropy;
+}
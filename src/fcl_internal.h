@@ -0,0 +1,636 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_internal.h
+ *  File Cache Library internal header file
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_internal.h
+ * Header shared by the source files of the library. It is not installed and
+ * nothing in here is part of the public API.
+ */
+
+#ifndef _LIBFCL_INTERNAL_H_
+#define _LIBFCL_INTERNAL_H_
+
+#include "fcl.h"
+
+/**
+ * @def LIBFCL_VIEW_WINDOW_SIZE
+ * Number of bytes read at once from the file on disk when walking the
+ * untouched parts of a file through a view.
+ */
+#define LIBFCL_VIEW_WINDOW_SIZE 1048576
+
+
+/**
+ * @def LIBFCL_BUF_IN_MEMORY
+ * TRUE when all the bytes of a buffer are in its data : it is neither spilled,
+ * compressed nor made of pieces. Otherwise its bytes are read with
+ * fcl_spill_read().
+ */
+#define LIBFCL_BUF_IN_MEMORY(a_buffer) ((a_buffer)->spilled == FALSE && (a_buffer)->packed == 0 && (a_buffer)->pieces == NULL)
+
+
+/**
+ * @def LIBFCL_CHECKSUM_SHA256_SIZE
+ * Size of a SHA-256 digest (see fcl_checksums_leaf_at())
+ */
+#define LIBFCL_CHECKSUM_SHA256_SIZE 32
+
+
+/**
+ * @def LIBFCL_TRACE_LOOKUP_HIT
+ * A buffer of the sequence was found (position, block, real_offset)
+ *
+ * @def LIBFCL_TRACE_LOOKUP_MISS
+ * A buffer was read from the disk (position, block, bytes read)
+ *
+ * @def LIBFCL_TRACE_READ
+ * Bytes read from a buffer (position, size, bytes read so far)
+ *
+ * @def LIBFCL_TRACE_OVERWRITE
+ * Bytes overwritten in a buffer (position, size, position in the buffer)
+ *
+ * @def LIBFCL_TRACE_INSERT
+ * Bytes inserted in a buffer (position, size, position in the buffer)
+ *
+ * @def LIBFCL_TRACE_DELETE
+ * Bytes deleted from a buffer (position, size, position in the buffer)
+ *
+ * @def LIBFCL_TRACE_BUFFER_INSERTED
+ * A buffer was put in the sequence (block, real_offset, size)
+ *
+ * @def LIBFCL_TRACE_BUFFER_DESTROYED
+ * A buffer was freed (block, real_offset, size)
+ *
+ * @def LIBFCL_TRACE_FILE_CLOSED
+ * A file was closed (buffers in the sequence, real_size, mode)
+ *
+ * @def LIBFCL_TRACE_BUFFER_SPILLED
+ * The data of a buffer was written to the scratch file (block, offset in the
+ * scratch file, size)
+ *
+ * @def LIBFCL_TRACE_BUFFER_LOADED
+ * The data of a buffer was read back from the scratch file (block, offset in
+ * the scratch file, size)
+ *
+ * @def LIBFCL_TRACE_N_EVENTS
+ * Number of kinds of events
+ */
+#define LIBFCL_TRACE_LOOKUP_HIT 0
+#define LIBFCL_TRACE_LOOKUP_MISS 1
+#define LIBFCL_TRACE_READ 2
+#define LIBFCL_TRACE_OVERWRITE 3
+#define LIBFCL_TRACE_INSERT 4
+#define LIBFCL_TRACE_DELETE 5
+#define LIBFCL_TRACE_BUFFER_INSERTED 6
+#define LIBFCL_TRACE_BUFFER_DESTROYED 7
+#define LIBFCL_TRACE_FILE_CLOSED 8
+#define LIBFCL_TRACE_BUFFER_SPILLED 9
+#define LIBFCL_TRACE_BUFFER_LOADED 10
+#define LIBFCL_TRACE_N_EVENTS 11
+
+
+/**
+ * @def LIBFCL_TRACE
+ * Records an event (see fcl_trace.c). It is compiled out (the arguments are
+ * not even evaluated) unless the library is configured with --enable-debug.
+ */
+#if ENABLE_DEBUG
+#define LIBFCL_TRACE(event, object, a, b, c) fcl_trace_record((event), (gconstpointer) (object), (gint64) (a), (gint64) (b), (gint64) (c))
+#else
+#define LIBFCL_TRACE(event, object, a, b, c)
+#endif
+
+
+/**
+ * @struct fcl_view_t
+ * A read only snapshot of the edited file (the logical view). It knows where
+ * each buffer of the sequence lies in the edited file so that any position
+ * can be reached with a binary search. Bytes are handed out as runs : either
+ * directly from the data of a buffer of the sequence or, for the untouched
+ * parts of the file and the buffers that were spilled, from a window read
+ * from the disk.
+ * The untouched parts are read through the backend of the file (read_at()
+ * may be called from many threads) or straight from its map when it has
+ * one, so that many views of the same file may be used at once from
+ * different threads. The file must not be edited while a view on it exists.
+ */
+typedef struct
+{
+    fcl_file_t *a_file;            /**< The file viewed                            */
+    const guchar *map;             /**< The file on disk in memory (or NULL)       */
+    gsize map_size;                /**< Number of bytes in map                     */
+    goffset real_size;             /**< Size of the file on disk                   */
+    goffset size;                  /**< Size of the edited file                    */
+    guint n_bufs;                  /**< Number of buffers in the sequence          */
+    fcl_buf_t **bufs;              /**< Buffers of the sequence (in order)         */
+    goffset *starts;               /**< Position of each buffer in the edited file */
+    goffset *gaps;                 /**< Size difference up to (and with) buffer i  */
+    guchar *window;                /**< Window of bytes read from the disk         */
+    goffset window_position;       /**< Position of the window in the edited file  */
+    gsize window_size;             /**< Number of valid bytes in the window        */
+    fcl_perf_t perf;               /**< Counters (added to the file's at the end)  */
+} fcl_view_t;
+
+
+/**
+ * Creates a view on the edited file. It must be freed with fcl_view_free()
+ * (in the same thread) : until then it holds the buffers_lock of the file
+ * (reader) so that no other file of its session spills its buffers.
+ * @param a_file : an openned fcl_file_t file
+ * @return a newly allocated fcl_view_t or NULL if a_file is NULL
+ */
+G_GNUC_INTERNAL fcl_view_t *fcl_view_new(fcl_file_t *a_file);
+
+
+/**
+ * Frees a view
+ * @param view : the view to be freed
+ */
+G_GNUC_INTERNAL void fcl_view_free(fcl_view_t *view);
+
+
+/**
+ * Gets the run of bytes that begins at position in the edited file.
+ * @param view : the view
+ * @param position : position in the edited file
+ * @param[out] size_pointer : number of bytes available in the returned run
+ * @return a pointer to the bytes (owned by the view or the file, do not free
+ *         it) or NULL if position is at or beyond the end of the edited file.
+ *         The pointer remains valid until the next call on the view.
+ */
+G_GNUC_INTERNAL const guchar *fcl_view_get_run(fcl_view_t *view, goffset position, gsize *size_pointer);
+
+
+/**
+ * Gets the run of bytes that ends just before position in the edited file
+ * (used when walking the file backward).
+ * @param view : the view
+ * @param position : position in the edited file (the run ends at
+ *                   position - 1)
+ * @param[out] size_pointer : number of bytes available in the returned run
+ * @return a pointer to the first byte of the run or NULL if position is 0 or
+ *         beyond the end of the edited file.
+ */
+G_GNUC_INTERNAL const guchar *fcl_view_get_run_before(fcl_view_t *view, goffset position, gsize *size_pointer);
+
+
+/**
+ * Copies size bytes at position from the edited file into data.
+ * @param view : the view
+ * @param position : position in the edited file
+ * @param data : buffer (of at least size bytes) where to copy the bytes
+ * @param size : number of bytes wanted
+ * @return the number of bytes copied (less than size at the end of the file)
+ */
+G_GNUC_INTERNAL gsize fcl_view_read(fcl_view_t *view, goffset position, guchar *data, gsize size);
+
+/**
+ * Copies bytes of the file on disk (as it was before any edition) into data.
+ * @param view : the view
+ * @param offset : offset in the file on disk
+ * @param data : buffer (of at least size bytes) where to copy the bytes
+ * @param size : number of bytes wanted
+ * @return the number of bytes copied (less than size at the end of the file
+ *         or on error)
+ */
+G_GNUC_INTERNAL gsize fcl_view_read_original(fcl_view_t *view, goffset offset, guchar *data, gsize size);
+
+
+/**
+ * Finds every match of a pattern in a view, in one pass. The matches do not
+ * overlap : the search goes on after the end of each match.
+ * @param view : a view on the edited file
+ * @param pattern : the bytes to look for
+ * @param len : the number of bytes in pattern
+ * @param from : position where the search begins
+ * @return a newly allocated GArray of the positions (goffset) of the matches
+ */
+G_GNUC_INTERNAL GArray *fcl_view_find_all(fcl_view_t *view, const guchar *pattern, gsize len, goffset from);
+
+
+/**
+ * Gets the position in the edited file of the begining of a block
+ * @param view : the view
+ * @param block : the number of the block (as the offset of a fcl_buf_t)
+ * @return the position of the first byte of the block in the edited file (or
+ *         where it would be if the block is empty)
+ */
+G_GNUC_INTERNAL goffset fcl_view_block_position(fcl_view_t *view, goffset block);
+
+
+/**
+ * Tells the hash trees of a file that a block was edited
+ * @param a_file : the file
+ * @param block : the number of the block (offset of the fcl_buf_t edited)
+ */
+G_GNUC_INTERNAL void fcl_checksums_invalidate(fcl_file_t *a_file, goffset block);
+
+
+/**
+ * Finds the leaf of the SHA-256 tree of a file that holds a position. Two
+ * leaves with the same digest have the same bytes.
+ * @param view : a view on the file
+ * @param position : position in the edited file
+ * @param[out] end_pointer : position of the end of the leaf
+ * @param[out] digest_pointer : the digest of the leaf or NULL if it is not
+ *                              known (the leaf was edited since the last
+ *                              fcl_checksum())
+ * @return the position of the begining of the leaf or G_MAXINT64 if there is
+ *         no such leaf (or no SHA-256 tree)
+ */
+G_GNUC_INTERNAL goffset fcl_checksums_leaf_at(fcl_view_t *view, goffset position, goffset *end_pointer, const guint8 **digest_pointer);
+
+
+/**
+ * Updates a CRC32C with some bytes
+ * @param crc : the CRC32C of the bytes before (0 at the begining)
+ * @param data : the bytes
+ * @param size : number of bytes
+ * @return the CRC32C of the bytes before and these ones
+ */
+G_GNUC_INTERNAL guint32 fcl_crc32c_update(guint32 crc, const guchar *data, gsize size);
+
+
+/**
+ * Frees the hash trees of a file
+ * @param checksums : the trees (may be NULL)
+ */
+G_GNUC_INTERNAL void fcl_checksums_free(fcl_checksums_t *checksums);
+
+
+/**
+ * Tells the histograms of a file that a block was edited
+ * @param a_file : the file
+ * @param block : the number of the block (offset of the fcl_buf_t edited)
+ */
+G_GNUC_INTERNAL void fcl_histograms_invalidate(fcl_file_t *a_file, goffset block);
+
+
+/**
+ * Frees the histograms of a file
+ * @param histograms : the histograms (may be NULL)
+ */
+G_GNUC_INTERNAL void fcl_histograms_free(fcl_histograms_t *histograms);
+
+
+/**
+ * Puts a file whose backend was just openned (or openned again) in the open
+ * files. If there are too many, the backends of the files used the longest
+ * time ago (and not in use) are released.
+ * @param a_file : the file (its backend_lock is held for reading)
+ */
+G_GNUC_INTERNAL void fcl_pool_use(fcl_file_t *a_file);
+
+
+/**
+ * Stamps a file whose backend is read as used now. It takes no lock : the
+ * stamp is only looked at when a backend is openned.
+ * @param a_file : the file
+ */
+G_GNUC_INTERNAL void fcl_pool_touch(fcl_file_t *a_file);
+
+
+/**
+ * Takes a file that is being closed out of the open files
+ * @param a_file : the file
+ */
+G_GNUC_INTERNAL void fcl_pool_leave(fcl_file_t *a_file);
+
+
+/**
+ * Creates the backend of a file openned by path : one of the default kind
+ * (see fcl_set_default_backend()) or a GIO one for a URI
+ * @param path : path or URI of the file
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ...)
+ * @return a new backend
+ */
+G_GNUC_INTERNAL fcl_backend_t *fcl_backend_for_path(const gchar *path, gint mode);
+
+
+/**
+ * Gets the GFile of a path or of a URI
+ * @param path : path or URI of the file
+ * @return a new GFile
+ */
+G_GNUC_INTERNAL GFile *fcl_backend_gfile(const gchar *path);
+
+
+/**
+ * Gets the device and the inode of the file of a backend of the library
+ * (neither a memory backend nor a backend of one's own have any)
+ * @param backend : the backend
+ * @param[out] device : device of the file
+ * @param[out] inode : inode of the file
+ * @return TRUE if the backend is a file that exists
+ */
+G_GNUC_INTERNAL gboolean fcl_backend_identity(fcl_backend_t *backend, guint64 *device, guint64 *inode);
+
+
+/**
+ * Counts the data of a buffer of the sequence that was just modified in the
+ * memory budget. If the budget is then exceeded, the data of the buffers of
+ * the file modified the longest time ago is written to its scratch file (in
+ * a session, the buffers of any file of the session that is not in use).
+ * @param a_file : the file (its buffers_lock is held, reader)
+ * @param a_buffer : a buffer of its sequence that was just modified
+ */
+G_GNUC_INTERNAL void fcl_spill_touch(fcl_file_t *a_file, fcl_buf_t *a_buffer);
+
+
+/**
+ * Loads the data of a buffer back from the scratch file (if it was spilled)
+ * and uncompresses it (if it was compressed). To be called before the data of
+ * a buffer of the sequence is modified.
+ * @param a_file : the file
+ * @param a_buffer : a buffer about to be modified
+ */
+G_GNUC_INTERNAL void fcl_spill_load(fcl_file_t *a_file, fcl_buf_t *a_buffer);
+
+
+/**
+ * Copies bytes of a buffer from its data or from the scratch file if it was
+ * spilled, uncompressing them if needed. It may be called from many threads
+ * at once.
+ * @param a_file : the file
+ * @param a_buffer : the buffer
+ * @param offset : offset of the first byte in the buffer
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to copy
+ * @param perf : the counters where to count the reads of the scratch file
+ * @return the number of bytes copied
+ */
+G_GNUC_INTERNAL gsize fcl_spill_read(fcl_file_t *a_file, fcl_buf_t *a_buffer, gsize offset, guchar *data, gsize size, fcl_perf_t *perf);
+
+
+/**
+ * Frees the data of a buffer of the sequence, in memory or in the scratch
+ * file, before it is replaced by new data
+ * @param a_file : the file
+ * @param a_buffer : the buffer (its data is NULL afterwards)
+ */
+G_GNUC_INTERNAL void fcl_spill_release(fcl_file_t *a_file, fcl_buf_t *a_buffer);
+
+
+/**
+ * Gets the number of bytes of the buffers of a file in memory, in the
+ * scratch file and compressed
+ * @param a_file : the file
+ * @param stats : the statistics where to put them (resident_size,
+ *                spilled_size, compressed_size and packed_size)
+ */
+G_GNUC_INTERNAL void fcl_spill_sizes(fcl_file_t *a_file, fcl_stat_buf_t *stats);
+
+
+/**
+ * Adds a file that was just opened to a session : its buffers are counted in
+ * the budget of the session
+ * @param a_file : the file
+ * @param session : the session
+ */
+G_GNUC_INTERNAL void fcl_spill_join(fcl_file_t *a_file, fcl_session_t *session);
+
+
+/**
+ * Closes the scratch file of a file, takes its buffers out of the memory
+ * budget and the file out of its session. To be called before the buffers
+ * of the sequence are freed.
+ * @param a_file : the file being closed
+ */
+G_GNUC_INTERNAL void fcl_spill_free(fcl_file_t *a_file);
+
+
+/**
+ * Opens a file whose ranges are to be inserted in buffers
+ * @param path : path of the file (or NULL to use fd)
+ * @param fd : an openned file descriptor, used when path is NULL (it is
+ *             duplicated : the caller may close it)
+ * @return a new fcl_source_t (with one reference) or NULL if the file can
+ *         not be openned
+ */
+G_GNUC_INTERNAL fcl_source_t *fcl_source_open(const gchar *path, gint fd);
+
+
+/**
+ * Gets the size of a source file
+ * @param source : the source file
+ * @return its size (when it was openned)
+ */
+G_GNUC_INTERNAL goffset fcl_source_size(fcl_source_t *source);
+
+
+/**
+ * Adds a reference to a source file
+ * @param source : the source file
+ * @return source
+ */
+G_GNUC_INTERNAL fcl_source_t *fcl_source_ref(fcl_source_t *source);
+
+
+/**
+ * Removes a reference to a source file, closing it with the last one
+ * @param source : the source file (may be NULL)
+ */
+G_GNUC_INTERNAL void fcl_source_unref(fcl_source_t *source);
+
+
+/**
+ * Inserts bytes in a buffer as a piece. A buffer whose bytes are in its data
+ * is first made a buffer of one piece. Its size is updated.
+ * @param a_buffer : a buffer that is not spilled
+ * @param position : position of the insertion in the buffer
+ * @param source : the source file of the bytes (a reference is taken) or
+ *                 NULL if they are in data
+ * @param offset : offset of the bytes in source
+ * @param data : the bytes (when source is NULL, they are copied)
+ * @param size : number of bytes
+ */
+G_GNUC_INTERNAL void fcl_pieces_insert(fcl_buf_t *a_buffer, gsize position, fcl_source_t *source, goffset offset, const guchar *data, gsize size);
+
+
+/**
+ * Deletes bytes of a buffer made of pieces. Its size is updated and it goes
+ * back to plain bytes in memory when none of its pieces is in a source file.
+ * @param a_buffer : a buffer made of pieces
+ * @param position : position of the first byte to delete in the buffer
+ * @param size : number of bytes to delete (they are in the buffer)
+ */
+G_GNUC_INTERNAL void fcl_pieces_delete(fcl_buf_t *a_buffer, gsize position, gsize size);
+
+
+/**
+ * Appends bytes of a buffer made of pieces to another buffer : the ranges of
+ * the source files are referenced and the bytes in memory are copied
+ * @param range : the buffer where to append the bytes (not spilled)
+ * @param a_buffer : a buffer made of pieces
+ * @param offset : offset of the first byte in a_buffer
+ * @param size : number of bytes (they are in a_buffer)
+ */
+G_GNUC_INTERNAL void fcl_pieces_copy(fcl_buf_t *range, fcl_buf_t *a_buffer, gsize offset, gsize size);
+
+
+/**
+ * Inserts all the bytes of a buffer (range) in another one, as pieces
+ * @param a_buffer : a buffer that is not spilled
+ * @param position : position of the insertion in a_buffer
+ * @param range : the buffer whose bytes are inserted (it is left as it is)
+ */
+G_GNUC_INTERNAL void fcl_pieces_splice(fcl_buf_t *a_buffer, gsize position, fcl_buf_t *range);
+
+
+/**
+ * Copies bytes of a buffer made of pieces. It may be called from many
+ * threads at once.
+ * @param a_buffer : a buffer made of pieces
+ * @param offset : offset of the first byte in the buffer
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to copy
+ * @param perf : the counters where to count the reads of the source files
+ * @return the number of bytes copied (less than size if a source file can
+ *         not be read)
+ */
+G_GNUC_INTERNAL gsize fcl_pieces_read(fcl_buf_t *a_buffer, gsize offset, guchar *data, gsize size, fcl_perf_t *perf);
+
+
+/**
+ * Gets the number of bytes of a buffer made of pieces that are in memory
+ * @param a_buffer : a buffer made of pieces
+ * @return the number of bytes of its pieces in memory
+ */
+G_GNUC_INTERNAL gsize fcl_pieces_memory(fcl_buf_t *a_buffer);
+
+
+/**
+ * Says wether a piece of a buffer is in a given file (a source file that is
+ * the file whose device and inode are given)
+ * @param a_buffer : a buffer made of pieces
+ * @param device : device of the file
+ * @param inode : inode of the file
+ * @return TRUE if a piece of a_buffer is read from that file
+ */
+G_GNUC_INTERNAL gboolean fcl_pieces_in_file(fcl_buf_t *a_buffer, guint64 device, guint64 inode);
+
+
+/**
+ * Frees the pieces of a buffer (if any)
+ * @param a_buffer : the buffer
+ */
+G_GNUC_INTERNAL void fcl_pieces_free(fcl_buf_t *a_buffer);
+
+
+/**
+ * Adds the time elapsed since start to the latency histogram of an operation
+ * @param perf : the counters of a file
+ * @param op : the operation (LIBFCL_PERF_READ...)
+ * @param start : time (g_get_monotonic_time()) when the operation began
+ */
+G_GNUC_INTERNAL void fcl_perf_record(fcl_perf_t *perf, gint op, gint64 start);
+
+
+/**
+ * Adds the counters of a view to the ones of its file. The views may be
+ * freed from many threads at once.
+ * @param a_file : the file
+ * @param perf : the counters to be added
+ */
+G_GNUC_INTERNAL void fcl_perf_merge(fcl_file_t *a_file, const fcl_perf_t *perf);
+
+
+/**
+ * Records the openning of a file if the calls are recorded (see fcl_record.c)
+ * @param a_file : the file openned
+ * @param start : time (g_get_monotonic_time()) when the openning began
+ * @param end : time when it ended
+ */
+G_GNUC_INTERNAL void fcl_record_open(fcl_file_t *a_file, gint64 start, gint64 end);
+
+
+/**
+ * Records a call whose arguments are numbers if the calls are recorded
+ * @param call : the call (LIBFCL_RECORD_READ...)
+ * @param a_file : the file
+ * @param start : time (g_get_monotonic_time()) when the call began
+ * @param n_args : number of arguments (3 at most)
+ * @param a : first argument
+ * @param b : second argument
+ * @param c : third argument
+ */
+G_GNUC_INTERNAL void fcl_record_call(gint call, fcl_file_t *a_file, gint64 start, gint n_args, guint64 a, guint64 b, guint64 c);
+
+
+/**
+ * Records the closing of a file if the calls are recorded
+ * @param a_file : the file being closed (only its address is used)
+ * @param save : save argument of the call
+ * @param start : time (g_get_monotonic_time()) when the call began
+ */
+G_GNUC_INTERNAL void fcl_record_close(gconstpointer a_file, gboolean save, gint64 start);
+
+
+/**
+ * Records a call to fcl_replace_all() if the calls are recorded
+ * @param a_file : the file
+ * @param start : time (g_get_monotonic_time()) when the call began
+ * @param pattern : the bytes looked for
+ * @param len : the number of bytes in pattern
+ * @param replacement : the bytes that replaced each occurrence
+ * @param replacement_len : the number of bytes in replacement
+ * @param count : what the call returned
+ */
+G_GNUC_INTERNAL void fcl_record_replace_all(fcl_file_t *a_file, gint64 start, const guchar *pattern, gsize len, const guchar *replacement, gsize replacement_len, goffset count);
+
+
+#if ENABLE_DEBUG
+/**
+ * Records an event in the ring of the calling thread (use LIBFCL_TRACE())
+ * @param event : kind of event (LIBFCL_TRACE_LOOKUP_HIT...)
+ * @param object : file or buffer concerned
+ * @param a : first number
+ * @param b : second number
+ * @param c : third number
+ */
+G_GNUC_INTERNAL void fcl_trace_record(gint event, gconstpointer object, gint64 a, gint64 b, gint64 c);
+#endif
+
+
+/**
+ * Runs func on each job with a pool of threads and returns once all the jobs
+ * are done. With only one thread (or one job) the jobs are run in the calling
+ * thread.
+ * @param func : the function to run (called with a job and NULL)
+ * @param jobs : the jobs
+ * @param n_jobs : number of jobs
+ * @param n_threads : maximum number of threads (0 means one per processor)
+ */
+G_GNUC_INTERNAL void fcl_run_jobs(GFunc func, gpointer *jobs, guint n_jobs, guint n_threads);
+
+
+/**
+ * Replaces the bytes that are not printable (outside of 0x20 to 0x7E) by '.'
+ * @param data : the bytes
+ * @param size : number of bytes
+ * @param ascii : where to write the size characters (no '\0' is added)
+ */
+G_GNUC_INTERNAL void fcl_render_ascii(const guchar *data, gsize size, gchar *ascii);
+
+
+
+#endif /* _LIBFCL_INTERNAL_H_ */
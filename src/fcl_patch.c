@@ -0,0 +1,726 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_patch.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_patch.c
+ * Binary patches made from the edits of a file.
+ *
+ * The sequence of edited buffers already tells how to build the edited file
+ * from the file on disk. A patch writes it down as a list of instructions :
+ *  - COPY : bytes of the source file (the untouched parts and the bytes of
+ *    an edited buffer that are still equal to the ones of its block at its
+ *    begining and at its end),
+ *  - ADD : new bytes (the rest of the edited buffers).
+ *
+ * Format (integers are unsigned LEB128 varints unless told otherwise) :
+ *  - "FCLP", a version byte (1), the size of the source, the size of the
+ *    target and the CRC32C of the target (4 bytes, little endian),
+ *  - instructions : LIBFCL_PATCH_COPY, the offset of the bytes in the source
+ *    (zigzag encoded difference with the end of the previous COPY) and their
+ *    number, or LIBFCL_PATCH_ADD, the number of bytes and the bytes,
+ *  - LIBFCL_PATCH_END.
+ *
+ * Exporting and applying a patch are both done in one streaming pass : only
+ * one buffer of each stream is in memory at once.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+/**
+ * @def LIBFCL_PATCH_MAGIC
+ * The first bytes of a patch
+ *
+ * @def LIBFCL_PATCH_VERSION
+ * Version of the format
+ *
+ * @def LIBFCL_PATCH_BUFFER_SIZE
+ * Size of the buffers used to read and to write the streams
+ */
+#define LIBFCL_PATCH_MAGIC "FCLP"
+#define LIBFCL_PATCH_VERSION 1
+#define LIBFCL_PATCH_BUFFER_SIZE 65536
+
+/**
+ * @def LIBFCL_PATCH_END
+ * End of the patch
+ *
+ * @def LIBFCL_PATCH_COPY
+ * Bytes copied from the source
+ *
+ * @def LIBFCL_PATCH_ADD
+ * Bytes given by the patch
+ */
+#define LIBFCL_PATCH_END 0
+#define LIBFCL_PATCH_COPY 1
+#define LIBFCL_PATCH_ADD 2
+
+
+/**
+ * @struct patch_writer_t
+ * A buffered output stream that knows how to write instructions. The last
+ * COPY is kept back so that the next one can be merged with it.
+ */
+typedef struct
+{
+    GOutputStream *out;      /**< The stream                                  */
+    guchar *buffer;          /**< Bytes not yet written to the stream         */
+    gsize size;              /**< Number of bytes in buffer                   */
+    gboolean ok;             /**< FALSE once a write failed                   */
+    goffset copy_offset;     /**< Offset of the COPY kept back                */
+    gsize copy_size;         /**< Size of the COPY kept back (0 : none)       */
+    goffset copy_end;        /**< End of the last COPY written                */
+} patch_writer_t;
+
+
+/**
+ * @struct patch_reader_t
+ * A buffered input stream
+ */
+typedef struct
+{
+    GInputStream *in;        /**< The stream                                  */
+    guchar *buffer;          /**< Bytes read from the stream                  */
+    gsize size;              /**< Number of bytes in buffer                   */
+    gsize position;          /**< Next byte to be read in buffer              */
+} patch_reader_t;
+
+
+static void writer_init(patch_writer_t *writer, GOutputStream *out);
+static void writer_put(patch_writer_t *writer, const guchar *data, gsize size);
+static void writer_put_varint(patch_writer_t *writer, guint64 value);
+static gboolean writer_close(patch_writer_t *writer);
+static void patch_copy(patch_writer_t *writer, goffset offset, gsize size);
+static void patch_add(patch_writer_t *writer, const guchar *data, gsize size);
+static void patch_add_buffer(patch_writer_t *writer, fcl_view_t *view, fcl_buf_t *seq_buf, gsize from, gsize size, guchar *chunk);
+static void flush_copy(patch_writer_t *writer);
+
+static gsize reader_get(patch_reader_t *reader, guchar *data, gsize size);
+static gboolean reader_get_varint(patch_reader_t *reader, guint64 *value_pointer);
+
+static gboolean apply_instructions(patch_reader_t *reader, patch_writer_t *writer, fcl_view_t *view, guint64 target_size, guint32 target_crc);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Writes the edits of a file as a patch (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param patch_path : path of the patch to be written
+ * @return TRUE if the patch was written, FALSE otherwise
+ */
+gboolean fcl_export_patch(fcl_file_t *a_file, const gchar *patch_path)
+{
+    GFile *patch_file = NULL;
+    GFileOutputStream *out = NULL;
+    patch_writer_t writer;
+    fcl_view_t *view = NULL;
+    fcl_buf_t *seq_buf = NULL;
+    guchar *original = NULL;
+    guchar *head = NULL;       /** first bytes of the buffer                    */
+    guchar *tail = NULL;       /** last bytes of the buffer                     */
+    gchar *checksum = NULL;
+    guchar header[4];
+    guint32 crc = 0;
+    goffset next = 0;          /** first byte of the source not yet in the patch */
+    goffset previous_gap = 0;
+    goffset orig_offset = 0;
+    gsize orig_size = 0;
+    gsize prefix = 0;
+    gsize suffix = 0;
+    gsize common = 0;
+    guint i = 0;
+
+    if (a_file == NULL || patch_path == NULL)
+        {
+            return FALSE;
+        }
+
+    checksum = fcl_checksum(a_file, LIBFCL_CHECKSUM_CRC32C);
+    crc = (guint32) g_ascii_strtoull(checksum, NULL, 16);
+    g_free(checksum);
+
+    patch_file = g_file_new_for_path(patch_path);
+    out = g_file_replace(patch_file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, NULL);
+
+    if (out == NULL)
+        {
+            fprintf(stderr, Q_("Unable to create the patch '%s'\n"), patch_path);
+            g_object_unref(patch_file);
+            return FALSE;
+        }
+
+    writer_init(&writer, G_OUTPUT_STREAM(out));
+    view = fcl_view_new(a_file);
+    original = (guchar *) g_malloc(LIBFCL_BUF_SIZE * sizeof(guchar));
+    head = (guchar *) g_malloc(LIBFCL_BUF_SIZE * sizeof(guchar));
+    tail = (guchar *) g_malloc(LIBFCL_BUF_SIZE * sizeof(guchar));
+
+    writer_put(&writer, (const guchar *) LIBFCL_PATCH_MAGIC, 4);
+    header[0] = LIBFCL_PATCH_VERSION;
+    writer_put(&writer, header, 1);
+    writer_put_varint(&writer, (guint64) view->real_size);
+    writer_put_varint(&writer, (guint64) view->size);
+    crc = GUINT32_TO_LE(crc);
+    memcpy(header, &crc, sizeof(guint32));
+    writer_put(&writer, header, 4);
+
+    for (i = 0; i < view->n_bufs && writer.ok == TRUE; i++)
+        {
+            seq_buf = view->bufs[i];
+            previous_gap = i > 0 ? view->gaps[i - 1] : 0;
+            orig_offset = view->starts[i] - previous_gap;
+            orig_size = (gsize) ((goffset) seq_buf->size - (view->gaps[i] - previous_gap));
+
+            /* The untouched part of the file before the buffer */
+            patch_copy(&writer, next, (gsize) (orig_offset - next));
+
+            if (fcl_view_read_original(view, orig_offset, original, orig_size) != orig_size)
+                {
+                    writer.ok = FALSE;
+                }
+
+            /* Only the middle of the buffer is new : its ends are compared
+             * with the original bytes, which are never more than
+             * LIBFCL_BUF_SIZE, thus a buffer that is not in memory (it may
+             * hold a whole range of another file) is never loaded at once.
+             */
+            common = MIN(seq_buf->size, orig_size);
+            fcl_spill_read(a_file, seq_buf, 0, head, common, &view->perf);
+            fcl_spill_read(a_file, seq_buf, seq_buf->size - common, tail, common, &view->perf);
+            prefix = 0;
+
+            while (prefix < common && head[prefix] == original[prefix])
+                {
+                    prefix++;
+                }
+
+            suffix = 0;
+
+            while (suffix < common - prefix && tail[common - 1 - suffix] == original[orig_size - 1 - suffix])
+                {
+                    suffix++;
+                }
+
+            patch_copy(&writer, orig_offset, prefix);
+            patch_add_buffer(&writer, view, seq_buf, prefix, seq_buf->size - prefix - suffix, head);
+            patch_copy(&writer, orig_offset + (goffset) (orig_size - suffix), suffix);
+
+            next = orig_offset + (goffset) orig_size;
+        }
+
+    patch_copy(&writer, next, (gsize) (view->real_size - next));
+    flush_copy(&writer);
+
+    header[0] = LIBFCL_PATCH_END;
+    writer_put(&writer, header, 1);
+
+    g_free(original);
+    g_free(head);
+    g_free(tail);
+    fcl_view_free(view);
+
+    if (writer_close(&writer) == FALSE)
+        {
+            fprintf(stderr, Q_("Unable to write the patch '%s'\n"), patch_path);
+            g_file_delete(patch_file, NULL, NULL);
+            g_object_unref(patch_file);
+            return FALSE;
+        }
+
+    g_object_unref(patch_file);
+
+    return TRUE;
+}
+
+
+/**
+ * Applies a patch to a file and writes the result (see fcl.h)
+ * @param a_file : an openned fcl_file_t file (the source)
+ * @param patch_path : path of the patch
+ * @param target_path : path of the file to be written
+ * @return TRUE if the patch was applied, FALSE otherwise
+ */
+gboolean fcl_apply_patch(fcl_file_t *a_file, const gchar *patch_path, const gchar *target_path)
+{
+    GFile *patch_file = NULL;
+    GFile *target_file = NULL;
+    GFileInputStream *in = NULL;
+    GFileOutputStream *out = NULL;
+    patch_reader_t reader;
+    patch_writer_t writer;
+    fcl_view_t *view = NULL;
+    guchar header[5];
+    guint64 source_size = 0;
+    guint64 target_size = 0;
+    guint32 target_crc = 0;
+    gboolean result = FALSE;
+
+    if (a_file == NULL || patch_path == NULL || target_path == NULL)
+        {
+            return FALSE;
+        }
+
+    patch_file = g_file_new_for_path(patch_path);
+    in = g_file_read(patch_file, NULL, NULL);
+    g_object_unref(patch_file);
+
+    if (in == NULL)
+        {
+            fprintf(stderr, Q_("Unable to open the patch '%s'\n"), patch_path);
+            return FALSE;
+        }
+
+    reader.in = G_INPUT_STREAM(in);
+    reader.buffer = (guchar *) g_malloc(LIBFCL_PATCH_BUFFER_SIZE * sizeof(guchar));
+    reader.size = 0;
+    reader.position = 0;
+
+    view = fcl_view_new(a_file);
+
+    if (reader_get(&reader, header, 5) != 5 || memcmp(header, LIBFCL_PATCH_MAGIC, 4) != 0 || header[4] != LIBFCL_PATCH_VERSION
+        || reader_get_varint(&reader, &source_size) == FALSE || reader_get_varint(&reader, &target_size) == FALSE
+        || reader_get(&reader, header, 4) != 4)
+        {
+            fprintf(stderr, Q_("'%s' is not a patch\n"), patch_path);
+        }
+    else if (source_size != (guint64) view->size)
+        {
+            fprintf(stderr, Q_("The patch '%s' does not apply to this file (wrong size)\n"), patch_path);
+        }
+    else
+        {
+            memcpy(&target_crc, header, sizeof(guint32));
+            target_crc = GUINT32_FROM_LE(target_crc);
+
+            target_file = g_file_new_for_path(target_path);
+            out = g_file_replace(target_file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, NULL);
+
+            if (out == NULL)
+                {
+                    fprintf(stderr, Q_("Unable to create '%s'\n"), target_path);
+                }
+            else
+                {
+                    writer_init(&writer, G_OUTPUT_STREAM(out));
+                    result = apply_instructions(&reader, &writer, view, target_size, target_crc);
+
+                    if (writer_close(&writer) == FALSE || result == FALSE)
+                        {
+                            fprintf(stderr, Q_("Applying the patch '%s' failed\n"), patch_path);
+                            g_file_delete(target_file, NULL, NULL);
+                            result = FALSE;
+                        }
+                }
+
+            g_object_unref(target_file);
+        }
+
+    fcl_view_free(view);
+    g_input_stream_close(reader.in, NULL, NULL);
+    g_object_unref(in);
+    g_free(reader.buffer);
+
+    return result;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Runs the instructions of a patch
+ * @param reader : the patch (after its header)
+ * @param writer : the target
+ * @param view : view on the source
+ * @param target_size : size of the target given by the header
+ * @param target_crc : CRC32C of the target given by the header
+ * @return TRUE if the patch is well formed and the target is the expected one
+ */
+static gboolean apply_instructions(patch_reader_t *reader, patch_writer_t *writer, fcl_view_t *view, guint64 target_size, guint32 target_crc)
+{
+    const guchar *run = NULL;
+    guchar *data = NULL;
+    guchar instruction = 0;
+    guint64 delta = 0;
+    guint64 size = 0;
+    guint64 written = 0;
+    goffset offset = 0;
+    goffset copy_end = 0;
+    gsize run_size = 0;
+    guint32 crc = 0;
+    gboolean end = FALSE;
+
+    data = (guchar *) g_malloc(LIBFCL_PATCH_BUFFER_SIZE * sizeof(guchar));
+
+    while (end == FALSE && writer->ok == TRUE && reader_get(reader, &instruction, 1) == 1)
+        {
+            switch (instruction)
+                {
+                    case LIBFCL_PATCH_COPY:
+                        if (reader_get_varint(reader, &delta) == FALSE || reader_get_varint(reader, &size) == FALSE)
+                            {
+                                writer->ok = FALSE;
+                                break;
+                            }
+
+                        /* zigzag decoding */
+                        offset = copy_end + ((delta & 1) ? -(goffset) (delta >> 1) - 1 : (goffset) (delta >> 1));
+
+                        if (offset < 0 || size > (guint64) view->size || offset > view->size - (goffset) size)
+                            {
+                                writer->ok = FALSE;
+                                break;
+                            }
+
+                        copy_end = offset + (goffset) size;
+
+                        while (offset < copy_end && (run = fcl_view_get_run(view, offset, &run_size)) != NULL)
+                            {
+                                run_size = (gsize) MIN((goffset) run_size, copy_end - offset);
+                                crc = fcl_crc32c_update(crc, run, run_size);
+                                writer_put(writer, run, run_size);
+                                offset = offset + run_size;
+                            }
+
+                        written = written + size;
+                    break;
+
+                    case LIBFCL_PATCH_ADD:
+                        if (reader_get_varint(reader, &size) == FALSE)
+                            {
+                                writer->ok = FALSE;
+                                break;
+                            }
+
+                        written = written + size;
+
+                        while (size > 0 && writer->ok == TRUE)
+                            {
+                                run_size = reader_get(reader, data, (gsize) MIN(size, LIBFCL_PATCH_BUFFER_SIZE));
+
+                                if (run_size == 0)
+                                    {
+                                        writer->ok = FALSE;
+                                    }
+
+                                crc = fcl_crc32c_update(crc, data, run_size);
+                                writer_put(writer, data, run_size);
+                                size = size - run_size;
+                            }
+                    break;
+
+                    case LIBFCL_PATCH_END:
+                        end = TRUE;
+                    break;
+
+                    default:
+                        writer->ok = FALSE;
+                    break;
+                }
+        }
+
+    g_free(data);
+
+    return end == TRUE && writer->ok == TRUE && written == target_size && crc == target_crc;
+}
+
+
+/**
+ * Inits a writer
+ * @param writer : the writer
+ * @param out : the stream where to write
+ */
+static void writer_init(patch_writer_t *writer, GOutputStream *out)
+{
+    writer->out = out;
+    writer->buffer = (guchar *) g_malloc(LIBFCL_PATCH_BUFFER_SIZE * sizeof(guchar));
+    writer->size = 0;
+    writer->ok = TRUE;
+    writer->copy_offset = 0;
+    writer->copy_size = 0;
+    writer->copy_end = 0;
+}
+
+
+/**
+ * Writes bytes (through the buffer)
+ * @param writer : the writer
+ * @param data : the bytes
+ * @param size : number of bytes
+ */
+static void writer_put(patch_writer_t *writer, const guchar *data, gsize size)
+{
+    gsize part = 0;
+
+    while (size > 0 && writer->ok == TRUE)
+        {
+            if (writer->size == LIBFCL_PATCH_BUFFER_SIZE)
+                {
+                    writer->ok = g_output_stream_write_all(writer->out, writer->buffer, writer->size, NULL, NULL, NULL);
+                    writer->size = 0;
+                }
+
+            part = MIN(size, LIBFCL_PATCH_BUFFER_SIZE - writer->size);
+            memcpy(writer->buffer + writer->size, data, part);
+            writer->size = writer->size + part;
+            data = data + part;
+            size = size - part;
+        }
+}
+
+
+/**
+ * Writes an unsigned LEB128 varint
+ * @param writer : the writer
+ * @param value : the value
+ */
+static void writer_put_varint(patch_writer_t *writer, guint64 value)
+{
+    guchar bytes[10];
+    gsize n = 0;
+
+    do
+        {
+            bytes[n] = (guchar) (value & 0x7F);
+            value = value >> 7;
+
+            if (value != 0)
+                {
+                    bytes[n] = bytes[n] | 0x80;
+                }
+
+            n++;
+        }
+    while (value != 0);
+
+    writer_put(writer, bytes, n);
+}
+
+
+/**
+ * Writes what remains in the buffer, closes the stream and frees the writer
+ * @param writer : the writer
+ * @return TRUE if everything was written
+ */
+static gboolean writer_close(patch_writer_t *writer)
+{
+    if (writer->ok == TRUE && writer->size > 0)
+        {
+            writer->ok = g_output_stream_write_all(writer->out, writer->buffer, writer->size, NULL, NULL, NULL);
+        }
+
+    if (g_output_stream_close(writer->out, NULL, NULL) == FALSE)
+        {
+            writer->ok = FALSE;
+        }
+
+    g_object_unref(writer->out);
+    g_free(writer->buffer);
+
+    return writer->ok;
+}
+
+
+/**
+ * Adds a COPY instruction (merged with the previous one when it follows it)
+ * @param writer : the writer
+ * @param offset : offset of the bytes in the source
+ * @param size : number of bytes
+ */
+static void patch_copy(patch_writer_t *writer, goffset offset, gsize size)
+{
+    if (size == 0)
+        {
+            return;
+        }
+
+    if (writer->copy_size > 0 && writer->copy_offset + (goffset) writer->copy_size == offset)
+        {
+            writer->copy_size = writer->copy_size + size;
+        }
+    else
+        {
+            flush_copy(writer);
+            writer->copy_offset = offset;
+            writer->copy_size = size;
+        }
+}
+
+
+/**
+ * Writes the COPY instruction kept back (if any)
+ * @param writer : the writer
+ */
+static void flush_copy(patch_writer_t *writer)
+{
+    guchar instruction = LIBFCL_PATCH_COPY;
+    goffset delta = 0;
+
+    if (writer->copy_size > 0)
+        {
+            delta = writer->copy_offset - writer->copy_end;
+
+            writer_put(writer, &instruction, 1);
+            /* zigzag encoding */
+            writer_put_varint(writer, delta >= 0 ? (guint64) delta << 1 : (((guint64) (-(delta + 1))) << 1) | 1);
+            writer_put_varint(writer, writer->copy_size);
+
+            writer->copy_end = writer->copy_offset + (goffset) writer->copy_size;
+            writer->copy_size = 0;
+        }
+}
+
+
+/**
+ * Adds an ADD instruction
+ * @param writer : the writer
+ * @param data : the new bytes
+ * @param size : number of bytes
+ */
+static void patch_add(patch_writer_t *writer, const guchar *data, gsize size)
+{
+    guchar instruction = LIBFCL_PATCH_ADD;
+
+    if (size == 0)
+        {
+            return;
+        }
+
+    flush_copy(writer);
+
+    writer_put(writer, &instruction, 1);
+    writer_put_varint(writer, size);
+    writer_put(writer, data, size);
+}
+
+
+/**
+ * Adds an ADD instruction with bytes of a buffer. A buffer that is not in
+ * memory is read chunk by chunk.
+ * @param writer : the writer
+ * @param view : the view on the edited file
+ * @param seq_buf : the buffer
+ * @param from : position of the first byte in the buffer
+ * @param size : number of bytes
+ * @param chunk : LIBFCL_BUF_SIZE bytes where to read the buffer
+ */
+static void patch_add_buffer(patch_writer_t *writer, fcl_view_t *view, fcl_buf_t *seq_buf, gsize from, gsize size, guchar *chunk)
+{
+    guchar instruction = LIBFCL_PATCH_ADD;
+    gsize done = 0;
+    gsize part = 0;
+
+    if (LIBFCL_BUF_IN_MEMORY(seq_buf))
+        {
+            patch_add(writer, seq_buf->data + from, size);
+            return;
+        }
+
+    if (size == 0)
+        {
+            return;
+        }
+
+    flush_copy(writer);
+
+    writer_put(writer, &instruction, 1);
+    writer_put_varint(writer, size);
+
+    while (done < size)
+        {
+            part = MIN(size - done, LIBFCL_BUF_SIZE);
+            fcl_spill_read(view->a_file, seq_buf, from + done, chunk, part, &view->perf);
+            writer_put(writer, chunk, part);
+            done = done + part;
+        }
+}
+
+
+/**
+ * Reads bytes (through the buffer)
+ * @param reader : the reader
+ * @param data : where to copy the bytes
+ * @param size : number of bytes wanted
+ * @return the number of bytes copied (less than size at the end of the
+ *         stream or on error)
+ */
+static gsize reader_get(patch_reader_t *reader, guchar *data, gsize size)
+{
+    gssize read = 0;
+    gsize copied = 0;
+    gsize part = 0;
+
+    while (copied < size)
+        {
+            if (reader->position == reader->size)
+                {
+                    read = g_input_stream_read(reader->in, reader->buffer, LIBFCL_PATCH_BUFFER_SIZE, NULL, NULL);
+
+                    if (read <= 0)
+                        {
+                            break;
+                        }
+
+                    reader->size = (gsize) read;
+                    reader->position = 0;
+                }
+
+            part = MIN(size - copied, reader->size - reader->position);
+            memcpy(data + copied, reader->buffer + reader->position, part);
+            reader->position = reader->position + part;
+            copied = copied + part;
+        }
+
+    return copied;
+}
+
+
+/**
+ * Reads an unsigned LEB128 varint
+ * @param reader : the reader
+ * @param[out] value_pointer : the value read
+ * @return FALSE if the varint is truncated or too long
+ */
+static gboolean reader_get_varint(patch_reader_t *reader, guint64 *value_pointer)
+{
+    guint64 value = 0;
+    guchar byte = 0x80;
+    gint shift = 0;
+
+    while ((byte & 0x80) != 0)
+        {
+            if (shift > 63 || reader_get(reader, &byte, 1) != 1)
+                {
+                    return FALSE;
+                }
+
+            value = value | ((guint64) (byte & 0x7F) << shift);
+            shift = shift + 7;
+        }
+
+    *value_pointer = value;
+
+    return TRUE;
+}
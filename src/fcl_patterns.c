@@ -0,0 +1,674 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_patterns.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_patterns.c
+ * Searching many patterns at once in the edited file.
+ *
+ * The patterns are compiled into an Aho-Corasick automaton. The edited file
+ * is cut into chunks that are scanned by a pool of threads, each one with its
+ * own view (see fcl_internal.h). A chunk [begin, end) reports the matches that
+ * begin in it : it is scanned from begin up to end + longest pattern - 1 so
+ * that the matches that straddle two chunks are found once, by the chunk where
+ * they begin. The matches of each chunk are sorted and the chunks are
+ * concatenated in order.
+ */
+#include <stdlib.h>
+
+#include "fcl.h"
+#include "fcl_internal.h"
+
+/**
+ * @def LIBFCL_PATTERNS_CHUNK_SIZE
+ * Minimum number of bytes of the edited file scanned by one job. Smaller
+ * files are scanned by only one job.
+ *
+ * @def LIBFCL_PATTERNS_JOBS_PER_THREAD
+ * Number of chunks per thread (more chunks than threads evens out the work
+ * when some parts of the file are slower to read than others).
+ *
+ * @def LIBFCL_PATTERNS_NO_STATE
+ * Value of a state number that does not exist (no edge, end of a list)
+ */
+#define LIBFCL_PATTERNS_CHUNK_SIZE (4 * LIBFCL_VIEW_WINDOW_SIZE)
+#define LIBFCL_PATTERNS_JOBS_PER_THREAD 4
+#define LIBFCL_PATTERNS_NO_STATE G_MAXUINT32
+
+
+/**
+ * @struct ac_state_t
+ * A state of the automaton (a node of the trie of the patterns)
+ */
+typedef struct
+{
+    guint32 fail;        /**< State to go to when no edge matches the byte            */
+    guint32 output;      /**< Next state on the fail chain that ends a pattern         */
+    gint32 pattern;      /**< First pattern that ends at this state or -1              */
+    guint32 first_edge;  /**< First edge of the state (a list while adding patterns)   */
+    guint32 n_edges;     /**< Number of edges of the state                             */
+} ac_state_t;
+
+
+/**
+ * @struct ac_edge_t
+ * An edge of the trie
+ */
+typedef struct
+{
+    guchar byte;         /**< Byte that leads to target                                */
+    guint32 target;      /**< State reached                                            */
+    guint32 next;        /**< Next edge of the same state while adding patterns        */
+} ac_edge_t;
+
+
+/**
+ * @struct fcl_patterns_t
+ * A set of patterns and the automaton compiled from it
+ */
+struct _fcl_patterns_t
+{
+    GArray *states;       /**< ac_state_t, the root is state 0                         */
+    GArray *edges;        /**< ac_edge_t, grouped and sorted by state once compiled     */
+    GArray *sizes;        /**< gsize, the size of each pattern                          */
+    GArray *same;         /**< gint32, next pattern with the same bytes or -1           */
+    guint32 root[256];    /**< Transitions of the root for every byte (once compiled)   */
+    gsize max_size;       /**< Size of the longest pattern                              */
+    gboolean compiled;    /**< TRUE when the automaton matches the patterns             */
+};
+
+
+/**
+ * @struct patterns_job_t
+ * A chunk of the edited file to be scanned by a thread
+ */
+typedef struct
+{
+    fcl_file_t *a_file;          /**< The file                                          */
+    fcl_patterns_t *patterns;    /**< Compiled patterns                                 */
+    goffset begin;               /**< First position of the chunk                       */
+    goffset end;                 /**< Position just after the chunk                     */
+    GArray *matches;             /**< fcl_match_t found beginning in the chunk          */
+} patterns_job_t;
+
+
+static guint32 add_state(fcl_patterns_t *patterns);
+static guint32 find_edge_while_adding(fcl_patterns_t *patterns, guint32 state, guchar byte);
+static void compile_patterns(fcl_patterns_t *patterns);
+static guint32 goto_state(fcl_patterns_t *patterns, guint32 state, guchar byte);
+static void scan_chunk(gpointer data, gpointer user_data);
+static gint cmp_matches(gconstpointer a, gconstpointer b);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Creates an empty set of patterns (see fcl.h)
+ * @return a newly allocated fcl_patterns_t
+ */
+fcl_patterns_t *fcl_patterns_new(void)
+{
+    fcl_patterns_t *patterns = NULL;
+
+    patterns = (fcl_patterns_t *) g_malloc0(sizeof(fcl_patterns_t));
+
+    patterns->states = g_array_new(FALSE, TRUE, sizeof(ac_state_t));
+    patterns->edges = g_array_new(FALSE, TRUE, sizeof(ac_edge_t));
+    patterns->sizes = g_array_new(FALSE, TRUE, sizeof(gsize));
+    patterns->same = g_array_new(FALSE, TRUE, sizeof(gint32));
+    patterns->max_size = 0;
+    patterns->compiled = FALSE;
+
+    add_state(patterns);  /* the root */
+
+    return patterns;
+}
+
+
+/**
+ * Frees a set of patterns
+ * @param patterns : the fcl_patterns_t to be freed
+ */
+void fcl_patterns_free(fcl_patterns_t *patterns)
+{
+    if (patterns != NULL)
+        {
+            g_array_free(patterns->states, TRUE);
+            g_array_free(patterns->edges, TRUE);
+            g_array_free(patterns->sizes, TRUE);
+            g_array_free(patterns->same, TRUE);
+            g_free(patterns);
+        }
+}
+
+
+/**
+ * Adds a pattern to a set (see fcl.h)
+ * @param patterns : the set of patterns
+ * @param pattern : the bytes of the pattern
+ * @param len : the number of bytes in pattern
+ * @return the number of the pattern in the set or -1 on error
+ */
+gint fcl_patterns_add(fcl_patterns_t *patterns, const guchar *pattern, gsize len)
+{
+    ac_state_t *a_state = NULL;
+    ac_edge_t edge;
+    guint32 state = 0;
+    guint32 next = 0;
+    gint32 number = 0;
+    gint32 last = 0;
+    gsize i = 0;
+
+    if (patterns == NULL || pattern == NULL || len == 0 || patterns->sizes->len >= G_MAXINT32)
+        {
+            return -1;
+        }
+
+    if (patterns->compiled == TRUE)
+        {
+            /* Back to the lists of edges used while adding */
+            for (i = 0; i < patterns->edges->len; i++)
+                {
+                    ac_edge_t *an_edge = &g_array_index(patterns->edges, ac_edge_t, i);
+
+                    /* edges of a state are contiguous : chaining them */
+                    if (i + 1 < patterns->edges->len)
+                        {
+                            an_edge->next = (guint32) (i + 1);
+                        }
+                    else
+                        {
+                            an_edge->next = LIBFCL_PATTERNS_NO_STATE;
+                        }
+                }
+
+            for (i = 0; i < patterns->states->len; i++)
+                {
+                    a_state = &g_array_index(patterns->states, ac_state_t, i);
+
+                    if (a_state->n_edges == 0)
+                        {
+                            a_state->first_edge = LIBFCL_PATTERNS_NO_STATE;
+                        }
+                    else
+                        {
+                            g_array_index(patterns->edges, ac_edge_t, a_state->first_edge + a_state->n_edges - 1).next = LIBFCL_PATTERNS_NO_STATE;
+                        }
+                }
+
+            patterns->compiled = FALSE;
+        }
+
+    for (i = 0; i < len; i++)
+        {
+            next = find_edge_while_adding(patterns, state, pattern[i]);
+
+            if (next == LIBFCL_PATTERNS_NO_STATE)
+                {
+                    next = add_state(patterns);
+
+                    a_state = &g_array_index(patterns->states, ac_state_t, state);
+                    edge.byte = pattern[i];
+                    edge.target = next;
+                    edge.next = a_state->first_edge;
+                    a_state->first_edge = patterns->edges->len;
+                    a_state->n_edges++;
+                    g_array_append_val(patterns->edges, edge);
+                }
+
+            state = next;
+        }
+
+    number = (gint32) patterns->sizes->len;
+    g_array_append_val(patterns->sizes, len);
+    last = -1;
+    g_array_append_val(patterns->same, last);
+
+    a_state = &g_array_index(patterns->states, ac_state_t, state);
+
+    if (a_state->pattern < 0)
+        {
+            a_state->pattern = number;
+        }
+    else
+        {
+            /* The same bytes were already added : chaining */
+            last = a_state->pattern;
+
+            while (g_array_index(patterns->same, gint32, last) >= 0)
+                {
+                    last = g_array_index(patterns->same, gint32, last);
+                }
+
+            g_array_index(patterns->same, gint32, last) = number;
+        }
+
+    patterns->max_size = MAX(patterns->max_size, len);
+
+    return (gint) number;
+}
+
+
+/**
+ * Finds all the matches of a set of patterns in the edited file (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param patterns : the set of patterns
+ * @param n_threads : number of threads to use (0 means one per processor)
+ * @return a newly allocated GArray of fcl_match_t or NULL on error
+ */
+GArray *fcl_find_patterns(fcl_file_t *a_file, fcl_patterns_t *patterns, guint n_threads)
+{
+    fcl_view_t *view = NULL;
+    patterns_job_t *jobs = NULL;
+    gpointer *job_pointers = NULL;
+    GArray *matches = NULL;
+    goffset size = 0;
+    goffset chunk_size = 0;
+    guint n_jobs = 0;
+    guint i = 0;
+
+    if (a_file == NULL || patterns == NULL)
+        {
+            return NULL;
+        }
+
+    matches = g_array_new(FALSE, FALSE, sizeof(fcl_match_t));
+
+    if (patterns->sizes->len == 0)
+        {
+            return matches;
+        }
+
+    if (patterns->compiled == FALSE)
+        {
+            compile_patterns(patterns);
+        }
+
+    view = fcl_view_new(a_file);
+    size = view->size;
+    fcl_view_free(view);
+
+    if (n_threads == 0)
+        {
+            n_threads = g_get_num_processors();
+        }
+
+    /* Cutting the file into chunks */
+    n_jobs = (guint) MIN((goffset) n_threads * LIBFCL_PATTERNS_JOBS_PER_THREAD, (size + LIBFCL_PATTERNS_CHUNK_SIZE - 1) / LIBFCL_PATTERNS_CHUNK_SIZE);
+    n_jobs = MAX(n_jobs, 1);
+    chunk_size = (size + n_jobs - 1) / n_jobs;
+
+    jobs = (patterns_job_t *) g_malloc0(n_jobs * sizeof(patterns_job_t));
+    job_pointers = (gpointer *) g_malloc0(n_jobs * sizeof(gpointer));
+
+    for (i = 0; i < n_jobs; i++)
+        {
+            jobs[i].a_file = a_file;
+            jobs[i].patterns = patterns;
+            jobs[i].begin = MIN((goffset) i * chunk_size, size);
+            jobs[i].end = MIN(jobs[i].begin + chunk_size, size);
+            jobs[i].matches = g_array_new(FALSE, FALSE, sizeof(fcl_match_t));
+            job_pointers[i] = &jobs[i];
+        }
+
+    fcl_run_jobs(scan_chunk, job_pointers, n_jobs, n_threads);
+
+    /* Chunks are in order : concatenating them keeps the matches in order */
+    for (i = 0; i < n_jobs; i++)
+        {
+            g_array_append_vals(matches, jobs[i].matches->data, jobs[i].matches->len);
+            g_array_free(jobs[i].matches, TRUE);
+        }
+
+    g_free(job_pointers);
+    g_free(jobs);
+
+    return matches;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Adds a new state (without any edge) to the automaton
+ * @param patterns : the set of patterns
+ * @return the number of the new state
+ */
+static guint32 add_state(fcl_patterns_t *patterns)
+{
+    ac_state_t a_state;
+
+    a_state.fail = 0;
+    a_state.output = 0;
+    a_state.pattern = -1;
+    a_state.first_edge = LIBFCL_PATTERNS_NO_STATE;
+    a_state.n_edges = 0;
+
+    g_array_append_val(patterns->states, a_state);
+
+    return patterns->states->len - 1;
+}
+
+
+/**
+ * Follows an edge while the edges of the states are still lists
+ * @param patterns : the set of patterns
+ * @param state : the state where we are
+ * @param byte : the byte read
+ * @return the state reached or LIBFCL_PATTERNS_NO_STATE if there is no edge
+ */
+static guint32 find_edge_while_adding(fcl_patterns_t *patterns, guint32 state, guchar byte)
+{
+    ac_edge_t *edge = NULL;
+    guint32 e = g_array_index(patterns->states, ac_state_t, state).first_edge;
+
+    while (e != LIBFCL_PATTERNS_NO_STATE)
+        {
+            edge = &g_array_index(patterns->edges, ac_edge_t, e);
+
+            if (edge->byte == byte)
+                {
+                    return edge->target;
+                }
+
+            e = edge->next;
+        }
+
+    return LIBFCL_PATTERNS_NO_STATE;
+}
+
+
+/**
+ * Compares two edges by their byte (to sort the edges of a state)
+ */
+static gint cmp_edges(gconstpointer a, gconstpointer b)
+{
+    const ac_edge_t *edge_a = (const ac_edge_t *) a;
+    const ac_edge_t *edge_b = (const ac_edge_t *) b;
+
+    return (gint) edge_a->byte - (gint) edge_b->byte;
+}
+
+
+/**
+ * Compiles the automaton : the edges of each state are stored together and
+ * sorted by byte, the fail and output links are computed (breadth first) and
+ * the transitions of the root are tabulated.
+ * @param patterns : the set of patterns
+ */
+static void compile_patterns(fcl_patterns_t *patterns)
+{
+    GArray *edges = NULL;
+    ac_state_t *states = NULL;
+    ac_edge_t *an_edge = NULL;
+    guint32 *queue = NULL;
+    guint32 head = 0;
+    guint32 tail = 0;
+    guint32 state = 0;
+    guint32 target = 0;
+    guint32 fail = 0;
+    guint32 e = 0;
+    guint32 first = 0;
+    guint i = 0;
+
+    /* Edges of each state stored together, sorted by byte */
+    edges = g_array_sized_new(FALSE, TRUE, sizeof(ac_edge_t), patterns->edges->len);
+    states = (ac_state_t *) patterns->states->data;
+
+    for (i = 0; i < patterns->states->len; i++)
+        {
+            first = edges->len;
+            e = states[i].first_edge;
+
+            while (e != LIBFCL_PATTERNS_NO_STATE)
+                {
+                    an_edge = &g_array_index(patterns->edges, ac_edge_t, e);
+                    g_array_append_vals(edges, an_edge, 1);
+                    e = an_edge->next;
+                }
+
+            qsort(edges->data + first * sizeof(ac_edge_t), edges->len - first, sizeof(ac_edge_t), cmp_edges);
+            states[i].first_edge = first;
+        }
+
+    g_array_free(patterns->edges, TRUE);
+    patterns->edges = edges;
+
+    /* The root goes to itself for the bytes that begin no pattern */
+    for (i = 0; i < 256; i++)
+        {
+            patterns->root[i] = 0;
+        }
+
+    for (e = 0; e < states[0].n_edges; e++)
+        {
+            an_edge = &g_array_index(edges, ac_edge_t, states[0].first_edge + e);
+            patterns->root[an_edge->byte] = an_edge->target;
+        }
+
+    patterns->compiled = TRUE;
+
+    /* Fail and output links, breadth first (a state fails to a shallower one) */
+    queue = (guint32 *) g_malloc(patterns->states->len * sizeof(guint32));
+
+    for (e = 0; e < states[0].n_edges; e++)
+        {
+            target = g_array_index(edges, ac_edge_t, states[0].first_edge + e).target;
+            states[target].fail = 0;
+            states[target].output = 0;
+            queue[tail] = target;
+            tail++;
+        }
+
+    while (head < tail)
+        {
+            state = queue[head];
+            head++;
+
+            for (e = 0; e < states[state].n_edges; e++)
+                {
+                    an_edge = &g_array_index(edges, ac_edge_t, states[state].first_edge + e);
+                    target = an_edge->target;
+
+                    fail = goto_state(patterns, states[state].fail, an_edge->byte);
+                    states[target].fail = fail;
+
+                    if (states[fail].pattern >= 0)
+                        {
+                            states[target].output = fail;
+                        }
+                    else
+                        {
+                            states[target].output = states[fail].output;
+                        }
+
+                    queue[tail] = target;
+                    tail++;
+                }
+        }
+
+    g_free(queue);
+}
+
+
+/**
+ * Follows an edge of the compiled automaton or, if there is none, the fail
+ * links until one is found.
+ * @param patterns : the compiled set of patterns
+ * @param state : the state where we are
+ * @param byte : the byte read
+ * @return the state reached
+ */
+static guint32 goto_state(fcl_patterns_t *patterns, guint32 state, guchar byte)
+{
+    const ac_state_t *states = (const ac_state_t *) patterns->states->data;
+    const ac_edge_t *edges = NULL;
+    guint32 low = 0;
+    guint32 high = 0;
+    guint32 middle = 0;
+
+    while (state != 0)
+        {
+            edges = (const ac_edge_t *) patterns->edges->data + states[state].first_edge;
+            low = 0;
+            high = states[state].n_edges;
+
+            if (high <= 4)
+                {
+                    for (low = 0; low < high; low++)
+                        {
+                            if (edges[low].byte == byte)
+                                {
+                                    return edges[low].target;
+                                }
+                        }
+                }
+            else
+                {
+                    while (low < high)
+                        {
+                            middle = (low + high) / 2;
+
+                            if (edges[middle].byte < byte)
+                                {
+                                    low = middle + 1;
+                                }
+                            else
+                                {
+                                    high = middle;
+                                }
+                        }
+
+                    if (low < states[state].n_edges && edges[low].byte == byte)
+                        {
+                            return edges[low].target;
+                        }
+                }
+
+            state = states[state].fail;
+        }
+
+    return patterns->root[byte];
+}
+
+
+/**
+ * Scans a chunk of the edited file (run by a thread of the pool)
+ * @param data : the patterns_job_t to do
+ * @param user_data : unused
+ */
+static void scan_chunk(gpointer data, gpointer user_data)
+{
+    patterns_job_t *job = (patterns_job_t *) data;
+    fcl_patterns_t *patterns = job->patterns;
+    const ac_state_t *states = (const ac_state_t *) patterns->states->data;
+    const gsize *sizes = (const gsize *) patterns->sizes->data;
+    const gint32 *same = (const gint32 *) patterns->same->data;
+    fcl_view_t *view = NULL;
+    fcl_match_t match;
+    const guchar *run = NULL;
+    gsize size = 0;
+    gsize i = 0;
+    goffset position = job->begin;
+    goffset stop = 0;
+    guint32 state = 0;
+    guint32 out = 0;
+    gint32 number = 0;
+
+    if (job->begin >= job->end)
+        {
+            return;
+        }
+
+    view = fcl_view_new(job->a_file);
+
+    /* Matches that begin before end may end up to max_size - 1 bytes after it */
+    stop = MIN(job->end + (goffset) patterns->max_size - 1, view->size);
+
+    while (position < stop && (run = fcl_view_get_run(view, position, &size)) != NULL)
+        {
+            size = (gsize) MIN((goffset) size, stop - position);
+
+            for (i = 0; i < size; i++)
+                {
+                    if (state == 0)
+                        {
+                            state = patterns->root[run[i]];
+                        }
+                    else
+                        {
+                            state = goto_state(patterns, state, run[i]);
+                        }
+
+                    out = states[state].pattern >= 0 ? state : states[state].output;
+
+                    while (out != 0)
+                        {
+                            for (number = states[out].pattern; number >= 0; number = same[number])
+                                {
+                                    match.position = position + (goffset) i + 1 - (goffset) sizes[number];
+                                    match.pattern = (guint) number;
+                                    match.size = sizes[number];
+
+                                    if (match.position < job->end)
+                                        {
+                                            g_array_append_val(job->matches, match);
+                                        }
+                                }
+
+                            out = states[out].output;
+                        }
+                }
+
+            position = position + size;
+        }
+
+    fcl_view_free(view);
+
+    g_array_sort(job->matches, cmp_matches);
+}
+
+
+/**
+ * Compares two matches : by position and then by pattern number
+ */
+static gint cmp_matches(gconstpointer a, gconstpointer b)
+{
+    const fcl_match_t *match_a = (const fcl_match_t *) a;
+    const fcl_match_t *match_b = (const fcl_match_t *) b;
+
+    if (match_a->position != match_b->position)
+        {
+            return match_a->position < match_b->position ? -1 : 1;
+        }
+    else if (match_a->pattern != match_b->pattern)
+        {
+            return match_a->pattern < match_b->pattern ? -1 : 1;
+        }
+    else
+        {
+            return 0;
+        }
+}
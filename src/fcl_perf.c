@@ -0,0 +1,182 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_perf.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_perf.c
+ * Performance counters of a file.
+ *
+ * The counters of a file are updated without any lock by the functions that
+ * edit or read the file (they are not to be called from many threads at
+ * once). The views, that may be used from many threads, count in their own
+ * fcl_perf_t which is added to the one of the file, under perf_lock, when
+ * the view is freed.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+static const gchar *op_names[LIBFCL_PERF_N_OPS] = {"read", "insert", "delete", "overwrite", "save", "move"};
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Gets a snapshot of the performance counters of a file (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @return a newly allocated fcl_perf_t or NULL if a_file is NULL
+ */
+fcl_perf_t *fcl_get_perf(fcl_file_t *a_file)
+{
+    fcl_perf_t *perf = NULL;
+
+    if (a_file != NULL && a_file->perf != NULL)
+        {
+            g_mutex_lock(&a_file->perf_lock);
+            perf = (fcl_perf_t *) g_memdup(a_file->perf, sizeof(fcl_perf_t));
+            g_mutex_unlock(&a_file->perf_lock);
+        }
+
+    return perf;
+}
+
+
+/**
+ * Sets the performance counters of a file back to 0
+ * @param a_file : an openned fcl_file_t file
+ */
+void fcl_reset_perf(fcl_file_t *a_file)
+{
+    if (a_file != NULL && a_file->perf != NULL)
+        {
+            g_mutex_lock(&a_file->perf_lock);
+            memset(a_file->perf, 0, sizeof(fcl_perf_t));
+            g_mutex_unlock(&a_file->perf_lock);
+        }
+}
+
+
+/**
+ * Prints the performance counters of a file
+ * @param a_file : an openned fcl_file_t file
+ */
+void fcl_print_perf(fcl_file_t *a_file)
+{
+    fcl_perf_t *perf = NULL;
+    gint op = 0;
+    gint bucket = 0;
+
+    perf = fcl_get_perf(a_file);
+
+    if (perf != NULL)
+        {
+            fprintf(stdout, "\n");
+            fprintf(stdout, "Performance counters of %s :\n", a_file->name);
+            fprintf(stdout, " Disk reads        : %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " seeks, %" G_GUINT64_FORMAT " bytes)\n", perf->disk_reads, perf->disk_seeks, perf->disk_bytes_read);
+            fprintf(stdout, " Lookups           : %" G_GUINT64_FORMAT " (%.2f steps on average)\n", perf->lookups, perf->lookups > 0 ? (gdouble) perf->lookup_steps / (gdouble) perf->lookups : 0.0);
+            fprintf(stdout, " Cache hits/misses : %" G_GUINT64_FORMAT " / %" G_GUINT64_FORMAT "\n", perf->cache_hits, perf->cache_misses);
+            fprintf(stdout, " Allocations       : %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " bytes)\n", perf->allocations, perf->allocated_bytes);
+            fprintf(stdout, " Scratch file      : %" G_GUINT64_FORMAT " writes (%" G_GUINT64_FORMAT " bytes), %" G_GUINT64_FORMAT " reads (%" G_GUINT64_FORMAT " bytes)\n", perf->spill_writes, perf->spill_bytes_written, perf->spill_reads, perf->spill_bytes_read);
+            fprintf(stdout, " Compression       : %" G_GUINT64_FORMAT " buffers compressed, %" G_GUINT64_FORMAT " uncompressed\n", perf->compressions, perf->decompressions);
+            fprintf(stdout, " Streams closed    : %" G_GUINT64_FORMAT " (too many open files)\n", perf->pool_closes);
+
+            for (op = 0; op < LIBFCL_PERF_N_OPS; op++)
+                {
+                    if (perf->op_count[op] > 0)
+                        {
+                            fprintf(stdout, " %-9s : %" G_GUINT64_FORMAT " in %" G_GUINT64_FORMAT " µs\n", op_names[op], perf->op_count[op], perf->op_time[op]);
+
+                            for (bucket = 0; bucket < LIBFCL_PERF_LATENCY_BUCKETS; bucket++)
+                                {
+                                    if (perf->latency[op][bucket] > 0)
+                                        {
+                                            fprintf(stdout, "   less than 2^%d µs : %" G_GUINT64_FORMAT "\n", bucket, perf->latency[op][bucket]);
+                                        }
+                                }
+                        }
+                }
+
+            fprintf(stdout, "\n");
+
+            g_free(perf);
+        }
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Adds the time elapsed since start to the latency histogram of an operation
+ * (see fcl_internal.h)
+ * @param perf : the counters of a file
+ * @param op : the operation (LIBFCL_PERF_READ...)
+ * @param start : time (g_get_monotonic_time()) when the operation began
+ */
+void fcl_perf_record(fcl_perf_t *perf, gint op, gint64 start)
+{
+    gint64 elapsed = g_get_monotonic_time() - start;
+    guint bucket = 0;
+
+    if (elapsed > 0)
+        {
+            bucket = MIN(g_bit_storage((gulong) elapsed), LIBFCL_PERF_LATENCY_BUCKETS - 1);
+        }
+    else
+        {
+            elapsed = 0;
+        }
+
+    perf->op_count[op] = perf->op_count[op] + 1;
+    perf->op_time[op] = perf->op_time[op] + (guint64) elapsed;
+    perf->latency[op][bucket] = perf->latency[op][bucket] + 1;
+}
+
+
+/**
+ * Adds the counters of a view to the ones of its file (see fcl_internal.h)
+ * @param a_file : the file
+ * @param perf : the counters to be added
+ */
+void fcl_perf_merge(fcl_file_t *a_file, const fcl_perf_t *perf)
+{
+    guint64 *to = NULL;
+    const guint64 *from = NULL;
+    gsize i = 0;
+
+    if (a_file != NULL && a_file->perf != NULL)
+        {
+            to = (guint64 *) a_file->perf;
+            from = (const guint64 *) perf;
+
+            g_mutex_lock(&a_file->perf_lock);
+
+            /* Every field of fcl_perf_t is a guint64 */
+            for (i = 0; i < sizeof(fcl_perf_t) / sizeof(guint64); i++)
+                {
+                    to[i] = to[i] + from[i];
+                }
+
+            g_mutex_unlock(&a_file->perf_lock);
+        }
+}
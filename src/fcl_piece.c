@@ -0,0 +1,744 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_piece.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_piece.c
+ * Buffers made of pieces.
+ *
+ * When a range of another file is inserted, its bytes are not read : the
+ * buffer where it is inserted is turned into a list of pieces (fcl_piece_t),
+ * each one being either bytes in memory or a range of a source file
+ * (fcl_source_t). The bytes of the sources are read (pread) only when they
+ * are read from the buffer or written to another file.
+ *
+ * The buffer is then edited piece by piece : the pieces are split where bytes
+ * are inserted or deleted and the new bytes go into pieces in memory, so that
+ * the ranges of the source files are never loaded. Once the last range of a
+ * source file is deleted, the buffer goes back to plain bytes in memory.
+ *
+ * Ranges copied or moved inside an edited file are pieces too : the parts of
+ * the range that are untouched reference the file itself as a source.
+ *
+ * The bytes in memory are held by chunks (fcl_chunk_t) : immutable and
+ * reference counted, a chunk is shared by every piece that holds a part of
+ * it, in any buffer of any file and in the clipboard. Splitting, copying or
+ * pasting pieces never copies their bytes. A chunk is shared when the pieces
+ * of more than one buffer use it : the parts of a piece split inside a
+ * buffer do not share it. A chunk is only appended to (as when typing) while
+ * it is not shared, otherwise the new bytes go into a new chunk. The bytes of
+ * the chunks that are shared are counted once, for the whole library (see
+ * fcl_get_shared_memory()).
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @struct fcl_source_t
+ * A file whose ranges are inserted in the buffers (shared by the pieces)
+ */
+struct _fcl_source_t
+{
+    gint ref_count;    /**< Number of pieces that use it */
+    gint fd;           /**< The file (openned read only) */
+    goffset size;      /**< Its size                     */
+};
+
+
+/**
+ * @struct fcl_chunk_t
+ * Bytes in memory (shared by the pieces)
+ */
+typedef struct
+{
+    gint ref_count;    /**< Number of pieces that use it  */
+    gint users;        /**< Number of buffers that use it */
+    gsize size;        /**< Number of bytes               */
+    guchar *data;      /**< The bytes                     */
+} fcl_chunk_t;
+
+
+/**
+ * @struct fcl_piece_t
+ * A part of a buffer
+ */
+typedef struct
+{
+    fcl_source_t *source;  /**< Where the bytes are (NULL : in chunk)       */
+    fcl_chunk_t *chunk;    /**< Where the bytes are (NULL : in source)      */
+    goffset offset;        /**< Offset of the bytes in the source or chunk  */
+    gsize size;            /**< Number of bytes                             */
+} fcl_piece_t;
+
+
+static GMutex shared_lock;      /** Protects shared_bytes                     */
+static gsize shared_bytes = 0;  /** Bytes of the chunks used by many buffers  */
+
+
+static GArray *get_pieces(fcl_buf_t *a_buffer);
+static guint split_at(fcl_buf_t *a_buffer, gsize position);
+static void clear_piece(fcl_buf_t *a_buffer, fcl_piece_t *piece);
+static void back_to_memory(fcl_buf_t *a_buffer);
+static gboolean holds_chunk(GArray *pieces, guint n, fcl_chunk_t *chunk);
+static fcl_chunk_t *chunk_new(guchar *data, gsize size);
+static fcl_chunk_t *chunk_ref(fcl_chunk_t *chunk, gboolean new_user);
+static void chunk_unref(fcl_chunk_t *chunk, gboolean last_use);
+static gboolean chunk_is_shared(fcl_chunk_t *chunk);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Gets the memory used by the chunks that are shared (see fcl.h)
+ * @return the number of bytes of the chunks shared by more than one buffer
+ */
+gsize fcl_get_shared_memory(void)
+{
+    gsize size = 0;
+
+    g_mutex_lock(&shared_lock);
+    size = shared_bytes;
+    g_mutex_unlock(&shared_lock);
+
+    return size;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Opens a source file (see fcl_internal.h)
+ * @param path : path of the file (or NULL to use fd)
+ * @param fd : an openned file descriptor (used when path is NULL)
+ * @return a new fcl_source_t (with one reference) or NULL if the file can
+ *         not be openned
+ */
+fcl_source_t *fcl_source_open(const gchar *path, gint fd)
+{
+    fcl_source_t *source = NULL;
+    struct stat status;
+
+    if (path != NULL)
+        {
+            fd = g_open(path, O_RDONLY, 0);
+        }
+    else if (fd >= 0)
+        {
+            /* The caller may close its own descriptor */
+            fd = dup(fd);
+        }
+
+    if (fd < 0)
+        {
+            return NULL;
+        }
+
+    if (fstat(fd, &status) != 0)
+        {
+            g_close(fd, NULL);
+            return NULL;
+        }
+
+    source = (fcl_source_t *) g_malloc0(sizeof(fcl_source_t));
+    source->ref_count = 1;
+    source->fd = fd;
+    source->size = (goffset) status.st_size;
+
+    return source;
+}
+
+
+/**
+ * Gets the size of a source file
+ * @param source : the source file
+ * @return its size (when it was openned)
+ */
+goffset fcl_source_size(fcl_source_t *source)
+{
+    return source->size;
+}
+
+
+/**
+ * Adds a reference to a source file
+ * @param source : the source file
+ * @return source
+ */
+fcl_source_t *fcl_source_ref(fcl_source_t *source)
+{
+    g_atomic_int_inc(&source->ref_count);
+
+    return source;
+}
+
+
+/**
+ * Removes a reference to a source file, closing it with the last one
+ * @param source : the source file (may be NULL)
+ */
+void fcl_source_unref(fcl_source_t *source)
+{
+    if (source != NULL && g_atomic_int_dec_and_test(&source->ref_count) == TRUE)
+        {
+            g_close(source->fd, NULL);
+            g_free(source);
+        }
+}
+
+
+/**
+ * Inserts bytes in a buffer as a piece (see fcl_internal.h)
+ * @param a_buffer : a buffer that is not spilled
+ * @param position : position of the insertion in the buffer
+ * @param source : the source file of the bytes or NULL if they are in data
+ * @param offset : offset of the bytes in source
+ * @param data : the bytes (when source is NULL)
+ * @param size : number of bytes
+ */
+void fcl_pieces_insert(fcl_buf_t *a_buffer, gsize position, fcl_source_t *source, goffset offset, const guchar *data, gsize size)
+{
+    GArray *pieces = get_pieces(a_buffer);
+    fcl_piece_t piece;
+    fcl_piece_t *previous = NULL;
+    fcl_chunk_t *chunk = NULL;
+    guint i = 0;
+
+    if (size == 0)
+        {
+            return;
+        }
+
+    i = split_at(a_buffer, position);
+
+    if (i > 0)
+        {
+            previous = &g_array_index(pieces, fcl_piece_t, i - 1);
+            chunk = previous->chunk;
+        }
+
+    if (source == NULL && chunk != NULL && chunk_is_shared(chunk) == FALSE && previous->offset + (goffset) previous->size == (goffset) chunk->size)
+        {
+            /* Typing goes on at the end of the bytes typed before (nobody
+             * else sees that chunk)
+             */
+            chunk->data = (guchar *) g_realloc(chunk->data, chunk->size + size);
+            memcpy(chunk->data + chunk->size, data, size);
+            chunk->size = chunk->size + size;
+            previous->size = previous->size + size;
+        }
+    else
+        {
+            piece.source = source != NULL ? fcl_source_ref(source) : NULL;
+            piece.chunk = source != NULL ? NULL : chunk_new((guchar *) g_memdup(data, size), size);
+            piece.offset = source != NULL ? offset : 0;
+            piece.size = size;
+
+            g_array_insert_val(pieces, i, piece);
+        }
+
+    a_buffer->size = a_buffer->size + size;
+}
+
+
+/**
+ * Deletes bytes of a buffer made of pieces (see fcl_internal.h)
+ * @param a_buffer : a buffer made of pieces
+ * @param position : position of the first byte to delete in the buffer
+ * @param size : number of bytes to delete (they are in the buffer)
+ */
+void fcl_pieces_delete(fcl_buf_t *a_buffer, gsize position, gsize size)
+{
+    fcl_piece_t piece;
+    guint first = 0;
+    guint last = 0;
+    guint i = 0;
+
+    if (size == 0)
+        {
+            return;
+        }
+
+    first = split_at(a_buffer, position);
+    last = split_at(a_buffer, position + size);
+
+    for (i = last; i > first; i--)
+        {
+            piece = g_array_index(a_buffer->pieces, fcl_piece_t, i - 1);
+            g_array_remove_index(a_buffer->pieces, i - 1);
+            clear_piece(a_buffer, &piece);
+        }
+
+    a_buffer->size = a_buffer->size - size;
+
+    back_to_memory(a_buffer);
+}
+
+
+/**
+ * Appends bytes of a buffer made of pieces to another buffer (see
+ * fcl_internal.h)
+ * @param range : the buffer where to append the bytes (not spilled)
+ * @param a_buffer : a buffer made of pieces
+ * @param offset : offset of the first byte in a_buffer
+ * @param size : number of bytes (they are in a_buffer)
+ */
+void fcl_pieces_copy(fcl_buf_t *range, fcl_buf_t *a_buffer, gsize offset, gsize size)
+{
+    fcl_piece_t *piece = NULL;
+    fcl_piece_t part;
+    gsize begin = 0;      /** offset of the piece in the buffer */
+    gsize from = 0;       /** first byte copied from the piece  */
+    gsize end = 0;        /** end of what is copied from the piece */
+    guint i = 0;
+
+    get_pieces(range);
+
+    for (i = 0; i < a_buffer->pieces->len && begin < offset + size; i++)
+        {
+            piece = &g_array_index(a_buffer->pieces, fcl_piece_t, i);
+            from = MAX(offset, begin);
+            end = MIN(offset + size, begin + piece->size);
+
+            if (from < end)
+                {
+                    part.source = piece->source != NULL ? fcl_source_ref(piece->source) : NULL;
+                    part.chunk = piece->chunk != NULL ? chunk_ref(piece->chunk, holds_chunk(range->pieces, range->pieces->len, piece->chunk) == FALSE) : NULL;
+                    part.offset = piece->offset + (goffset) (from - begin);
+                    part.size = end - from;
+
+                    g_array_append_val(range->pieces, part);
+                    range->size = range->size + part.size;
+                }
+
+            begin = begin + piece->size;
+        }
+}
+
+
+/**
+ * Inserts the bytes of a buffer in another one (see fcl_internal.h)
+ * @param a_buffer : a buffer that is not spilled
+ * @param position : position of the insertion in a_buffer
+ * @param range : the buffer whose bytes are inserted (it is left as it is)
+ */
+void fcl_pieces_splice(fcl_buf_t *a_buffer, gsize position, fcl_buf_t *range)
+{
+    fcl_piece_t piece;
+    guint i = 0;
+    guint j = 0;
+
+    if (range->size == 0)
+        {
+            return;
+        }
+
+    get_pieces(a_buffer);
+    get_pieces(range);
+    i = split_at(a_buffer, position);
+
+    for (j = 0; j < range->pieces->len; j++)
+        {
+            piece = g_array_index(range->pieces, fcl_piece_t, j);
+
+            if (piece.source != NULL)
+                {
+                    fcl_source_ref(piece.source);
+                }
+            else
+                {
+                    chunk_ref(piece.chunk, holds_chunk(a_buffer->pieces, a_buffer->pieces->len, piece.chunk) == FALSE);
+                }
+
+            g_array_insert_val(a_buffer->pieces, i + j, piece);
+        }
+
+    a_buffer->size = a_buffer->size + range->size;
+
+    back_to_memory(a_buffer);
+}
+
+
+/**
+ * Copies bytes of a buffer made of pieces (see fcl_internal.h)
+ * @param a_buffer : a buffer made of pieces
+ * @param offset : offset of the first byte in the buffer
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to copy
+ * @param perf : the counters where to count the reads of the source files
+ * @return the number of bytes copied (less than size if a source file can
+ *         not be read)
+ */
+gsize fcl_pieces_read(fcl_buf_t *a_buffer, gsize offset, guchar *data, gsize size, fcl_perf_t *perf)
+{
+    fcl_piece_t *piece = NULL;
+    gssize read = 0;
+    gsize begin = 0;      /** offset of the piece in the buffer */
+    gsize end = 0;        /** end of what is copied from the piece */
+    gsize done = 0;
+    guint i = 0;
+
+    for (i = 0; i < a_buffer->pieces->len && done < size; i++)
+        {
+            piece = &g_array_index(a_buffer->pieces, fcl_piece_t, i);
+            end = MIN(offset + size, begin + piece->size);
+
+            while (offset + done < end)
+                {
+                    if (piece->source == NULL)
+                        {
+                            memcpy(data + done, piece->chunk->data + piece->offset + (offset + done - begin), end - (offset + done));
+                            done = end - offset;
+                        }
+                    else
+                        {
+                            perf->disk_reads = perf->disk_reads + 1;
+                            read = pread(piece->source->fd, data + done, end - (offset + done), (off_t) (piece->offset + (goffset) (offset + done - begin)));
+
+                            if (read <= 0)
+                                {
+                                    return done;
+                                }
+
+                            perf->disk_bytes_read = perf->disk_bytes_read + (guint64) read;
+                            done = done + (gsize) read;
+                        }
+                }
+
+            begin = begin + piece->size;
+        }
+
+    return done;
+}
+
+
+/**
+ * Says wether a piece of a buffer is in a given file (see fcl_internal.h)
+ * @param a_buffer : a buffer made of pieces
+ * @param device : device of the file
+ * @param inode : inode of the file
+ * @return TRUE if a piece of a_buffer is read from that file
+ */
+gboolean fcl_pieces_in_file(fcl_buf_t *a_buffer, guint64 device, guint64 inode)
+{
+    fcl_piece_t *piece = NULL;
+    struct stat status;
+    guint i = 0;
+
+    for (i = 0; i < a_buffer->pieces->len; i++)
+        {
+            piece = &g_array_index(a_buffer->pieces, fcl_piece_t, i);
+
+            if (piece->source != NULL && fstat(piece->source->fd, &status) == 0 && (guint64) status.st_dev == device && (guint64) status.st_ino == inode)
+                {
+                    return TRUE;
+                }
+        }
+
+    return FALSE;
+}
+
+
+/**
+ * Gets the number of bytes of a buffer made of pieces that are in memory and
+ * only used by it (the shared chunks are counted by fcl_get_shared_memory())
+ * @param a_buffer : a buffer made of pieces
+ * @return the number of bytes of its pieces in chunks that are not shared
+ */
+gsize fcl_pieces_memory(fcl_buf_t *a_buffer)
+{
+    fcl_piece_t *piece = NULL;
+    gsize size = 0;
+    guint i = 0;
+
+    for (i = 0; i < a_buffer->pieces->len; i++)
+        {
+            piece = &g_array_index(a_buffer->pieces, fcl_piece_t, i);
+
+            /* A chunk split in many pieces is counted once */
+            if (piece->chunk != NULL && chunk_is_shared(piece->chunk) == FALSE && holds_chunk(a_buffer->pieces, i, piece->chunk) == FALSE)
+                {
+                    size = size + piece->chunk->size;
+                }
+        }
+
+    return size;
+}
+
+
+/**
+ * Frees the pieces of a buffer (if any)
+ * @param a_buffer : the buffer
+ */
+void fcl_pieces_free(fcl_buf_t *a_buffer)
+{
+    fcl_piece_t piece;
+
+    if (a_buffer->pieces != NULL)
+        {
+            while (a_buffer->pieces->len > 0)
+                {
+                    piece = g_array_index(a_buffer->pieces, fcl_piece_t, a_buffer->pieces->len - 1);
+                    g_array_set_size(a_buffer->pieces, a_buffer->pieces->len - 1);
+                    clear_piece(a_buffer, &piece);
+                }
+
+            g_array_free(a_buffer->pieces, TRUE);
+            a_buffer->pieces = NULL;
+        }
+}
+
+
+/**
+ * Gets the pieces of a buffer. A buffer whose bytes are in its data becomes
+ * a buffer of one piece (its data becomes a chunk).
+ * @param a_buffer : a buffer that is not spilled
+ * @return its pieces
+ */
+static GArray *get_pieces(fcl_buf_t *a_buffer)
+{
+    fcl_piece_t piece;
+
+    if (a_buffer->pieces == NULL)
+        {
+            a_buffer->pieces = g_array_new(FALSE, FALSE, sizeof(fcl_piece_t));
+
+            if (a_buffer->size > 0)
+                {
+                    piece.source = NULL;
+                    piece.chunk = chunk_new(a_buffer->data, a_buffer->size);
+                    piece.offset = 0;
+                    piece.size = a_buffer->size;
+                    g_array_append_val(a_buffer->pieces, piece);
+                }
+            else
+                {
+                    g_free(a_buffer->data);
+                }
+
+            a_buffer->data = NULL;
+        }
+
+    return a_buffer->pieces;
+}
+
+
+/**
+ * Splits the piece of a buffer that holds a position so that a piece begins
+ * there. Both parts of a piece in memory use its chunk, that is not shared
+ * for that since they are in the same buffer.
+ * @param a_buffer : a buffer made of pieces
+ * @param position : a position in the buffer (at most its size)
+ * @return the index of the piece that begins at position (the number of
+ *         pieces if position is the end of the buffer)
+ */
+static guint split_at(fcl_buf_t *a_buffer, gsize position)
+{
+    GArray *pieces = a_buffer->pieces;
+    fcl_piece_t *piece = NULL;
+    fcl_piece_t tail;
+    gsize begin = 0;
+    gsize cut = 0;
+    guint i = 0;
+
+    while (i < pieces->len && begin + g_array_index(pieces, fcl_piece_t, i).size <= position)
+        {
+            begin = begin + g_array_index(pieces, fcl_piece_t, i).size;
+            i++;
+        }
+
+    if (i == pieces->len || begin == position)
+        {
+            return i;
+        }
+
+    piece = &g_array_index(pieces, fcl_piece_t, i);
+    cut = position - begin;
+
+    tail.source = piece->source != NULL ? fcl_source_ref(piece->source) : NULL;
+    tail.chunk = piece->chunk != NULL ? chunk_ref(piece->chunk, FALSE) : NULL;
+    tail.offset = piece->offset + (goffset) cut;
+    tail.size = piece->size - cut;
+
+    piece->size = cut;
+    g_array_insert_val(pieces, i + 1, tail);
+
+    return i + 1;
+}
+
+
+/**
+ * Frees what a piece removed from a buffer holds
+ * @param a_buffer : the buffer the piece was removed from
+ * @param piece : the piece
+ */
+static void clear_piece(fcl_buf_t *a_buffer, fcl_piece_t *piece)
+{
+    fcl_source_unref(piece->source);
+
+    if (piece->chunk != NULL)
+        {
+            chunk_unref(piece->chunk, g_atomic_int_get(&piece->chunk->ref_count) == 1 || holds_chunk(a_buffer->pieces, a_buffer->pieces->len, piece->chunk) == FALSE);
+        }
+}
+
+
+/**
+ * Turns a buffer made of pieces back into plain bytes in memory once none of
+ * its pieces is in a source file or in a chunk shared with another buffer
+ * @param a_buffer : a buffer made of pieces
+ */
+static void back_to_memory(fcl_buf_t *a_buffer)
+{
+    fcl_piece_t *piece = NULL;
+    guchar *data = NULL;
+    gsize done = 0;
+    guint i = 0;
+
+    for (i = 0; i < a_buffer->pieces->len; i++)
+        {
+            piece = &g_array_index(a_buffer->pieces, fcl_piece_t, i);
+
+            if (piece->source != NULL || chunk_is_shared(piece->chunk) == TRUE)
+                {
+                    return;
+                }
+        }
+
+    data = (guchar *) g_malloc(a_buffer->size * sizeof(guchar));
+
+    for (i = 0; i < a_buffer->pieces->len; i++)
+        {
+            piece = &g_array_index(a_buffer->pieces, fcl_piece_t, i);
+            memcpy(data + done, piece->chunk->data + piece->offset, piece->size);
+            done = done + piece->size;
+        }
+
+    fcl_pieces_free(a_buffer);
+    a_buffer->data = data;
+}
+
+
+/**
+ * Says whether one of the first pieces of a buffer uses a chunk
+ * @param pieces : the pieces of the buffer
+ * @param n : number of pieces looked at
+ * @param chunk : the chunk
+ * @return TRUE if one of the n first pieces is in chunk
+ */
+static gboolean holds_chunk(GArray *pieces, guint n, fcl_chunk_t *chunk)
+{
+    guint i = 0;
+
+    for (i = 0; i < n; i++)
+        {
+            if (g_array_index(pieces, fcl_piece_t, i).chunk == chunk)
+                {
+                    return TRUE;
+                }
+        }
+
+    return FALSE;
+}
+
+
+/**
+ * Creates a chunk
+ * @param data : the bytes (the chunk takes them)
+ * @param size : number of bytes
+ * @return a new fcl_chunk_t with one reference and one user
+ */
+static fcl_chunk_t *chunk_new(guchar *data, gsize size)
+{
+    fcl_chunk_t *chunk = NULL;
+
+    chunk = (fcl_chunk_t *) g_malloc0(sizeof(fcl_chunk_t));
+    chunk->ref_count = 1;
+    chunk->users = 1;
+    chunk->size = size;
+    chunk->data = data;
+
+    return chunk;
+}
+
+
+/**
+ * Adds a reference to a chunk. Its bytes are counted as shared from its
+ * second user on.
+ * @param chunk : the chunk
+ * @param new_user : TRUE if the piece goes in a buffer that did not use chunk
+ * @return chunk
+ */
+static fcl_chunk_t *chunk_ref(fcl_chunk_t *chunk, gboolean new_user)
+{
+    g_atomic_int_inc(&chunk->ref_count);
+
+    if (new_user == TRUE && g_atomic_int_add(&chunk->users, 1) == 1)
+        {
+            g_mutex_lock(&shared_lock);
+            shared_bytes = shared_bytes + chunk->size;
+            g_mutex_unlock(&shared_lock);
+        }
+
+    return chunk;
+}
+
+
+/**
+ * Removes a reference to a chunk, freeing it with the last one
+ * @param chunk : the chunk
+ * @param last_use : TRUE if no other piece of the buffer uses chunk
+ */
+static void chunk_unref(fcl_chunk_t *chunk, gboolean last_use)
+{
+    if (last_use == TRUE && g_atomic_int_add(&chunk->users, -1) == 2)
+        {
+            g_mutex_lock(&shared_lock);
+            shared_bytes = shared_bytes - chunk->size;
+            g_mutex_unlock(&shared_lock);
+        }
+
+    if (g_atomic_int_dec_and_test(&chunk->ref_count) == TRUE)
+        {
+            g_free(chunk->data);
+            g_free(chunk);
+        }
+}
+
+
+/**
+ * Says whether a chunk is used by more than one buffer. A chunk that is not
+ * shared may be appended to by the buffer that uses it.
+ * @param chunk : the chunk
+ * @return TRUE if the chunk is shared
+ */
+static gboolean chunk_is_shared(fcl_chunk_t *chunk)
+{
+    return g_atomic_int_get(&chunk->users) > 1;
+}
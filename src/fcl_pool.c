@@ -0,0 +1,264 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_pool.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_pool.c
+ * Pool of the open files : the files whose backend is open, the last one
+ * openned first.
+ *
+ * The pool is only changed when a backend is openned (or openned again). A
+ * read only stamps its file with the pool clock, that ticks at each
+ * opening, without taking any lock. When there are more open files than the
+ * limit, the backends of the files with the oldest stamps are released
+ * (their streams or their file descriptor are closed). They are openned
+ * again, lazily, the next time the file is read (see fcl_backend.c). The
+ * backends that never need to be released (memory) are not in the pool. A
+ * backend that stays open when released (a GIO stream replacing its file)
+ * stays in the pool and the next file is released instead.
+ *
+ * The backend of a file is read under its backend_lock (reader). A file
+ * releasing the backend of another one only tries to take its lock (writer) :
+ * a file in use is skipped and the next one in the pool is released instead.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+/**
+ * @struct pool_entry_t
+ * A file of the pool and its stamp, when looking for the ones to release
+ */
+typedef struct
+{
+    fcl_file_t *a_file;  /**< The file                                 */
+    guint used;          /**< Its stamp (see fcl_pool_touch())         */
+    guint rank;          /**< Its rank in the pool, the oldest first   */
+} pool_entry_t;
+
+
+static gint cmp_used(gconstpointer a, gconstpointer b);
+static gboolean release_backend(fcl_file_t *a_file);
+
+static GMutex pool_lock;        /** Protects pool and max_open                */
+static GQueue pool;             /** Files with an open backend, last openned first */
+static guint max_open = 0;      /** Maximum number of open files (0 : none)   */
+static guint pool_clock = 0;    /** Ticks at each opening (atomic, wraps)     */
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Sets the maximum number of files whose streams may be open at once (see
+ * fcl.h)
+ * @param n_files : the number of files (0 means no limit)
+ */
+void fcl_set_max_open_files(guint n_files)
+{
+    g_mutex_lock(&pool_lock);
+    max_open = n_files;
+    g_mutex_unlock(&pool_lock);
+}
+
+
+/**
+ * Gets the maximum number of files whose streams may be open at once
+ * @return the number of files (0 means no limit)
+ */
+guint fcl_get_max_open_files(void)
+{
+    guint n_files = 0;
+
+    g_mutex_lock(&pool_lock);
+    n_files = max_open;
+    g_mutex_unlock(&pool_lock);
+
+    return n_files;
+}
+
+
+/**
+ * Gets the number of files whose streams are open
+ * @return the number of files
+ */
+guint fcl_get_open_files(void)
+{
+    guint n_files = 0;
+
+    g_mutex_lock(&pool_lock);
+    n_files = g_queue_get_length(&pool);
+    g_mutex_unlock(&pool_lock);
+
+    return n_files;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Puts a file whose backend was just openned in the pool and releases the
+ * backends of the files used the longest time ago if there are too many (see
+ * fcl_internal.h)
+ * @param a_file : the file (its backend_lock is held for reading)
+ */
+void fcl_pool_use(fcl_file_t *a_file)
+{
+    GArray *entries = NULL;
+    pool_entry_t entry;
+    GList *link = NULL;
+    guint i = 0;
+
+    g_mutex_lock(&pool_lock);
+
+    g_atomic_int_inc(&pool_clock);
+    fcl_pool_touch(a_file);
+
+    if (a_file->pool == NULL)
+        {
+            g_queue_push_head(&pool, a_file);
+            a_file->pool = g_queue_peek_head_link(&pool);
+        }
+
+    if (max_open > 0 && g_queue_get_length(&pool) > max_open)
+        {
+            /* The stamps are read once : the files may be read meanwhile */
+            entries = g_array_sized_new(FALSE, FALSE, sizeof(pool_entry_t), g_queue_get_length(&pool));
+
+            for (link = g_queue_peek_tail_link(&pool); link != NULL; link = link->prev)
+                {
+                    entry.a_file = (fcl_file_t *) link->data;
+                    entry.used = g_atomic_int_get(&entry.a_file->used);
+                    entry.rank = entries->len;
+
+                    if (entry.a_file != a_file)
+                        {
+                            g_array_append_val(entries, entry);
+                        }
+                }
+
+            g_array_sort(entries, cmp_used);
+
+            for (i = 0; i < entries->len && g_queue_get_length(&pool) > max_open; i++)
+                {
+                    release_backend(g_array_index(entries, pool_entry_t, i).a_file);
+                }
+
+            g_array_free(entries, TRUE);
+        }
+
+    g_mutex_unlock(&pool_lock);
+}
+
+
+/**
+ * Stamps a file that is read with the pool clock (see fcl_internal.h)
+ * @param a_file : the file
+ */
+void fcl_pool_touch(fcl_file_t *a_file)
+{
+    guint now = g_atomic_int_get(&pool_clock);
+
+    /* Only written once between two openings */
+    if (g_atomic_int_get(&a_file->used) != now)
+        {
+            g_atomic_int_set(&a_file->used, now);
+        }
+}
+
+
+/**
+ * Takes a file that is being closed out of the pool (see fcl_internal.h)
+ * @param a_file : the file
+ */
+void fcl_pool_leave(fcl_file_t *a_file)
+{
+    g_mutex_lock(&pool_lock);
+
+    if (a_file->pool != NULL)
+        {
+            g_queue_delete_link(&pool, a_file->pool);
+            a_file->pool = NULL;
+        }
+
+    g_mutex_unlock(&pool_lock);
+}
+
+
+/**
+ * Compares two files of the pool : the one used the longest time ago first,
+ * then the one openned the longest time ago. The pool clock wraps : the
+ * stamps are compared by their difference, that stays right as long as two
+ * stamps are less than G_MAXINT openings apart.
+ * @param a : a pool_entry_t
+ * @param b : another pool_entry_t
+ * @return a negative value if a goes before b, a positive one otherwise
+ */
+static gint cmp_used(gconstpointer a, gconstpointer b)
+{
+    const pool_entry_t *first = (const pool_entry_t *) a;
+    const pool_entry_t *second = (const pool_entry_t *) b;
+
+    if (first->used != second->used)
+        {
+            return (gint) (first->used - second->used) < 0 ? -1 : 1;
+        }
+
+    return first->rank < second->rank ? -1 : 1;
+}
+
+
+/**
+ * Releases the backend of a file of the pool unless it is in use and takes
+ * it out of the pool
+ * @param a_file : the file
+ * @return TRUE if it was released, FALSE if the file is in use or if its
+ *         backend stays open
+ */
+static gboolean release_backend(fcl_file_t *a_file)
+{
+    if (g_rw_lock_writer_trylock(&a_file->backend_lock) == FALSE)
+        {
+            return FALSE;
+        }
+
+    a_file->backend->release(a_file->backend);
+
+    if (a_file->backend->is_open == TRUE)
+        {
+            g_rw_lock_writer_unlock(&a_file->backend_lock);
+            return FALSE;
+        }
+
+    g_queue_delete_link(&pool, a_file->pool);
+    a_file->pool = NULL;
+
+    /* The file may be in use by another thread */
+    g_mutex_lock(&a_file->perf_lock);
+    a_file->perf->pool_closes = a_file->perf->pool_closes + 1;
+    g_mutex_unlock(&a_file->perf_lock);
+
+    g_rw_lock_writer_unlock(&a_file->backend_lock);
+
+    return TRUE;
+}
@@ -0,0 +1,390 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_record.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_record.c
+ * Recording of the calls made to the library (fcl_record_start()) so that a
+ * real session can be replayed later (benchlibfcl --replay).
+ *
+ * Format (integers are unsigned LEB128 varints, negative positions are
+ * written as their two's complement) :
+ *  - LIBFCL_RECORD_MAGIC and a version byte (LIBFCL_RECORD_VERSION),
+ *  - one record for each call : the call (LIBFCL_RECORD_OPEN...), the number
+ *    of the file (files are numbered from 0 in the order the recorder first
+ *    sees them), the time elapsed since the begining of the previous call and
+ *    the time taken by the call (both in microseconds) and its arguments :
+ *     - OPEN : the mode, the size of the path and the path,
+ *     - CLOSE : save (0 or 1),
+ *     - READ : the position, the size asked for and the size read,
+ *     - OVERWRITE : the position, the size asked for and the size written,
+ *     - INSERT : the position and the size,
+ *     - DELETE : the position, the size asked for and the size deleted,
+ *     - REPLACE_ALL : the number of occurrences replaced, the size of the
+ *       pattern and the pattern and the size of the replacement and the
+ *       replacement,
+ *     - COPY and MOVE : the position of the range, its size and the position
+ *       where it goes.
+ *
+ * The bytes inserted or overwritten are not recorded (only their number) :
+ * a trace tells how the library is driven, not what the files contain.
+ * A file already openned when the recording starts gets an OPEN record
+ * (taking no time) the first time it is used.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#include <glib/gstdio.h>
+
+/**
+ * @def LIBFCL_RECORD_BUFFER_SIZE
+ * Size of the buffer of the trace stream
+ */
+#define LIBFCL_RECORD_BUFFER_SIZE 65536
+
+
+/**
+ * @struct fcl_recorder_t
+ * The trace being recorded
+ */
+typedef struct
+{
+    FILE *stream;            /**< The trace                                   */
+    GHashTable *files;       /**< Number of each file seen (fcl_file_t *)     */
+    guint n_files;           /**< Number of files seen                        */
+    gint64 last;             /**< Begining of the previous call recorded      */
+} fcl_recorder_t;
+
+
+static void put_varint(FILE *stream, guint64 value);
+static void put_bytes(FILE *stream, const guchar *data, gsize size);
+static gboolean begin_record(gint call, gconstpointer a_file, gint64 start, gint64 end);
+static guint file_number(fcl_file_t *a_file, gint64 start, gint64 end);
+
+static gint recording = 0;                 /** TRUE while recorder.stream is openned */
+static GMutex recorder_lock;               /** Protects recorder                     */
+static fcl_recorder_t recorder = {NULL, NULL, 0, 0};
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Starts recording the calls to the library (see fcl.h)
+ * @param trace_path : path of the trace to be written
+ * @return TRUE if the recording started, FALSE otherwise
+ */
+gboolean fcl_record_start(const gchar *trace_path)
+{
+    FILE *stream = NULL;
+    guchar version = LIBFCL_RECORD_VERSION;
+
+    if (trace_path == NULL)
+        {
+            return FALSE;
+        }
+
+    g_mutex_lock(&recorder_lock);
+
+    if (recorder.stream != NULL)
+        {
+            g_mutex_unlock(&recorder_lock);
+            fprintf(stderr, Q_("Calls are already recorded\n"));
+            return FALSE;
+        }
+
+    stream = g_fopen(trace_path, "wb");
+
+    if (stream == NULL)
+        {
+            g_mutex_unlock(&recorder_lock);
+            fprintf(stderr, Q_("Unable to create the trace '%s'\n"), trace_path);
+            return FALSE;
+        }
+
+    setvbuf(stream, NULL, _IOFBF, LIBFCL_RECORD_BUFFER_SIZE);
+    put_bytes(stream, (const guchar *) LIBFCL_RECORD_MAGIC, 4);
+    put_bytes(stream, &version, 1);
+
+    recorder.stream = stream;
+    recorder.files = g_hash_table_new(g_direct_hash, g_direct_equal);
+    recorder.n_files = 0;
+    recorder.last = g_get_monotonic_time();
+
+    g_atomic_int_set(&recording, TRUE);
+
+    g_mutex_unlock(&recorder_lock);
+
+    return TRUE;
+}
+
+
+/**
+ * Stops recording the calls to the library (see fcl.h)
+ */
+void fcl_record_stop(void)
+{
+    g_mutex_lock(&recorder_lock);
+
+    if (recorder.stream != NULL)
+        {
+            g_atomic_int_set(&recording, FALSE);
+
+            if (fclose(recorder.stream) != 0)
+                {
+                    fprintf(stderr, Q_("Unable to write the trace\n"));
+                }
+
+            g_hash_table_destroy(recorder.files);
+            recorder.stream = NULL;
+            recorder.files = NULL;
+        }
+
+    g_mutex_unlock(&recorder_lock);
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Records the openning of a file (see fcl_internal.h)
+ * @param a_file : the file openned
+ * @param start : time (g_get_monotonic_time()) when the openning began
+ * @param end : time when it ended
+ */
+void fcl_record_open(fcl_file_t *a_file, gint64 start, gint64 end)
+{
+    if (g_atomic_int_get(&recording) == FALSE || a_file == NULL)
+        {
+            return;
+        }
+
+    g_mutex_lock(&recorder_lock);
+
+    if (recorder.stream != NULL)
+        {
+            /* The file is numbered (and its OPEN record written) here */
+            file_number(a_file, start, end);
+        }
+
+    g_mutex_unlock(&recorder_lock);
+}
+
+
+/**
+ * Records a call that only has numbers as arguments (see fcl_internal.h)
+ * @param call : the call (LIBFCL_RECORD_READ...)
+ * @param a_file : the file
+ * @param start : time (g_get_monotonic_time()) when the call began
+ * @param n_args : number of arguments
+ * @param a : first argument
+ * @param b : second argument
+ * @param c : third argument
+ */
+void fcl_record_call(gint call, fcl_file_t *a_file, gint64 start, gint n_args, guint64 a, guint64 b, guint64 c)
+{
+    guint64 args[3];
+    gint i = 0;
+
+    if (g_atomic_int_get(&recording) == FALSE || a_file == NULL)
+        {
+            return;
+        }
+
+    args[0] = a;
+    args[1] = b;
+    args[2] = c;
+
+    g_mutex_lock(&recorder_lock);
+
+    if (recorder.stream != NULL)
+        {
+            file_number(a_file, start, start);
+
+            if (begin_record(call, a_file, start, g_get_monotonic_time()) == TRUE)
+                {
+                    for (i = 0; i < n_args && i < 3; i++)
+                        {
+                            put_varint(recorder.stream, args[i]);
+                        }
+                }
+        }
+
+    g_mutex_unlock(&recorder_lock);
+}
+
+
+/**
+ * Records the closing of a file (see fcl_internal.h)
+ * @param a_file : the file being closed (only its address is used)
+ * @param save : save argument of the call
+ * @param start : time (g_get_monotonic_time()) when the call began
+ */
+void fcl_record_close(gconstpointer a_file, gboolean save, gint64 start)
+{
+    if (g_atomic_int_get(&recording) == FALSE)
+        {
+            return;
+        }
+
+    g_mutex_lock(&recorder_lock);
+
+    /* A file that was not used while recording is not in the trace */
+    if (recorder.stream != NULL && begin_record(LIBFCL_RECORD_CLOSE, a_file, start, g_get_monotonic_time()) == TRUE)
+        {
+            put_varint(recorder.stream, save == TRUE ? 1 : 0);
+            g_hash_table_remove(recorder.files, a_file);
+        }
+
+    g_mutex_unlock(&recorder_lock);
+}
+
+
+/**
+ * Records a call to fcl_replace_all() (see fcl_internal.h)
+ * @param a_file : the file
+ * @param start : time (g_get_monotonic_time()) when the call began
+ * @param pattern : the bytes looked for
+ * @param len : the number of bytes in pattern
+ * @param replacement : the bytes that replaced each occurrence
+ * @param replacement_len : the number of bytes in replacement
+ * @param count : what the call returned
+ */
+void fcl_record_replace_all(fcl_file_t *a_file, gint64 start, const guchar *pattern, gsize len, const guchar *replacement, gsize replacement_len, goffset count)
+{
+    if (g_atomic_int_get(&recording) == FALSE || a_file == NULL)
+        {
+            return;
+        }
+
+    g_mutex_lock(&recorder_lock);
+
+    if (recorder.stream != NULL)
+        {
+            file_number(a_file, start, start);
+
+            if (begin_record(LIBFCL_RECORD_REPLACE_ALL, a_file, start, g_get_monotonic_time()) == TRUE)
+                {
+                    put_varint(recorder.stream, (guint64) count);
+                    put_varint(recorder.stream, len);
+                    put_bytes(recorder.stream, pattern, len);
+                    put_varint(recorder.stream, replacement_len);
+                    put_bytes(recorder.stream, replacement, replacement_len);
+                }
+        }
+
+    g_mutex_unlock(&recorder_lock);
+}
+
+
+/**
+ * Writes the first fields of a record (recorder_lock must be held)
+ * @param call : the call (LIBFCL_RECORD_OPEN...)
+ * @param a_file : the file (it must already have a number)
+ * @param start : time (g_get_monotonic_time()) when the call began
+ * @param end : time when the call ended
+ * @return FALSE if the file has no number (nothing is written)
+ */
+static gboolean begin_record(gint call, gconstpointer a_file, gint64 start, gint64 end)
+{
+    gpointer number = NULL;
+
+    if (g_hash_table_lookup_extended(recorder.files, a_file, NULL, &number) == FALSE)
+        {
+            return FALSE;
+        }
+
+    put_varint(recorder.stream, (guint64) call);
+    put_varint(recorder.stream, (guint64) GPOINTER_TO_UINT(number));
+    put_varint(recorder.stream, (guint64) MAX(start - recorder.last, 0));
+    put_varint(recorder.stream, (guint64) MAX(end - start, 0));
+
+    recorder.last = MAX(start, recorder.last);
+
+    return TRUE;
+}
+
+
+/**
+ * Gets the number of a file. A file seen for the first time is given the
+ * next number and an OPEN record is written (recorder_lock must be held).
+ * @param a_file : the file
+ * @param start : time (g_get_monotonic_time()) when the call began
+ * @param end : time when the openning ended (start for a file openned before
+ *              the recording started)
+ * @return the number of the file
+ */
+static guint file_number(fcl_file_t *a_file, gint64 start, gint64 end)
+{
+    gpointer number = NULL;
+    gsize len = 0;
+
+    if (g_hash_table_lookup_extended(recorder.files, a_file, NULL, &number) == FALSE)
+        {
+            number = GUINT_TO_POINTER(recorder.n_files);
+            recorder.n_files = recorder.n_files + 1;
+            g_hash_table_insert(recorder.files, a_file, number);
+
+            len = a_file->name != NULL ? strlen(a_file->name) : 0;
+
+            begin_record(LIBFCL_RECORD_OPEN, a_file, start, end);
+            put_varint(recorder.stream, (guint64) a_file->mode);
+            put_varint(recorder.stream, len);
+            put_bytes(recorder.stream, (const guchar *) a_file->name, len);
+        }
+
+    return GPOINTER_TO_UINT(number);
+}
+
+
+/**
+ * Writes an unsigned LEB128 varint
+ * @param stream : the trace
+ * @param value : the number to be written
+ */
+static void put_varint(FILE *stream, guint64 value)
+{
+    while (value >= 0x80)
+        {
+            putc((gint) ((value & 0x7f) | 0x80), stream);
+            value = value >> 7;
+        }
+
+    putc((gint) value, stream);
+}
+
+
+/**
+ * Writes bytes
+ * @param stream : the trace
+ * @param data : the bytes (may be NULL if size is 0)
+ * @param size : the number of bytes
+ */
+static void put_bytes(FILE *stream, const guchar *data, gsize size)
+{
+    if (size > 0)
+        {
+            fwrite(data, sizeof(guchar), size, stream);
+        }
+}
@@ -0,0 +1,251 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_regex.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_regex.c
+ * Searching a regular expression in the edited file.
+ *
+ * The expression is compiled with GRegex in raw mode (bytes, not UTF-8) and
+ * run over a window that slides along the edited file. A match is limited to
+ * max_size bytes : a match found at s is only trusted when the window holds
+ * at least max_size bytes from s on (or reaches the end of the file), because
+ * a match that would begin before s may need more bytes than the window had.
+ * Otherwise the window slides and the expression is run again. The window
+ * also keeps a few bytes before the position searched so that look-behinds
+ * and \b work across the slides.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+/**
+ * @def LIBFCL_REGEX_MAX_MATCH_SIZE
+ * Maximum size of a match when none is given to fcl_regex_find_all()
+ *
+ * @def LIBFCL_REGEX_CONTEXT_SIZE
+ * Number of bytes kept before the position searched (for look-behinds)
+ */
+#define LIBFCL_REGEX_MAX_MATCH_SIZE 65536
+#define LIBFCL_REGEX_CONTEXT_SIZE 256
+
+
+/**
+ * @struct fcl_regex_iter_t
+ * State of a search of a regular expression in the edited file
+ */
+struct _fcl_regex_iter_t
+{
+    GRegex *regex;              /**< The compiled expression                          */
+    fcl_view_t *view;           /**< View on the edited file                          */
+    gsize max_size;             /**< Maximum size of a match                          */
+    guchar *window;             /**< Bytes of the edited file being searched          */
+    gsize capacity;             /**< Size of the window buffer                        */
+    gsize window_size;          /**< Number of valid bytes in the window              */
+    goffset window_position;    /**< Position of the window in the edited file        */
+    goffset position;           /**< Where the next match may begin                   */
+};
+
+
+static gsize slide_window(fcl_regex_iter_t *iter);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Begins the search of a regular expression in the edited file (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param pattern : the regular expression (PCRE syntax, on bytes)
+ * @param from : position where the search begins
+ * @param max_size : maximum size of a match (0 for the default)
+ * @return a newly allocated fcl_regex_iter_t or NULL on error
+ */
+fcl_regex_iter_t *fcl_regex_find_all(fcl_file_t *a_file, const gchar *pattern, goffset from, gsize max_size)
+{
+    fcl_regex_iter_t *iter = NULL;
+    GRegex *regex = NULL;
+    GError *error = NULL;
+
+    if (a_file == NULL || pattern == NULL || from < 0)
+        {
+            return NULL;
+        }
+
+    regex = g_regex_new(pattern, G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, &error);
+
+    if (regex == NULL)
+        {
+            fprintf(stderr, Q_("Unable to compile the regular expression '%s' : %s\n"), pattern, error->message);
+            g_error_free(error);
+            return NULL;
+        }
+
+    if (max_size == 0)
+        {
+            max_size = LIBFCL_REGEX_MAX_MATCH_SIZE;
+        }
+
+    iter = (fcl_regex_iter_t *) g_malloc0(sizeof(fcl_regex_iter_t));
+
+    iter->regex = regex;
+    iter->view = fcl_view_new(a_file);
+    iter->max_size = max_size;
+    iter->capacity = MAX(LIBFCL_VIEW_WINDOW_SIZE, LIBFCL_REGEX_CONTEXT_SIZE + 4 * max_size);
+    iter->window = (guchar *) g_malloc(iter->capacity * sizeof(guchar));
+    iter->window_size = 0;
+    iter->window_position = 0;
+    iter->position = from;
+
+    return iter;
+}
+
+
+/**
+ * Gets the next match (see fcl.h)
+ * @param iter : the search
+ * @param[out] position_pointer : position of the match in the edited file
+ * @param[out] size_pointer : size of the match
+ * @return TRUE if a match was found, FALSE at the end of the file
+ */
+gboolean fcl_regex_iter_next(fcl_regex_iter_t *iter, goffset *position_pointer, gsize *size_pointer)
+{
+    GMatchInfo *match_info = NULL;
+    GRegexMatchFlags flags = 0;
+    gboolean at_end = FALSE;
+    gboolean found = FALSE;
+    gsize resolved = 0;   /** no match was missed before this offset of the window */
+    gint start = 0;
+    gint end = 0;
+
+    if (iter == NULL)
+        {
+            return FALSE;
+        }
+
+    while (iter->position <= iter->view->size)
+        {
+            at_end = iter->window_position + (goffset) iter->window_size >= iter->view->size;
+
+            /* A window that is not full before the end was read short */
+            if (iter->window_size == 0 || iter->position - iter->window_position > LIBFCL_REGEX_CONTEXT_SIZE || (at_end == FALSE && iter->window_size < iter->capacity))
+                {
+                    if (slide_window(iter) == 0 && iter->window_position + (goffset) iter->window_size < iter->view->size)
+                        {
+                            /* The file can not be read any more : no match
+                             * can be resolved */
+                            iter->position = iter->view->size + 1;
+                            return FALSE;
+                        }
+
+                    at_end = iter->window_position + (goffset) iter->window_size >= iter->view->size;
+                }
+
+            flags = 0;
+
+            if (iter->window_position > 0)
+                {
+                    flags = flags | G_REGEX_MATCH_NOTBOL;
+                }
+
+            if (at_end == FALSE)
+                {
+                    flags = flags | G_REGEX_MATCH_NOTEOL;
+                }
+
+            found = g_regex_match_full(iter->regex, (const gchar *) iter->window, iter->window_size, iter->position - iter->window_position, flags, &match_info, NULL);
+            g_match_info_fetch_pos(match_info, 0, &start, &end);
+            g_match_info_free(match_info);
+
+            resolved = iter->window_size >= iter->max_size ? iter->window_size - iter->max_size + 1 : 0;
+
+            if (found == TRUE && (at_end == TRUE || (gsize) start < resolved))
+                {
+                    *position_pointer = iter->window_position + start;
+                    *size_pointer = (gsize) (end - start);
+
+                    /* An empty match must not be found again */
+                    iter->position = iter->window_position + MAX(end, start + 1);
+
+                    return TRUE;
+                }
+            else if (at_end == TRUE)
+                {
+                    iter->position = iter->view->size + 1;
+                }
+            else
+                {
+                    /* Nothing begins before resolved : sliding to the remaining part */
+                    iter->position = MAX(iter->position, iter->window_position + (goffset) resolved);
+                }
+        }
+
+    return FALSE;
+}
+
+
+/**
+ * Ends a search (see fcl.h)
+ * @param iter : the search to be freed
+ */
+void fcl_regex_iter_free(fcl_regex_iter_t *iter)
+{
+    if (iter != NULL)
+        {
+            g_regex_unref(iter->regex);
+            fcl_view_free(iter->view);
+            g_free(iter->window);
+            g_free(iter);
+        }
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Slides the window so that it begins LIBFCL_REGEX_CONTEXT_SIZE bytes before
+ * the position searched and fills it. The bytes already in the window are
+ * kept.
+ * @param iter : the search
+ * @return the number of bytes read into the window
+ */
+static gsize slide_window(fcl_regex_iter_t *iter)
+{
+    goffset position = MAX(iter->position - LIBFCL_REGEX_CONTEXT_SIZE, 0);
+    goffset kept_end = iter->window_position + (goffset) iter->window_size;
+    gsize kept = 0;
+    gsize read = 0;
+
+    if (iter->window_size > 0 && position >= iter->window_position && position < kept_end)
+        {
+            kept = (gsize) (kept_end - position);
+            memmove(iter->window, iter->window + (position - iter->window_position), kept);
+        }
+
+    read = fcl_view_read(iter->view, position + kept, iter->window + kept, iter->capacity - kept);
+
+    iter->window_position = position;
+    iter->window_size = kept + read;
+
+    return read;
+}
@@ -0,0 +1,391 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_render.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_render.c
+ * Hexadecimal and ASCII rendering of a viewport of the edited file.
+ *
+ * The bytes of the viewport are copied once through a view and then turned
+ * into text 16 or 32 bytes at a time (SSE2 or AVX2 when available) : both
+ * nibbles of each byte are converted to their hexadecimal digits with a
+ * compare and an add, the printable bytes (0x20 to 0x7E) are kept in the
+ * ASCII column and the others are replaced by '.'. When the differences are
+ * asked for, the bytes are compared with the ones at the same offset in the
+ * file on disk in the same pass.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define LIBFCL_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define LIBFCL_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/**
+ * @def LIBFCL_RENDER_OFFSET_DIGITS
+ * Number of hexadecimal digits of the position at the begining of a row
+ */
+#define LIBFCL_RENDER_OFFSET_DIGITS 16
+
+
+static const gchar lower_digits[] = "0123456789abcdef";
+static const gchar upper_digits[] = "0123456789ABCDEF";
+
+static void render_bytes(const guchar *data, const guchar *orig, gsize size, gchar *hex, gchar *ascii, gboolean upper);
+static void render_bytes_scalar(const guchar *data, const guchar *orig, gsize size, gchar *hex, gboolean upper);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Gets the size of the buffer needed by fcl_render_hex() (see fcl.h)
+ * @param rows : number of rows of the viewport
+ * @param cols : number of bytes in a row
+ * @param flags : the flags given to fcl_render_hex()
+ * @return the number of characters (with the final '\0')
+ */
+gsize fcl_render_hex_size(guint rows, guint cols, gint flags)
+{
+    gsize row_size = 4 * (gsize) cols + 2;   /** "hh " per byte, ' ', ASCII and '\n' */
+
+    if (flags & LIBFCL_RENDER_OFFSET)
+        {
+            row_size = row_size + LIBFCL_RENDER_OFFSET_DIGITS + 2;
+        }
+
+    return (gsize) rows * row_size + 1;
+}
+
+
+/**
+ * Renders a viewport of the edited file in hexadecimal and ASCII (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param offset : position of the first byte of the viewport
+ * @param rows : number of rows of the viewport
+ * @param cols : number of bytes in a row
+ * @param out : buffer of at least fcl_render_hex_size(rows, cols, flags)
+ *              characters
+ * @param flags : LIBFCL_RENDER_OFFSET, LIBFCL_RENDER_UPPER and
+ *                LIBFCL_RENDER_DIFF or'ed together (or 0)
+ * @return the number of characters written (without the final '\0')
+ */
+gsize fcl_render_hex(fcl_file_t *a_file, goffset offset, guint rows, guint cols, gchar *out, gint flags)
+{
+    fcl_view_t *view = NULL;
+    const gchar *digits = (flags & LIBFCL_RENDER_UPPER) ? upper_digits : lower_digits;
+    guchar *data = NULL;
+    guchar *orig = NULL;
+    gchar *row = out;
+    goffset position = 0;
+    gsize size = (gsize) rows * cols;
+    gsize read = 0;
+    gsize orig_read = 0;
+    gsize i = 0;
+    gsize n = 0;
+    gint d = 0;
+
+    if (out == NULL)
+        {
+            return 0;
+        }
+
+    out[0] = '\0';
+
+    if (a_file == NULL || offset < 0 || size == 0)
+        {
+            return 0;
+        }
+
+    view = fcl_view_new(a_file);
+    data = (guchar *) g_malloc(size * sizeof(guchar));
+    read = fcl_view_read(view, offset, data, size);
+
+    if (flags & LIBFCL_RENDER_DIFF)
+        {
+            orig = (guchar *) g_malloc(size * sizeof(guchar));
+
+            if (offset < view->real_size)
+                {
+                    orig_read = fcl_view_read_original(view, offset, orig, MIN(read, (gsize) (view->real_size - offset)));
+                }
+
+            /* Bytes that are not on disk differ from whatever they are */
+            for (i = orig_read; i < read; i++)
+                {
+                    orig[i] = ~data[i];
+                }
+        }
+
+    fcl_view_free(view);
+
+    for (i = 0; i < read; i = i + cols)
+        {
+            n = MIN((gsize) cols, read - i);
+
+            if (flags & LIBFCL_RENDER_OFFSET)
+                {
+                    position = offset + (goffset) i;
+
+                    for (d = LIBFCL_RENDER_OFFSET_DIGITS - 1; d >= 0; d--)
+                        {
+                            row[d] = digits[position & 0xF];
+                            position = position >> 4;
+                        }
+
+                    row[LIBFCL_RENDER_OFFSET_DIGITS] = ' ';
+                    row[LIBFCL_RENDER_OFFSET_DIGITS + 1] = ' ';
+                    row = row + LIBFCL_RENDER_OFFSET_DIGITS + 2;
+                }
+
+            render_bytes(data + i, orig != NULL ? orig + i : NULL, n, row, row + 3 * cols + 1, (flags & LIBFCL_RENDER_UPPER) != 0);
+
+            /* The last row may be short : it is padded so that the ASCII
+             * column stays aligned */
+            memset(row + 3 * n, ' ', 3 * (cols - n) + 1);
+            memset(row + 3 * cols + 1 + n, ' ', cols - n);
+            row[4 * cols + 1] = '\n';
+            row = row + 4 * cols + 2;
+        }
+
+    *row = '\0';
+
+    g_free(data);
+    g_free(orig);
+
+    return (gsize) (row - out);
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Replaces the bytes that are not printable by '.' (see fcl_internal.h)
+ * @param data : the bytes
+ * @param size : number of bytes
+ * @param ascii : where to write the size characters
+ */
+void fcl_render_ascii(const guchar *data, gsize size, gchar *ascii)
+{
+    gsize i = 0;
+#ifdef LIBFCL_HAVE_SSE2
+    __m128i bytes;
+    __m128i printable;
+    const __m128i low = _mm_set1_epi8(0x1F);
+    const __m128i high = _mm_set1_epi8(0x7F);
+    const __m128i dot = _mm_set1_epi8('.');
+
+    /* Bytes of 0x80 and more are negative : they are not greater than 0x1F */
+    while (i + 16 <= size)
+        {
+            bytes = _mm_loadu_si128((const __m128i *) (data + i));
+            printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, low), _mm_cmplt_epi8(bytes, high));
+            _mm_storeu_si128((__m128i *) (ascii + i), _mm_or_si128(_mm_and_si128(printable, bytes), _mm_andnot_si128(printable, dot)));
+            i = i + 16;
+        }
+#endif
+
+    while (i < size)
+        {
+            ascii[i] = (data[i] >= 0x20 && data[i] < 0x7F) ? (gchar) data[i] : '.';
+            i++;
+        }
+}
+
+
+#ifdef LIBFCL_HAVE_AVX2
+/**
+ * Says (once) whether the processor can run AVX2 instructions
+ */
+static gboolean cpu_has_avx2(void)
+{
+    static gint has_avx2 = -1;
+
+    if (has_avx2 < 0)
+        {
+            __builtin_cpu_init();
+            has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        }
+
+    return has_avx2 == 1;
+}
+
+
+/**
+ * Renders 32 bytes at a time
+ * @return the number of bytes rendered (a multiple of 32)
+ */
+__attribute__((target("avx2")))
+static gsize render_bytes_avx2(const guchar *data, const guchar *orig, gsize size, gchar *hex, gchar *ascii, gboolean upper)
+{
+    __m256i bytes;
+    __m256i high_nibbles;
+    __m256i low_nibbles;
+    __m256i printable;
+    __m256i first;
+    __m256i second;
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i letters = _mm256_set1_epi8(upper == TRUE ? 'A' - '0' - 10 : 'a' - '0' - 10);
+    const __m256i low = _mm256_set1_epi8(0x1F);
+    const __m256i high = _mm256_set1_epi8(0x7F);
+    const __m256i dot = _mm256_set1_epi8('.');
+    gchar pairs[64];
+    guint differ = 0;
+    gsize i = 0;
+    gint j = 0;
+
+    while (i + 32 <= size)
+        {
+            bytes = _mm256_loadu_si256((const __m256i *) (data + i));
+
+            high_nibbles = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+            low_nibbles = _mm256_and_si256(bytes, nibble);
+            high_nibbles = _mm256_add_epi8(_mm256_add_epi8(high_nibbles, zero), _mm256_and_si256(_mm256_cmpgt_epi8(high_nibbles, nine), letters));
+            low_nibbles = _mm256_add_epi8(_mm256_add_epi8(low_nibbles, zero), _mm256_and_si256(_mm256_cmpgt_epi8(low_nibbles, nine), letters));
+
+            /* unpack works in each 128 bits lane : the lanes are put back
+             * in order */
+            first = _mm256_unpacklo_epi8(high_nibbles, low_nibbles);
+            second = _mm256_unpackhi_epi8(high_nibbles, low_nibbles);
+            _mm256_storeu_si256((__m256i *) pairs, _mm256_permute2x128_si256(first, second, 0x20));
+            _mm256_storeu_si256((__m256i *) (pairs + 32), _mm256_permute2x128_si256(first, second, 0x31));
+
+            printable = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, low), _mm256_cmpgt_epi8(high, bytes));
+            _mm256_storeu_si256((__m256i *) (ascii + i), _mm256_or_si256(_mm256_and_si256(printable, bytes), _mm256_andnot_si256(printable, dot)));
+
+            differ = 0;
+
+            if (orig != NULL)
+                {
+                    differ = ~(guint) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_loadu_si256((const __m256i *) (orig + i))));
+                }
+
+            for (j = 0; j < 32; j++)
+                {
+                    memcpy(hex + 3 * (i + j), pairs + 2 * j, 2);
+                    hex[3 * (i + j) + 2] = (differ & (1U << j)) ? '*' : ' ';
+                }
+
+            i = i + 32;
+        }
+
+    return i;
+}
+#endif /* LIBFCL_HAVE_AVX2 */
+
+
+/**
+ * Renders bytes : two hexadecimal digits and a separator for each byte in
+ * hex and one character for each byte in ascii
+ * @param data : the bytes
+ * @param orig : the bytes on disk at the same offsets or NULL. The separator
+ *               of a byte that differs from its original is '*' instead of
+ *               ' '.
+ * @param size : number of bytes
+ * @param hex : where to write the 3 * size hexadecimal characters
+ * @param ascii : where to write the size ASCII characters
+ * @param upper : TRUE for upper case digits
+ */
+static void render_bytes(const guchar *data, const guchar *orig, gsize size, gchar *hex, gchar *ascii, gboolean upper)
+{
+    gsize i = 0;
+#ifdef LIBFCL_HAVE_SSE2
+    __m128i bytes;
+    __m128i high_nibbles;
+    __m128i low_nibbles;
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i letters = _mm_set1_epi8(upper == TRUE ? 'A' - '0' - 10 : 'a' - '0' - 10);
+    gchar pairs[32];
+    guint differ = 0;
+    gint j = 0;
+
+#ifdef LIBFCL_HAVE_AVX2
+    if (cpu_has_avx2())
+        {
+            i = render_bytes_avx2(data, orig, size, hex, ascii, upper);
+        }
+#endif
+
+    fcl_render_ascii(data + i, size - i, ascii + i);
+
+    while (i + 16 <= size)
+        {
+            bytes = _mm_loadu_si128((const __m128i *) (data + i));
+
+            high_nibbles = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+            low_nibbles = _mm_and_si128(bytes, nibble);
+            high_nibbles = _mm_add_epi8(_mm_add_epi8(high_nibbles, zero), _mm_and_si128(_mm_cmpgt_epi8(high_nibbles, nine), letters));
+            low_nibbles = _mm_add_epi8(_mm_add_epi8(low_nibbles, zero), _mm_and_si128(_mm_cmpgt_epi8(low_nibbles, nine), letters));
+
+            _mm_storeu_si128((__m128i *) pairs, _mm_unpacklo_epi8(high_nibbles, low_nibbles));
+            _mm_storeu_si128((__m128i *) (pairs + 16), _mm_unpackhi_epi8(high_nibbles, low_nibbles));
+
+            differ = 0;
+
+            if (orig != NULL)
+                {
+                    differ = ~(guint) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_loadu_si128((const __m128i *) (orig + i))));
+                }
+
+            for (j = 0; j < 16; j++)
+                {
+                    memcpy(hex + 3 * (i + j), pairs + 2 * j, 2);
+                    hex[3 * (i + j) + 2] = (differ & (1U << j)) ? '*' : ' ';
+                }
+
+            i = i + 16;
+        }
+#else
+    fcl_render_ascii(data, size, ascii);
+#endif
+
+    render_bytes_scalar(data + i, orig != NULL ? orig + i : NULL, size - i, hex + 3 * i, upper);
+}
+
+
+/**
+ * Renders the hexadecimal digits of the bytes that are left one at a time
+ * (see render_bytes())
+ */
+static void render_bytes_scalar(const guchar *data, const guchar *orig, gsize size, gchar *hex, gboolean upper)
+{
+    const gchar *digits = upper == TRUE ? upper_digits : lower_digits;
+    gsize i = 0;
+
+    for (i = 0; i < size; i++)
+        {
+            hex[3 * i] = digits[data[i] >> 4];
+            hex[3 * i + 1] = digits[data[i] & 0xF];
+            hex[3 * i + 2] = (orig != NULL && orig[i] != data[i]) ? '*' : ' ';
+        }
+}
@@ -0,0 +1,755 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_search.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_search.c
+ * Searching bytes in the edited file.
+ *
+ * The file is walked run by run through a view (see fcl_internal.h) : the
+ * bytes of the buffers of the sequence are searched in place and the untouched
+ * parts of the file are searched in the window they are read into. A match
+ * that straddles two runs is looked for in a small seam buffer made of the
+ * last pattern length - 1 bytes of a run and the first ones of the next run.
+ *
+ * Within a run, short patterns are found by filtering the positions where both
+ * the first and the last byte of the pattern match (16 or 32 positions at a
+ * time with SSE2 or AVX2 when available) and long patterns with the
+ * Boyer-Moore-Horspool algorithm.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define LIBFCL_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define LIBFCL_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/**
+ * @def LIBFCL_HORSPOOL_MIN_SIZE
+ * Patterns of at least this size are searched with the Boyer-Moore-Horspool
+ * algorithm. Shorter ones use the first and last byte filter.
+ */
+#define LIBFCL_HORSPOOL_MIN_SIZE 32
+
+
+/**
+ * @struct fcl_finder_t
+ * A compiled pattern
+ */
+typedef struct
+{
+    const guchar *pattern;  /**< The pattern                              */
+    gsize len;              /**< Length of the pattern                    */
+    gint direction;         /**< LIBFCL_FIND_FORWARD or _BACKWARD         */
+    gsize shift[256];       /**< Horspool shift table (long patterns)     */
+} fcl_finder_t;
+
+
+static void init_finder(fcl_finder_t *finder, const guchar *pattern, gsize len, gint direction);
+static gssize find_in_run(fcl_finder_t *finder, const guchar *haystack, gsize size);
+
+static gssize filter_forward(const guchar *haystack, gsize size, const guchar *pattern, gsize len);
+static gssize filter_backward(const guchar *haystack, gsize size, const guchar *pattern, gsize len);
+static gssize horspool_forward(fcl_finder_t *finder, const guchar *haystack, gsize size);
+static gssize horspool_backward(fcl_finder_t *finder, const guchar *haystack, gsize size);
+
+static goffset find_forward(fcl_view_t *view, fcl_finder_t *finder, goffset from);
+static goffset find_backward(fcl_view_t *view, fcl_finder_t *finder, goffset from);
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Finds a pattern in the edited file (see fcl.h)
+ * @param a_file : an openned fcl_file_t file
+ * @param pattern : the bytes to look for
+ * @param len : the number of bytes in pattern
+ * @param from : position where the search begins
+ * @param direction : LIBFCL_FIND_FORWARD or LIBFCL_FIND_BACKWARD
+ * @return the position of the match or -1 if the pattern was not found
+ */
+goffset fcl_find(fcl_file_t *a_file, const guchar *pattern, gsize len, goffset from, gint direction)
+{
+    fcl_view_t *view = NULL;
+    fcl_finder_t *finder = NULL;
+    goffset found = -1;
+
+    if (a_file == NULL || pattern == NULL || len == 0 || from < 0)
+        {
+            return -1;
+        }
+
+    finder = (fcl_finder_t *) g_malloc0(sizeof(fcl_finder_t));
+    init_finder(finder, pattern, len, direction);
+
+    view = fcl_view_new(a_file);
+
+    if (direction == LIBFCL_FIND_BACKWARD)
+        {
+            found = find_backward(view, finder, from);
+        }
+    else
+        {
+            found = find_forward(view, finder, from);
+        }
+
+    fcl_view_free(view);
+    g_free(finder);
+
+    return found;
+}
+
+
+/**
+ * Finds every match of a pattern in a view (see fcl_internal.h)
+ * @param view : a view on the edited file
+ * @param pattern : the bytes to look for
+ * @param len : the number of bytes in pattern
+ * @param from : position where the search begins
+ * @return a newly allocated GArray of goffset
+ */
+GArray *fcl_view_find_all(fcl_view_t *view, const guchar *pattern, gsize len, goffset from)
+{
+    fcl_finder_t *finder = NULL;
+    GArray *matches = NULL;
+    goffset found = -1;
+
+    matches = g_array_new(FALSE, FALSE, sizeof(goffset));
+
+    if (view == NULL || pattern == NULL || len == 0 || from < 0)
+        {
+            return matches;
+        }
+
+    finder = (fcl_finder_t *) g_malloc0(sizeof(fcl_finder_t));
+    init_finder(finder, pattern, len, LIBFCL_FIND_FORWARD);
+
+    /* The window of the view is kept from one match to the next one */
+    while ((found = find_forward(view, finder, from)) >= 0)
+        {
+            g_array_append_val(matches, found);
+            from = found + len;
+        }
+
+    g_free(finder);
+
+    return matches;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Compiles a pattern
+ * @param finder : the finder structure to fill
+ * @param pattern : the bytes to look for
+ * @param len : the number of bytes in pattern
+ * @param direction : LIBFCL_FIND_FORWARD or LIBFCL_FIND_BACKWARD
+ */
+static void init_finder(fcl_finder_t *finder, const guchar *pattern, gsize len, gint direction)
+{
+    gsize i = 0;
+
+    finder->pattern = pattern;
+    finder->len = len;
+    finder->direction = direction;
+
+    if (len >= LIBFCL_HORSPOOL_MIN_SIZE)
+        {
+            for (i = 0; i < 256; i++)
+                {
+                    finder->shift[i] = len;
+                }
+
+            if (direction == LIBFCL_FIND_BACKWARD)
+                {
+                    /* the window is shifted by the first byte it begins with */
+                    for (i = len - 1; i > 0; i--)
+                        {
+                            finder->shift[pattern[i]] = i;
+                        }
+                }
+            else
+                {
+                    /* the window is shifted by the last byte it ends with */
+                    for (i = 0; i < len - 1; i++)
+                        {
+                            finder->shift[pattern[i]] = len - 1 - i;
+                        }
+                }
+        }
+}
+
+
+/**
+ * Finds the pattern within a run of bytes.
+ * @param finder : the compiled pattern
+ * @param haystack : the bytes where to look for the pattern
+ * @param size : number of bytes in haystack
+ * @return the offset in haystack of the first (forward) or of the last
+ *         (backward) match or -1 if there is no match.
+ */
+static gssize find_in_run(fcl_finder_t *finder, const guchar *haystack, gsize size)
+{
+    const guchar *found = NULL;
+    gsize i = 0;
+
+    if (size < finder->len)
+        {
+            return -1;
+        }
+
+    if (finder->len == 1)
+        {
+            if (finder->direction == LIBFCL_FIND_BACKWARD)
+                {
+                    for (i = size; i > 0; i--)
+                        {
+                            if (haystack[i - 1] == finder->pattern[0])
+                                {
+                                    return (gssize) i - 1;
+                                }
+                        }
+                    return -1;
+                }
+            else
+                {
+                    found = memchr(haystack, finder->pattern[0], size);
+                    return found == NULL ? -1 : found - haystack;
+                }
+        }
+    else if (finder->len < LIBFCL_HORSPOOL_MIN_SIZE)
+        {
+            if (finder->direction == LIBFCL_FIND_BACKWARD)
+                {
+                    return filter_backward(haystack, size, finder->pattern, finder->len);
+                }
+            else
+                {
+                    return filter_forward(haystack, size, finder->pattern, finder->len);
+                }
+        }
+    else
+        {
+            if (finder->direction == LIBFCL_FIND_BACKWARD)
+                {
+                    return horspool_backward(finder, haystack, size);
+                }
+            else
+                {
+                    return horspool_forward(finder, haystack, size);
+                }
+        }
+}
+
+
+/********************************** Kernels ***********************************/
+
+/**
+ * Says whether the pattern matches at a position where its first and last
+ * bytes are already known to match.
+ */
+static gboolean match_inside(const guchar *candidate, const guchar *pattern, gsize len)
+{
+    return len <= 2 || memcmp(candidate + 1, pattern + 1, len - 2) == 0;
+}
+
+
+#ifdef LIBFCL_HAVE_AVX2
+/**
+ * Says (once) whether the processor can run AVX2 instructions
+ */
+static gboolean cpu_has_avx2(void)
+{
+    static gint has_avx2 = -1;
+
+    if (has_avx2 < 0)
+        {
+            __builtin_cpu_init();
+            has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        }
+
+    return has_avx2 == 1;
+}
+
+
+/**
+ * First and last byte filter, 32 positions at a time, forward.
+ * @param[in,out] i_pointer : first position to test, returns the first
+ *                            position that was not tested
+ * @return the first match or -1
+ */
+__attribute__((target("avx2")))
+static gssize filter_forward_avx2(const guchar *haystack, gsize size, const guchar *pattern, gsize len, gsize *i_pointer)
+{
+    const __m256i first = _mm256_set1_epi8((char) pattern[0]);
+    const __m256i last = _mm256_set1_epi8((char) pattern[len - 1]);
+    __m256i block_first;
+    __m256i block_last;
+    guint32 mask = 0;
+    gsize i = *i_pointer;
+    gint bit = 0;
+
+    while (i + 32 + len - 1 <= size)
+        {
+            block_first = _mm256_loadu_si256((const __m256i *) (haystack + i));
+            block_last = _mm256_loadu_si256((const __m256i *) (haystack + i + len - 1));
+            mask = (guint32) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+
+            while (mask != 0)
+                {
+                    bit = __builtin_ctz(mask);
+
+                    if (match_inside(haystack + i + bit, pattern, len))
+                        {
+                            return (gssize) (i + bit);
+                        }
+
+                    mask = mask & (mask - 1);
+                }
+
+            i = i + 32;
+        }
+
+    *i_pointer = i;
+
+    return -1;
+}
+
+
+/**
+ * First and last byte filter, 32 positions at a time, backward.
+ * @param[in,out] end_pointer : the positions below end_pointer are to be
+ *                              tested, returns the lowest position tested
+ * @return the last match or -1
+ */
+__attribute__((target("avx2")))
+static gssize filter_backward_avx2(const guchar *haystack, const guchar *pattern, gsize len, gsize *end_pointer)
+{
+    const __m256i first = _mm256_set1_epi8((char) pattern[0]);
+    const __m256i last = _mm256_set1_epi8((char) pattern[len - 1]);
+    __m256i block_first;
+    __m256i block_last;
+    guint32 mask = 0;
+    gsize end = *end_pointer;
+    gint bit = 0;
+
+    while (end >= 32)
+        {
+            block_first = _mm256_loadu_si256((const __m256i *) (haystack + end - 32));
+            block_last = _mm256_loadu_si256((const __m256i *) (haystack + end - 32 + len - 1));
+            mask = (guint32) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+
+            while (mask != 0)
+                {
+                    bit = 31 - __builtin_clz(mask);
+
+                    if (match_inside(haystack + end - 32 + bit, pattern, len))
+                        {
+                            return (gssize) (end - 32 + bit);
+                        }
+
+                    mask = mask & ~(1U << bit);
+                }
+
+            end = end - 32;
+        }
+
+    *end_pointer = end;
+
+    return -1;
+}
+#endif /* LIBFCL_HAVE_AVX2 */
+
+
+/**
+ * Finds the first match of a short pattern (at least 2 bytes)
+ * @param haystack : the bytes where to look for the pattern
+ * @param size : number of bytes in haystack (at least len)
+ * @param pattern : the pattern
+ * @param len : the length of the pattern
+ * @return the offset of the first match or -1
+ */
+static gssize filter_forward(const guchar *haystack, gsize size, const guchar *pattern, gsize len)
+{
+    gsize i = 0;
+#ifdef LIBFCL_HAVE_SSE2
+    const __m128i first = _mm_set1_epi8((char) pattern[0]);
+    const __m128i last = _mm_set1_epi8((char) pattern[len - 1]);
+    __m128i block_first;
+    __m128i block_last;
+    guint mask = 0;
+    gint bit = 0;
+    gssize found = -1;
+
+#ifdef LIBFCL_HAVE_AVX2
+    if (cpu_has_avx2())
+        {
+            found = filter_forward_avx2(haystack, size, pattern, len, &i);
+
+            if (found >= 0)
+                {
+                    return found;
+                }
+        }
+#endif
+
+    while (i + 16 + len - 1 <= size)
+        {
+            block_first = _mm_loadu_si128((const __m128i *) (haystack + i));
+            block_last = _mm_loadu_si128((const __m128i *) (haystack + i + len - 1));
+            mask = (guint) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+            while (mask != 0)
+                {
+                    bit = __builtin_ctz(mask);
+
+                    if (match_inside(haystack + i + bit, pattern, len))
+                        {
+                            return (gssize) (i + bit);
+                        }
+
+                    mask = mask & (mask - 1);
+                }
+
+            i = i + 16;
+        }
+#endif
+
+    /* What is left (or everything without SSE2) is done with memchr */
+    while (i + len <= size)
+        {
+            const guchar *candidate = memchr(haystack + i, pattern[0], size - len + 1 - i);
+
+            if (candidate == NULL)
+                {
+                    return -1;
+                }
+
+            if (candidate[len - 1] == pattern[len - 1] && match_inside(candidate, pattern, len))
+                {
+                    return candidate - haystack;
+                }
+
+            i = (gsize) (candidate - haystack) + 1;
+        }
+
+    return -1;
+}
+
+
+/**
+ * Finds the last match of a short pattern (at least 2 bytes)
+ * @param haystack : the bytes where to look for the pattern
+ * @param size : number of bytes in haystack (at least len)
+ * @param pattern : the pattern
+ * @param len : the length of the pattern
+ * @return the offset of the last match or -1
+ */
+static gssize filter_backward(const guchar *haystack, gsize size, const guchar *pattern, gsize len)
+{
+    gsize end = size - len + 1;   /** positions below end are still to be tested */
+#ifdef LIBFCL_HAVE_SSE2
+    const __m128i first = _mm_set1_epi8((char) pattern[0]);
+    const __m128i last = _mm_set1_epi8((char) pattern[len - 1]);
+    __m128i block_first;
+    __m128i block_last;
+    guint mask = 0;
+    gint bit = 0;
+    gssize found = -1;
+
+#ifdef LIBFCL_HAVE_AVX2
+    if (cpu_has_avx2())
+        {
+            found = filter_backward_avx2(haystack, pattern, len, &end);
+
+            if (found >= 0)
+                {
+                    return found;
+                }
+        }
+#endif
+
+    while (end >= 16)
+        {
+            block_first = _mm_loadu_si128((const __m128i *) (haystack + end - 16));
+            block_last = _mm_loadu_si128((const __m128i *) (haystack + end - 16 + len - 1));
+            mask = (guint) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+            while (mask != 0)
+                {
+                    bit = 31 - __builtin_clz(mask);
+
+                    if (match_inside(haystack + end - 16 + bit, pattern, len))
+                        {
+                            return (gssize) (end - 16 + bit);
+                        }
+
+                    mask = mask & ~(1U << bit);
+                }
+
+            end = end - 16;
+        }
+#endif
+
+    while (end > 0)
+        {
+            end = end - 1;
+
+            if (haystack[end] == pattern[0] && haystack[end + len - 1] == pattern[len - 1] && match_inside(haystack + end, pattern, len))
+                {
+                    return (gssize) end;
+                }
+        }
+
+    return -1;
+}
+
+
+/**
+ * Boyer-Moore-Horspool, forward
+ * @param finder : the compiled pattern
+ * @param haystack : the bytes where to look for the pattern
+ * @param size : number of bytes in haystack (at least finder->len)
+ * @return the offset of the first match or -1
+ */
+static gssize horspool_forward(fcl_finder_t *finder, const guchar *haystack, gsize size)
+{
+    const guchar *pattern = finder->pattern;
+    gsize len = finder->len;
+    gsize i = 0;
+    guchar last = pattern[len - 1];
+    guchar c = 0;
+
+    while (i + len <= size)
+        {
+            c = haystack[i + len - 1];
+
+            if (c == last && memcmp(haystack + i, pattern, len - 1) == 0)
+                {
+                    return (gssize) i;
+                }
+
+            i = i + finder->shift[c];
+        }
+
+    return -1;
+}
+
+
+/**
+ * Boyer-Moore-Horspool, backward
+ * @param finder : the compiled pattern
+ * @param haystack : the bytes where to look for the pattern
+ * @param size : number of bytes in haystack (at least finder->len)
+ * @return the offset of the last match or -1
+ */
+static gssize horspool_backward(fcl_finder_t *finder, const guchar *haystack, gsize size)
+{
+    const guchar *pattern = finder->pattern;
+    gsize len = finder->len;
+    gsize i = size - len;
+    gsize shift = 0;
+    guchar c = 0;
+
+    while (TRUE)
+        {
+            c = haystack[i];
+
+            if (c == pattern[0] && memcmp(haystack + i + 1, pattern + 1, len - 1) == 0)
+                {
+                    return (gssize) i;
+                }
+
+            shift = finder->shift[c];
+
+            if (shift > i)
+                {
+                    return -1;
+                }
+
+            i = i - shift;
+        }
+}
+
+
+/******************************* Walking a view *******************************/
+
+/**
+ * Finds the first match at or after from
+ * @param view : a view on the edited file
+ * @param finder : the compiled pattern
+ * @param from : position where the search begins
+ * @return the position of the match or -1
+ */
+static goffset find_forward(fcl_view_t *view, fcl_finder_t *finder, goffset from)
+{
+    gsize len = finder->len;
+    guchar *seam = NULL;         /** last bytes of the previous runs + first bytes of the run */
+    gsize seam_size = 0;         /** bytes in the seam that come from the previous runs       */
+    goffset seam_position = 0;   /** position of the seam in the edited file                  */
+    const guchar *run = NULL;
+    gsize size = 0;
+    gsize n = 0;
+    gsize keep = 0;
+    gssize found = -1;
+    goffset position = from;
+
+    seam = (guchar *) g_malloc(2 * len * sizeof(guchar));
+
+    while ((run = fcl_view_get_run(view, position, &size)) != NULL)
+        {
+            /* A match beginning in the previous runs and ending in this one */
+            n = MIN(len - 1, size);
+            memcpy(seam + seam_size, run, n);
+
+            if (seam_size > 0)
+                {
+                    /* The seam is too short to hold a match that would not begin in its first part */
+                    found = find_in_run(finder, seam, seam_size + n);
+
+                    if (found >= 0)
+                        {
+                            g_free(seam);
+                            return seam_position + found;
+                        }
+                }
+            else
+                {
+                    seam_position = position;
+                }
+
+            found = find_in_run(finder, run, size);
+
+            if (found >= 0)
+                {
+                    g_free(seam);
+                    return position + found;
+                }
+
+            /* Keeping the last len - 1 bytes */
+            keep = MIN(seam_size + n, len - 1);
+
+            if (size >= len - 1)
+                {
+                    memcpy(seam, run + size - keep, keep);
+                    seam_position = position + size - keep;
+                }
+            else
+                {
+                    memmove(seam, seam + seam_size + n - keep, keep);
+                    seam_position = seam_position + seam_size + n - keep;
+                }
+
+            seam_size = keep;
+            position = position + size;
+        }
+
+    g_free(seam);
+
+    return -1;
+}
+
+
+/**
+ * Finds the last match that begins at or before from
+ * @param view : a view on the edited file
+ * @param finder : the compiled pattern
+ * @param from : position where the search begins
+ * @return the position of the match or -1
+ */
+static goffset find_backward(fcl_view_t *view, fcl_finder_t *finder, goffset from)
+{
+    gsize len = finder->len;
+    guchar *seam = NULL;         /** last bytes of the run + first bytes of the next runs */
+    guchar *carry = NULL;        /** first bytes of the runs already searched             */
+    gsize carry_size = 0;
+    const guchar *run = NULL;
+    gsize size = 0;
+    gsize n = 0;
+    gssize found = -1;
+    goffset position = 0;        /** end of the part of the file still to be searched     */
+
+    /* A match may not end after from + len */
+    position = MIN(from + (goffset) len, view->size);
+
+    seam = (guchar *) g_malloc(2 * len * sizeof(guchar));
+    carry = (guchar *) g_malloc(len * sizeof(guchar));
+
+    while ((run = fcl_view_get_run_before(view, position, &size)) != NULL)
+        {
+            /* A match beginning in this run and ending in the next ones */
+            n = MIN(len - 1, size);
+
+            if (carry_size > 0)
+                {
+                    memcpy(seam, run + size - n, n);
+                    memcpy(seam + n, carry, carry_size);
+
+                    found = find_in_run(finder, seam, n + carry_size);
+
+                    if (found >= 0)
+                        {
+                            g_free(seam);
+                            g_free(carry);
+                            return position - n + found;
+                        }
+                }
+
+            found = find_in_run(finder, run, size);
+
+            if (found >= 0)
+                {
+                    g_free(seam);
+                    g_free(carry);
+                    return position - size + found;
+                }
+
+            /* Keeping the first len - 1 bytes */
+            if (size >= len - 1)
+                {
+                    memcpy(carry, run, len - 1);
+                    carry_size = len - 1;
+                }
+            else
+                {
+                    memmove(carry + size, carry, MIN(carry_size, len - 1 - size));
+                    memcpy(carry, run, size);
+                    carry_size = MIN(len - 1, size + carry_size);
+                }
+
+            position = position - size;
+        }
+
+    g_free(seam);
+    g_free(carry);
+
+    return -1;
+}
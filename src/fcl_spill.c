@@ -0,0 +1,1089 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_spill.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_spill.c
+ * Memory budget : the data of the buffers of the sequences may be written to
+ * a scratch file and freed.
+ *
+ * The bytes of the buffers of the sequences of all the files are counted.
+ * When there are more than the budget, the file being edited writes the data
+ * of its buffers that were modified the longest time ago to its scratch file
+ * until the library is back under the budget. The buffer just modified is
+ * never spilled : it would be loaded back at once.
+ *
+ * The scratch file is created the first time a buffer is spilled and removed
+ * from the disk at once : it goes away with the process. The places freed in
+ * it are reused by the next buffers spilled.
+ *
+ * A spilled buffer is read in place (pread) when its bytes are read and is
+ * only loaded back into memory before being modified. The buffers made of
+ * pieces (see fcl_piece.c) are not spilled : only the bytes typed in them
+ * are in memory. The chunks that they share are counted once, for the whole
+ * library.
+ *
+ * Before that, when the compression is on, the data of a buffer that is no
+ * longer one of the LIBFCL_SPILL_HOT_BUFFERS last modified ones is compressed
+ * in memory (raw deflate at its fastest level). It is uncompressed when its
+ * bytes are read and loaded back before being modified, as a spilled buffer.
+ * A compressed buffer that is spilled is written compressed.
+ *
+ * The files opened in a session (fcl_session_t) have a budget of their own.
+ * When the session is over its budget, the file being edited spills the
+ * buffers modified the longest time ago of any file of the session : each
+ * buffer is stamped with a clock that ticks at each modification. The
+ * buffers of a file are used under its buffers_lock (reader) : the file
+ * being edited only tries to take the lock of another file (writer) and
+ * skips the files in use, as the pool of open files does (see fcl_pool.c).
+ * A file only ever compresses its own buffers.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+/**
+ * @def LIBFCL_SPILL_HOT_BUFFERS
+ * Number of the buffers modified last that are never compressed
+ */
+#define LIBFCL_SPILL_HOT_BUFFERS 16
+
+/**
+ * @def LIBFCL_SPILL_MIN_COMPRESSED
+ * Size of the smallest buffer compressed (the smaller ones would not gain
+ * much) : 512 bytes or a whole block when the blocks are smaller
+ */
+#define LIBFCL_SPILL_MIN_COMPRESSED MIN(LIBFCL_BUF_SIZE, 512)
+
+/**
+ * @struct spill_hole_t
+ * A free place in the scratch file
+ */
+typedef struct
+{
+    goffset offset;    /**< Offset of the place in the scratch file */
+    gsize size;        /**< Its size                                */
+} spill_hole_t;
+
+
+/**
+ * @struct fcl_spill_t
+ * The scratch file of a file and its buffers by last modification
+ */
+struct _fcl_spill_t
+{
+    gint fd;           /**< The scratch file (-1 until needed)              */
+    goffset end;       /**< End of the used part of the scratch file        */
+    GArray *holes;     /**< Free places before end (spill_hole_t, in order) */
+    fcl_session_t *session; /**< Session of the file (or NULL)              */
+    GQueue lru;        /**< Buffers in memory, the last one modified first  */
+    gsize resident;    /**< Bytes of these buffers                          */
+    gsize spilled;     /**< Bytes of the buffers in the scratch file        */
+    gsize compressed;  /**< Bytes of the buffers that are compressed        */
+    gsize packed;      /**< Their size once compressed                      */
+    GZlibCompressor *compressor; /**< Compresses its buffers (NULL until needed) */
+};
+
+
+/**
+ * @struct fcl_session_t
+ * Files that share a memory budget
+ */
+struct _fcl_session_t
+{
+    GMutex lock;       /**< Protects budget, usage and files                 */
+    gsize budget;      /**< Budget of the files of the session (0 : none)    */
+    gsize usage;       /**< Bytes of their buffers in memory                 */
+    GQueue files;      /**< Files opened in the session and not closed yet   */
+};
+
+
+static fcl_spill_t *get_spill(fcl_file_t *a_file);
+static void count_resident(fcl_spill_t *spill, fcl_buf_t *a_buffer, gsize size);
+static gboolean over_budget(fcl_spill_t *spill);
+static gboolean spill_buffer(fcl_file_t *a_file, fcl_spill_t *spill, fcl_buf_t *a_buffer);
+static gboolean spill_coldest(fcl_file_t *a_file, fcl_spill_t *spill, fcl_buf_t *a_buffer);
+static goffset take_place(fcl_spill_t *spill, gsize size);
+static void free_place(fcl_spill_t *spill, goffset offset, gsize size);
+static gsize stored_size(fcl_buf_t *a_buffer);
+static gsize read_slot(fcl_spill_t *spill, goffset offset, guchar *data, gsize size, fcl_perf_t *perf);
+static void compress_buffer(fcl_file_t *a_file, fcl_spill_t *spill, fcl_buf_t *a_buffer);
+static gboolean uncompress_buffer(fcl_file_t *a_file, fcl_buf_t *a_buffer, guchar *data, fcl_perf_t *perf);
+static void uncount_packed(fcl_spill_t *spill, fcl_buf_t *a_buffer);
+
+static GMutex budget_lock;      /** Protects budget, usage and compression    */
+static gsize budget = 0;        /** The memory budget (0 : no budget)         */
+static gsize usage = 0;         /** Bytes of the buffers of all the sequences */
+static gboolean compression = FALSE; /** Cold buffers are compressed          */
+static guint touch_clock = 0;   /** Ticks at each modification (atomic, wraps) */
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Sets the memory budget of the library (see fcl.h)
+ * @param size : number of bytes the data of the edited buffers may use (0
+ *               means no budget)
+ */
+void fcl_set_memory_budget(gsize size)
+{
+    g_mutex_lock(&budget_lock);
+    budget = size;
+    g_mutex_unlock(&budget_lock);
+}
+
+
+/**
+ * Gets the memory budget of the library
+ * @return the budget in bytes (0 means no budget)
+ */
+gsize fcl_get_memory_budget(void)
+{
+    gsize size = 0;
+
+    g_mutex_lock(&budget_lock);
+    size = budget;
+    g_mutex_unlock(&budget_lock);
+
+    return size;
+}
+
+
+/**
+ * Gets the number of bytes of the edited buffers that are in memory
+ * @return the bytes of the buffers of all the files that are not spilled and
+ *         of the chunks they share
+ */
+gsize fcl_get_memory_usage(void)
+{
+    gsize size = 0;
+
+    g_mutex_lock(&budget_lock);
+    size = usage;
+    g_mutex_unlock(&budget_lock);
+
+    return size + fcl_get_shared_memory();
+}
+
+
+/**
+ * Turns the compression of the buffers modified the longest time ago on or
+ * off (see fcl.h)
+ * @param on : TRUE to compress them
+ */
+void fcl_set_compression(gboolean on)
+{
+    g_mutex_lock(&budget_lock);
+    compression = on;
+    g_mutex_unlock(&budget_lock);
+}
+
+
+/**
+ * Says wether the buffers modified the longest time ago are compressed
+ * @return TRUE if they are
+ */
+gboolean fcl_get_compression(void)
+{
+    gboolean on = FALSE;
+
+    g_mutex_lock(&budget_lock);
+    on = compression;
+    g_mutex_unlock(&budget_lock);
+
+    return on;
+}
+
+
+/**
+ * Creates a session (see fcl.h)
+ * @param budget : number of bytes the buffers of its files may use (0 means
+ *                 no budget)
+ * @return a new session to be freed with fcl_session_free()
+ */
+fcl_session_t *fcl_session_new(gsize budget)
+{
+    fcl_session_t *session = NULL;
+
+    session = (fcl_session_t *) g_malloc0(sizeof(fcl_session_t));
+
+    g_mutex_init(&session->lock);
+    session->budget = budget;
+    session->usage = 0;
+    g_queue_init(&session->files);
+
+    return session;
+}
+
+
+/**
+ * Frees a session whose files are all closed
+ * @param session : the session (may be NULL)
+ */
+void fcl_session_free(fcl_session_t *session)
+{
+    guint n_files = 0;
+
+    if (session != NULL)
+        {
+            g_mutex_lock(&session->lock);
+            n_files = g_queue_get_length(&session->files);
+            g_mutex_unlock(&session->lock);
+
+            if (n_files > 0)
+                {
+                    fprintf(stderr, Q_("Unable to free a session : %u of its files are not closed\n"), n_files);
+                    return;
+                }
+
+            g_mutex_clear(&session->lock);
+            g_free(session);
+        }
+}
+
+
+/**
+ * Sets the memory budget of a session
+ * @param session : the session
+ * @param size : number of bytes (0 means no budget)
+ */
+void fcl_session_set_memory_budget(fcl_session_t *session, gsize size)
+{
+    g_mutex_lock(&session->lock);
+    session->budget = size;
+    g_mutex_unlock(&session->lock);
+}
+
+
+/**
+ * Gets the memory budget of a session
+ * @param session : the session
+ * @return the budget in bytes (0 means no budget)
+ */
+gsize fcl_session_get_memory_budget(fcl_session_t *session)
+{
+    gsize size = 0;
+
+    g_mutex_lock(&session->lock);
+    size = session->budget;
+    g_mutex_unlock(&session->lock);
+
+    return size;
+}
+
+
+/**
+ * Gets the number of bytes of the buffers of the files of a session that
+ * are in memory
+ * @param session : the session
+ * @return the number of bytes
+ */
+gsize fcl_session_get_memory_usage(fcl_session_t *session)
+{
+    gsize size = 0;
+
+    g_mutex_lock(&session->lock);
+    size = session->usage;
+    g_mutex_unlock(&session->lock);
+
+    return size;
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+/**
+ * Counts a modified buffer and spills buffers if the budget is exceeded (see
+ * fcl_internal.h)
+ * @param a_file : the file
+ * @param a_buffer : a buffer of its sequence that was just modified
+ */
+void fcl_spill_touch(fcl_file_t *a_file, fcl_buf_t *a_buffer)
+{
+    fcl_spill_t *spill = get_spill(a_file);
+    GList *link = NULL;
+
+    if (a_buffer->pieces != NULL)
+        {
+            /* Only the bytes typed in it are in memory : it is not spilled */
+            count_resident(spill, a_buffer, fcl_pieces_memory(a_buffer));
+
+            if (a_buffer->lru != NULL)
+                {
+                    g_queue_delete_link(&spill->lru, a_buffer->lru);
+                    a_buffer->lru = NULL;
+                }
+        }
+    else
+        {
+            count_resident(spill, a_buffer, a_buffer->size);
+            a_buffer->touched = (guint) g_atomic_int_add(&touch_clock, 1) + 1;
+
+            if (a_buffer->lru == NULL)
+                {
+                    g_queue_push_head(&spill->lru, a_buffer);
+                    a_buffer->lru = g_queue_peek_head_link(&spill->lru);
+                }
+            else if (a_buffer->lru != g_queue_peek_head_link(&spill->lru))
+                {
+                    g_queue_unlink(&spill->lru, a_buffer->lru);
+                    g_queue_push_head_link(&spill->lru, a_buffer->lru);
+                }
+
+            /* At most one buffer left the hot ones : the one just behind them */
+            if (fcl_get_compression() == TRUE)
+                {
+                    link = g_queue_peek_nth_link(&spill->lru, LIBFCL_SPILL_HOT_BUFFERS);
+
+                    if (link != NULL && ((fcl_buf_t *) link->data)->packed == 0)
+                        {
+                            compress_buffer(a_file, spill, (fcl_buf_t *) link->data);
+                        }
+                }
+        }
+
+    /* The buffer just modified stays : it would be read back at once */
+    while (over_budget(spill) == TRUE)
+        {
+            if (spill->session != NULL)
+                {
+                    if (spill_coldest(a_file, spill, a_buffer) == FALSE)
+                        {
+                            break;
+                        }
+                }
+            else if ((link = g_queue_peek_tail_link(&spill->lru)) == NULL || link->data == a_buffer || spill_buffer(a_file, spill, (fcl_buf_t *) link->data) == FALSE)
+                {
+                    break;
+                }
+        }
+}
+
+
+/**
+ * Loads the data of a buffer back into memory (see fcl_internal.h)
+ * @param a_file : the file
+ * @param a_buffer : a buffer about to be modified
+ */
+void fcl_spill_load(fcl_file_t *a_file, fcl_buf_t *a_buffer)
+{
+    fcl_spill_t *spill = a_file->spill;
+    guchar *data = NULL;
+
+    if (a_buffer->spilled == TRUE || a_buffer->packed > 0)
+        {
+            data = (guchar *) g_malloc0(a_buffer->size * sizeof(guchar));
+
+            if (fcl_spill_read(a_file, a_buffer, 0, data, a_buffer->size, a_file->perf) != a_buffer->size)
+                {
+                    fprintf(stderr, Q_("Unable to read a buffer back from the scratch file\n"));
+                }
+
+            if (a_buffer->spilled == TRUE)
+                {
+                    LIBFCL_TRACE(LIBFCL_TRACE_BUFFER_LOADED, a_buffer, a_buffer->offset, a_buffer->slot, a_buffer->size);
+
+                    free_place(spill, a_buffer->slot, stored_size(a_buffer));
+                    spill->spilled = spill->spilled - stored_size(a_buffer);
+                }
+            else
+                {
+                    g_free(a_buffer->data);
+                }
+
+            uncount_packed(spill, a_buffer);
+
+            a_buffer->data = data;
+            a_buffer->spilled = FALSE;
+            a_buffer->slot = 0;
+        }
+}
+
+
+/**
+ * Copies bytes of a buffer, wherever they are (see fcl_internal.h)
+ * @param a_file : the file
+ * @param a_buffer : the buffer
+ * @param offset : offset of the first byte in the buffer
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to copy
+ * @param perf : the counters where to count the reads of the scratch file
+ * @return the number of bytes copied
+ */
+gsize fcl_spill_read(fcl_file_t *a_file, fcl_buf_t *a_buffer, gsize offset, guchar *data, gsize size, fcl_perf_t *perf)
+{
+    guchar *whole = NULL;
+    gsize done = 0;
+
+    size = MIN(size, a_buffer->size - MIN(offset, a_buffer->size));
+
+    if (a_buffer->pieces != NULL)
+        {
+            return fcl_pieces_read(a_buffer, offset, data, size, perf);
+        }
+    else if (a_buffer->packed > 0)
+        {
+            /* The whole buffer has to be uncompressed */
+            whole = (guchar *) g_malloc(a_buffer->size * sizeof(guchar));
+
+            if (uncompress_buffer(a_file, a_buffer, whole, perf) == TRUE)
+                {
+                    memcpy(data, whole + offset, size);
+                    done = size;
+                }
+
+            g_free(whole);
+
+            return done;
+        }
+    else if (a_buffer->spilled == FALSE)
+        {
+            memcpy(data, a_buffer->data + offset, size);
+            return size;
+        }
+
+    return read_slot(a_file->spill, a_buffer->slot + (goffset) offset, data, size, perf);
+}
+
+
+/**
+ * Frees the data of a buffer of the sequence, wherever it is (see
+ * fcl_internal.h)
+ * @param a_file : the file
+ * @param a_buffer : a buffer whose data is about to be replaced
+ */
+void fcl_spill_release(fcl_file_t *a_file, fcl_buf_t *a_buffer)
+{
+    fcl_spill_t *spill = get_spill(a_file);
+
+    if (a_buffer->spilled == TRUE)
+        {
+            free_place(spill, a_buffer->slot, stored_size(a_buffer));
+            spill->spilled = spill->spilled - stored_size(a_buffer);
+            a_buffer->spilled = FALSE;
+            a_buffer->slot = 0;
+        }
+    else
+        {
+            g_free(a_buffer->data);
+            fcl_pieces_free(a_buffer);
+        }
+
+    uncount_packed(spill, a_buffer);
+    a_buffer->data = NULL;
+    count_resident(spill, a_buffer, 0);
+
+    if (a_buffer->lru != NULL)
+        {
+            g_queue_delete_link(&spill->lru, a_buffer->lru);
+            a_buffer->lru = NULL;
+        }
+}
+
+
+/**
+ * Gets the number of bytes of the buffers of a file in memory and in the
+ * scratch file (see fcl_internal.h)
+ * @param a_file : the file
+ * @param stats : the statistics where to put them
+ */
+void fcl_spill_sizes(fcl_file_t *a_file, fcl_stat_buf_t *stats)
+{
+    stats->resident_size = 0;
+    stats->spilled_size = 0;
+    stats->compressed_size = 0;
+    stats->packed_size = 0;
+
+    if (a_file->spill != NULL)
+        {
+            stats->resident_size = a_file->spill->resident;
+            stats->spilled_size = a_file->spill->spilled;
+            stats->compressed_size = a_file->spill->compressed;
+            stats->packed_size = a_file->spill->packed;
+        }
+}
+
+
+/**
+ * Adds a file that was just opened to a session (see fcl_internal.h)
+ * @param a_file : the file
+ * @param session : the session
+ */
+void fcl_spill_join(fcl_file_t *a_file, fcl_session_t *session)
+{
+    a_file->session = session;
+
+    g_mutex_lock(&session->lock);
+    g_queue_push_tail(&session->files, a_file);
+    g_mutex_unlock(&session->lock);
+}
+
+
+/**
+ * Frees the scratch file of a file before its buffers are freed and takes it
+ * out of its session (see fcl_internal.h)
+ * @param a_file : the file being closed
+ */
+void fcl_spill_free(fcl_file_t *a_file)
+{
+    fcl_spill_t *spill = a_file->spill;
+
+    if (a_file->session != NULL)
+        {
+            g_mutex_lock(&a_file->session->lock);
+            g_queue_remove(&a_file->session->files, a_file);
+            g_mutex_unlock(&a_file->session->lock);
+
+            /* Another file of the session may be spilling its buffers */
+            g_rw_lock_writer_lock(&a_file->buffers_lock);
+            g_rw_lock_writer_unlock(&a_file->buffers_lock);
+            a_file->session = NULL;
+        }
+
+    if (spill != NULL)
+        {
+            if (spill->session != NULL)
+                {
+                    g_mutex_lock(&spill->session->lock);
+                    spill->session->usage = spill->session->usage - spill->resident;
+                    g_mutex_unlock(&spill->session->lock);
+                }
+
+            g_mutex_lock(&budget_lock);
+            usage = usage - spill->resident;
+            g_mutex_unlock(&budget_lock);
+
+            if (spill->fd >= 0)
+                {
+                    g_close(spill->fd, NULL);
+                }
+
+            if (spill->compressor != NULL)
+                {
+                    g_object_unref(spill->compressor);
+                }
+
+            g_queue_clear(&spill->lru);
+            g_array_free(spill->holes, TRUE);
+            g_free(spill);
+            a_file->spill = NULL;
+        }
+}
+
+
+/**
+ * Gets the scratch file of a file, creating the structure if needed (the
+ * file itself is only created when a buffer is spilled)
+ * @param a_file : the file
+ * @return its fcl_spill_t structure
+ */
+static fcl_spill_t *get_spill(fcl_file_t *a_file)
+{
+    fcl_spill_t *spill = a_file->spill;
+
+    if (spill == NULL)
+        {
+            spill = (fcl_spill_t *) g_malloc0(sizeof(fcl_spill_t));
+            spill->fd = -1;
+            spill->holes = g_array_new(FALSE, FALSE, sizeof(spill_hole_t));
+            spill->session = a_file->session;
+            g_queue_init(&spill->lru);
+
+            a_file->spill = spill;
+        }
+
+    return spill;
+}
+
+
+/**
+ * Changes the number of bytes counted for a buffer in memory
+ * @param spill : the scratch file of the file of the buffer
+ * @param a_buffer : the buffer
+ * @param size : number of bytes of the buffer now in memory
+ */
+static void count_resident(fcl_spill_t *spill, fcl_buf_t *a_buffer, gsize size)
+{
+    spill->resident = spill->resident - a_buffer->resident + size;
+
+    g_mutex_lock(&budget_lock);
+    usage = usage - a_buffer->resident + size;
+    g_mutex_unlock(&budget_lock);
+
+    if (spill->session != NULL)
+        {
+            g_mutex_lock(&spill->session->lock);
+            spill->session->usage = spill->session->usage - a_buffer->resident + size;
+            g_mutex_unlock(&spill->session->lock);
+        }
+
+    a_buffer->resident = size;
+}
+
+
+/**
+ * Says wether the buffers use more memory than the budget : the one of the
+ * session of the file or the one of the library
+ * @param spill : the scratch file of the file being edited
+ * @return TRUE if there is a budget and it is exceeded
+ */
+static gboolean over_budget(fcl_spill_t *spill)
+{
+    gboolean over = FALSE;
+    gsize shared = fcl_get_shared_memory();
+
+    if (spill->session != NULL)
+        {
+            g_mutex_lock(&spill->session->lock);
+            over = spill->session->budget > 0 && spill->session->usage + shared > spill->session->budget;
+            g_mutex_unlock(&spill->session->lock);
+
+            return over;
+        }
+
+    g_mutex_lock(&budget_lock);
+    over = budget > 0 && usage + shared > budget;
+    g_mutex_unlock(&budget_lock);
+
+    return over;
+}
+
+
+/**
+ * Writes the data of a buffer to the scratch file and frees it
+ * @param a_file : the file
+ * @param spill : its scratch file
+ * @param a_buffer : a buffer of the sequence that is in memory
+ * @return FALSE if the scratch file could not be created or written
+ */
+static gboolean spill_buffer(fcl_file_t *a_file, fcl_spill_t *spill, fcl_buf_t *a_buffer)
+{
+    GError *error = NULL;
+    gchar *path = NULL;
+    goffset slot = 0;
+    gssize written = 0;
+    gsize done = 0;
+
+    if (spill->fd < 0)
+        {
+            spill->fd = g_file_open_tmp("libfcl-XXXXXX", &path, &error);
+
+            if (spill->fd < 0)
+                {
+                    fprintf(stderr, Q_("Unable to create a scratch file : %s\n"), error->message);
+                    g_error_free(error);
+                    return FALSE;
+                }
+
+            /* Nobody else needs to see it */
+            g_unlink(path);
+            g_free(path);
+        }
+
+    slot = take_place(spill, stored_size(a_buffer));
+
+    while (done < stored_size(a_buffer))
+        {
+            written = pwrite(spill->fd, a_buffer->data + done, stored_size(a_buffer) - done, (off_t) (slot + done));
+
+            if (written <= 0)
+                {
+                    fprintf(stderr, Q_("Unable to write a buffer to the scratch file\n"));
+                    free_place(spill, slot, stored_size(a_buffer));
+                    return FALSE;
+                }
+
+            done = done + (gsize) written;
+            a_file->perf->spill_writes = a_file->perf->spill_writes + 1;
+        }
+
+    a_file->perf->spill_bytes_written = a_file->perf->spill_bytes_written + done;
+
+    LIBFCL_TRACE(LIBFCL_TRACE_BUFFER_SPILLED, a_buffer, a_buffer->offset, slot, a_buffer->size);
+
+    g_free(a_buffer->data);
+    a_buffer->data = NULL;
+    a_buffer->spilled = TRUE;
+    a_buffer->slot = slot;
+    spill->spilled = spill->spilled + stored_size(a_buffer);
+    count_resident(spill, a_buffer, 0);
+
+    g_queue_delete_link(&spill->lru, a_buffer->lru);
+    a_buffer->lru = NULL;
+
+    return TRUE;
+}
+
+
+/**
+ * Spills the buffer modified the longest time ago of the files of a session :
+ * one of the file being edited (but the one just modified) or one of another
+ * file that is not in use. The lock of the other file is only tried : a file
+ * read or edited by another thread is skipped.
+ * @param a_file : the file being edited (its buffers_lock is held, reader)
+ * @param spill : its scratch file
+ * @param a_buffer : the buffer just modified
+ * @return FALSE if there was no buffer to spill or if it could not be spilled
+ */
+static gboolean spill_coldest(fcl_file_t *a_file, fcl_spill_t *spill, fcl_buf_t *a_buffer)
+{
+    fcl_file_t *victim = NULL;   /** other file holding coldest (its lock is held) */
+    fcl_file_t *other = NULL;
+    fcl_buf_t *coldest = NULL;
+    fcl_buf_t *tail = NULL;
+    GList *link = NULL;
+    gboolean done = FALSE;
+
+    tail = (fcl_buf_t *) g_queue_peek_tail(&spill->lru);
+
+    if (tail != a_buffer)
+        {
+            coldest = tail;
+        }
+
+    g_mutex_lock(&spill->session->lock);
+
+    for (link = g_queue_peek_head_link(&spill->session->files); link != NULL; link = link->next)
+        {
+            other = (fcl_file_t *) link->data;
+
+            if (other == a_file || g_rw_lock_writer_trylock(&other->buffers_lock) == FALSE)
+                {
+                    continue;
+                }
+
+            tail = other->spill != NULL ? (fcl_buf_t *) g_queue_peek_tail(&other->spill->lru) : NULL;
+
+            /* The clock wraps : the stamps are compared by their difference */
+            if (tail != NULL && (coldest == NULL || (gint) (tail->touched - coldest->touched) < 0))
+                {
+                    if (victim != NULL)
+                        {
+                            g_rw_lock_writer_unlock(&victim->buffers_lock);
+                        }
+
+                    victim = other;
+                    coldest = tail;
+                }
+            else
+                {
+                    g_rw_lock_writer_unlock(&other->buffers_lock);
+                }
+        }
+
+    g_mutex_unlock(&spill->session->lock);
+
+    if (victim != NULL)
+        {
+            /* The other file may be looked at by another thread */
+            g_mutex_lock(&victim->perf_lock);
+            done = spill_buffer(victim, victim->spill, coldest);
+            g_mutex_unlock(&victim->perf_lock);
+
+            g_rw_lock_writer_unlock(&victim->buffers_lock);
+        }
+    else if (coldest != NULL)
+        {
+            done = spill_buffer(a_file, spill, coldest);
+        }
+
+    return done;
+}
+
+
+/**
+ * Finds a place for some bytes in the scratch file : the first hole big
+ * enough or the end of the file
+ * @param spill : the scratch file
+ * @param size : number of bytes
+ * @return the offset of the place
+ */
+static goffset take_place(fcl_spill_t *spill, gsize size)
+{
+    spill_hole_t *hole = NULL;
+    goffset offset = 0;
+    guint i = 0;
+
+    for (i = 0; i < spill->holes->len; i++)
+        {
+            hole = &g_array_index(spill->holes, spill_hole_t, i);
+
+            if (hole->size >= size)
+                {
+                    offset = hole->offset;
+                    hole->offset = hole->offset + (goffset) size;
+                    hole->size = hole->size - size;
+
+                    if (hole->size == 0)
+                        {
+                            g_array_remove_index(spill->holes, i);
+                        }
+
+                    return offset;
+                }
+        }
+
+    offset = spill->end;
+    spill->end = spill->end + (goffset) size;
+
+    return offset;
+}
+
+
+/**
+ * Gives a place back to the scratch file. It is merged with the holes next
+ * to it and the end of the file goes back if it was the last place.
+ * @param spill : the scratch file
+ * @param offset : offset of the place
+ * @param size : its size
+ */
+static void free_place(fcl_spill_t *spill, goffset offset, gsize size)
+{
+    spill_hole_t hole;
+    spill_hole_t *previous = NULL;
+    spill_hole_t *next = NULL;
+    guint i = 0;
+
+    if (size == 0)
+        {
+            return;
+        }
+
+    while (i < spill->holes->len && g_array_index(spill->holes, spill_hole_t, i).offset < offset)
+        {
+            i++;
+        }
+
+    hole.offset = offset;
+    hole.size = size;
+    g_array_insert_val(spill->holes, i, hole);
+
+    if (i + 1 < spill->holes->len)
+        {
+            next = &g_array_index(spill->holes, spill_hole_t, i + 1);
+
+            if (offset + (goffset) size == next->offset)
+                {
+                    g_array_index(spill->holes, spill_hole_t, i).size = size + next->size;
+                    g_array_remove_index(spill->holes, i + 1);
+                }
+        }
+
+    if (i > 0)
+        {
+            previous = &g_array_index(spill->holes, spill_hole_t, i - 1);
+
+            if (previous->offset + (goffset) previous->size == offset)
+                {
+                    previous->size = previous->size + g_array_index(spill->holes, spill_hole_t, i).size;
+                    g_array_remove_index(spill->holes, i);
+                }
+        }
+
+    /* The last hole is not a hole : it is the end of the file */
+    if (spill->holes->len > 0)
+        {
+            next = &g_array_index(spill->holes, spill_hole_t, spill->holes->len - 1);
+
+            if (next->offset + (goffset) next->size == spill->end)
+                {
+                    spill->end = next->offset;
+                    g_array_remove_index(spill->holes, spill->holes->len - 1);
+                }
+        }
+}
+
+
+/**
+ * Gets the number of bytes of the data of a buffer as it is stored
+ * @param a_buffer : a buffer that is not made of pieces
+ * @return its size once compressed if it is, its size otherwise
+ */
+static gsize stored_size(fcl_buf_t *a_buffer)
+{
+    if (a_buffer->packed > 0)
+        {
+            return a_buffer->packed;
+        }
+    else
+        {
+            return a_buffer->size;
+        }
+}
+
+
+/**
+ * Reads bytes from the scratch file
+ * @param spill : the scratch file
+ * @param offset : offset of the first byte in the scratch file
+ * @param data : where to copy the bytes (at least size bytes)
+ * @param size : number of bytes to read
+ * @param perf : the counters where to count the reads
+ * @return the number of bytes read
+ */
+static gsize read_slot(fcl_spill_t *spill, goffset offset, guchar *data, gsize size, fcl_perf_t *perf)
+{
+    gssize read = 0;
+    gsize done = 0;
+
+    while (done < size)
+        {
+            read = pread(spill->fd, data + done, size - done, (off_t) (offset + done));
+
+            if (read <= 0)
+                {
+                    break;
+                }
+
+            done = done + (gsize) read;
+            perf->spill_reads = perf->spill_reads + 1;
+        }
+
+    perf->spill_bytes_read = perf->spill_bytes_read + done;
+
+    return done;
+}
+
+
+/**
+ * Compresses the data of a buffer in memory with the compressor of the
+ * scratch file. The data is left as is when the buffer is smaller than
+ * LIBFCL_SPILL_MIN_COMPRESSED or would not be at least an eighth smaller.
+ * @param a_file : the file
+ * @param spill : its scratch file
+ * @param a_buffer : a buffer of the sequence that is in memory
+ */
+static void compress_buffer(fcl_file_t *a_file, fcl_spill_t *spill, fcl_buf_t *a_buffer)
+{
+    GZlibCompressor *compressor = NULL;
+    GConverterResult result = G_CONVERTER_ERROR;
+    GError *error = NULL;
+    guchar *packed = NULL;
+    gsize size = a_buffer->size - a_buffer->size / 8;
+    gsize read = 0;
+    gsize written = 0;
+
+    if (a_buffer->size < LIBFCL_SPILL_MIN_COMPRESSED)
+        {
+            return;
+        }
+
+    if (spill->compressor == NULL)
+        {
+            spill->compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 1);
+        }
+
+    compressor = spill->compressor;
+    packed = (guchar *) g_malloc(size * sizeof(guchar));
+
+    result = g_converter_convert(G_CONVERTER(compressor), a_buffer->data, a_buffer->size, packed, size, G_CONVERTER_INPUT_AT_END, &read, &written, &error);
+
+    g_clear_error(&error);
+    g_converter_reset(G_CONVERTER(compressor));
+
+    if (result != G_CONVERTER_FINISHED || read != a_buffer->size || written == 0)
+        {
+            g_free(packed);
+            return;
+        }
+
+    g_free(a_buffer->data);
+    a_buffer->data = (guchar *) g_realloc(packed, written * sizeof(guchar));
+    a_buffer->packed = written;
+
+    spill->compressed = spill->compressed + a_buffer->size;
+    spill->packed = spill->packed + written;
+    a_file->perf->compressions = a_file->perf->compressions + 1;
+    count_resident(spill, a_buffer, written);
+}
+
+
+/**
+ * Uncompresses the data of a compressed buffer, in memory or in the scratch
+ * file. It may be called from many threads at once.
+ * @param a_file : the file
+ * @param a_buffer : a compressed buffer
+ * @param data : where to put its bytes (at least a_buffer->size bytes)
+ * @param perf : the counters where to count the reads and the decompression
+ * @return TRUE if all its bytes were uncompressed
+ */
+static gboolean uncompress_buffer(fcl_file_t *a_file, fcl_buf_t *a_buffer, guchar *data, fcl_perf_t *perf)
+{
+    GZlibDecompressor *decompressor = NULL;
+    GConverterResult result = G_CONVERTER_ERROR;
+    GError *error = NULL;
+    guchar *packed = a_buffer->data;
+    gsize read = 0;
+    gsize written = 0;
+
+    if (a_buffer->spilled == TRUE)
+        {
+            packed = (guchar *) g_malloc(a_buffer->packed * sizeof(guchar));
+
+            if (read_slot(a_file->spill, a_buffer->slot, packed, a_buffer->packed, perf) != a_buffer->packed)
+                {
+                    g_free(packed);
+                    return FALSE;
+                }
+        }
+
+    decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW);
+    result = g_converter_convert(G_CONVERTER(decompressor), packed, a_buffer->packed, data, a_buffer->size, G_CONVERTER_INPUT_AT_END, &read, &written, &error);
+
+    if (result != G_CONVERTER_FINISHED || written != a_buffer->size)
+        {
+            fprintf(stderr, Q_("Unable to uncompress a buffer : %s\n"), error != NULL ? error->message : "");
+        }
+
+    g_clear_error(&error);
+    g_object_unref(decompressor);
+
+    if (packed != a_buffer->data)
+        {
+            g_free(packed);
+        }
+
+    perf->decompressions = perf->decompressions + 1;
+
+    return result == G_CONVERTER_FINISHED && written == a_buffer->size;
+}
+
+
+/**
+ * Takes a buffer out of the compressed ones of its file (if it was)
+ * @param spill : the scratch file of the file of the buffer
+ * @param a_buffer : a buffer whose data is no longer compressed
+ */
+static void uncount_packed(fcl_spill_t *spill, fcl_buf_t *a_buffer)
+{
+    if (a_buffer->packed > 0)
+        {
+            spill->compressed = spill->compressed - a_buffer->size;
+            spill->packed = spill->packed - a_buffer->packed;
+            a_buffer->packed = 0;
+        }
+}
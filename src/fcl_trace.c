@@ -0,0 +1,281 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  fcl_trace.c
+ *  File Cache Library
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file fcl_trace.c
+ * Tracing of what the library does (--enable-debug only).
+ *
+ * An event is a small fixed size record (time, thread, kind of event, the
+ * object concerned and three numbers) written with LIBFCL_TRACE() into a
+ * ring of the calling thread : no lock, no formatting and no output while
+ * the library works. The last LIBFCL_TRACE_RING_SIZE events of each thread
+ * are kept and fcl_trace_dump() prints them afterward, ordered by time.
+ *
+ * The ring of a thread is given back when the thread exits and reused by the
+ * next thread that records an event (the events are kept until then).
+ * Without --enable-debug, LIBFCL_TRACE() expands to nothing.
+ */
+#include "fcl.h"
+#include "fcl_internal.h"
+
+#if ENABLE_DEBUG
+
+/**
+ * @def LIBFCL_TRACE_RING_SIZE
+ * Number of events kept for each thread (a power of 2)
+ */
+#define LIBFCL_TRACE_RING_SIZE 4096
+
+
+/**
+ * @struct fcl_trace_event_t
+ * An event recorded by LIBFCL_TRACE()
+ */
+typedef struct
+{
+    gint64 time;            /**< Time of the event (g_get_monotonic_time())    */
+    guint thread;           /**< Number of the thread that recorded it         */
+    gint event;             /**< Kind of event (LIBFCL_TRACE_LOOKUP_HIT...)    */
+    gconstpointer object;   /**< File or buffer concerned                      */
+    gint64 a;               /**< First number (see event_names)                */
+    gint64 b;               /**< Second number                                 */
+    gint64 c;               /**< Third number                                  */
+} fcl_trace_event_t;
+
+
+/**
+ * @struct trace_ring_t
+ * The last events recorded by a thread
+ */
+typedef struct
+{
+    gint head;              /**< Number of events recorded in the ring         */
+    guint thread;           /**< Number of the thread that owns the ring       */
+    gboolean in_use;        /**< FALSE once the thread has exited              */
+    fcl_trace_event_t events[LIBFCL_TRACE_RING_SIZE];
+} trace_ring_t;
+
+
+/**
+ * Name of each kind of event and of its three numbers
+ */
+static const gchar *event_names[LIBFCL_TRACE_N_EVENTS][4] =
+{
+    {"lookup hit",       "position", "block",       "real_offset"},
+    {"lookup miss",      "position", "block",       "read"},
+    {"read",             "position", "size",        "in_data"},
+    {"overwrite",        "position", "size",        "buf_position"},
+    {"insert",           "position", "size",        "buf_position"},
+    {"delete",           "position", "size",        "buf_position"},
+    {"buffer inserted",  "block",    "real_offset", "size"},
+    {"buffer destroyed", "block",    "real_offset", "size"},
+    {"file closed",      "buffers",  "real_size",   "mode"},
+    {"buffer spilled",   "block",    "slot",        "size"},
+    {"buffer loaded",    "block",    "slot",        "size"},
+};
+
+static void release_ring(gpointer data);
+static trace_ring_t *get_ring(void);
+static gint cmp_event_time(gconstpointer a, gconstpointer b);
+
+static GMutex rings_lock;                                /** Protects rings and n_threads */
+static GPtrArray *rings = NULL;                          /** Every ring ever created      */
+static guint n_threads = 0;                              /** Threads that recorded events */
+static GPrivate ring_key = G_PRIVATE_INIT(release_ring); /** Ring of the calling thread   */
+
+#endif /* ENABLE_DEBUG */
+
+
+/******************************************************************************/
+/********************************* Public API *********************************/
+/******************************************************************************/
+
+/**
+ * Prints the events recorded by every thread, ordered by time (see fcl.h)
+ * @param stream : where to print the events
+ */
+void fcl_trace_dump(FILE *stream)
+{
+#if ENABLE_DEBUG
+    GArray *events = NULL;
+    trace_ring_t *ring = NULL;
+    fcl_trace_event_t *event = NULL;
+    const gchar **names = NULL;
+    gint head = 0;
+    gint i = 0;
+    guint r = 0;
+
+    events = g_array_new(FALSE, FALSE, sizeof(fcl_trace_event_t));
+
+    g_mutex_lock(&rings_lock);
+
+    for (r = 0; rings != NULL && r < rings->len; r++)
+        {
+            ring = (trace_ring_t *) g_ptr_array_index(rings, r);
+            head = g_atomic_int_get(&ring->head);
+
+            for (i = MAX(head - LIBFCL_TRACE_RING_SIZE, 0); i < head; i++)
+                {
+                    g_array_append_val(events, ring->events[i & (LIBFCL_TRACE_RING_SIZE - 1)]);
+                }
+        }
+
+    g_mutex_unlock(&rings_lock);
+
+    g_array_sort(events, cmp_event_time);
+
+    for (r = 0; r < events->len; r++)
+        {
+            event = &g_array_index(events, fcl_trace_event_t, r);
+            names = event_names[event->event];
+
+            fprintf(stream, "%" G_GINT64_FORMAT " [%u] %-16s %p %s %" G_GINT64_FORMAT " %s %" G_GINT64_FORMAT " %s %" G_GINT64_FORMAT "\n",
+                    event->time, event->thread, names[0], event->object, names[1], event->a, names[2], event->b, names[3], event->c);
+        }
+
+    g_array_free(events, TRUE);
+#endif
+}
+
+
+/******************************************************************************/
+/****************************** Intern functions ******************************/
+/******************************************************************************/
+
+#if ENABLE_DEBUG
+
+/**
+ * Records an event in the ring of the calling thread (see fcl_internal.h)
+ * @param event : kind of event (LIBFCL_TRACE_LOOKUP_HIT...)
+ * @param object : file or buffer concerned
+ * @param a : first number
+ * @param b : second number
+ * @param c : third number
+ */
+void fcl_trace_record(gint event, gconstpointer object, gint64 a, gint64 b, gint64 c)
+{
+    trace_ring_t *ring = get_ring();
+    fcl_trace_event_t *slot = NULL;
+
+    slot = &ring->events[ring->head & (LIBFCL_TRACE_RING_SIZE - 1)];
+
+    slot->time = g_get_monotonic_time();
+    slot->thread = ring->thread;
+    slot->event = event;
+    slot->object = object;
+    slot->a = a;
+    slot->b = b;
+    slot->c = c;
+
+    /* Only this thread writes in the ring : the new head is published once
+     * the event is written */
+    g_atomic_int_set(&ring->head, ring->head + 1);
+}
+
+
+/**
+ * Gets the ring of the calling thread. The first time, a ring given back by
+ * a thread that exited is reused (or a new one is created).
+ * @return the ring of the calling thread
+ */
+static trace_ring_t *get_ring(void)
+{
+    trace_ring_t *ring = (trace_ring_t *) g_private_get(&ring_key);
+    guint r = 0;
+
+    if (ring == NULL)
+        {
+            g_mutex_lock(&rings_lock);
+
+            if (rings == NULL)
+                {
+                    rings = g_ptr_array_new();
+                }
+
+            for (r = 0; r < rings->len && ring == NULL; r++)
+                {
+                    if (((trace_ring_t *) g_ptr_array_index(rings, r))->in_use == FALSE)
+                        {
+                            ring = (trace_ring_t *) g_ptr_array_index(rings, r);
+                        }
+                }
+
+            if (ring == NULL)
+                {
+                    ring = (trace_ring_t *) g_malloc0(sizeof(trace_ring_t));
+                    g_ptr_array_add(rings, ring);
+                }
+
+            ring->in_use = TRUE;
+            ring->thread = n_threads;
+            n_threads = n_threads + 1;
+
+            g_mutex_unlock(&rings_lock);
+
+            g_private_set(&ring_key, ring);
+        }
+
+    return ring;
+}
+
+
+/**
+ * Gives back the ring of a thread that exits
+ * @param data : the ring
+ */
+static void release_ring(gpointer data)
+{
+    trace_ring_t *ring = (trace_ring_t *) data;
+
+    g_mutex_lock(&rings_lock);
+    ring->in_use = FALSE;
+    g_mutex_unlock(&rings_lock);
+}
+
+
+/**
+ * Compares the time of two events
+ * @param a : a fcl_trace_event_t
+ * @param b : another fcl_trace_event_t
+ * @return a negative value if a is before b, 0 if they are at the same time
+ *         and a positive value otherwise
+ */
+static gint cmp_event_time(gconstpointer a, gconstpointer b)
+{
+    const fcl_trace_event_t *event_a = (const fcl_trace_event_t *) a;
+    const fcl_trace_event_t *event_b = (const fcl_trace_event_t *) b;
+
+    if (event_a->time < event_b->time)
+        {
+            return -1;
+        }
+    else if (event_a->time > event_b->time)
+        {
+            return 1;
+        }
+    else
+        {
+            return 0;
+        }
+}
+
+#endif /* ENABLE_DEBUG */
@@ -84,6 +84,287 @@
 #define LIBFCL_MODE_CREATE 4
 
 
+/**
+ * @def LIBFCL_FIND_FORWARD
+ * Direction of a search : looks for the first match at or after the position
+ * given
+ *
+ * @def LIBFCL_FIND_BACKWARD
+ * Direction of a search : looks for the last match that begins at or before
+ * the position given
+ */
+#define LIBFCL_FIND_FORWARD 0
+#define LIBFCL_FIND_BACKWARD 1
+
+
+/**
+ * @def LIBFCL_CHECKSUM_CRC32C
+ * CRC32C (Castagnoli) checksum, see fcl_checksum()
+ *
+ * @def LIBFCL_CHECKSUM_XXH64
+ * xxHash (64 bits) checksum, see fcl_checksum()
+ *
+ * @def LIBFCL_CHECKSUM_SHA256
+ * SHA-256 checksum, see fcl_checksum()
+ */
+#define LIBFCL_CHECKSUM_CRC32C 0
+#define LIBFCL_CHECKSUM_XXH64 1
+#define LIBFCL_CHECKSUM_SHA256 2
+
+
+/**
+ * @def LIBFCL_RENDER_OFFSET
+ * Begins each row of fcl_render_hex() with its position (16 hexadecimal
+ * digits)
+ *
+ * @def LIBFCL_RENDER_UPPER
+ * Upper case hexadecimal digits in fcl_render_hex()
+ *
+ * @def LIBFCL_RENDER_DIFF
+ * Marks with a '*' (instead of a space) after its hexadecimal digits each
+ * byte that differs from the byte at the same offset in the file on disk
+ */
+#define LIBFCL_RENDER_OFFSET 1
+#define LIBFCL_RENDER_UPPER 2
+#define LIBFCL_RENDER_DIFF 4
+
+
+/**
+ * @def LIBFCL_BACKEND_GIO
+ * Storage backend that reads and writes through GIO streams : any path or URI
+ * that GIO knows. The reads of a file are serialized (the streams are
+ * positionned). This is the default backend.
+ *
+ * @def LIBFCL_BACKEND_POSIX
+ * Storage backend that reads and writes a file descriptor with pread() and
+ * pwrite() : no seek, no copy in the buffer of a stream and the reads of many
+ * threads go on at once (local files only)
+ *
+ * @def LIBFCL_BACKEND_MMAP
+ * Storage backend that maps the file in memory : the untouched parts of the
+ * file are read in place, without any copy. It writes as the POSIX backend.
+ *
+ * @def LIBFCL_BACKEND_MEMORY
+ * Storage backend whose bytes are in memory. A file is loaded at once when
+ * it is openned and is never written back to the disk. It holds at most
+ * G_MAXUINT bytes : a bigger file is openned with LIBFCL_BACKEND_POSIX.
+ */
+#define LIBFCL_BACKEND_GIO 0
+#define LIBFCL_BACKEND_POSIX 1
+#define LIBFCL_BACKEND_MMAP 2
+#define LIBFCL_BACKEND_MEMORY 3
+
+
+/**
+ * @struct fcl_checksums_t
+ * Hash trees kept on a file by fcl_checksum() (opaque)
+ */
+typedef struct _fcl_checksums_t fcl_checksums_t;
+
+
+/**
+ * @struct fcl_histograms_t
+ * Byte histograms and entropies kept on a file by fcl_byte_histogram() and
+ * fcl_entropy_map() (opaque)
+ */
+typedef struct _fcl_histograms_t fcl_histograms_t;
+
+
+/**
+ * @struct fcl_spill_t
+ * Scratch file where the data of the buffers of a file goes when the memory
+ * budget is exceeded (opaque, see fcl_set_memory_budget())
+ */
+typedef struct _fcl_spill_t fcl_spill_t;
+
+
+/**
+ * @struct fcl_session_t
+ * Files that share a memory budget (opaque, see fcl_session_new())
+ */
+typedef struct _fcl_session_t fcl_session_t;
+
+
+/**
+ * @struct fcl_source_t
+ * A file whose ranges are inserted in buffers made of pieces (opaque, see
+ * fcl_insert_file_range())
+ */
+typedef struct _fcl_source_t fcl_source_t;
+
+
+/**
+ * @struct fcl_backend_t
+ * Storage backend of a file : the functions through which its bytes are read
+ * and written (see fcl_backend_new()). A backend of one's own embeds this
+ * structure at its beginning and fills it. read_at() may be called by many
+ * threads at once. read_at() and write_at() open the storage when it is not.
+ */
+typedef struct _fcl_backend_t fcl_backend_t;
+struct _fcl_backend_t
+{
+    gboolean (*open)(fcl_backend_t *backend);   /**< Opens the storage (TRUE if it is open) */
+    gssize (*read_at)(fcl_backend_t *backend, goffset offset, guchar *data, gsize size);  /**< Reads size bytes at offset (-1 on error) */
+    gssize (*write_at)(fcl_backend_t *backend, goffset offset, const guchar *data, gsize size);  /**< Writes size bytes at offset (-1 on error) */
+    goffset (*size)(fcl_backend_t *backend);    /**< Size of the storage (-1 if it does not exist) */
+    gboolean (*sync)(fcl_backend_t *backend);   /**< Makes what was written durable */
+    const guchar *(*map)(fcl_backend_t *backend, gsize *size_pointer);  /**< The bytes in memory, valid until the next write (may be NULL) */
+    void (*release)(fcl_backend_t *backend);    /**< Closes the storage until the next read or write (NULL if it never needs to), unless it can not be openned again as it is (is_open stays TRUE) */
+    void (*free)(fcl_backend_t *backend);       /**< Closes the storage and frees the backend */
+    gint mode;                                  /**< Mode of the file (LIBFCL_MODE_READ...) */
+    gboolean is_open;                           /**< TRUE while the storage is open */
+};
+
+
+/**
+ * @def LIBFCL_STATS_HISTOGRAM_SIZE
+ * Number of classes of the histogram of the sizes of the buffers : class 0
+ * counts the empty buffers, class i the buffers of 2^(i-1) to 2^i - 1 bytes
+ * and the last class all the bigger ones.
+ */
+#define LIBFCL_STATS_HISTOGRAM_SIZE 40
+
+
+/**
+ * @struct fcl_stat_buf_t
+ * Structure that can manage some statistics about the buffers in the sequence
+ * of an fcl_file_t. They are kept up to date as the file is edited.
+ */
+typedef struct
+{
+    gssize min_buf_size;   /** Minimum size of a buffer in the sequence */
+    gssize max_buf_size;   /** Maximum size of a buffer in the sequence */
+    gssize add_size;       /** Additions done within the sequence (file)*/
+    gssize real_edit_size; /** Real size of the additions and deletions */
+    guint64 n_bufs;        /** Number of buffers in the sequence        */
+    gssize del_size;       /** Deletions done within the sequence       */
+    goffset logical_size;  /** Size of the edited file                  */
+    gsize resident_size;   /** Bytes of the buffers held in memory      */
+    gsize spilled_size;    /** Bytes of the buffers in the scratch file */
+    gsize compressed_size; /** Bytes of the buffers that are compressed */
+    gsize packed_size;     /** Their size once compressed               */
+    guint64 histogram[LIBFCL_STATS_HISTOGRAM_SIZE]; /** Buffers by size (see LIBFCL_STATS_HISTOGRAM_SIZE) */
+} fcl_stat_buf_t;
+
+
+/**
+ * @def LIBFCL_PERF_READ
+ * Reads (fcl_read_bytes()), see fcl_perf_t
+ *
+ * @def LIBFCL_PERF_INSERT
+ * Insertions (fcl_insert_bytes()), see fcl_perf_t
+ *
+ * @def LIBFCL_PERF_DELETE
+ * Deletions (fcl_delete_bytes()), see fcl_perf_t
+ *
+ * @def LIBFCL_PERF_OVERWRITE
+ * Overwrites (fcl_overwrite_bytes()), see fcl_perf_t
+ *
+ * @def LIBFCL_PERF_SAVE
+ * Saves of the file, see fcl_perf_t
+ *
+ * @def LIBFCL_PERF_MOVE
+ * Moves of a range (fcl_move_range()), see fcl_perf_t
+ *
+ * @def LIBFCL_PERF_N_OPS
+ * Number of kinds of operations timed
+ *
+ * @def LIBFCL_PERF_LATENCY_BUCKETS
+ * Number of buckets of the latency histograms : bucket 0 counts the
+ * operations that took less than 1 µs, bucket i the ones that took 2^(i-1)
+ * to 2^i - 1 µs and the last bucket all the longer ones.
+ */
+#define LIBFCL_PERF_READ 0
+#define LIBFCL_PERF_INSERT 1
+#define LIBFCL_PERF_DELETE 2
+#define LIBFCL_PERF_OVERWRITE 3
+#define LIBFCL_PERF_SAVE 4
+#define LIBFCL_PERF_MOVE 5
+#define LIBFCL_PERF_N_OPS 6
+#define LIBFCL_PERF_LATENCY_BUCKETS 32
+
+
+/**
+ * @def LIBFCL_RECORD_MAGIC
+ * The first bytes of a trace written by fcl_record_start()
+ *
+ * @def LIBFCL_RECORD_VERSION
+ * Version of the format of the traces (see fcl_record.c)
+ *
+ * @def LIBFCL_RECORD_OPEN
+ * Record of fcl_open_file()
+ *
+ * @def LIBFCL_RECORD_CLOSE
+ * Record of fcl_close_file()
+ *
+ * @def LIBFCL_RECORD_READ
+ * Record of fcl_read_bytes()
+ *
+ * @def LIBFCL_RECORD_OVERWRITE
+ * Record of fcl_overwrite_bytes()
+ *
+ * @def LIBFCL_RECORD_INSERT
+ * Record of fcl_insert_bytes()
+ *
+ * @def LIBFCL_RECORD_DELETE
+ * Record of fcl_delete_bytes()
+ *
+ * @def LIBFCL_RECORD_REPLACE_ALL
+ * Record of fcl_replace_all()
+ *
+ * @def LIBFCL_RECORD_COPY
+ * Record of fcl_copy_range()
+ *
+ * @def LIBFCL_RECORD_MOVE
+ * Record of fcl_move_range()
+ *
+ * @def LIBFCL_RECORD_N_CALLS
+ * Number of kinds of records
+ */
+#define LIBFCL_RECORD_MAGIC "FCLR"
+#define LIBFCL_RECORD_VERSION 1
+#define LIBFCL_RECORD_OPEN 0
+#define LIBFCL_RECORD_CLOSE 1
+#define LIBFCL_RECORD_READ 2
+#define LIBFCL_RECORD_OVERWRITE 3
+#define LIBFCL_RECORD_INSERT 4
+#define LIBFCL_RECORD_DELETE 5
+#define LIBFCL_RECORD_REPLACE_ALL 6
+#define LIBFCL_RECORD_COPY 7
+#define LIBFCL_RECORD_MOVE 8
+#define LIBFCL_RECORD_N_CALLS 9
+
+
+/**
+ * @struct fcl_perf_t
+ * Performance counters of an fcl_file_t. They only cost a few additions and
+ * two clock readings per operation so they are always kept. Every field is a
+ * guint64.
+ */
+typedef struct
+{
+    guint64 disk_reads;       /** Reads from the disk                               */
+    guint64 disk_seeks;       /** Seeks in the file on disk                         */
+    guint64 disk_bytes_read;  /** Bytes read from the disk                          */
+    guint64 lookups;          /** Searches of the buffer holding a position         */
+    guint64 lookup_steps;     /** Buffers of the sequence walked by these searches  */
+    guint64 cache_hits;       /** Searches that found the buffer in the sequence    */
+    guint64 cache_misses;     /** Searches that had to read the buffer from disk    */
+    guint64 allocations;      /** Memory allocations done by the edits and reads    */
+    guint64 allocated_bytes;  /** Bytes allocated by these allocations              */
+    guint64 spill_writes;     /** Writes to the scratch file                        */
+    guint64 spill_bytes_written; /** Bytes written to the scratch file              */
+    guint64 spill_reads;      /** Reads from the scratch file                       */
+    guint64 spill_bytes_read; /** Bytes read from the scratch file                  */
+    guint64 compressions;     /** Buffers compressed in memory                      */
+    guint64 decompressions;   /** Buffers uncompressed to be read or modified       */
+    guint64 pool_closes;      /** Times its streams were closed (too many open files) */
+    guint64 op_count[LIBFCL_PERF_N_OPS];  /** Operations done (LIBFCL_PERF_READ...)  */
+    guint64 op_time[LIBFCL_PERF_N_OPS];   /** Time spent in these operations (µs)    */
+    guint64 latency[LIBFCL_PERF_N_OPS][LIBFCL_PERF_LATENCY_BUCKETS]; /** Latency histograms (see LIBFCL_PERF_LATENCY_BUCKETS) */
+} fcl_perf_t;
+
+
 /**
  * @struct fcl_file_t
  * Structure that contains all the definitions needed by the library for a
@@ -98,10 +379,22 @@ typedef struct
     gchar *name;                   /**< Name for the file                 */
     gint mode;                     /**< Mode in which the file was opened */
     goffset real_size;             /**< Actual size of the file           */
-    GFile *the_file;               /**< The corresponding GFile           */
-    GFileInputStream *in_stream;   /**< Stream used for reading           */
-    GFileOutputStream *out_stream; /**< Stream used for writing           */
+    GFile *the_file;               /**< The corresponding GFile (or NULL) */
+    fcl_backend_t *backend;        /**< Storage of the file               */
     GSequence *sequence;           /**< Sequence of buffers (fcl_buf_t)   */
+    fcl_checksums_t *checksums;    /**< Hash trees (NULL until needed)    */
+    fcl_histograms_t *histograms;  /**< Histograms (NULL until needed)    */
+    fcl_spill_t *spill;            /**< Scratch file (NULL until needed)  */
+    fcl_session_t *session;        /**< Session of the file (or NULL)     */
+    GList *pool;                   /**< Link in the open files (or NULL)  */
+    guint used;                    /**< Last use of its backend (pool clock) */
+    GRWLock backend_lock;          /**< Held (reader) while it is read    */
+    GRWLock buffers_lock;          /**< Held (reader) while its buffers are used */
+    fcl_source_t *origin;          /**< Itself as a source of pieces      */
+    fcl_stat_buf_t *stats;         /**< Statistics of the sequence        */
+    GHashTable *buf_sizes;         /**< Number of buffers of each size    */
+    fcl_perf_t *perf;              /**< Performance counters              */
+    GMutex perf_lock;              /**< Protects perf from the views      */
 } fcl_file_t;
 
 
@@ -116,22 +409,69 @@ typedef struct
     gsize size;          /** Size of the buffer                                  */
     guchar *data;        /** The buffer (if any)                                 */
     gboolean in_seq;     /** Says wether the buffer is in the sequence or not    */
+    gsize stat_size;     /** Size counted in the statistics (when in_seq)        */
+    gboolean spilled;    /** The data is in the scratch file (data is NULL)      */
+    goffset slot;        /** Offset of the data in the scratch file              */
+    gsize resident;      /** Size counted in the memory budget                   */
+    GList *lru;          /** Link in the buffers by last modification (or NULL)  */
+    guint touched;       /** Stamp of its last modification (see fcl_spill.c)    */
+    GArray *pieces;      /** Its pieces when it holds ranges of other files      */
+    gsize packed;        /** Size of its data once compressed (0 : not compressed) */
 } fcl_buf_t;
 
 
 /**
- * @struct fcl_stat_buf_t
- * Structure that can manage some statistics about the buffers in the sequence
- * of an fcl_file_t
+ * @struct fcl_match_t
+ * A match of one of the patterns of a fcl_patterns_t set in the edited file
  */
 typedef struct
 {
-    gssize min_buf_size;   /** Minimum size of a buffer in the sequence */
-    gssize max_buf_size;   /** Maximum size of a buffer in the sequence */
-    gssize add_size;       /** Additions done within the sequence (file)*/
-    gssize real_edit_size; /** Real size of the additions and deletions */
-    guint64 n_bufs;        /** Number of buffers in the sequence        */
-} fcl_stat_buf_t;
+    goffset position;  /** Position of the match in the edited file           */
+    guint pattern;     /** Number of the pattern (given by fcl_patterns_add) */
+    gsize size;        /** Size of the pattern                                */
+} fcl_match_t;
+
+
+/**
+ * @struct fcl_diff_t
+ * A difference between two edited files : a_size bytes at a_position in the
+ * first file are replaced by b_size bytes at b_position in the second one.
+ * a_size is 0 for bytes inserted in the second file and b_size is 0 for
+ * bytes deleted from the first one.
+ */
+typedef struct
+{
+    goffset a_position;  /** Position of the difference in the first file  */
+    gsize a_size;        /** Number of bytes in the first file              */
+    goffset b_position;  /** Position of the difference in the second file */
+    gsize b_size;        /** Number of bytes in the second file             */
+} fcl_diff_t;
+
+
+/**
+ * @struct fcl_entropy_t
+ * A block of the entropy map of an edited file (see fcl_entropy_map())
+ */
+typedef struct
+{
+    goffset position;  /** Position of the block in the edited file       */
+    gsize size;        /** Number of bytes of the block                   */
+    gdouble entropy;   /** Entropy of the bytes (bits per byte, 0 to 8)    */
+} fcl_entropy_t;
+
+
+/**
+ * @struct fcl_patterns_t
+ * An opaque set of patterns compiled to be searched all at once
+ */
+typedef struct _fcl_patterns_t fcl_patterns_t;
+
+
+/**
+ * @struct fcl_regex_iter_t
+ * An opaque search of a regular expression in the edited file
+ */
+typedef struct _fcl_regex_iter_t fcl_regex_iter_t;
 
 
 /**
@@ -166,11 +506,67 @@ extern void libfcl_initialize(void);
 extern fcl_file_t *fcl_open_file(gchar *path, gint mode);
 
 
+/**
+ * Opens a file lazily : only its size is asked for (one stat) and the streams
+ * are openned the first time the file is read or written. The file is not
+ * created (LIBFCL_MODE_WRITE) or emptied (LIBFCL_MODE_CREATE) until then.
+ * @param path : the path of the file to be opened
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ, LIBFCL_MODE_WRITE,
+ *               LIBFCL_MODE_CREATE).
+ * @return a correctly filled fcl_file_t structure that represents the file
+ *         or NULL if mode is not one of the modes
+ */
+extern fcl_file_t *fcl_open_file_lazy(gchar *path, gint mode);
+
+
+/**
+ * Opens many files lazily (see fcl_open_file_lazy()). The sizes of the files
+ * are asked for by a pool of threads.
+ * @param paths : the paths of the files (NULL terminated)
+ * @param mode : the mode to open the files (LIBFCL_MODE_READ...)
+ * @param n_threads : maximum number of threads (0 means one per processor)
+ * @return a GPtrArray of the fcl_file_t files, in the order of paths, or NULL
+ *         if mode is not one of the modes. Each file is to be closed with
+ *         fcl_close_file() and the array freed with g_ptr_array_free().
+ */
+extern GPtrArray *fcl_open_files(gchar **paths, gint mode, guint n_threads);
+
+
+/**
+ * Sets the maximum number of files whose streams may be open at once (each
+ * one holds one or two file descriptors). When it is exceeded, the streams
+ * of the files used the longest time ago are closed (their backend is
+ * released) : they are openned again the next time the file is read and the
+ * fcl_file_t stays valid meanwhile. The files of a memory backend do not
+ * count.
+ * The limit may also be set with the LIBFCL_MAX_OPEN_FILES environment
+ * variable before libfcl_initialize() is called.
+ * @param n_files : the number of files (0, the default, means no limit)
+ */
+extern void fcl_set_max_open_files(guint n_files);
+
+
+/**
+ * Gets the maximum number of files whose streams may be open at once
+ * @return the number of files (0 means no limit)
+ */
+extern guint fcl_get_max_open_files(void);
+
+
+/**
+ * Gets the number of files whose streams are open
+ * @return the number of files
+ */
+extern guint fcl_get_open_files(void);
+
+
 /**
  * This function closes a fcl_file_t
  * @param the fcl_file_t to close
  * @param save : a gboolean to say wether if we want to save the file before
- *               closinf it or not.
+ *               closinf it or not. The edited file is written to a temporary
+ *               file next to it that then replaces it (the file has to be a
+ *               local one, openned in a writable mode).
  */
 extern void fcl_close_file(fcl_file_t *a_file, gboolean save);
 
@@ -220,6 +616,125 @@ extern gboolean fcl_overwrite_bytes(fcl_file_t *a_file, guchar *data, goffset po
 extern gboolean fcl_insert_bytes(fcl_file_t *a_file, guchar *data, goffset position, gsize size);
 
 
+/**
+ * Inserts a range of another file at 'position' without reading it : the
+ * edited file only references the range, whose bytes are read from the other
+ * file when they are needed (reads, searches, fcl_save_as()...). Editing
+ * inside the range keeps the rest of it referenced.
+ * @warning the other file must not be modified while it is referenced.
+ * @param a_file : the fcl_file_t file where to insert the range
+ * @param position : position of the insertion in the edited file
+ * @param path : path of the file that holds the range
+ * @param offset : offset of the range in that file
+ * @param length : number of bytes of the range
+ * @return TRUE if the range was inserted, FALSE otherwise (read only file,
+ *         range beyond the end of the other file...)
+ */
+extern gboolean fcl_insert_file_range(fcl_file_t *a_file, goffset position, const gchar *path, goffset offset, gsize length);
+
+
+/**
+ * Same as fcl_insert_file_range() with an openned file descriptor (which has
+ * to be seekable). It is duplicated : the caller may close it at once.
+ * @param a_file : the fcl_file_t file where to insert the range
+ * @param position : position of the insertion in the edited file
+ * @param fd : the file descriptor
+ * @param offset : offset of the range in that file
+ * @param length : number of bytes of the range
+ * @return TRUE if the range was inserted, FALSE otherwise
+ */
+extern gboolean fcl_insert_fd_range(fcl_file_t *a_file, goffset position, gint fd, goffset offset, gsize length);
+
+
+/**
+ * Copies a range of the edited file to another position of it. Nothing is
+ * read : the copy references the untouched parts of the file on disk and the
+ * ranges inserted from other files (see fcl_insert_file_range()), only the
+ * bytes already edited in the range are copied. The memory used thus does
+ * not depend on the size of the range, unless the file has no local path
+ * (in memory, a URI) : its untouched bytes are then read and copied too.
+ * @param a_file : the fcl_file_t file
+ * @param src_position : position of the range
+ * @param size : number of bytes of the range
+ * @param dst_position : position where the copy is inserted (it may be in
+ *                       the range)
+ * @return TRUE if the range was copied, FALSE otherwise (read only file,
+ *         range or position beyond the end of the file...)
+ */
+extern gboolean fcl_copy_range(fcl_file_t *a_file, goffset src_position, gsize size, goffset dst_position);
+
+
+/**
+ * Moves a range of the edited file to another position of it, by reference
+ * as fcl_copy_range() does. The range is then deleted from where it was.
+ * @param a_file : the fcl_file_t file
+ * @param src_position : position of the range
+ * @param size : number of bytes of the range
+ * @param dst_position : position, before the move, where the range goes (it
+ *                       can not be inside the range). When it is after the
+ *                       range the moved bytes end at dst_position.
+ * @return TRUE if the range was moved, FALSE otherwise
+ */
+extern gboolean fcl_move_range(fcl_file_t *a_file, goffset src_position, gsize size, goffset dst_position);
+
+
+/**
+ * Copies a range of the edited file to the clipboard of the library, by
+ * reference as fcl_copy_range() does. The clipboard may then be pasted in
+ * any file, as many times as needed : the bytes in memory are shared by
+ * every paste (they are immutable, an edit of a pasted range only changes
+ * the file edited) and the untouched parts of the range still reference the
+ * file on disk they come from.
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the range
+ * @param size : number of bytes of the range
+ * @return TRUE if the range was copied, FALSE otherwise
+ */
+extern gboolean fcl_clipboard_copy(fcl_file_t *a_file, goffset position, gsize size);
+
+
+/**
+ * Copies a range of the edited file to the clipboard (see
+ * fcl_clipboard_copy()) and deletes it from the file
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the range
+ * @param size : number of bytes of the range
+ * @return TRUE if the range was cut, FALSE otherwise
+ */
+extern gboolean fcl_clipboard_cut(fcl_file_t *a_file, goffset position, gsize size);
+
+
+/**
+ * Puts bytes in the clipboard of the library (they are copied once)
+ * @param data : the bytes
+ * @param size : number of bytes
+ */
+extern void fcl_clipboard_set(const guchar *data, gsize size);
+
+
+/**
+ * Inserts the bytes of the clipboard in a file without copying them
+ * @param a_file : the fcl_file_t file
+ * @param position : position of the insertion
+ * @return TRUE if the clipboard was pasted (an empty clipboard pastes
+ *         nothing), FALSE otherwise
+ */
+extern gboolean fcl_clipboard_paste(fcl_file_t *a_file, goffset position);
+
+
+/**
+ * Gets the size of the clipboard
+ * @return the number of bytes in the clipboard
+ */
+extern gsize fcl_clipboard_size(void);
+
+
+/**
+ * Empties the clipboard
+ */
+extern void fcl_clipboard_clear(void);
+
+
 /**
  * Deletes bytes in the buffers.
  * @param a_file : the fcl_file_t file to which we want to deleted size bytes
@@ -231,11 +746,119 @@ extern gboolean fcl_insert_bytes(fcl_file_t *a_file, guchar *data, goffset posit
 extern gboolean fcl_delete_bytes(fcl_file_t *a_file, goffset position, gsize *size_pointer);
 
 
+/**
+ * Replaces every occurrence of a pattern in the file by another sequence of
+ * bytes (of any size). The occurrences are found in one pass (they do not
+ * overlap) and are all replaced at once : each buffer touched is rebuilt only
+ * once, whatever the number of occurrences in it.
+ * @warning it does do not writes to disk directly.
+ * @param a_file : the fcl_file_t file where to replace the pattern
+ * @param pattern : the bytes to look for
+ * @param len : the number of bytes in pattern
+ * @param replacement : the bytes that replace each occurrence
+ * @param replacement_len : the number of bytes in replacement (0 to delete
+ *                          every occurrence)
+ * @return the number of occurrences replaced or -1 on error (for instance if
+ *         the file is read only)
+ */
+extern goffset fcl_replace_all(fcl_file_t *a_file, const guchar *pattern, gsize len, const guchar *replacement, gsize replacement_len);
+
+
+/**
+ * Writes the edited file to another file. The edited file is streamed run by
+ * run thus the memory used does not depend on its size, and the ranges
+ * inserted from other files are copied from them at that time.
+ * @param a_file : the fcl_file_t file to be saved
+ * @param path : path of the file to write (replaced if it exists). It can not
+ *               be the edited file itself.
+ * @return TRUE if the whole edited file was written, FALSE otherwise
+ */
+extern gboolean fcl_save_as(fcl_file_t *a_file, const gchar *path);
+
+
+/******************************************************************************/
+/******************************* Storage backends *****************************/
+
+/**
+ * Creates a storage backend for a file. Nothing is openned before the first
+ * read or write.
+ * @param kind : LIBFCL_BACKEND_GIO, LIBFCL_BACKEND_POSIX, LIBFCL_BACKEND_MMAP
+ *               or LIBFCL_BACKEND_MEMORY (the file is loaded at once unless
+ *               mode is LIBFCL_MODE_CREATE)
+ * @param path : path of the file (or URI with LIBFCL_BACKEND_GIO)
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ, LIBFCL_MODE_WRITE,
+ *               LIBFCL_MODE_CREATE : the file is emptied when first written)
+ * @return a new backend, to be freed with fcl_backend_free() unless a file
+ *         is openned on it, or NULL if kind is not a backend or if the file
+ *         is too big for LIBFCL_BACKEND_MEMORY (more than G_MAXUINT bytes)
+ */
+extern fcl_backend_t *fcl_backend_new(gint kind, const gchar *path, gint mode);
+
+
+/**
+ * Creates a memory backend (LIBFCL_MODE_WRITE) holding a copy of some bytes
+ * @param data : the bytes (may be NULL if size is 0)
+ * @param size : number of bytes
+ * @return a new backend, to be freed with fcl_backend_free() unless a file
+ *         is openned on it, or NULL if size is more than G_MAXUINT
+ */
+extern fcl_backend_t *fcl_backend_new_from_data(const guchar *data, gsize size);
+
+
+/**
+ * Frees a backend and closes its storage. A replaced file (GIO) takes its
+ * place at that time.
+ * @param backend : the backend (may be NULL)
+ */
+extern void fcl_backend_free(fcl_backend_t *backend);
+
+
+/**
+ * Sets the backend of the files openned by path (fcl_open_file()...). The
+ * URIs are always openned with LIBFCL_BACKEND_GIO. The backend may also be
+ * set with the LIBFCL_BACKEND environment variable (gio, posix, mmap or
+ * memory) before libfcl_initialize() is called.
+ * @param kind : LIBFCL_BACKEND_GIO (the default), LIBFCL_BACKEND_POSIX,
+ *               LIBFCL_BACKEND_MMAP or LIBFCL_BACKEND_MEMORY
+ */
+extern void fcl_set_default_backend(gint kind);
+
+
+/**
+ * Gets the backend of the files openned by path
+ * @return LIBFCL_BACKEND_GIO, LIBFCL_BACKEND_POSIX, LIBFCL_BACKEND_MMAP or
+ *         LIBFCL_BACKEND_MEMORY
+ */
+extern gint fcl_get_default_backend(void);
+
+
+/**
+ * Opens a file on a backend, lazily (see fcl_open_file_lazy()) : the file
+ * owns the backend and frees it when it is closed.
+ * @param backend : the backend (its mode is the mode of the file)
+ * @param name : name of the file (may be NULL)
+ * @return a correctly filled fcl_file_t structure, to be closed with
+ *         fcl_close_file(), or NULL if backend is NULL
+ */
+extern fcl_file_t *fcl_open_backend(fcl_backend_t *backend, const gchar *name);
+
+
+/**
+ * Writes the edited file to a backend from its beginning, run by run (see
+ * fcl_save_as()), and syncs it.
+ * @param a_file : the fcl_file_t file to be saved
+ * @param target : an empty backend that is not the one of a_file
+ * @return TRUE if the whole edited file was written, FALSE otherwise
+ */
+extern gboolean fcl_save_to_backend(fcl_file_t *a_file, fcl_backend_t *target);
+
+
 /******************************************************************************/
 /*********************************** Buffers **********************************/
 
 /**
- * Prints a buffer data (exactly 'size' bytes)
+ * Prints a buffer data (exactly 'size' bytes). The bytes that are not
+ * printable ASCII characters are printed as '.'.
  * @todo : print UTF8 encoded values
  * @param data : buffer data to be printed
  * @param size : number of bytes to prints (from data)
@@ -245,11 +868,42 @@ extern void fcl_print_data(guchar *data, gsize size, gboolean EOL);
 
 
 /**
- * Gets the statistics of the buffers of a fcl_file_t file.
+ * Gets the size of the buffer needed by fcl_render_hex()
+ * @param rows : number of rows of the viewport
+ * @param cols : number of bytes in a row
+ * @param flags : the flags that will be given to fcl_render_hex()
+ * @return the number of characters needed (with the final '\0')
+ */
+extern gsize fcl_render_hex_size(guint rows, guint cols, gint flags);
+
+
+/**
+ * Renders a viewport of the edited file as an hexadecimal editor shows it.
+ * Each row is made of the position of its first byte (LIBFCL_RENDER_OFFSET)
+ * followed by two spaces, then of two hexadecimal digits and a separator for
+ * each byte, a space, the bytes as ASCII characters ('.' for the ones that are
+ * not printable) and '\n'. All rows have the same size : the last one is
+ * padded with spaces. Rows after the end of the file are not written.
+ * @param a_file : an openned fcl_file_t file
+ * @param offset : position of the first byte of the viewport
+ * @param rows : number of rows of the viewport
+ * @param cols : number of bytes in a row
+ * @param out : buffer of at least fcl_render_hex_size(rows, cols, flags)
+ *              characters. It is ended by '\0'.
+ * @param flags : LIBFCL_RENDER_OFFSET, LIBFCL_RENDER_UPPER and
+ *                LIBFCL_RENDER_DIFF or'ed together (or 0)
+ * @return the number of characters written (without the final '\0')
+ */
+extern gsize fcl_render_hex(fcl_file_t *a_file, goffset offset, guint rows, guint cols, gchar *out, gint flags);
+
+
+/**
+ * Gets the statistics of the buffers of a fcl_file_t file. They are kept up
+ * to date by the edits so this does not walk the sequence.
  * @param a_file : an openned fcl_file_t file.
  * @return A newly allocated fcl_stat_buf_t filled with the statistics about
  *         the sequence structure of the fcl_file_t structure. Returns NULL if
- *         the structure does not exists or does not have any buffers.
+ *         the structure does not exists.
  */
 extern fcl_stat_buf_t *fcl_get_buffer_stats(fcl_file_t *a_file);
 
@@ -270,5 +924,396 @@ extern fcl_stat_buf_t *fcl_init_buffer_stats();
 extern void fcl_print_buffer_stats(fcl_file_t *a_file);
 
 
+/******************************************************************************/
+/********************************* Performance ********************************/
+
+/**
+ * Gets the performance counters of a file : disk reads, searches of buffers
+ * in the sequence, allocations and the latencies of the reads, edits and
+ * saves since the file was opened (or since the last fcl_reset_perf()).
+ * The average number of buffers walked by a search is lookup_steps / lookups.
+ * @param a_file : an openned fcl_file_t file
+ * @return a newly allocated snapshot of the counters (to be freed with
+ *         g_free()) or NULL if a_file is NULL
+ */
+extern fcl_perf_t *fcl_get_perf(fcl_file_t *a_file);
+
+
+/**
+ * Sets all the performance counters of a file back to 0
+ * @param a_file : an openned fcl_file_t file
+ */
+extern void fcl_reset_perf(fcl_file_t *a_file);
+
+
+/**
+ * Prints the performance counters of a file
+ * @param a_file : an openned fcl_file_t file
+ */
+extern void fcl_print_perf(fcl_file_t *a_file);
+
+
+/******************************************************************************/
+/******************************** Memory budget *******************************/
+
+/**
+ * Sets the memory budget of the library : the number of bytes that the data
+ * of the buffers of all the edited files may use. When it is exceeded, the
+ * file being edited writes the data of its buffers modified the longest time
+ * ago (but the one just modified) to a scratch file (removed from the disk as
+ * soon as it is created) and frees it, until the budget is met again. The data is read from there when needed and loaded back into
+ * memory when the buffer is modified again. The budget may also be set with
+ * the LIBFCL_MEMORY_BUDGET environment variable (in bytes) before
+ * libfcl_initialize() is called. A new budget is applied at the next edits.
+ * @param size : number of bytes (0, the default, means no budget)
+ */
+extern void fcl_set_memory_budget(gsize size);
+
+
+/**
+ * Gets the memory budget of the library
+ * @return the budget in bytes (0 means no budget)
+ */
+extern gsize fcl_get_memory_budget(void);
+
+
+/**
+ * Gets the number of bytes of the data of the buffers of all the edited
+ * files that are in memory (ie not in a scratch file)
+ * @return the number of bytes
+ */
+extern gsize fcl_get_memory_usage(void);
+
+
+/**
+ * Gets the number of bytes in memory that are shared : the bytes pasted from
+ * the clipboard or copied with fcl_copy_range() are held once, whatever the
+ * number of buffers and files that use them. They are counted in
+ * fcl_get_memory_usage().
+ * @return the number of bytes used by more than one part of the files (in
+ *         one or many buffers) or by the clipboard
+ */
+extern gsize fcl_get_shared_memory(void);
+
+
+/**
+ * Turns the compression of the edited buffers on or off. When it is on, the
+ * data of a buffer that is not one of the last modified ones is compressed
+ * in memory (zlib at its fastest level) if it gets at least an eighth
+ * smaller. It is uncompressed when it is read and before it is modified. The
+ * compression goes before the scratch file : the budget is counted on the
+ * compressed bytes. It may also be turned on with the LIBFCL_COMPRESSION
+ * environment variable (set to 1) before libfcl_initialize() is called.
+ * Turning it off leaves the buffers already compressed as they are.
+ * @param on : TRUE to compress the buffers (FALSE, the default, otherwise)
+ */
+extern void fcl_set_compression(gboolean on);
+
+
+/**
+ * Says wether the edited buffers are compressed
+ * @return TRUE if the compression is on
+ */
+extern gboolean fcl_get_compression(void);
+
+
+/******************************************************************************/
+/*********************************** Sessions *********************************/
+
+/**
+ * Creates a session : the files opened in it share a memory budget of their
+ * own instead of the one of the library. When the budget is exceeded, the
+ * file being edited spills the buffers modified the longest time ago of all
+ * the files of the session (but the one it just modified). The files being
+ * read or edited by other threads at that time are skipped.
+ * @param budget : number of bytes the data of the buffers of its files may
+ *                 use (0 means no budget)
+ * @return a new session to be freed with fcl_session_free()
+ */
+extern fcl_session_t *fcl_session_new(gsize budget);
+
+
+/**
+ * Frees a session. Its files have to be closed before (nothing is done
+ * otherwise).
+ * @param session : the session (may be NULL)
+ */
+extern void fcl_session_free(fcl_session_t *session);
+
+
+/**
+ * Opens a file lazily (see fcl_open_file_lazy()) in a session
+ * @param session : the session
+ * @param path : the path of the file to be opened
+ * @param mode : the mode to open the file (LIBFCL_MODE_READ, LIBFCL_MODE_WRITE,
+ *               LIBFCL_MODE_CREATE).
+ * @return a correctly filled fcl_file_t structure, to be closed with
+ *         fcl_close_file(), or NULL if mode is not one of the modes
+ */
+extern fcl_file_t *fcl_session_open_file(fcl_session_t *session, gchar *path, gint mode);
+
+
+/**
+ * Sets the memory budget of a session. It is applied at the next edits.
+ * @param session : the session
+ * @param size : number of bytes (0 means no budget)
+ */
+extern void fcl_session_set_memory_budget(fcl_session_t *session, gsize size);
+
+
+/**
+ * Gets the memory budget of a session
+ * @param session : the session
+ * @return the budget in bytes (0 means no budget)
+ */
+extern gsize fcl_session_get_memory_budget(fcl_session_t *session);
+
+
+/**
+ * Gets the number of bytes of the data of the buffers of the files of a
+ * session that are in memory. The chunks shared with the clipboard or other
+ * files are not counted (see fcl_get_shared_memory()).
+ * @param session : the session
+ * @return the number of bytes
+ */
+extern gsize fcl_session_get_memory_usage(fcl_session_t *session);
+
+
+/******************************************************************************/
+/*********************************** Tracing **********************************/
+
+/**
+ * Prints the last events (lookups, reads, edits, buffers put in the sequence
+ * or freed...) recorded by each thread, ordered by time. Events are only
+ * recorded when the library is configured with --enable-debug, otherwise
+ * nothing is printed.
+ * @param stream : where to print the events (stdout for instance)
+ */
+extern void fcl_trace_dump(FILE *stream);
+
+
+/******************************************************************************/
+/********************************** Recording *********************************/
+
+/**
+ * Starts recording the calls made to the library (openning and closing files,
+ * reads, overwrites, insertions, deletions and replacements) along with the
+ * time each of them took into a compact binary trace that benchlibfcl
+ * --replay runs again and measures. The bytes written in the files are not
+ * recorded. Setting the LIBFCL_RECORD environment variable to the path of a
+ * trace starts the recording in libfcl_initialize().
+ * @param trace_path : path of the trace (it is replaced)
+ * @return TRUE if the recording started, FALSE if the trace can not be
+ *         created or if calls are already recorded
+ */
+extern gboolean fcl_record_start(const gchar *trace_path);
+
+
+/**
+ * Stops the recording and closes the trace. The trace is also complete if the
+ * program exits normally while recording.
+ */
+extern void fcl_record_stop(void);
+
+
+/******************************************************************************/
+/********************************* Checksums **********************************/
+
+/**
+ * Computes a checksum of the edited file. The first call for an algorithm
+ * hashes the whole file (in parallel) and keeps a tree of the hashes of its
+ * parts. After that, an edit only invalidates the part it touches and the
+ * next call only hashes the parts edited since the previous one.
+ * @param a_file : an openned fcl_file_t file
+ * @param algo : LIBFCL_CHECKSUM_CRC32C, LIBFCL_CHECKSUM_XXH64 or
+ *               LIBFCL_CHECKSUM_SHA256. The CRC32C is the one of the whole
+ *               edited file. For the other ones, files bigger than 64 KiB
+ *               get a tree hash (the hash of the hashes of the two halves
+ *               and so on) and not the hash of their bytes.
+ * @return a newly allocated string with the checksum in hexadecimal or NULL
+ *         on error
+ */
+extern gchar *fcl_checksum(fcl_file_t *a_file, gint algo);
+
+
+/******************************************************************************/
+/****************************** Byte distribution *****************************/
+
+/**
+ * Counts each byte value in a range of the edited file. The histograms of
+ * the parts of the file that are not edited since the last call are kept and
+ * only the edited parts are counted again (with a pool of threads).
+ * @param a_file : an openned fcl_file_t file
+ * @param position : position of the first byte of the range
+ * @param size : number of bytes of the range (it ends at the end of the file
+ *               at most)
+ * @param histogram : array of 256 counts where the number of bytes of each
+ *                    value is written
+ * @return the number of bytes counted
+ */
+extern goffset fcl_byte_histogram(fcl_file_t *a_file, goffset position, goffset size, guint64 *histogram);
+
+
+/**
+ * Computes the entropy of each block of the edited file (to spot the parts
+ * that are compressed or encrypted). The blocks are groups of about
+ * block_size bytes of the file on disk (a multiple of LIBFCL_BUF_SIZE) with
+ * their edits : a block where bytes were inserted or deleted is bigger or
+ * smaller, and only the blocks edited since the last call with the same
+ * block_size are counted again (with a pool of threads).
+ * @param a_file : an openned fcl_file_t file
+ * @param block_size : size of the blocks
+ * @return a newly allocated GArray of fcl_entropy_t ordered by position
+ *         (free it with g_array_free()) or NULL on error
+ */
+extern GArray *fcl_entropy_map(fcl_file_t *a_file, gsize block_size);
+
+
+/******************************************************************************/
+/********************************* Differences ********************************/
+
+/**
+ * Finds the differences between two edited files (with their edits). Bytes
+ * inserted in or deleted from one of the files are found as such (up to
+ * 16 MiB) and do not make the rest of the files differ. When the SHA-256
+ * checksums of both files were computed with fcl_checksum() the equal parts
+ * that were not edited since are skipped without being read.
+ * @param a_file : an openned fcl_file_t file
+ * @param b_file : another openned fcl_file_t file (it may be a_file itself)
+ * @return a newly allocated GArray of fcl_diff_t ordered by position (empty
+ *         when the files are equal) or NULL on error. Applying the
+ *         differences to the first file gives the second one.
+ */
+extern GArray *fcl_diff(fcl_file_t *a_file, fcl_file_t *b_file);
+
+
+/******************************************************************************/
+/*********************************** Patches **********************************/
+
+/**
+ * Writes the edits of a file as a binary patch (in the library's own format,
+ * see fcl_patch.c). Only the bytes that were really changed are in the
+ * patch : the rest is copied from the source when the patch is applied.
+ * @param a_file : an openned fcl_file_t file
+ * @param patch_path : path of the patch to be written (replaced if it
+ *                     exists)
+ * @return TRUE if the patch was written, FALSE otherwise
+ */
+extern gboolean fcl_export_patch(fcl_file_t *a_file, const gchar *patch_path);
+
+
+/**
+ * Applies a patch made by fcl_export_patch() in one streaming pass (with
+ * bounded memory) and writes the result in a new file.
+ * @param a_file : the source : an openned fcl_file_t file with the content
+ *                 of the file the patch was made from (its edits, if any,
+ *                 are taken into account)
+ * @param patch_path : path of the patch
+ * @param target_path : path of the file to be written (replaced if it
+ *                      exists). It is deleted if the patch does not apply :
+ *                      its size and its CRC32C must be the ones recorded in
+ *                      the patch.
+ * @return TRUE if the patch was applied, FALSE otherwise
+ */
+extern gboolean fcl_apply_patch(fcl_file_t *a_file, const gchar *patch_path, const gchar *target_path);
+
+
+/******************************************************************************/
+/*********************************** Search ***********************************/
+
+/**
+ * Finds a pattern of bytes in the edited file (ie as fcl_read_bytes would
+ * read it). The file is walked without copying the edited buffers and matches
+ * that span buffers or untouched parts of the file are found.
+ * @param a_file : an openned fcl_file_t file
+ * @param pattern : the bytes to look for
+ * @param len : the number of bytes in pattern
+ * @param from : position where the search begins. Forward, the first match
+ *               beginning at or after from is returned. Backward, the last
+ *               match beginning at or before from is returned.
+ * @param direction : LIBFCL_FIND_FORWARD or LIBFCL_FIND_BACKWARD
+ * @return the position of the match in the edited file or -1 if the pattern
+ *         was not found
+ */
+extern goffset fcl_find(fcl_file_t *a_file, const guchar *pattern, gsize len, goffset from, gint direction);
+
+
+/**
+ * Creates an empty set of patterns
+ * @return a newly allocated fcl_patterns_t to be freed with fcl_patterns_free()
+ */
+extern fcl_patterns_t *fcl_patterns_new(void);
+
+
+/**
+ * Adds a pattern to a set of patterns. The bytes are copied.
+ * @param patterns : the set of patterns
+ * @param pattern : the bytes of the pattern
+ * @param len : the number of bytes in pattern
+ * @return the number of the pattern in the set (0 for the first one added, 1
+ *         for the second one...) or -1 on error
+ */
+extern gint fcl_patterns_add(fcl_patterns_t *patterns, const guchar *pattern, gsize len);
+
+
+/**
+ * Frees a set of patterns
+ * @param patterns : the fcl_patterns_t to be freed
+ */
+extern void fcl_patterns_free(fcl_patterns_t *patterns);
+
+
+/**
+ * Finds every match of every pattern of a set in the edited file. The file is
+ * cut into chunks that are searched in parallel. Overlapping matches are all
+ * reported.
+ * @param a_file : an openned fcl_file_t file
+ * @param patterns : the set of patterns
+ * @param n_threads : maximum number of threads to use (0 means one per
+ *                    processor)
+ * @return a newly allocated GArray of fcl_match_t ordered by position and
+ *         then by pattern number (free it with g_array_free()) or NULL on
+ *         error
+ */
+extern GArray *fcl_find_patterns(fcl_file_t *a_file, fcl_patterns_t *patterns, guint n_threads);
+
+
+/**
+ * Begins the search of a regular expression in the edited file. The file is
+ * read through a window that slides along it thus the memory used depends on
+ * max_size and not on the size of the file. The matches are then retrieved
+ * one by one with fcl_regex_iter_next() and the search may be stopped at any
+ * time with fcl_regex_iter_free(). The file must not be edited meanwhile.
+ * @param a_file : an openned fcl_file_t file
+ * @param pattern : the regular expression (PCRE syntax). It is matched
+ *                  against bytes and not UTF-8 characters (use \xhh to look
+ *                  for any byte)
+ * @param from : position where the search begins
+ * @param max_size : maximum size of a match (0 for 64 KiB). A longer match is
+ *                   cut to the bytes that the window holds.
+ * @return a newly allocated fcl_regex_iter_t or NULL if the expression does
+ *         not compile
+ */
+extern fcl_regex_iter_t *fcl_regex_find_all(fcl_file_t *a_file, const gchar *pattern, goffset from, gsize max_size);
+
+
+/**
+ * Gets the next match of a search. Matches do not overlap and come in the
+ * order of their position in the edited file.
+ * @param iter : the search begun with fcl_regex_find_all()
+ * @param[out] position_pointer : position of the match in the edited file
+ * @param[out] size_pointer : size of the match (may be 0)
+ * @return TRUE if a match was found, FALSE once the end of the file is reached
+ */
+extern gboolean fcl_regex_iter_next(fcl_regex_iter_t *iter, goffset *position_pointer, gsize *size_pointer);
+
+
+/**
+ * Ends a search and frees it
+ * @param iter : the search begun with fcl_regex_find_all()
+ */
+extern void fcl_regex_iter_free(fcl_regex_iter_t *iter);
+
+
 
 #endif /* _LIBFCL_H_ */
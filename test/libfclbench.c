@@ -0,0 +1,1287 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  libfclbench.c
+ *  File Cache Library Benchmarks
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file libfclbench.c
+ * Benchmarks of the library (make bench).
+ *
+ * Each workload (sequential scan, random reads, viewport scrolling, hex
+ * rendering, typing, scattered overwrites, large deletes and save) is run on generated files of
+ * each size asked for. The files begin with 1 MiB of random bytes and the
+ * rest is a hole (a sparse file) so that 100 GB files cost nothing on disk.
+ * Every workload opens the file again so that it begins with no edits.
+ *
+ * The results are written in JSON : for each workload and each size, the
+ * number of operations, the operations per second, the median and 99th
+ * percentile latencies and the peak resident memory of the process so far.
+ *
+ * With --scaling, the cost of the operations is measured against the number
+ * of buffers in the sequence instead (make bench-scaling) : edits are added
+ * to a file (clustered, uniformly spread or each one after the previous
+ * one) and, each time the sequence reaches 10, 100, ... buffers, the
+ * latencies of one byte reads, inserts and deletes at random positions and
+ * the average number of buffers walked by a lookup are measured. A curve
+ * stops once it has taken more than --budget seconds.
+ *
+ * With --replay, a trace recorded by the library (fcl_record_start() or the
+ * LIBFCL_RECORD environment variable) is run again (make bench-replay
+ * TRACE=...) : the files are openned where they were recorded (or by their
+ * name in --root) and for each kind of call the time it took when recorded,
+ * the time it takes now and the latencies are written. Files openned in create
+ * mode are openned in write mode so that they are not emptied and nothing is
+ * saved.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#include <fcl.h>
+
+/**
+ * @def BENCH_HEADER_SIZE
+ * Number of random bytes at the begining of each generated file
+ *
+ * @def BENCH_SCAN_SIZE
+ * Number of bytes read by each operation of the sequential scan and of the
+ * random reads
+ *
+ * @def BENCH_VIEWPORT_COLUMNS
+ * Number of bytes in a row of the viewport
+ *
+ * @def BENCH_VIEWPORT_ROWS
+ * Number of rows in the viewport
+ *
+ * @def BENCH_RENDER_COLUMNS
+ * Number of bytes in a row of the rendered viewport
+ *
+ * @def BENCH_RENDER_ROWS
+ * Number of rows of the rendered viewport (a 4K screen)
+ *
+ * @def BENCH_DELETE_SIZE
+ * Number of bytes removed by each large delete
+ */
+#define BENCH_HEADER_SIZE 1048576
+#define BENCH_SCAN_SIZE 4096
+#define BENCH_VIEWPORT_COLUMNS 16
+#define BENCH_VIEWPORT_ROWS 32
+#define BENCH_RENDER_COLUMNS 32
+#define BENCH_RENDER_ROWS 120
+#define BENCH_DELETE_SIZE 4096
+
+
+/**
+ * @def BENCH_SCALING_SIZE
+ * Size of the (sparse) file edited by the scaling benchmark
+ *
+ * @def BENCH_SCALING_CLUSTERS
+ * Number of places where the edits of the clustered distribution are done
+ *
+ * @def BENCH_SCALING_PROBES
+ * Number of reads, inserts and deletes measured at each step
+ */
+#define BENCH_SCALING_SIZE G_GINT64_CONSTANT(1073741824)
+#define BENCH_SCALING_CLUSTERS 16
+#define BENCH_SCALING_PROBES 200
+
+
+/**
+ * @struct bench_t
+ * What a benchmark run needs
+ */
+typedef struct
+{
+    GRand *rand;        /**< Random numbers (seeded so that runs compare)     */
+    gchar *path;        /**< Path of the generated file                       */
+    goffset size;       /**< Size of the generated file                       */
+    guint ops;          /**< Number of operations of the lightest workloads   */
+    goffset save_limit; /**< Biggest file that is saved (it is written again) */
+} bench_t;
+
+
+/**
+ * @struct workload_t
+ * A workload : a function that does some operations on an openned file and
+ * measures each of them
+ */
+typedef struct
+{
+    const gchar *name;  /**< Name of the workload in the JSON output          */
+    void (*run)(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+    guint divider;      /**< The workload does bench->ops / divider operations */
+} workload_t;
+
+static guint64 now_ns(void);
+static glong peak_rss_kb(void);
+static goffset parse_size(const gchar *text);
+static gboolean create_bench_file(bench_t *bench);
+static goffset random_position(bench_t *bench, goffset size);
+static void record(GArray *latencies, guint64 start);
+static gint cmp_latency(gconstpointer a, gconstpointer b);
+static gdouble percentile_us(GArray *latencies, guint percent);
+static void print_result(FILE *stream, const gchar *workload, goffset size, GArray *latencies, gboolean first);
+static void run_workloads(bench_t *bench, gchar **sizes, FILE *stream);
+static goffset scaling_position(bench_t *bench, gint distribution, guint64 edit);
+static void run_scaling(bench_t *bench, guint64 max_edits, gint budget, FILE *stream);
+static gboolean get_varints(FILE *trace, guint64 *values, guint n);
+static guchar *get_bytes(FILE *trace, guint64 *size_pointer);
+static guchar *filler(guchar *data, gsize *size_pointer, gsize size);
+static gboolean run_replay(const gchar *trace_path, const gchar *root, FILE *stream);
+
+static void bench_sequential_scan(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+static void bench_random_reads(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+static void bench_viewport_scrolling(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+static void bench_hex_rendering(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+static void bench_typing(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+static void bench_scattered_overwrites(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+static void bench_large_deletes(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+static void bench_save(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies);
+
+/**
+ * Names of the distributions of the edits of the scaling benchmark : in a
+ * few clusters, uniformly spread over the file or each one in the block
+ * after the previous one (the sequence only grows at its end)
+ */
+static const gchar *distributions[] = {"clustered", "uniform", "append"};
+
+/**
+ * Name of each kind of call of a trace (LIBFCL_RECORD_OPEN...)
+ */
+static const gchar *calls[LIBFCL_RECORD_N_CALLS] = {"open", "close", "read", "overwrite", "insert", "delete", "replace_all", "copy", "move"};
+
+/**
+ * Number of varints that follow the first fields of each kind of record
+ */
+static const guint n_args[LIBFCL_RECORD_N_CALLS] = {1, 1, 3, 3, 2, 3, 1, 3, 3};
+
+static const workload_t workloads[] =
+{
+    {"sequential_scan",      bench_sequential_scan,      1},
+    {"random_reads",         bench_random_reads,         1},
+    {"viewport_scrolling",   bench_viewport_scrolling,   1},
+    {"hex_rendering",        bench_hex_rendering,        1},
+    {"typing",               bench_typing,               1},
+    {"scattered_overwrites", bench_scattered_overwrites, 1},
+    {"large_deletes",        bench_large_deletes,        10},
+    {"save",                 bench_save,                 100},
+};
+
+
+/**
+ * Gets a monotonic time
+ * @return the time in nanoseconds
+ */
+static guint64 now_ns(void)
+{
+#ifdef G_OS_UNIX
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (guint64) now.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64) now.tv_nsec;
+#else
+    return (guint64) g_get_monotonic_time() * 1000;
+#endif
+}
+
+
+/**
+ * Gets the peak resident memory of the process
+ * @return the peak resident memory in KiB (0 if it is not known)
+ */
+static glong peak_rss_kb(void)
+{
+#ifdef G_OS_UNIX
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        {
+            return usage.ru_maxrss;
+        }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * Reads a size such as 4096, 1M, 10G or 100G (powers of 1024)
+ * @param text : the size
+ * @return the size in bytes or -1 if text is not a size
+ */
+static goffset parse_size(const gchar *text)
+{
+    gchar *end = NULL;
+    goffset size = 0;
+
+    size = (goffset) g_ascii_strtoull(text, &end, 10);
+
+    if (end == text)
+        {
+            return -1;
+        }
+
+    switch (*end)
+        {
+            case 'K':
+            case 'k':
+                return size << 10;
+
+            case 'M':
+            case 'm':
+                return size << 20;
+
+            case 'G':
+            case 'g':
+                return size << 30;
+
+            case 'T':
+            case 't':
+                return size << 40;
+
+            case '\0':
+                return size;
+
+            default:
+                return -1;
+        }
+}
+
+
+/**
+ * Creates the file of a benchmark : BENCH_HEADER_SIZE random bytes followed
+ * by a hole up to the size wanted
+ * @param bench : the benchmark (path and size of the file)
+ * @return TRUE if the file was created
+ */
+static gboolean create_bench_file(bench_t *bench)
+{
+    FILE *stream = NULL;
+    guchar *header = NULL;
+    gsize size = (gsize) MIN(bench->size, BENCH_HEADER_SIZE);
+    gsize i = 0;
+    gboolean ok = FALSE;
+
+    stream = fopen(bench->path, "wb");
+
+    if (stream != NULL)
+        {
+            header = (guchar *) g_malloc(size * sizeof(guchar));
+
+            for (i = 0; i < size; i++)
+                {
+                    header[i] = (guchar) g_rand_int_range(bench->rand, 0, 256);
+                }
+
+            ok = fwrite(header, sizeof(guchar), size, stream) == size;
+
+            if (ok == TRUE && bench->size > (goffset) size)
+                {
+                    ok = fseeko(stream, (off_t) (bench->size - 1), SEEK_SET) == 0 && fputc(0, stream) != EOF;
+                }
+
+            ok = (fclose(stream) == 0) && ok;
+            g_free(header);
+        }
+
+    return ok;
+}
+
+
+/**
+ * Draws a random position
+ * @param bench : the benchmark
+ * @param size : the position is below size
+ * @return a position between 0 and size - 1 (0 if size is 0 or less)
+ */
+static goffset random_position(bench_t *bench, goffset size)
+{
+    if (size <= 0)
+        {
+            return 0;
+        }
+
+    return (goffset) (g_rand_double(bench->rand) * (gdouble) size) % size;
+}
+
+
+/**
+ * Records the latency of an operation
+ * @param latencies : the latencies (guint64, in nanoseconds) of the workload
+ * @param start : time (now_ns()) when the operation began
+ */
+static void record(GArray *latencies, guint64 start)
+{
+    guint64 latency = now_ns() - start;
+
+    g_array_append_val(latencies, latency);
+}
+
+
+/**
+ * Compares two latencies
+ * @param a : a guint64
+ * @param b : another guint64
+ * @return -1, 0 or 1 as a is lower, equal or greater than b
+ */
+static gint cmp_latency(gconstpointer a, gconstpointer b)
+{
+    guint64 latency_a = *(const guint64 *) a;
+    guint64 latency_b = *(const guint64 *) b;
+
+    return (latency_a > latency_b) - (latency_a < latency_b);
+}
+
+
+/**
+ * Gets a percentile of latencies
+ * @param latencies : the latencies (guint64, in nanoseconds). They are sorted.
+ * @param percent : the percentile wanted (50 for the median)
+ * @return the percentile in microseconds (0 if there is no latency)
+ */
+static gdouble percentile_us(GArray *latencies, guint percent)
+{
+    if (latencies->len == 0)
+        {
+            return 0.0;
+        }
+
+    g_array_sort(latencies, cmp_latency);
+
+    return (gdouble) g_array_index(latencies, guint64, ((latencies->len - 1) * percent) / 100) / 1e3;
+}
+
+
+/**
+ * Prints the result of a workload as a JSON object
+ * @param stream : where to print it
+ * @param workload : name of the workload
+ * @param size : size of the file
+ * @param latencies : latencies of the operations (they are sorted)
+ * @param first : TRUE for the first result (no comma before it)
+ */
+static void print_result(FILE *stream, const gchar *workload, goffset size, GArray *latencies, gboolean first)
+{
+    guint64 total = 0;
+    guint i = 0;
+
+    for (i = 0; i < latencies->len; i++)
+        {
+            total = total + g_array_index(latencies, guint64, i);
+        }
+
+    fprintf(stream, "%s\n    {\"workload\": \"%s\", \"file_size\": %" G_GOFFSET_FORMAT ", \"ops\": %u, ", first == TRUE ? "" : ",", workload, size, latencies->len);
+    fprintf(stream, "\"ops_per_sec\": %.1f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"peak_rss_kb\": %ld}",
+            total > 0 ? (gdouble) latencies->len * 1e9 / (gdouble) total : 0.0, percentile_us(latencies, 50), percentile_us(latencies, 99), peak_rss_kb());
+}
+
+
+/******************************************************************************/
+/********************************* Workloads **********************************/
+
+/**
+ * Reads the file from the begining, BENCH_SCAN_SIZE bytes at a time (and
+ * again from the begining at the end of the file)
+ */
+static void bench_sequential_scan(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    goffset position = 0;
+    guchar *data = NULL;
+    guint64 start = 0;
+    gsize size = 0;
+    guint i = 0;
+
+    for (i = 0; i < ops; i++)
+        {
+            size = BENCH_SCAN_SIZE;
+
+            start = now_ns();
+            data = fcl_read_bytes(a_file, position, &size);
+            record(latencies, start);
+
+            g_free(data);
+
+            position = position + (goffset) size;
+
+            if (size < BENCH_SCAN_SIZE)
+                {
+                    position = 0;
+                }
+        }
+}
+
+
+/**
+ * Reads BENCH_SCAN_SIZE bytes at random positions
+ */
+static void bench_random_reads(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    guchar *data = NULL;
+    goffset position = 0;
+    guint64 start = 0;
+    gsize size = 0;
+    guint i = 0;
+
+    for (i = 0; i < ops; i++)
+        {
+            size = BENCH_SCAN_SIZE;
+            position = random_position(bench, bench->size - BENCH_SCAN_SIZE);
+
+            start = now_ns();
+            data = fcl_read_bytes(a_file, position, &size);
+            record(latencies, start);
+
+            g_free(data);
+        }
+}
+
+
+/**
+ * Scrolls a viewport (BENCH_VIEWPORT_ROWS rows of BENCH_VIEWPORT_COLUMNS
+ * bytes) down one row at a time, as in an hexadecimal editor, with a jump
+ * to a random place every 100 rows
+ */
+static void bench_viewport_scrolling(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    guchar *data = NULL;
+    goffset position = 0;
+    guint64 start = 0;
+    gsize size = 0;
+    guint i = 0;
+
+    for (i = 0; i < ops; i++)
+        {
+            if (i % 100 == 0 || position + BENCH_VIEWPORT_ROWS * BENCH_VIEWPORT_COLUMNS > bench->size)
+                {
+                    position = random_position(bench, bench->size / BENCH_VIEWPORT_COLUMNS) * BENCH_VIEWPORT_COLUMNS;
+                }
+
+            size = BENCH_VIEWPORT_ROWS * BENCH_VIEWPORT_COLUMNS;
+
+            start = now_ns();
+            data = fcl_read_bytes(a_file, position, &size);
+            record(latencies, start);
+
+            g_free(data);
+
+            position = position + BENCH_VIEWPORT_COLUMNS;
+        }
+}
+
+
+/**
+ * Renders a viewport of BENCH_RENDER_ROWS rows of BENCH_RENDER_COLUMNS bytes
+ * in hexadecimal and ASCII with the differences from the disk marked,
+ * scrolling down one row at a time with a jump to a random place every 100
+ * rows
+ */
+static void bench_hex_rendering(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    gchar *out = NULL;
+    goffset position = 0;
+    guint64 start = 0;
+    guint i = 0;
+
+    out = (gchar *) g_malloc(fcl_render_hex_size(BENCH_RENDER_ROWS, BENCH_RENDER_COLUMNS, LIBFCL_RENDER_OFFSET | LIBFCL_RENDER_DIFF));
+
+    for (i = 0; i < ops; i++)
+        {
+            if (i % 100 == 0 || position + BENCH_RENDER_ROWS * BENCH_RENDER_COLUMNS > bench->size)
+                {
+                    position = random_position(bench, bench->size / BENCH_RENDER_COLUMNS) * BENCH_RENDER_COLUMNS;
+                }
+
+            start = now_ns();
+            fcl_render_hex(a_file, position, BENCH_RENDER_ROWS, BENCH_RENDER_COLUMNS, out, LIBFCL_RENDER_OFFSET | LIBFCL_RENDER_DIFF);
+            record(latencies, start);
+
+            position = position + BENCH_RENDER_COLUMNS;
+        }
+
+    g_free(out);
+}
+
+
+/**
+ * Inserts one byte at a time after the previous one, as someone typing, with
+ * a move of the cursor to a random place every 200 bytes
+ */
+static void bench_typing(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    guchar byte = 0;
+    goffset cursor = 0;
+    guint64 start = 0;
+    guint i = 0;
+
+    for (i = 0; i < ops; i++)
+        {
+            if (i % 200 == 0)
+                {
+                    cursor = random_position(bench, bench->size);
+                }
+
+            byte = (guchar) ('a' + i % 26);
+
+            start = now_ns();
+            fcl_insert_bytes(a_file, &byte, cursor, 1);
+            record(latencies, start);
+
+            cursor = cursor + 1;
+        }
+}
+
+
+/**
+ * Overwrites 1 to 16 bytes at random positions
+ */
+static void bench_scattered_overwrites(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    guchar data[16];
+    goffset position = 0;
+    guint64 start = 0;
+    gsize size = 0;
+    guint i = 0;
+
+    memset(data, 0x5A, sizeof(data));
+
+    for (i = 0; i < ops; i++)
+        {
+            size = (gsize) g_rand_int_range(bench->rand, 1, (gint32) sizeof(data) + 1);
+            position = random_position(bench, bench->size - (goffset) sizeof(data));
+
+            start = now_ns();
+            fcl_overwrite_bytes(a_file, data, position, &size);
+            record(latencies, start);
+        }
+}
+
+
+/**
+ * Deletes BENCH_DELETE_SIZE bytes at random positions
+ */
+static void bench_large_deletes(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    goffset size = bench->size;   /** Size of the edited file */
+    goffset position = 0;
+    guint64 start = 0;
+    gsize deleted = 0;
+    guint i = 0;
+
+    for (i = 0; i < ops && size > 2 * BENCH_DELETE_SIZE; i++)
+        {
+            deleted = BENCH_DELETE_SIZE;
+            position = random_position(bench, size - 2 * BENCH_DELETE_SIZE);
+
+            start = now_ns();
+            fcl_delete_bytes(a_file, position, &deleted);
+            record(latencies, start);
+
+            size = size - BENCH_DELETE_SIZE;
+        }
+}
+
+
+/**
+ * Saves the edited file after a few edits : the edits are exported as a
+ * patch which is applied to the file on disk to write the edited file again
+ * (the library has no saving in place yet). Files bigger than
+ * bench->save_limit are not saved.
+ */
+static void bench_save(bench_t *bench, fcl_file_t *a_file, guint ops, GArray *latencies)
+{
+    fcl_file_t *source = NULL;
+    gchar *patch_path = NULL;
+    gchar *target_path = NULL;
+    guchar data[4] = {'f', 'c', 'l', '!'};
+    guint64 start = 0;
+    gsize size = 0;
+    guint i = 0;
+
+    if (bench->size > bench->save_limit)
+        {
+            return;
+        }
+
+    for (i = 0; i < 100; i++)
+        {
+            size = sizeof(data);
+            fcl_overwrite_bytes(a_file, data, random_position(bench, bench->size - (goffset) sizeof(data)), &size);
+            fcl_insert_bytes(a_file, data, random_position(bench, bench->size), sizeof(data));
+        }
+
+    patch_path = g_strconcat(bench->path, ".patch", NULL);
+    target_path = g_strconcat(bench->path, ".saved", NULL);
+    source = fcl_open_file(bench->path, LIBFCL_MODE_READ);
+
+    for (i = 0; i < MAX(ops, 1); i++)
+        {
+            start = now_ns();
+            fcl_export_patch(a_file, patch_path);
+            fcl_apply_patch(source, patch_path, target_path);
+            record(latencies, start);
+        }
+
+    fcl_close_file(source, FALSE);
+    g_unlink(patch_path);
+    g_unlink(target_path);
+    g_free(patch_path);
+    g_free(target_path);
+}
+
+
+/******************************************************************************/
+/********************************** Runners ***********************************/
+
+/**
+ * Runs every workload on files of each size
+ * @param bench : the benchmark
+ * @param sizes : the sizes of the files (NULL terminated)
+ * @param stream : where to print the results
+ */
+static void run_workloads(bench_t *bench, gchar **sizes, FILE *stream)
+{
+    GArray *latencies = NULL;
+    fcl_file_t *a_file = NULL;
+    gboolean first = TRUE;
+    guint s = 0;
+    guint w = 0;
+
+    for (s = 0; sizes[s] != NULL; s++)
+        {
+            bench->size = parse_size(sizes[s]);
+
+            if (bench->size <= 2 * BENCH_DELETE_SIZE)
+                {
+                    fprintf(stderr, "Skipping size %s (not a size or too small)\n", sizes[s]);
+                    continue;
+                }
+
+            if (create_bench_file(bench) == FALSE)
+                {
+                    fprintf(stderr, "Can not create %s (%s bytes)\n", bench->path, sizes[s]);
+                    continue;
+                }
+
+            for (w = 0; w < G_N_ELEMENTS(workloads); w++)
+                {
+                    fprintf(stderr, "%s on %s ...\n", workloads[w].name, sizes[s]);
+
+                    latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+                    a_file = fcl_open_file(bench->path, LIBFCL_MODE_WRITE);
+
+                    workloads[w].run(bench, a_file, MAX(bench->ops / workloads[w].divider, 1), latencies);
+
+                    fcl_close_file(a_file, FALSE);
+
+                    if (latencies->len > 0)
+                        {
+                            print_result(stream, workloads[w].name, bench->size, latencies, first);
+                            first = FALSE;
+                        }
+
+                    g_array_free(latencies, TRUE);
+                }
+
+            g_unlink(bench->path);
+        }
+}
+
+
+/**
+ * Gets the position of an edit of the scaling benchmark. Each edit is in a
+ * block of its own (every other block) so that each one adds a buffer to the
+ * sequence.
+ * @param bench : the benchmark
+ * @param distribution : the distribution (index in distributions)
+ * @param edit : the number of the edit
+ * @return the position of the edit
+ */
+static goffset scaling_position(bench_t *bench, gint distribution, guint64 edit)
+{
+    goffset n_blocks = bench->size / (2 * LIBFCL_BUF_SIZE);
+    goffset cluster = 0;
+
+    switch (distribution)
+        {
+            case 0:
+                /* clustered : the edits go round the clusters, each one
+                 * growing from its begining */
+                cluster = (goffset) (edit % BENCH_SCALING_CLUSTERS);
+                return ((cluster * n_blocks / BENCH_SCALING_CLUSTERS + (goffset) (edit / BENCH_SCALING_CLUSTERS)) % n_blocks) * 2 * LIBFCL_BUF_SIZE;
+
+            case 1:
+                /* uniform */
+                return random_position(bench, n_blocks) * 2 * LIBFCL_BUF_SIZE;
+
+            default:
+                /* append : each edit after the previous one */
+                return ((goffset) edit % n_blocks) * 2 * LIBFCL_BUF_SIZE;
+        }
+}
+
+
+/**
+ * Runs the scaling benchmark : for each distribution, edits are added to the
+ * file and the operations are measured when the sequence reaches 10, 100...
+ * up to max_edits buffers.
+ * @param bench : the benchmark (its size is the size of the file)
+ * @param max_edits : number of buffers in the sequence at the last step
+ * @param budget : seconds after which a distribution is stopped
+ * @param stream : where to print the results
+ */
+static void run_scaling(bench_t *bench, guint64 max_edits, gint budget, FILE *stream)
+{
+    GArray *reads = NULL;
+    GArray *inserts = NULL;
+    GArray *deletes = NULL;
+    GArray *edited = NULL;       /** positions of the edits */
+    fcl_file_t *a_file = NULL;
+    fcl_stat_buf_t *stats = NULL;
+    fcl_perf_t *perf = NULL;
+    guchar byte = 0x5A;
+    guchar *data = NULL;
+    goffset position = 0;
+    guint64 distribution_start = 0;
+    guint64 start = 0;
+    guint64 step = 0;
+    guint64 edit = 0;
+    guint64 n_bufs = 0;
+    gboolean first = TRUE;
+    gboolean over = FALSE;       /** the budget is spent */
+    gsize size = 0;
+    gint d = 0;
+    guint i = 0;
+
+    if (create_bench_file(bench) == FALSE)
+        {
+            fprintf(stderr, "Can not create %s\n", bench->path);
+            return;
+        }
+
+    for (d = 0; d < (gint) G_N_ELEMENTS(distributions); d++)
+        {
+            a_file = fcl_open_file(bench->path, LIBFCL_MODE_WRITE);
+            edited = g_array_new(FALSE, FALSE, sizeof(goffset));
+            distribution_start = now_ns();
+            over = FALSE;
+            edit = 0;
+
+            for (step = 10; step <= max_edits && over == FALSE; step = step * 10)
+                {
+                    fprintf(stderr, "%s with %" G_GUINT64_FORMAT " edits ...\n", distributions[d], step);
+
+                    /* Filling the sequence up to step buffers */
+                    do
+                        {
+                            size = 1;
+                            position = scaling_position(bench, d, edit);
+                            fcl_overwrite_bytes(a_file, &byte, position, &size);
+                            g_array_append_val(edited, position);
+                            edit = edit + 1;
+
+                            stats = fcl_get_buffer_stats(a_file);
+                            n_bufs = stats->n_bufs;
+                            g_free(stats);
+
+                            over = (edit % 1024 == 0) && (now_ns() - distribution_start > (guint64) budget * G_GUINT64_CONSTANT(1000000000));
+                        }
+                    while (n_bufs < step && edit < 4 * max_edits && over == FALSE);
+
+                    if (over == TRUE)
+                        {
+                            break;
+                        }
+
+                    /* Measuring one byte reads (anywhere) and inserts and
+                     * deletes (in the edited blocks so that the sequence
+                     * does not grow) */
+                    reads = g_array_new(FALSE, FALSE, sizeof(guint64));
+                    inserts = g_array_new(FALSE, FALSE, sizeof(guint64));
+                    deletes = g_array_new(FALSE, FALSE, sizeof(guint64));
+                    fcl_reset_perf(a_file);
+
+                    for (i = 0; i < BENCH_SCALING_PROBES; i++)
+                        {
+                            position = random_position(bench, bench->size);
+
+                            size = 1;
+                            start = now_ns();
+                            data = fcl_read_bytes(a_file, position, &size);
+                            record(reads, start);
+                            g_free(data);
+
+                            position = g_array_index(edited, goffset, random_position(bench, edited->len));
+
+                            start = now_ns();
+                            fcl_insert_bytes(a_file, &byte, position, 1);
+                            record(inserts, start);
+
+                            size = 1;
+                            start = now_ns();
+                            fcl_delete_bytes(a_file, position, &size);
+                            record(deletes, start);
+                        }
+
+                    perf = fcl_get_perf(a_file);
+
+                    fprintf(stream, "%s\n    {\"distribution\": \"%s\", \"edits\": %" G_GUINT64_FORMAT ", \"buffers\": %" G_GUINT64_FORMAT ", ", first == TRUE ? "" : ",", distributions[d], step, n_bufs);
+                    fprintf(stream, "\"read_p50_us\": %.3f, \"read_p99_us\": %.3f, ", percentile_us(reads, 50), percentile_us(reads, 99));
+                    fprintf(stream, "\"insert_p50_us\": %.3f, \"insert_p99_us\": %.3f, ", percentile_us(inserts, 50), percentile_us(inserts, 99));
+                    fprintf(stream, "\"delete_p50_us\": %.3f, \"delete_p99_us\": %.3f, ", percentile_us(deletes, 50), percentile_us(deletes, 99));
+                    fprintf(stream, "\"lookup_steps\": %.1f, \"peak_rss_kb\": %ld}", perf->lookups > 0 ? (gdouble) perf->lookup_steps / (gdouble) perf->lookups : 0.0, peak_rss_kb());
+                    fflush(stream);
+                    first = FALSE;
+
+                    g_free(perf);
+                    g_array_free(reads, TRUE);
+                    g_array_free(inserts, TRUE);
+                    g_array_free(deletes, TRUE);
+
+                    over = now_ns() - distribution_start > (guint64) budget * G_GUINT64_CONSTANT(1000000000);
+                }
+
+            if (over == TRUE)
+                {
+                    fprintf(stderr, "%s stopped : more than %d seconds\n", distributions[d], budget);
+                }
+
+            fcl_close_file(a_file, FALSE);
+            g_array_free(edited, TRUE);
+        }
+
+    g_unlink(bench->path);
+}
+
+
+/******************************************************************************/
+/*********************************** Replay ***********************************/
+
+/**
+ * Reads varints from a trace
+ * @param trace : the trace
+ * @param[out] values : the numbers read
+ * @param n : the number of varints to be read
+ * @return FALSE at the end of the trace or if a varint is cut
+ */
+static gboolean get_varints(FILE *trace, guint64 *values, guint n)
+{
+    gint byte = 0;
+    guint shift = 0;
+    guint i = 0;
+
+    for (i = 0; i < n; i++)
+        {
+            values[i] = 0;
+            shift = 0;
+
+            do
+                {
+                    byte = getc(trace);
+
+                    if (byte == EOF || shift > 63)
+                        {
+                            return FALSE;
+                        }
+
+                    values[i] = values[i] | ((guint64) (byte & 0x7f) << shift);
+                    shift = shift + 7;
+                }
+            while ((byte & 0x80) != 0);
+        }
+
+    return TRUE;
+}
+
+
+/**
+ * Reads bytes preceded by their number from a trace
+ * @param trace : the trace
+ * @param[out] size_pointer : the number of bytes read
+ * @return the bytes (followed by a 0, to be freed with g_free()) or NULL if
+ *         the trace is cut
+ */
+static guchar *get_bytes(FILE *trace, guint64 *size_pointer)
+{
+    guchar *data = NULL;
+
+    if (get_varints(trace, size_pointer, 1) == FALSE || *size_pointer > G_MAXUINT32)
+        {
+            return NULL;
+        }
+
+    data = (guchar *) g_malloc0((gsize) *size_pointer + 1);
+
+    if (fread(data, sizeof(guchar), (gsize) *size_pointer, trace) != (gsize) *size_pointer)
+        {
+            g_free(data);
+            return NULL;
+        }
+
+    return data;
+}
+
+
+/**
+ * Gets a buffer of at least size bytes to be inserted or overwritten (the
+ * bytes of the recorded calls are not in the trace)
+ * @param data : the buffer so far (may be NULL)
+ * @param[in,out] size_pointer : the size of data
+ * @param size : the number of bytes needed
+ * @return the buffer
+ */
+static guchar *filler(guchar *data, gsize *size_pointer, gsize size)
+{
+    if (size > *size_pointer)
+        {
+            data = (guchar *) g_realloc(data, size);
+            memset(data + *size_pointer, 'x', size - *size_pointer);
+            *size_pointer = size;
+        }
+
+    return data;
+}
+
+
+/**
+ * Replays a trace recorded by the library and prints, for each kind of call,
+ * the time the calls took when recorded and now
+ * @param trace_path : the trace
+ * @param root : directory where the files are looked for by their name (NULL
+ *               to open them where they were recorded)
+ * @param stream : where to print the results
+ * @return FALSE if the trace can not be read (or is cut)
+ */
+static gboolean run_replay(const gchar *trace_path, const gchar *root, FILE *stream)
+{
+    FILE *trace = NULL;
+    GPtrArray *files = NULL;
+    GArray *latencies[LIBFCL_RECORD_N_CALLS];
+    guint64 recorded[LIBFCL_RECORD_N_CALLS];
+    guint64 replayed = 0;
+    guint64 head[4];           /** call, file, time since the previous call and time taken */
+    guint64 args[3];
+    guchar magic[5];
+    fcl_file_t *a_file = NULL;
+    guchar *data = NULL;
+    gsize data_size = 0;
+    guchar *pattern = NULL;
+    guchar *replacement = NULL;
+    guint64 pattern_len = 0;
+    guint64 replacement_len = 0;
+    guint64 len = 0;
+    gchar *name = NULL;
+    gchar *path = NULL;
+    gsize size = 0;
+    guint64 start = 0;
+    gboolean ok = TRUE;
+    gboolean first = TRUE;
+    guint i = 0;
+    guint j = 0;
+
+    trace = fopen(trace_path, "rb");
+
+    if (trace == NULL || fread(magic, sizeof(guchar), 5, trace) != 5 || memcmp(magic, LIBFCL_RECORD_MAGIC, 4) != 0 || magic[4] != LIBFCL_RECORD_VERSION)
+        {
+            fprintf(stderr, "%s is not a trace of this version of the library\n", trace_path);
+
+            if (trace != NULL)
+                {
+                    fclose(trace);
+                }
+
+            return FALSE;
+        }
+
+    files = g_ptr_array_new();
+
+    for (i = 0; i < LIBFCL_RECORD_N_CALLS; i++)
+        {
+            latencies[i] = g_array_new(FALSE, FALSE, sizeof(guint64));
+            recorded[i] = 0;
+        }
+
+    while (ok == TRUE && get_varints(trace, head, 1) == TRUE)
+        {
+            ok = head[0] < LIBFCL_RECORD_N_CALLS && get_varints(trace, head + 1, 3) == TRUE && head[1] <= G_MAXUINT32;
+
+            if (ok == TRUE && head[0] != LIBFCL_RECORD_OPEN)
+                {
+                    ok = head[1] < files->len && g_ptr_array_index(files, head[1]) != NULL;
+                }
+
+            if (ok == FALSE)
+                {
+                    break;
+                }
+
+            a_file = head[0] != LIBFCL_RECORD_OPEN ? (fcl_file_t *) g_ptr_array_index(files, head[1]) : NULL;
+
+            /* The numbers come first, then the bytes (OPEN and REPLACE_ALL) */
+            if (get_varints(trace, args, n_args[head[0]]) == FALSE)
+                {
+                    ok = FALSE;
+                    break;
+                }
+
+            switch (head[0])
+                {
+                    case LIBFCL_RECORD_OPEN:
+                        name = (gchar *) get_bytes(trace, &len);
+                        ok = name != NULL;
+
+                        if (ok == TRUE)
+                            {
+                                if (root != NULL)
+                                    {
+                                        path = g_path_get_basename(name);
+                                        g_free(name);
+                                        name = g_build_filename(root, path, NULL);
+                                        g_free(path);
+                                    }
+
+                                if (head[1] >= files->len)
+                                    {
+                                        g_ptr_array_set_size(files, (guint) head[1] + 1);
+                                    }
+
+                                start = now_ns();
+                                a_file = fcl_open_file(name, args[0] == LIBFCL_MODE_READ ? LIBFCL_MODE_READ : LIBFCL_MODE_WRITE);
+                                record(latencies[head[0]], start);
+
+                                g_ptr_array_index(files, head[1]) = a_file;
+                                g_free(name);
+                            }
+                    break;
+
+                    case LIBFCL_RECORD_CLOSE:
+                        start = now_ns();
+                        fcl_close_file(a_file, FALSE);
+                        record(latencies[head[0]], start);
+                        g_ptr_array_index(files, head[1]) = NULL;
+                    break;
+
+                    case LIBFCL_RECORD_READ:
+                        size = (gsize) args[1];
+                        start = now_ns();
+                        g_free(fcl_read_bytes(a_file, (goffset) args[0], &size));
+                        record(latencies[head[0]], start);
+                    break;
+
+                    case LIBFCL_RECORD_OVERWRITE:
+                        size = (gsize) args[1];
+                        data = filler(data, &data_size, size);
+                        start = now_ns();
+                        fcl_overwrite_bytes(a_file, data, (goffset) args[0], &size);
+                        record(latencies[head[0]], start);
+                    break;
+
+                    case LIBFCL_RECORD_INSERT:
+                        data = filler(data, &data_size, (gsize) args[1]);
+                        start = now_ns();
+                        fcl_insert_bytes(a_file, data, (goffset) args[0], (gsize) args[1]);
+                        record(latencies[head[0]], start);
+                    break;
+
+                    case LIBFCL_RECORD_DELETE:
+                        size = (gsize) args[1];
+                        start = now_ns();
+                        fcl_delete_bytes(a_file, (goffset) args[0], &size);
+                        record(latencies[head[0]], start);
+                    break;
+
+                    case LIBFCL_RECORD_REPLACE_ALL:
+                        pattern = get_bytes(trace, &pattern_len);
+                        replacement = get_bytes(trace, &replacement_len);
+                        ok = pattern != NULL && replacement != NULL;
+
+                        if (ok == TRUE)
+                            {
+                                start = now_ns();
+                                fcl_replace_all(a_file, pattern, (gsize) pattern_len, replacement, (gsize) replacement_len);
+                                record(latencies[head[0]], start);
+                            }
+
+                        g_free(pattern);
+                        g_free(replacement);
+                    break;
+
+                    case LIBFCL_RECORD_COPY:
+                        start = now_ns();
+                        fcl_copy_range(a_file, (goffset) args[0], (gsize) args[1], (goffset) args[2]);
+                        record(latencies[head[0]], start);
+                    break;
+
+                    case LIBFCL_RECORD_MOVE:
+                        start = now_ns();
+                        fcl_move_range(a_file, (goffset) args[0], (gsize) args[1], (goffset) args[2]);
+                        record(latencies[head[0]], start);
+                    break;
+                }
+
+            recorded[head[0]] = recorded[head[0]] + head[3];
+        }
+
+    if (ok == FALSE)
+        {
+            fprintf(stderr, "%s is cut or corrupted (stopped at byte %ld)\n", trace_path, ftell(trace));
+        }
+
+    for (i = 0; i < files->len; i++)
+        {
+            if (g_ptr_array_index(files, i) != NULL)
+                {
+                    fcl_close_file((fcl_file_t *) g_ptr_array_index(files, i), FALSE);
+                }
+        }
+
+    for (i = 0; i < LIBFCL_RECORD_N_CALLS; i++)
+        {
+            if (latencies[i]->len > 0)
+                {
+                    replayed = 0;
+
+                    for (j = 0; j < latencies[i]->len; j++)
+                        {
+                            replayed = replayed + g_array_index(latencies[i], guint64, j);
+                        }
+
+                    fprintf(stream, "%s\n    {\"call\": \"%s\", \"ops\": %u, \"recorded_us\": %" G_GUINT64_FORMAT ", \"replayed_us\": %.3f, ", first == TRUE ? "" : ",", calls[i], latencies[i]->len, recorded[i], (gdouble) replayed / 1e3);
+                    fprintf(stream, "\"ops_per_sec\": %.1f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"peak_rss_kb\": %ld}",
+                            replayed > 0 ? (gdouble) latencies[i]->len * 1e9 / (gdouble) replayed : 0.0, percentile_us(latencies[i], 50), percentile_us(latencies[i], 99), peak_rss_kb());
+                    first = FALSE;
+                }
+
+            g_array_free(latencies[i], TRUE);
+        }
+
+    g_ptr_array_free(files, TRUE);
+    g_free(data);
+    fclose(trace);
+
+    return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+    GOptionContext *context = NULL;
+    GError *error = NULL;
+    gchar *sizes_option = NULL;
+    gchar *dir_option = NULL;
+    gchar *output_option = NULL;
+    gchar *save_limit_option = NULL;
+    gint ops_option = 1000;
+    gint seed_option = 42;
+    gboolean scaling_option = FALSE;
+    gint64 max_edits_option = 1000000;
+    gint budget_option = 300;
+    gchar *replay_option = NULL;
+    gchar *root_option = NULL;
+    gboolean ok = TRUE;
+    gchar **sizes = NULL;
+    FILE *stream = stdout;
+    bench_t bench;
+
+    GOptionEntry entries[] =
+    {
+        {"sizes", 's', 0, G_OPTION_ARG_STRING, &sizes_option, "Sizes of the files (default 1M,100M,10G,100G)", "SIZES"},
+        {"ops", 'n', 0, G_OPTION_ARG_INT, &ops_option, "Operations of the lightest workloads (default 1000)", "N"},
+        {"dir", 'd', 0, G_OPTION_ARG_FILENAME, &dir_option, "Directory of the generated files (default the temporary directory)", "DIR"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output_option, "JSON output file (default stdout)", "FILE"},
+        {"save-limit", 'l', 0, G_OPTION_ARG_STRING, &save_limit_option, "Biggest file that is saved (default 1G)", "SIZE"},
+        {"seed", 0, 0, G_OPTION_ARG_INT, &seed_option, "Seed of the random numbers (default 42)", "SEED"},
+        {"scaling", 0, 0, G_OPTION_ARG_NONE, &scaling_option, "Measures the operations against the number of edits", NULL},
+        {"max-edits", 0, 0, G_OPTION_ARG_INT64, &max_edits_option, "Number of buffers in the sequence at the last step of --scaling (default 1000000)", "N"},
+        {"budget", 0, 0, G_OPTION_ARG_INT, &budget_option, "Seconds after which a curve of --scaling stops (default 300)", "SECONDS"},
+        {"replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_option, "Replays a trace recorded with LIBFCL_RECORD", "TRACE"},
+        {"root", 0, 0, G_OPTION_ARG_FILENAME, &root_option, "Directory where the files of the trace are (default where they were recorded)", "DIR"},
+        {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+    };
+
+    context = g_option_context_new("- libfcl benchmarks");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (g_option_context_parse(context, &argc, &argv, &error) == FALSE)
+        {
+            fprintf(stderr, "%s\n", error->message);
+            g_error_free(error);
+            g_option_context_free(context);
+            return 1;
+        }
+
+    g_option_context_free(context);
+
+    libfcl_initialize();
+
+    bench.rand = g_rand_new_with_seed((guint32) seed_option);
+    bench.path = g_build_filename(dir_option != NULL ? dir_option : g_get_tmp_dir(), "libfcl_bench", NULL);
+    bench.ops = (guint) MAX(ops_option, 1);
+    bench.save_limit = parse_size(save_limit_option != NULL ? save_limit_option : "1G");
+
+    if (output_option != NULL)
+        {
+            stream = fopen(output_option, "w");
+
+            if (stream == NULL)
+                {
+                    fprintf(stderr, "Can not write %s\n", output_option);
+                    return 1;
+                }
+        }
+
+    if (replay_option != NULL)
+        {
+            fprintf(stream, "{\n  \"library\": \"libfcl\", \"version\": \"%s\", \"buf_size\": %d, \"trace\": \"%s\",\n  \"replay\": [", LIBFCL_VERSION, LIBFCL_BUF_SIZE, replay_option);
+            ok = run_replay(replay_option, root_option, stream);
+        }
+    else if (scaling_option == TRUE)
+        {
+            bench.size = BENCH_SCALING_SIZE;
+            fprintf(stream, "{\n  \"library\": \"libfcl\", \"version\": \"%s\", \"buf_size\": %d, \"seed\": %d,\n  \"scaling\": [", LIBFCL_VERSION, LIBFCL_BUF_SIZE, seed_option);
+            run_scaling(&bench, (guint64) MAX(max_edits_option, 10), budget_option, stream);
+        }
+    else
+        {
+            sizes = g_strsplit(sizes_option != NULL ? sizes_option : "1M,100M,10G,100G", ",", -1);
+            fprintf(stream, "{\n  \"library\": \"libfcl\", \"version\": \"%s\", \"buf_size\": %d, \"seed\": %d,\n  \"results\": [", LIBFCL_VERSION, LIBFCL_BUF_SIZE, seed_option);
+            run_workloads(&bench, sizes, stream);
+            g_strfreev(sizes);
+        }
+
+    fprintf(stream, "\n  ]\n}\n");
+
+    if (stream != stdout)
+        {
+            fclose(stream);
+        }
+
+    g_free(bench.path);
+    g_rand_free(bench.rand);
+
+    return ok == TRUE ? 0 : 1;
+}
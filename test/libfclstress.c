@@ -0,0 +1,526 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- */
+/*
+ *  libfclstress.c
+ *  File Cache Library Stress test
+ *
+ *  (C) Copyright 2010 - 2012 Olivier Delhomme
+ *  e-mail : olivier.delhomme@free.fr
+ *  URL    : https://gna.org/projects/fcl/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or  (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY;  without even the implied warranty of
+ *  MERCHANTABILITY  or  FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/** @file libfclstress.c
+ * Randomized differential test of the library (make stress).
+ *
+ * Random inserts, deletes, overwrites and reads are done both on a file
+ * openned with the library and on a copy of the file in memory (the reference
+ * model). The result of each operation (the bytes read, the number of bytes
+ * overwritten or deleted) is checked against the model and the whole file is
+ * read and compared every --check-every operations and at the end. The first
+ * difference stops the run with the operation that caused it : running again
+ * with the same --seed does the same operations.
+ *
+ * Half of the edits are at most two blocks (LIBFCL_BUF_SIZE) long and the
+ * others up to --max-edit bytes so that many of them cross blocks, and some
+ * of the overwrites, deletes and reads go past the end of the file (the
+ * library tells about these ones on stderr). The number of operations per
+ * second of each kind (time spent in the library only) is written in JSON.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <time.h>
+#endif
+
+#include <fcl.h>
+
+/**
+ * @def STRESS_READ
+ * fcl_read_bytes()
+ *
+ * @def STRESS_INSERT
+ * fcl_insert_bytes()
+ *
+ * @def STRESS_DELETE
+ * fcl_delete_bytes()
+ *
+ * @def STRESS_OVERWRITE
+ * fcl_overwrite_bytes()
+ *
+ * @def STRESS_N_OPS
+ * Number of kinds of operations
+ */
+#define STRESS_READ 0
+#define STRESS_INSERT 1
+#define STRESS_DELETE 2
+#define STRESS_OVERWRITE 3
+#define STRESS_N_OPS 4
+
+
+/**
+ * @struct stress_t
+ * A stress run : the file, its model and what was measured
+ */
+typedef struct
+{
+    GRand *rand;                  /**< Random numbers (seeded)                     */
+    fcl_file_t *a_file;           /**< The file edited with the library            */
+    GByteArray *model;            /**< What the edited file must contain           */
+    gsize max_edit;               /**< Biggest edit                                */
+    gsize max_size;               /**< Inserts become deletes above this size      */
+    guint64 op;                   /**< Number of the current operation             */
+    guint64 count[STRESS_N_OPS];  /**< Operations done of each kind                */
+    guint64 time[STRESS_N_OPS];   /**< Time spent in them (nanoseconds)            */
+    guint64 checks;               /**< Whole file comparisons done                 */
+} stress_t;
+
+
+static const gchar *op_names[STRESS_N_OPS] = {"read", "insert", "delete", "overwrite"};
+
+static guint64 now_ns(void);
+static goffset random_below(stress_t *stress, goffset limit);
+static gsize random_size(stress_t *stress);
+static gboolean create_stress_file(stress_t *stress, const gchar *path, gsize size);
+static void fail(stress_t *stress, gint op, goffset position, gsize size, const gchar *what);
+static gboolean compare(stress_t *stress, gint op, goffset position, gsize size, const guchar *data, gsize data_size);
+static gboolean do_operation(stress_t *stress);
+static gboolean check_whole_file(stress_t *stress);
+
+
+/**
+ * Gets a monotonic time
+ * @return the time in nanoseconds
+ */
+static guint64 now_ns(void)
+{
+#ifdef G_OS_UNIX
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (guint64) now.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64) now.tv_nsec;
+#else
+    return (guint64) g_get_monotonic_time() * 1000;
+#endif
+}
+
+
+/**
+ * Draws a random number
+ * @param stress : the stress run
+ * @param limit : the number is below limit
+ * @return a number between 0 and limit - 1 (0 if limit is 0 or less)
+ */
+static goffset random_below(stress_t *stress, goffset limit)
+{
+    if (limit <= 0)
+        {
+            return 0;
+        }
+
+    return (goffset) (g_rand_double(stress->rand) * (gdouble) limit) % limit;
+}
+
+
+/**
+ * Draws the size of an operation : half of them are at most two blocks long
+ * @param stress : the stress run
+ * @return a size between 1 and max_edit
+ */
+static gsize random_size(stress_t *stress)
+{
+    if (g_rand_boolean(stress->rand) == TRUE)
+        {
+            return 1 + (gsize) random_below(stress, MIN(2 * LIBFCL_BUF_SIZE, (goffset) stress->max_edit));
+        }
+
+    return 1 + (gsize) random_below(stress, (goffset) stress->max_edit);
+}
+
+
+/**
+ * Creates the file of the stress run with random bytes and loads the model
+ * with them
+ * @param stress : the stress run
+ * @param path : path of the file
+ * @param size : size of the file
+ * @return TRUE if the file was created
+ */
+static gboolean create_stress_file(stress_t *stress, const gchar *path, gsize size)
+{
+    FILE *stream = NULL;
+    gsize i = 0;
+    gboolean ok = FALSE;
+
+    g_byte_array_set_size(stress->model, (guint) size);
+
+    for (i = 0; i < size; i++)
+        {
+            stress->model->data[i] = (guint8) g_rand_int_range(stress->rand, 0, 256);
+        }
+
+    stream = fopen(path, "wb");
+
+    if (stream != NULL)
+        {
+            ok = fwrite(stress->model->data, sizeof(guchar), size, stream) == size;
+            ok = (fclose(stream) == 0) && ok;
+        }
+
+    return ok;
+}
+
+
+/**
+ * Prints the operation that made the file differ from the model
+ * @param stress : the stress run
+ * @param op : the operation (STRESS_READ...) or -1 for a whole file check
+ * @param position : its position
+ * @param size : its size
+ * @param what : what differs
+ */
+static void fail(stress_t *stress, gint op, goffset position, gsize size, const gchar *what)
+{
+    fprintf(stderr, "Operation %" G_GUINT64_FORMAT " (%s of %" G_GSIZE_FORMAT " bytes at %" G_GOFFSET_FORMAT ", file of %u bytes) : %s\n",
+            stress->op, op >= 0 ? op_names[op] : "check", size, position, stress->model->len, what);
+}
+
+
+/**
+ * Compares bytes read with the library with the ones of the model
+ * @param stress : the stress run
+ * @param op : the operation (for the message)
+ * @param position : position of the bytes
+ * @param size : number of bytes asked for
+ * @param data : the bytes read (may be NULL)
+ * @param data_size : the number of bytes read
+ * @return TRUE if they are the bytes of the model
+ */
+static gboolean compare(stress_t *stress, gint op, goffset position, gsize size, const guchar *data, gsize data_size)
+{
+    gsize expected = (gsize) CLAMP((goffset) stress->model->len - position, 0, (goffset) size);
+    gchar *what = NULL;
+    gsize i = 0;
+
+    if (data_size != expected || (data_size > 0 && data == NULL))
+        {
+            what = g_strdup_printf("%" G_GSIZE_FORMAT " bytes read instead of %" G_GSIZE_FORMAT, data_size, expected);
+            fail(stress, op, position, size, what);
+            g_free(what);
+            return FALSE;
+        }
+
+    for (i = 0; i < data_size; i++)
+        {
+            if (data[i] != stress->model->data[position + i])
+                {
+                    what = g_strdup_printf("byte %" G_GOFFSET_FORMAT " is %02x instead of %02x", position + (goffset) i, data[i], stress->model->data[position + i]);
+                    fail(stress, op, position, size, what);
+                    g_free(what);
+                    return FALSE;
+                }
+        }
+
+    return TRUE;
+}
+
+
+/**
+ * Does a random operation on the file and on the model and checks its result
+ * @param stress : the stress run
+ * @return FALSE if the file differs from the model
+ */
+static gboolean do_operation(stress_t *stress)
+{
+    goffset len = (goffset) stress->model->len;
+    goffset position = 0;
+    guchar *data = NULL;
+    gsize size = random_size(stress);
+    gsize asked = size;
+    gsize expected = 0;
+    gsize i = 0;
+    guint64 start = 0;
+    gint op = 0;
+    gboolean ok = TRUE;
+
+    op = g_rand_int_range(stress->rand, 0, STRESS_N_OPS);
+
+    if (op == STRESS_INSERT && (gsize) len + size > stress->max_size)
+        {
+            op = STRESS_DELETE;
+        }
+
+    /* Some operations begin near the end of the file so that they go past it */
+    if (op != STRESS_INSERT && g_rand_int_range(stress->rand, 0, 100) < 2)
+        {
+            position = MAX(len - (goffset) size / 2, 0);
+        }
+    else
+        {
+            position = random_below(stress, len + 1);
+        }
+
+    expected = (gsize) CLAMP(len - position, 0, (goffset) size);
+
+    switch (op)
+        {
+            case STRESS_READ:
+                start = now_ns();
+                data = fcl_read_bytes(stress->a_file, position, &size);
+                stress->time[op] = stress->time[op] + now_ns() - start;
+
+                ok = compare(stress, op, position, asked, data, data == NULL ? 0 : size);
+                g_free(data);
+            break;
+
+            case STRESS_INSERT:
+                data = (guchar *) g_malloc(size * sizeof(guchar));
+
+                for (i = 0; i < size; i++)
+                    {
+                        data[i] = (guchar) g_rand_int_range(stress->rand, 0, 256);
+                    }
+
+                start = now_ns();
+                ok = fcl_insert_bytes(stress->a_file, data, position, size);
+                stress->time[op] = stress->time[op] + now_ns() - start;
+
+                g_byte_array_set_size(stress->model, stress->model->len + (guint) size);
+                memmove(stress->model->data + position + size, stress->model->data + position, (gsize) len - (gsize) position);
+                memcpy(stress->model->data + position, data, size);
+                g_free(data);
+
+                if (ok == FALSE)
+                    {
+                        fail(stress, op, position, asked, "insertion refused");
+                    }
+            break;
+
+            case STRESS_DELETE:
+                start = now_ns();
+                fcl_delete_bytes(stress->a_file, position, &size);
+                stress->time[op] = stress->time[op] + now_ns() - start;
+
+                g_byte_array_remove_range(stress->model, (guint) position, (guint) expected);
+
+                if (size != expected)
+                    {
+                        fail(stress, op, position, asked, "wrong number of bytes deleted");
+                        ok = FALSE;
+                    }
+            break;
+
+            case STRESS_OVERWRITE:
+                data = (guchar *) g_malloc(size * sizeof(guchar));
+
+                for (i = 0; i < size; i++)
+                    {
+                        data[i] = (guchar) g_rand_int_range(stress->rand, 0, 256);
+                    }
+
+                start = now_ns();
+                fcl_overwrite_bytes(stress->a_file, data, position, &size);
+                stress->time[op] = stress->time[op] + now_ns() - start;
+
+                memcpy(stress->model->data + position, data, expected);
+                g_free(data);
+
+                if (size != expected)
+                    {
+                        fail(stress, op, position, asked, "wrong number of bytes overwritten");
+                        ok = FALSE;
+                    }
+            break;
+        }
+
+    stress->count[op] = stress->count[op] + 1;
+
+    return ok;
+}
+
+
+/**
+ * Reads the whole edited file and compares it (and its size in the
+ * statistics) with the model
+ * @param stress : the stress run
+ * @return FALSE if they differ
+ */
+static gboolean check_whole_file(stress_t *stress)
+{
+    fcl_stat_buf_t *stats = NULL;
+    guchar *data = NULL;
+    gsize size = stress->model->len + LIBFCL_BUF_SIZE;
+    gboolean ok = TRUE;
+
+    stress->checks = stress->checks + 1;
+
+    data = fcl_read_bytes(stress->a_file, 0, &size);
+    ok = compare(stress, -1, 0, stress->model->len + LIBFCL_BUF_SIZE, data, data == NULL ? 0 : size);
+    g_free(data);
+
+    stats = fcl_get_buffer_stats(stress->a_file);
+
+    if (ok == TRUE && stats->logical_size != (goffset) stress->model->len)
+        {
+            fail(stress, -1, 0, 0, "wrong size in the statistics");
+            ok = FALSE;
+        }
+
+    g_free(stats);
+
+    return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+    GOptionContext *context = NULL;
+    GError *error = NULL;
+    gchar *dir_option = NULL;
+    gchar *output_option = NULL;
+    gchar *path = NULL;
+    gint64 ops_option = 1000000;
+    gint size_option = 65536;
+    gint max_edit_option = 4 * LIBFCL_BUF_SIZE;
+    gint check_every_option = 10000;
+    gint seed_option = 42;
+    FILE *stream = stdout;
+    fcl_stat_buf_t *stats = NULL;
+    guint64 total = 0;
+    guint64 ops_done = 0;
+    guint64 start = 0;
+    gdouble seconds = 0.0;
+    gboolean ok = TRUE;
+    gint op = 0;
+    stress_t stress;
+
+    GOptionEntry entries[] =
+    {
+        {"ops", 'n', 0, G_OPTION_ARG_INT64, &ops_option, "Number of operations (default 1000000)", "N"},
+        {"size", 's', 0, G_OPTION_ARG_INT, &size_option, "Size of the file at the begining (default 65536)", "BYTES"},
+        {"max-edit", 'e', 0, G_OPTION_ARG_INT, &max_edit_option, "Biggest insert, delete, overwrite or read (default 4 blocks)", "BYTES"},
+        {"check-every", 'c', 0, G_OPTION_ARG_INT, &check_every_option, "Operations between two whole file comparisons (default 10000)", "N"},
+        {"dir", 'd', 0, G_OPTION_ARG_FILENAME, &dir_option, "Directory of the file (default the temporary directory)", "DIR"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &output_option, "JSON output file (default stdout)", "FILE"},
+        {"seed", 0, 0, G_OPTION_ARG_INT, &seed_option, "Seed of the random numbers (default 42)", "SEED"},
+        {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+    };
+
+    context = g_option_context_new("- libfcl randomized differential test");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (g_option_context_parse(context, &argc, &argv, &error) == FALSE)
+        {
+            fprintf(stderr, "%s\n", error->message);
+            g_error_free(error);
+            g_option_context_free(context);
+            return 1;
+        }
+
+    g_option_context_free(context);
+
+    libfcl_initialize();
+
+    memset(&stress, 0, sizeof(stress_t));
+    stress.rand = g_rand_new_with_seed((guint32) seed_option);
+    stress.model = g_byte_array_new();
+    stress.max_edit = (gsize) MAX(max_edit_option, 1);
+    stress.max_size = 2 * (gsize) MAX(size_option, 0) + stress.max_edit;
+    check_every_option = MAX(check_every_option, 1);
+
+    path = g_build_filename(dir_option != NULL ? dir_option : g_get_tmp_dir(), "libfcl_stress", NULL);
+
+    if (create_stress_file(&stress, path, (gsize) MAX(size_option, 0)) == FALSE)
+        {
+            fprintf(stderr, "Can not create %s\n", path);
+            return 1;
+        }
+
+    if (output_option != NULL)
+        {
+            stream = fopen(output_option, "w");
+
+            if (stream == NULL)
+                {
+                    fprintf(stderr, "Can not write %s\n", output_option);
+                    return 1;
+                }
+        }
+
+    stress.a_file = fcl_open_file(path, LIBFCL_MODE_WRITE);
+    start = now_ns();
+
+    for (stress.op = 0; stress.op < (guint64) ops_option && ok == TRUE; stress.op++)
+        {
+            ok = do_operation(&stress);
+
+            if (ok == TRUE && (stress.op + 1) % (guint64) check_every_option == 0)
+                {
+                    ok = check_whole_file(&stress);
+                }
+        }
+
+    ops_done = stress.op;
+
+    if (ok == TRUE)
+        {
+            ok = check_whole_file(&stress);
+        }
+
+    seconds = (gdouble) (now_ns() - start) / 1e9;
+
+    for (op = 0; op < STRESS_N_OPS; op++)
+        {
+            total = total + stress.time[op];
+        }
+
+    stats = fcl_get_buffer_stats(stress.a_file);
+
+    fprintf(stream, "{\n  \"library\": \"libfcl\", \"version\": \"%s\", \"buf_size\": %d, \"seed\": %d, \"file_size\": %d,\n", LIBFCL_VERSION, LIBFCL_BUF_SIZE, seed_option, size_option);
+    fprintf(stream, "  \"result\": \"%s\", \"ops\": %" G_GUINT64_FORMAT ", \"checks\": %" G_GUINT64_FORMAT ", \"seconds\": %.3f, \"ops_per_sec\": %.1f,\n",
+            ok == TRUE ? "ok" : "failed", ops_done, stress.checks, seconds, total > 0 ? (gdouble) ops_done * 1e9 / (gdouble) total : 0.0);
+    fprintf(stream, "  \"final_size\": %u, \"buffers\": %" G_GUINT64_FORMAT ",\n  \"operations\": [", stress.model->len, stats->n_bufs);
+
+    for (op = 0; op < STRESS_N_OPS; op++)
+        {
+            fprintf(stream, "%s\n    {\"operation\": \"%s\", \"ops\": %" G_GUINT64_FORMAT ", \"ops_per_sec\": %.1f}", op == 0 ? "" : ",", op_names[op], stress.count[op],
+                    stress.time[op] > 0 ? (gdouble) stress.count[op] * 1e9 / (gdouble) stress.time[op] : 0.0);
+        }
+
+    fprintf(stream, "\n  ]\n}\n");
+
+    if (stream != stdout)
+        {
+            fclose(stream);
+        }
+
+    if (ok == FALSE)
+        {
+            fprintf(stderr, "Run again with --seed %d --ops %" G_GUINT64_FORMAT " to get the same operations\n", seed_option, ops_done);
+        }
+
+    g_free(stats);
+    fcl_close_file(stress.a_file, FALSE);
+    g_unlink(path);
+    g_free(path);
+    g_byte_array_free(stress.model, TRUE);
+    g_rand_free(stress.rand);
+
+    return ok == TRUE ? 0 : 1;
+}
@@ -27,7 +27,10 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 
 #include <fcl.h>
 
@@ -39,12 +42,34 @@ static void print_message(gboolean success, const char *format, ...);
 static gchar *get_home_dir(void);
 
 static guchar *fill_data_with_char(gint size, guchar car);
+static gchar *create_test_file(const gchar *name, const gchar *content);
 
 static void test_openning_and_closing_files(void);
+static void test_lazy_openning_of_files(void);
 static void test_openning_and_reading_files(void);
 static void test_openning_and_overwriting_files(void);
 static void test_openning_and_inserting_in_files(void);
 static void test_openning_and_deleting_in_files(void);
+static void test_openning_and_searching_in_files(void);
+static void test_searching_many_patterns_in_files(void);
+static void test_searching_regular_expressions_in_files(void);
+static void test_replacing_in_files(void);
+static void test_checksums_of_files(void);
+static void test_byte_distribution_of_files(void);
+static void test_diffing_files(void);
+static void test_patching_files(void);
+static void test_rendering_files(void);
+static void test_memory_budget(void);
+static void test_compression(void);
+static void test_sessions(void);
+static void test_open_files(void);
+static void test_backends(void);
+static void test_inserting_ranges(void);
+static void test_copying_ranges(void);
+static void test_clipboard(void);
+static void test_buffer_statistics(void);
+static void test_performance_counters(void);
+static void test_recording_calls(void);
 
 /**
  *  Inits internationalisation
@@ -135,6 +160,31 @@ static guchar *fill_data_with_char(gint size, guchar car)
 }
 
 
+/**
+ * Creates a file in the temporary directory with some content
+ * @param name : the name of the file
+ * @param content : what is written in the file
+ * @return the full path of the file in a gchar * that can be freed when no
+ *         longer needed
+ */
+static gchar *create_test_file(const gchar *name, const gchar *content)
+{
+    gchar *filename = NULL;
+    FILE *stream = NULL;
+
+    filename = g_build_path(G_DIR_SEPARATOR_S, g_get_tmp_dir(), name, NULL);
+    stream = fopen(filename, "wb");
+
+    if (stream != NULL)
+        {
+            fwrite(content, sizeof(gchar), strlen(content), stream);
+            fclose(stream);
+        }
+
+    return filename;
+}
+
+
 /**
  * This function tests openning files and closing them with different modes
  */
@@ -168,6 +218,60 @@ static void test_openning_and_closing_files(void)
 }
 
 
+/**
+ * This function tests openning files lazily, one by one and many at once
+ */
+static void test_lazy_openning_of_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    GPtrArray *files = NULL;
+    gchar *paths[4] = {NULL, NULL, NULL, NULL};
+    guchar *data = NULL;
+    gsize size = 0;
+    gboolean ok = TRUE;
+    guint i = 0;
+    gint backend = 0;
+
+    /* The streams are openned by the GIO backend (not by the memory one) */
+    backend = fcl_get_default_backend();
+    fcl_set_default_backend(LIBFCL_BACKEND_GIO);
+
+    paths[0] = create_test_file("libfcl_lazy_test_0", "0123456789ABCDEF");
+    paths[1] = create_test_file("libfcl_lazy_test_1", "");
+    paths[2] = create_test_file("libfcl_lazy_test_2", "0123456789");
+
+    my_test_file = fcl_open_file_lazy(paths[0], LIBFCL_MODE_WRITE);
+    print_message(my_test_file != NULL && my_test_file->backend->is_open == FALSE && my_test_file->real_size == 16, Q_("Opening a file lazily (no stream)"));
+
+    size = 4;
+    data = fcl_read_bytes(my_test_file, 10, &size);
+    print_message(size == 4 && memcmp(data, "ABCD", 4) == 0 && my_test_file->backend->is_open == TRUE, Q_("Reading a file openned lazily"));
+    g_free(data);
+    fcl_close_file(my_test_file, FALSE);
+
+    files = fcl_open_files(paths, LIBFCL_MODE_READ, 2);
+
+    for (i = 0; files != NULL && i < files->len; i++)
+        {
+            my_test_file = (fcl_file_t *) g_ptr_array_index(files, i);
+            ok = ok && my_test_file->real_size == (goffset) (i == 0 ? 16 : (i == 1 ? 0 : 10)) && my_test_file->backend->is_open == FALSE;
+            fcl_close_file(my_test_file, FALSE);
+        }
+
+    print_message(files != NULL && files->len == 3 && ok == TRUE, Q_("Opening %u files at once"), files != NULL ? files->len : 0);
+
+    g_ptr_array_free(files, TRUE);
+
+    for (i = 0; i < 3; i++)
+        {
+            g_unlink(paths[i]);
+            g_free(paths[i]);
+        }
+
+    fcl_set_default_backend(backend);
+}
+
+
 /**
  * This function test openning, reading in the file and closing them
  */
@@ -291,6 +395,21 @@ static void test_openning_and_overwriting_files(void)
     fcl_print_data(data, size, TRUE);
 
     fcl_close_file(my_test_file, FALSE);
+    g_free(data);
+    g_free(filename);
+
+    /* Overwriting bytes of two blocks, away from the begining of the file */
+    filename = create_test_file("libfcl_overwrite_test", "0123456789ABCDEFGHIJ");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+    size = 6;
+    fcl_overwrite_bytes(my_test_file, (guchar *) "abcdef", 13, &size);
+    size = 100;
+    data = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(size == 20 && memcmp(data, "0123456789ABCabcdefJ", 20) == 0, Q_("Overwriting across blocks (%ld bytes)"), size);
+
+    fcl_close_file(my_test_file, FALSE);
+    g_free(data);
+    g_free(filename);
 
     g_free(buffer);
 
@@ -334,6 +453,8 @@ static void test_openning_and_deleting_in_files(void)
     fcl_file_t *my_test_file = NULL;
     guchar *data = NULL;
     gsize size = 0;
+    gsize deleted = 0;
+    gboolean result = FALSE;
     gchar *filename = NULL;
 
     filename = g_build_path(G_DIR_SEPARATOR_S, get_home_dir(), ".bashrc", NULL);
@@ -350,10 +471,1160 @@ static void test_openning_and_deleting_in_files(void)
     fcl_print_data(data, size, TRUE);
 
     fcl_close_file(my_test_file, FALSE);
+    g_free(data);
+    g_free(filename);
+
+    /* Deleting bytes of many blocks, then past the end of the file */
+    filename = create_test_file("libfcl_delete_test", "0123456789ABCDEFGHIJKLMNOPQRSTUV");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    size = 20;
+    result = fcl_delete_bytes(my_test_file, 5, &size);
+    deleted = size;
+    size = 100;
+    data = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(result == TRUE && deleted == 20 && size == 12 && memcmp(data, "01234PQRSTUV", 12) == 0, Q_("Deleting 20 bytes across blocks (%ld bytes left)"), size);
+    g_free(data);
+
+    size = 20;
+    fcl_delete_bytes(my_test_file, 8, &size);
+    deleted = size;
+    size = 100;
+    data = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(deleted == 4 && size == 8 && memcmp(data, "01234PQR", 8) == 0, Q_("Deleting past the end of the file (%ld bytes deleted)"), deleted);
+    g_free(data);
+
+    fcl_close_file(my_test_file, FALSE);
+    g_free(filename);
+}
+
+
+/**
+ * This function tests searching bytes in files, edited or not
+ */
+static void test_openning_and_searching_in_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    gchar *filename = NULL;
+    guchar *buffer = NULL;
+    goffset found = 0;
+
+    /* Searching in a file that has not been edited */
+    my_test_file = fcl_open_file("/bin/bash", LIBFCL_MODE_READ);
+    found = fcl_find(my_test_file, (guchar *) "ELF", 3, 0, LIBFCL_FIND_FORWARD);
+    print_message(found == 1, Q_("Searching 'ELF' forward in /bin/bash (found at %ld)"), found);
+    found = fcl_find(my_test_file, (guchar *) "ELF", 3, my_test_file->real_size, LIBFCL_FIND_BACKWARD);
+    print_message(found >= 1, Q_("Searching 'ELF' backward from the end of /bin/bash (found at %ld)"), found);
+    fcl_close_file(my_test_file, FALSE);
+
+    /* Searching in an edited file : matches span inserted bytes and untouched parts */
+    filename = create_test_file("libfcl_search_test", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    buffer = (guchar *) g_strdup_printf("xyz");
+    fcl_insert_bytes(my_test_file, buffer, 10, 3);
+
+    found = fcl_find(my_test_file, (guchar *) "789xyzAB", 8, 0, LIBFCL_FIND_FORWARD);
+    print_message(found == 7, Q_("Searching across an inserted buffer (found at %ld)"), found);
+
+    found = fcl_find(my_test_file, (guchar *) "EFGH", 4, 0, LIBFCL_FIND_FORWARD);
+    print_message(found == 17, Q_("Searching across an edited buffer and the file (found at %ld)"), found);
+
+    found = fcl_find(my_test_file, (guchar *) "EFGH", 4, 38, LIBFCL_FIND_BACKWARD);
+    print_message(found == 17, Q_("Searching backward across an edited buffer and the file (found at %ld)"), found);
+
+    found = fcl_find(my_test_file, (guchar *) "9", 1, 38, LIBFCL_FIND_BACKWARD);
+    print_message(found == 9, Q_("Searching one byte backward (found at %ld)"), found);
+
+    found = fcl_find(my_test_file, (guchar *) "EFGH", 4, 18, LIBFCL_FIND_FORWARD);
+    print_message(found == -1, Q_("Searching after the last match (found at %ld)"), found);
+
+    fcl_close_file(my_test_file, FALSE);
+
+    g_free(buffer);
+    g_free(filename);
+}
+
+
+/**
+ * This function tests searching many patterns at once in an edited file
+ */
+static void test_searching_many_patterns_in_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_patterns_t *patterns = NULL;
+    fcl_match_t *match = NULL;
+    GArray *matches = NULL;
+    gchar *filename = NULL;
+    guchar *buffer = NULL;
+    /* expected position and pattern number of each match */
+    goffset positions[] = {9, 10, 11, 11, 15};
+    guint numbers[] = {0, 2, 1, 4, 3};
+    gboolean ok = TRUE;
+    guint i = 0;
+
+    filename = create_test_file("libfcl_patterns_test", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    buffer = (guchar *) g_strdup_printf("xyz");
+    fcl_insert_bytes(my_test_file, buffer, 10, 3);
+
+    patterns = fcl_patterns_new();
+    fcl_patterns_add(patterns, (guchar *) "9xyzA", 5);
+    fcl_patterns_add(patterns, (guchar *) "yz", 2);
+    fcl_patterns_add(patterns, (guchar *) "xyz", 3);
+    fcl_patterns_add(patterns, (guchar *) "CDE", 3);
+    fcl_patterns_add(patterns, (guchar *) "yz", 2);
+
+    matches = fcl_find_patterns(my_test_file, patterns, 2);
+
+    ok = matches != NULL && matches->len == 5;
+
+    for (i = 0; ok == TRUE && i < matches->len; i++)
+        {
+            match = &g_array_index(matches, fcl_match_t, i);
+            ok = match->position == positions[i] && match->pattern == numbers[i];
+        }
+
+    print_message(ok, Q_("Searching 5 patterns at once in an edited file (%d matches)"), matches == NULL ? -1 : (gint) matches->len);
+
+    if (matches != NULL)
+        {
+            g_array_free(matches, TRUE);
+        }
+
+    fcl_patterns_free(patterns);
+    fcl_close_file(my_test_file, FALSE);
+
+    g_free(buffer);
+    g_free(filename);
+}
+
+
+/**
+ * This function tests searching a regular expression in an edited file
+ */
+static void test_searching_regular_expressions_in_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_regex_iter_t *iter = NULL;
+    gchar *filename = NULL;
+    guchar *buffer = NULL;
+    goffset position = 0;
+    gsize size = 0;
+    gint n = 0;
+    gboolean ok = TRUE;
+
+    filename = create_test_file("libfcl_regex_test", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    buffer = (guchar *) g_strdup_printf("xyz");
+    fcl_insert_bytes(my_test_file, buffer, 10, 3);
+
+    /* "89xyzA" spans the file and the inserted buffer */
+    iter = fcl_regex_find_all(my_test_file, "[0-9]{2}[x-z]+[A-C]|[U-Z]+$", 0, 0);
+
+    while (fcl_regex_iter_next(iter, &position, &size) == TRUE)
+        {
+            ok = ok && ((n == 0 && position == 8 && size == 6) || (n == 1 && position == 33 && size == 6));
+            n++;
+        }
+
+    print_message(ok && n == 2, Q_("Searching a regular expression in an edited file (%d matches)"), n);
+    fcl_regex_iter_free(iter);
+
+    /* Stopping early */
+    iter = fcl_regex_find_all(my_test_file, "[A-Z]", 20, 0);
+    ok = fcl_regex_iter_next(iter, &position, &size) == TRUE && position == 20 && size == 1;
+    print_message(ok, Q_("Searching a regular expression from a position (found at %ld)"), position);
+    fcl_regex_iter_free(iter);
+
+    iter = fcl_regex_find_all(my_test_file, "(unbalanced", 0, 0);
+    print_message(iter == NULL, Q_("Searching a regular expression that does not compile"));
+
+    fcl_close_file(my_test_file, FALSE);
+
+    /* The file is cut behind the back of the library : it reads short */
+    my_test_file = fcl_open_backend(fcl_backend_new(LIBFCL_BACKEND_POSIX, filename, LIBFCL_MODE_READ), filename);
+    ok = truncate(filename, 10) == 0;
+    iter = fcl_regex_find_all(my_test_file, "Z", 0, 0);
+    ok = ok && fcl_regex_iter_next(iter, &position, &size) == FALSE;
+    print_message(ok, Q_("Searching a regular expression in a file that reads short"));
+    fcl_regex_iter_free(iter);
+    fcl_close_file(my_test_file, FALSE);
+
+    g_unlink(filename);
+
+    g_free(buffer);
+    g_free(filename);
+}
+
+
+/**
+ * This function tests replacing every occurrence of a pattern in a file
+ */
+static void test_replacing_in_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    gchar *filename = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    goffset count = 0;
+    const gchar *expected = "0123-789ABCDEFGHIJKLMNOPQRSTUVWXYZ0123-789";
+
+    filename = create_test_file("libfcl_replace_test", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_READ);
+    count = fcl_replace_all(my_test_file, (guchar *) "456", 3, (guchar *) "-", 1);
+    print_message(count == -1, Q_("Trying to replace in a READ ONLY opened file"));
+    fcl_close_file(my_test_file, FALSE);
+
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    /* Shorter replacement : the matches span two buffers */
+    count = fcl_replace_all(my_test_file, (guchar *) "456", 3, (guchar *) "-", 1);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(count == 2 && size == strlen(expected) && memcmp(buffer, expected, size) == 0, Q_("Replacing 2 occurrences by a shorter replacement (%ld bytes)"), size);
+    g_free(buffer);
+
+    /* Longer replacement, over the buffers edited above */
+    count = fcl_replace_all(my_test_file, (guchar *) "3-7", 3, (guchar *) "three-seven", 11);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(count == 2 && size == strlen(expected) + 16 && memcmp(buffer + 34 + 8, "012three-seven89", 16) == 0, Q_("Replacing 2 occurrences by a longer replacement (%ld bytes)"), size);
+    g_free(buffer);
+
+    /* Deleting */
+    count = fcl_replace_all(my_test_file, (guchar *) "three-seven", 11, NULL, 0);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(count == 2 && size == strlen(expected) - 6 && memcmp(buffer, "01289ABC", 8) == 0, Q_("Deleting 2 occurrences (%ld bytes)"), size);
+    g_free(buffer);
+
+    fcl_close_file(my_test_file, FALSE);
+
+    g_free(filename);
+}
+
+
+/**
+ * This function tests the checksums of files, before and after edition
+ */
+static void test_checksums_of_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    gchar *filename = NULL;
+    gchar *checksum = NULL;
+    gchar *before = NULL;
+
+    filename = create_test_file("libfcl_checksum_test", "12345");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    before = fcl_checksum(my_test_file, LIBFCL_CHECKSUM_CRC32C);
+    print_message(before != NULL, Q_("CRC32C before edition : %s"), before);
+
+    /* The file is now "123456789" */
+    fcl_insert_bytes(my_test_file, (guchar *) "6789", 5, 4);
+
+    checksum = fcl_checksum(my_test_file, LIBFCL_CHECKSUM_CRC32C);
+    print_message(g_strcmp0(checksum, "e3069283") == 0, Q_("CRC32C after edition : %s"), checksum);
+    g_free(checksum);
+
+    checksum = fcl_checksum(my_test_file, LIBFCL_CHECKSUM_SHA256);
+    print_message(g_strcmp0(checksum, "15e2b0d3c33891ebb0f1ef609ec419420c20e320ce94c65fbc8c3312448eb225") == 0, Q_("SHA-256 after edition : %s"), checksum);
+    g_free(checksum);
+
+    fcl_close_file(my_test_file, FALSE);
+    g_free(filename);
+
+    filename = create_test_file("libfcl_checksum_test", "abc");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_READ);
+    checksum = fcl_checksum(my_test_file, LIBFCL_CHECKSUM_XXH64);
+    print_message(g_strcmp0(checksum, "44bc2cf5ad770999") == 0, Q_("XXH64 : %s"), checksum);
+    fcl_close_file(my_test_file, FALSE);
+
+    g_free(checksum);
+    g_free(before);
+    g_free(filename);
+}
+
+
+/**
+ * Tests the histograms and the entropy map of a file
+ */
+static void test_byte_distribution_of_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    gchar *filename = NULL;
+    guint64 histogram[256];
+    GArray *map = NULL;
+    fcl_entropy_t *first = NULL;
+    fcl_entropy_t *second = NULL;
+    goffset total = 0;
+
+    filename = create_test_file("libfcl_distribution_test", "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA0123456789abcdef0123456789abcdef");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    total = fcl_byte_histogram(my_test_file, 0, G_MAXINT64, histogram);
+    print_message(total == 64 && histogram['A'] == 32 && histogram['0'] == 2 && histogram['f'] == 2 && histogram['B'] == 0, Q_("Histogram of a file (%" G_GINT64_FORMAT " bytes)"), total);
+
+    map = fcl_entropy_map(my_test_file, 32);
+    first = map->len == 2 ? &g_array_index(map, fcl_entropy_t, 0) : NULL;
+    second = map->len == 2 ? &g_array_index(map, fcl_entropy_t, 1) : NULL;
+    print_message(first != NULL && first->entropy == 0.0 && second->position == 32 && second->entropy == 4.0, Q_("Entropy map of a file (%u blocks)"), map->len);
+    g_array_free(map, TRUE);
+
+    /* Only the edited block changes */
+    fcl_insert_bytes(my_test_file, (guchar *) "BBBB", 4, 4);
+
+    total = fcl_byte_histogram(my_test_file, 0, G_MAXINT64, histogram);
+    print_message(total == 68 && histogram['A'] == 32 && histogram['B'] == 4, Q_("Histogram after an insertion (%" G_GINT64_FORMAT " bytes)"), total);
+
+    total = fcl_byte_histogram(my_test_file, 2, 8, histogram);
+    print_message(total == 8 && histogram['A'] == 4 && histogram['B'] == 4, Q_("Histogram of a range (%" G_GINT64_FORMAT " bytes)"), total);
+
+    map = fcl_entropy_map(my_test_file, 32);
+    first = map->len == 2 ? &g_array_index(map, fcl_entropy_t, 0) : NULL;
+    second = map->len == 2 ? &g_array_index(map, fcl_entropy_t, 1) : NULL;
+    print_message(first != NULL && first->size == 36 && first->entropy > 0.5 && first->entropy < 0.51 && second->position == 36 && second->entropy == 4.0, Q_("Entropy map after an insertion (%.3f)"), first != NULL ? first->entropy : -1.0);
+    g_array_free(map, TRUE);
+
+    fcl_close_file(my_test_file, FALSE);
+    g_unlink(filename);
+    g_free(filename);
+}
+
+
+/**
+ * Tests the differences between two files
+ */
+static void test_diffing_files(void)
+{
+    fcl_file_t *a_file = NULL;
+    fcl_file_t *b_file = NULL;
+    gchar *a_filename = NULL;
+    gchar *b_filename = NULL;
+    GArray *diffs = NULL;
+    fcl_diff_t *diff = NULL;
+    gsize size = 0;
+
+    a_filename = create_test_file("libfcl_diff_test_a", "The quick brown fox jumps over the lazy dog, twice : the quick brown fox jumps over the lazy dog.");
+    b_filename = create_test_file("libfcl_diff_test_b", "The quick brown fox jumps over the lazy dog, twice : the quick brown fox jumps over the lazy dog.");
+    a_file = fcl_open_file(a_filename, LIBFCL_MODE_WRITE);
+    b_file = fcl_open_file(b_filename, LIBFCL_MODE_READ);
+
+    diffs = fcl_diff(a_file, b_file);
+    print_message(diffs != NULL && diffs->len == 0, Q_("Equal files : %d difference(s)"), diffs != NULL ? diffs->len : -1);
+    g_array_free(diffs, TRUE);
+
+    /* An insertion must not make the rest of the file differ */
+    fcl_insert_bytes(a_file, (guchar *) "INSERTED", 4, 8);
+    diffs = fcl_diff(a_file, b_file);
+    diff = diffs->len > 0 ? &g_array_index(diffs, fcl_diff_t, 0) : NULL;
+    print_message(diffs->len == 1 && diff->a_position == 4 && diff->a_size == 8 && diff->b_size == 0, Q_("Insertion : %d difference(s)"), diffs->len);
+    g_array_free(diffs, TRUE);
+
+    /* The last dog becomes a cat */
+    size = 3;
+    fcl_delete_bytes(a_file, 101, &size);
+    fcl_insert_bytes(a_file, (guchar *) "cat", 101, 3);
+    diffs = fcl_diff(a_file, b_file);
+    diff = diffs->len > 1 ? &g_array_index(diffs, fcl_diff_t, 1) : NULL;
+    print_message(diffs->len == 2 && diff->a_position == 101 && diff->a_size == 3 && diff->b_position == 93 && diff->b_size == 3, Q_("Insertion and replacement : %d difference(s)"), diffs->len);
+    g_array_free(diffs, TRUE);
+
+    fcl_close_file(a_file, FALSE);
+    fcl_close_file(b_file, FALSE);
+    g_free(a_filename);
+    g_free(b_filename);
+}
+
+
+
+/**
+ * Tests exporting the edits of a file as a patch and applying it
+ */
+static void test_patching_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_file_t *expected_file = NULL;
+    gchar *filename = NULL;
+    gchar *patch_name = NULL;
+    gchar *target_name = NULL;
+    gchar *expected_name = NULL;
+    GArray *diffs = NULL;
+    gboolean result = FALSE;
+    gsize size = 0;
+
+    filename = create_test_file("libfcl_patch_test", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    expected_name = create_test_file("libfcl_patch_test_expected", "0123new456789ABCDEFGHIJKLMNOPQRSTUVWXYZ!");
+    patch_name = g_build_path(G_DIR_SEPARATOR_S, g_get_tmp_dir(), "libfcl_patch_test.patch", NULL);
+    target_name = g_build_path(G_DIR_SEPARATOR_S, g_get_tmp_dir(), "libfcl_patch_test_target", NULL);
+
+    /* The edited file is "0123new456789ABCDEFGHIJKLMNOPQRSTUVWXYZ!" */
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+    fcl_insert_bytes(my_test_file, (guchar *) "new", 4, 3);
+    fcl_insert_bytes(my_test_file, (guchar *) "!", 39, 1);
+    size = 2;
+    fcl_delete_bytes(my_test_file, 19, &size);
+    fcl_insert_bytes(my_test_file, (guchar *) "GH", 19, 2);
+
+    result = fcl_export_patch(my_test_file, patch_name);
+    print_message(result, Q_("Exporting the edits as a patch"));
+    fcl_close_file(my_test_file, FALSE);
+
+    /* The file on disk was not saved : it is the source of the patch */
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_READ);
+    result = fcl_apply_patch(my_test_file, patch_name, target_name);
+    fcl_close_file(my_test_file, FALSE);
+
+    my_test_file = fcl_open_file(target_name, LIBFCL_MODE_READ);
+    expected_file = fcl_open_file(expected_name, LIBFCL_MODE_READ);
+    diffs = fcl_diff(my_test_file, expected_file);
+    print_message(result == TRUE && diffs->len == 0, Q_("Applying the patch (%d difference(s))"), diffs->len);
+    g_array_free(diffs, TRUE);
+
+    /* The target is not the source : the patch must not apply */
+    result = fcl_apply_patch(expected_file, patch_name, target_name);
+    print_message(result == FALSE, Q_("Applying the patch to another file"));
+
+    fcl_close_file(my_test_file, FALSE);
+    fcl_close_file(expected_file, FALSE);
+
+    g_free(filename);
+    g_free(patch_name);
+    g_free(target_name);
+    g_free(expected_name);
+}
+
+
+
+/**
+ * Tests rendering a viewport of a file in hexadecimal and ASCII
+ */
+static void test_rendering_files(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    gchar *filename = NULL;
+    gchar *out = NULL;
+    gsize written = 0;
+    gsize size = 2;
+    gint marks = 0;
+    gint i = 0;
+
+    filename = create_test_file("libfcl_render_test", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789\n\377");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+    out = (gchar *) g_malloc(fcl_render_hex_size(2, 64, LIBFCL_RENDER_OFFSET));
+
+    written = fcl_render_hex(my_test_file, 0, 1, 16, out, 0);
+    print_message(written == 66 && strcmp(out, "41 42 43 44 45 46 47 48 49 4a 4b 4c 4d 4e 4f 50  ABCDEFGHIJKLMNOP\n") == 0, Q_("Rendering a row"));
+
+    /* The last row is padded and the rows after the end are not written */
+    written = fcl_render_hex(my_test_file, 56, 2, 16, out, LIBFCL_RENDER_OFFSET | LIBFCL_RENDER_UPPER);
+    print_message(written == 84 && strcmp(out, "0000000000000038  34 35 36 37 38 39 0A FF                          456789..        \n") == 0, Q_("Rendering the end of the file"));
+
+    fcl_overwrite_bytes(my_test_file, (guchar *) "xy", 33, &size);
+    written = fcl_render_hex(my_test_file, 0, 1, 64, out, LIBFCL_RENDER_DIFF);
+
+    for (i = 0; i < 64; i++)
+        {
+            marks = marks + (out[3 * i + 2] == '*' ? (i == 33 || i == 34 ? 1 : 100) : 0);
+        }
+
+    print_message(written == 258 && marks == 2 && memcmp(out + 3 * 33, "78*79*", 6) == 0 && memcmp(out + 193 + 30, "efgxyjk", 7) == 0 && out[193 + 63] == '.', Q_("Rendering the differences from the disk (%d)"), marks);
+
+    g_free(out);
+    fcl_close_file(my_test_file, FALSE);
+    g_unlink(filename);
+    g_free(filename);
+}
+
+
+/**
+ * Tests editing a file whose buffers do not fit in the memory budget
+ */
+static void test_memory_budget(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_stat_buf_t *stats = NULL;
+    gchar *filename = NULL;
+    guchar *buffer = NULL;
+    gchar *checksum = NULL;
+    gsize size = 0;
+    gsize budget = 0;
+    goffset found = 0;
+    const gchar *expected = "0123ab456789ABCDEFGHIJKLxxOPQRSTUVWXYZ012345678!";
+
+    filename = create_test_file("libfcl_budget_test", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    /* Not even one buffer fits : every buffer edited is spilled but the
+     * last one */
+    budget = fcl_get_memory_budget();
+    fcl_set_memory_budget(1);
+
+    fcl_insert_bytes(my_test_file, (guchar *) "ab", 4, 2);
+    size = 2;
+    fcl_overwrite_bytes(my_test_file, (guchar *) "xx", 24, &size);
+    size = 1;
+    fcl_delete_bytes(my_test_file, 47, &size);
+    fcl_insert_bytes(my_test_file, (guchar *) "!", 47, 1);
+
+    stats = fcl_get_buffer_stats(my_test_file);
+    print_message(stats->resident_size > 0 && stats->resident_size <= LIBFCL_BUF_SIZE && stats->spilled_size > 0, Q_("Buffers spilled to the scratch file (%" G_GSIZE_FORMAT " bytes)"), stats->spilled_size);
+    g_free(stats);
+
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(size == strlen(expected) && memcmp(buffer, expected, size) == 0, Q_("Reading spilled buffers (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+
+    found = fcl_find(my_test_file, (guchar *) "xxO", 3, 0, LIBFCL_FIND_FORWARD);
+    checksum = fcl_checksum(my_test_file, LIBFCL_CHECKSUM_CRC32C);
+    print_message(found == 24 && checksum != NULL, Q_("Searching spilled buffers (%" G_GOFFSET_FORMAT ")"), found);
+    g_free(checksum);
+
+    fcl_set_memory_budget(budget);
+    fcl_close_file(my_test_file, FALSE);
+    print_message(fcl_get_memory_usage() == 0, Q_("Memory given back when closing (%" G_GSIZE_FORMAT " bytes)"), fcl_get_memory_usage());
+
+    g_unlink(filename);
+    g_free(filename);
+}
+
+
+/**
+ * Tests compressing the buffers modified the longest time ago
+ */
+static void test_compression(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_stat_buf_t *stats = NULL;
+    gchar *filename = NULL;
+    gchar *content = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    gsize budget = 0;
+    gsize n = 24 * LIBFCL_BUF_SIZE;
+    gsize i = 0;
+    gboolean compression = FALSE;
+    gboolean result = FALSE;
+
+    content = g_strnfill(n, 'a');
+    filename = create_test_file("libfcl_compression_test", content);
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    /* No budget : nothing is spilled before being compressed */
+    budget = fcl_get_memory_budget();
+    fcl_set_memory_budget(0);
+    compression = fcl_get_compression();
+    fcl_set_compression(TRUE);
+
+    /* One byte changed in each block : the first ones get cold */
+    for (i = 0; i < 24; i++)
+        {
+            size = 1;
+            fcl_overwrite_bytes(my_test_file, (guchar *) "b", i * LIBFCL_BUF_SIZE, &size);
+            content[i * LIBFCL_BUF_SIZE] = 'b';
+        }
+
+    stats = fcl_get_buffer_stats(my_test_file);
+    print_message(stats->packed_size > 0 && stats->compressed_size > stats->packed_size, Q_("Cold buffers compressed (%" G_GSIZE_FORMAT " bytes in %" G_GSIZE_FORMAT ")"), stats->compressed_size, stats->packed_size);
+    g_free(stats);
+
+    size = n;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(size == n && memcmp(buffer, content, size) == 0, Q_("Reading compressed buffers (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+
+    size = 1;
+    fcl_overwrite_bytes(my_test_file, (guchar *) "c", 1, &size);
+    content[1] = 'c';
+    fcl_insert_bytes(my_test_file, (guchar *) "d", 2 * LIBFCL_BUF_SIZE, 1);
+
+    size = n + 1;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    result = size == n + 1 && memcmp(buffer, content, 2 * LIBFCL_BUF_SIZE) == 0 && buffer[2 * LIBFCL_BUF_SIZE] == 'd';
+    print_message(result == TRUE && memcmp(buffer + 2 * LIBFCL_BUF_SIZE + 1, content + 2 * LIBFCL_BUF_SIZE, n - 2 * LIBFCL_BUF_SIZE) == 0, Q_("Editing compressed buffers"));
+    g_free(buffer);
+
+    fcl_set_compression(compression);
+    fcl_set_memory_budget(budget);
+    fcl_close_file(my_test_file, FALSE);
+
+    g_unlink(filename);
+    g_free(filename);
+    g_free(content);
+}
+
+
+/**
+ * Tests editing files that share the memory budget of a session
+ */
+static void test_sessions(void)
+{
+    fcl_session_t *session = NULL;
+    fcl_file_t *first_file = NULL;
+    fcl_file_t *second_file = NULL;
+    fcl_stat_buf_t *stats = NULL;
+    gchar *first_name = NULL;
+    gchar *second_name = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    gsize budget = 0;
+    gboolean result = FALSE;
+
+    first_name = create_test_file("libfcl_session_test_1", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    second_name = create_test_file("libfcl_session_test_2", "abcdefghijklmnopqrstuvwxyz");
+
+    session = fcl_session_new(0);
+    first_file = fcl_session_open_file(session, first_name, LIBFCL_MODE_WRITE);
+    second_file = fcl_session_open_file(session, second_name, LIBFCL_MODE_WRITE);
+
+    /* Only the buffer of the first file fits */
+    fcl_insert_bytes(first_file, (guchar *) "+", 0, 1);
+    budget = fcl_session_get_memory_usage(session);
+    fcl_session_set_memory_budget(session, budget);
+    fcl_insert_bytes(second_file, (guchar *) "-", 0, 1);
+
+    /* The first file, idle, has the buffer modified the longest time ago */
+    stats = fcl_get_buffer_stats(first_file);
+    result = stats->resident_size == 0 && stats->spilled_size > 0;
+    g_free(stats);
+    stats = fcl_get_buffer_stats(second_file);
+    print_message(result == TRUE && stats->resident_size > 0 && stats->spilled_size == 0 && fcl_session_get_memory_usage(session) <= budget, Q_("Buffers of an idle file of the session spilled (%" G_GSIZE_FORMAT " bytes in memory)"), fcl_session_get_memory_usage(session));
+    g_free(stats);
+
+    /* Then the second file spills its own older buffer, but the one just
+     * modified */
+    fcl_insert_bytes(second_file, (guchar *) "-", 20, 1);
+    fcl_insert_bytes(first_file, (guchar *) "*", 30, 1);
+    stats = fcl_get_buffer_stats(second_file);
+    result = stats->resident_size == 0 && stats->spilled_size > 0;
+    g_free(stats);
+    stats = fcl_get_buffer_stats(first_file);
+    print_message(result == TRUE && stats->resident_size > 0 && fcl_session_get_memory_usage(session) <= budget, Q_("Buffers of the session spilled the oldest first (%" G_GSIZE_FORMAT " bytes in memory)"), fcl_session_get_memory_usage(session));
+    g_free(stats);
+
+    size = 100;
+    buffer = fcl_read_bytes(first_file, 0, &size);
+    result = size == 38 && memcmp(buffer, "+0123456789ABCDEFGHIJKLMNOPQRS*TUVWXYZ", size) == 0;
+    g_free(buffer);
+    size = 100;
+    buffer = fcl_read_bytes(second_file, 0, &size);
+    print_message(result == TRUE && size == 28 && memcmp(buffer, "-abcdefghijklmnopqrs-tuvwxyz", size) == 0, Q_("Reading the files of a session"));
+    g_free(buffer);
+
+    fcl_session_free(session);
+    fcl_close_file(first_file, FALSE);
+    fcl_close_file(second_file, FALSE);
+    print_message(fcl_session_get_memory_usage(session) == 0, Q_("Memory of the session given back (%" G_GSIZE_FORMAT " bytes)"), fcl_session_get_memory_usage(session));
+    fcl_session_free(session);
+
+    g_unlink(first_name);
+    g_unlink(second_name);
+    g_free(first_name);
+    g_free(second_name);
 }
 
 
+/**
+ * Tests reading more files than the streams that may be open at once
+ */
+static void test_open_files(void)
+{
+    fcl_file_t *files[4];
+    fcl_file_t *replaced = NULL;
+    gchar *names[4];
+    gchar *name = NULL;
+    gchar *content = NULL;
+    fcl_perf_t *perf = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    guint max_open = 0;
+    guint i = 0;
+    gint backend = 0;
+    gboolean result = TRUE;
+
+    max_open = fcl_get_max_open_files();
+    fcl_set_max_open_files(2);
+    backend = fcl_get_default_backend();
+    fcl_set_default_backend(LIBFCL_BACKEND_GIO);
+
+    for (i = 0; i < 4; i++)
+        {
+            name = g_strdup_printf("libfcl_pool_test_%u", i);
+            content = g_strdup_printf("file number %u", i);
+            names[i] = create_test_file(name, content);
+            g_free(content);
+            g_free(name);
+            files[i] = fcl_open_file_lazy(names[i], LIBFCL_MODE_READ);
+
+            size = 1;
+            buffer = fcl_read_bytes(files[i], 12, &size);
+            result = result && size == 1 && buffer[0] == '0' + i;
+            g_free(buffer);
+        }
+
+    print_message(result == TRUE && fcl_get_open_files() <= 2, Q_("Streams of the files used the longest time ago closed (%u open)"), fcl_get_open_files());
+
+    size = 100;
+    buffer = fcl_read_bytes(files[0], 0, &size);
+    perf = fcl_get_perf(files[0]);
+    print_message(size == 13 && memcmp(buffer, "file number 0", size) == 0 && perf->pool_closes == 1, Q_("Reading a file whose streams were closed (%" G_GUINT64_FORMAT " closed)"), perf->pool_closes);
+    g_free(perf);
+    g_free(buffer);
+
+    /* A file being replaced is only put in place when its backend is freed */
+    name = create_test_file("libfcl_pool_replaced", "old");
+    replaced = fcl_open_backend(fcl_backend_new(LIBFCL_BACKEND_GIO, name, LIBFCL_MODE_CREATE), name);
+    size = 1;
+    buffer = fcl_read_bytes(replaced, 0, &size);
+    g_free(buffer);
+    result = replaced->backend->write_at(replaced->backend, 0, (const guchar *) "new", 3) == 3;
+
+    for (i = 0; i < 4; i++)
+        {
+            size = 1;
+            buffer = fcl_read_bytes(files[i], 0, &size);
+            g_free(buffer);
+        }
+
+    g_file_get_contents(name, &content, &size, NULL);
+    result = result && replaced->backend->is_open == TRUE && size == 3 && memcmp(content, "old", size) == 0;
+    g_free(content);
+    fcl_close_file(replaced, FALSE);
+    g_file_get_contents(name, &content, &size, NULL);
+    print_message(result == TRUE && size == 3 && memcmp(content, "new", size) == 0, Q_("Stream replacing a file kept open by the pool"));
+    g_free(content);
+    g_unlink(name);
+    g_free(name);
+
+    for (i = 0; i < 4; i++)
+        {
+            fcl_close_file(files[i], FALSE);
+            g_unlink(names[i]);
+            g_free(names[i]);
+        }
 
+    fcl_set_max_open_files(max_open);
+    fcl_set_default_backend(backend);
+}
+
+
+/**
+ * Tests reading, editing and saving files through the storage backends
+ */
+static void test_backends(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_backend_t *target = NULL;
+    gchar *filename = NULL;
+    gchar *saved = NULL;
+    gchar *contents = NULL;
+    const guchar *map = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    gint kind = 0;
+    gboolean result = TRUE;
+
+    filename = create_test_file("libfcl_backend_test", "0123456789ABCDEF");
+    saved = g_build_path(G_DIR_SEPARATOR_S, g_get_tmp_dir(), "libfcl_backend_saved", NULL);
+
+    for (kind = LIBFCL_BACKEND_GIO; kind <= LIBFCL_BACKEND_MEMORY; kind++)
+        {
+            my_test_file = fcl_open_backend(fcl_backend_new(kind, filename, LIBFCL_MODE_READ), filename);
+            size = 4;
+            buffer = fcl_read_bytes(my_test_file, 10, &size);
+            result = result && my_test_file->real_size == 16 && size == 4 && memcmp(buffer, "ABCD", 4) == 0;
+            g_free(buffer);
+            fcl_close_file(my_test_file, FALSE);
+        }
+
+    print_message(result == TRUE, Q_("Reading a file with each backend"));
+
+    /* The untouched parts are read in place from the mapping */
+    my_test_file = fcl_open_backend(fcl_backend_new(LIBFCL_BACKEND_MMAP, filename, LIBFCL_MODE_WRITE), filename);
+    fcl_insert_bytes(my_test_file, (guchar *) "--", 8, 2);
+    target = fcl_backend_new(LIBFCL_BACKEND_POSIX, saved, LIBFCL_MODE_CREATE);
+    result = fcl_save_to_backend(my_test_file, target);
+    fcl_backend_free(target);
+    g_file_get_contents(saved, &contents, &size, NULL);
+    print_message(result == TRUE && size == 18 && memcmp(contents, "01234567--89ABCDEF", size) == 0, Q_("Saving a mapped file with the POSIX backend"));
+    g_free(contents);
+    fcl_close_file(my_test_file, FALSE);
+
+    my_test_file = fcl_open_backend(fcl_backend_new_from_data((const guchar *) "in memory", 9), NULL);
+    fcl_insert_bytes(my_test_file, (guchar *) "edited ", 0, 7);
+    target = fcl_backend_new_from_data(NULL, 0);
+    result = fcl_save_to_backend(my_test_file, target);
+    map = target->map(target, &size);
+    print_message(result == TRUE && size == 16 && memcmp(map, "edited in memory", size) == 0 && fcl_get_open_files() == 0, Q_("Editing and saving a file in memory"));
+    fcl_backend_free(target);
+    fcl_close_file(my_test_file, FALSE);
+
+    /* Its bytes are in a GByteArray, that holds at most G_MAXUINT bytes */
+    target = fcl_backend_new_from_data(NULL, 0);
+    result = target->write_at(target, (goffset) G_MAXUINT, (const guchar *) "x", 1) == -1 && target->size(target) == 0;
+    print_message(result == TRUE && (sizeof(gsize) == sizeof(guint) || fcl_backend_new_from_data((const guchar *) "x", (gsize) G_MAXUINT + 1) == NULL), Q_("Memory backend bigger than G_MAXUINT bytes refused"));
+    fcl_backend_free(target);
+
+    g_unlink(filename);
+    g_unlink(saved);
+    g_free(filename);
+    g_free(saved);
+}
+
+
+/**
+ * Tests inserting ranges of other files and saving the result
+ */
+static void test_inserting_ranges(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    gchar *filename = NULL;
+    gchar *source = NULL;
+    gchar *saved = NULL;
+    gchar *contents = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    gint fd = -1;
+    gint backend = LIBFCL_BACKEND_GIO;
+    gboolean result = FALSE;
+    const gchar *expected = "uvwz01234cdXYg!hijkl56789";
+
+    source = create_test_file("libfcl_range_source", "abcdefghijklmnopqrstuvwxyz");
+    filename = create_test_file("libfcl_range_test", "0123456789");
+    saved = g_build_filename(g_get_tmp_dir(), "libfcl_range_saved", NULL);
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    result = fcl_insert_file_range(my_test_file, 5, source, 2, 10);
+    fd = g_open(source, O_RDONLY, 0);
+    result = result && fcl_insert_fd_range(my_test_file, 0, fd, 20, 6);
+    g_close(fd, NULL);
+
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(result == TRUE && size == 26 && memcmp(buffer, "uvwxyz01234cdefghijkl56789", size) == 0, Q_("Inserting ranges of a file (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+
+    result = fcl_insert_file_range(my_test_file, 0, source, 20, 10);
+    print_message(result == FALSE, Q_("Range beyond the end of the file refused"));
+
+    size = 2;
+    fcl_overwrite_bytes(my_test_file, (guchar *) "XY", 13, &size);
+    fcl_insert_bytes(my_test_file, (guchar *) "!", 16, 1);
+    size = 2;
+    fcl_delete_bytes(my_test_file, 3, &size);
+
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(size == strlen(expected) && memcmp(buffer, expected, size) == 0, Q_("Editing the inserted ranges (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+
+    result = fcl_save_as(my_test_file, saved);
+    g_file_get_contents(saved, &contents, &size, NULL);
+    print_message(result == TRUE && size == strlen(expected) && memcmp(contents, expected, size) == 0, Q_("Saving the file elsewhere (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(contents);
+
+    print_message(fcl_save_as(my_test_file, filename) == FALSE, Q_("Saving a file over itself refused"));
+
+    g_unlink(saved);
+    result = link(source, saved) == 0 && fcl_save_as(my_test_file, saved) == FALSE;
+    g_file_get_contents(source, &contents, &size, NULL);
+    print_message(result == TRUE && size == 26, Q_("Saving over a link to a source of the file refused"));
+    g_free(contents);
+
+    size = strlen(expected);
+    fcl_delete_bytes(my_test_file, 0, &size);
+    fcl_insert_bytes(my_test_file, (guchar *) "ok", 0, 2);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(size == 2 && memcmp(buffer, "ok", size) == 0, Q_("Deleting the inserted ranges (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+
+    fcl_close_file(my_test_file, TRUE);
+    g_file_get_contents(filename, &contents, &size, NULL);
+    print_message(size == 2 && memcmp(contents, "ok", size) == 0, Q_("Saving the file when closing it (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(contents);
+
+    /* A file that is only read is never replaced by its own backend */
+    backend = fcl_get_default_backend();
+    fcl_set_default_backend(LIBFCL_BACKEND_GIO);
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_CREATE);
+    fcl_set_default_backend(backend);
+    fcl_insert_bytes(my_test_file, (guchar *) "!", 2, 1);
+    fcl_close_file(my_test_file, TRUE);
+    g_file_get_contents(filename, &contents, &size, NULL);
+    print_message(size == 3 && memcmp(contents, "ok!", size) == 0, Q_("Saving a file opened in create mode when closing it (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(contents);
+
+    /* The source is cut behind the back of the library */
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+    result = fcl_insert_file_range(my_test_file, 1, source, 0, 26) && truncate(source, 4) == 0;
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(result == TRUE && size == 5 && memcmp(buffer, "oabcd", size) == 0, Q_("Reading a range whose source was cut (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+    fcl_close_file(my_test_file, FALSE);
+
+    g_unlink(saved);
+    g_unlink(source);
+    g_unlink(filename);
+    g_free(saved);
+    g_free(source);
+    g_free(filename);
+}
+
+
+/**
+ * Tests copying and moving ranges of a file by reference
+ */
+static void test_copying_ranges(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_stat_buf_t *stats = NULL;
+    fcl_perf_t *perf = NULL;
+    gchar *filename = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    gboolean result = FALSE;
+    const gchar *copied = "0123ABCDEFGHIJKLMNOPQRST456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const gchar *moved = "CDEFGHIJKLMNOPQRST456789ABCD0123ABEFGHIJKLMNOPQRSTUVWXYZ";
+
+    filename = create_test_file("libfcl_copy_test", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    result = fcl_copy_range(my_test_file, 10, 20, 4);
+    stats = fcl_get_buffer_stats(my_test_file);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(result == TRUE && size == strlen(copied) && memcmp(buffer, copied, size) == 0 && stats->resident_size < 20, Q_("Copying a range (%" G_GSIZE_FORMAT " bytes in memory)"), stats->resident_size);
+    g_free(buffer);
+    g_free(stats);
+
+    result = fcl_move_range(my_test_file, 0, 6, 34);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(result == TRUE && size == strlen(moved) && memcmp(buffer, moved, size) == 0, Q_("Moving a range (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+
+    result = fcl_move_range(my_test_file, 28, 6, 0);
+    perf = fcl_get_perf(my_test_file);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(result == TRUE && size == strlen(copied) && memcmp(buffer, copied, size) == 0 && perf->op_count[LIBFCL_PERF_MOVE] == 2, Q_("Moving a range backwards (%" G_GUINT64_FORMAT " moves)"), perf->op_count[LIBFCL_PERF_MOVE]);
+    g_free(buffer);
+    g_free(perf);
+
+    result = fcl_move_range(my_test_file, 0, 10, 5) || fcl_copy_range(my_test_file, 50, 10, 0);
+    print_message(result == FALSE, Q_("Moving a range inside itself or copying beyond the end refused"));
+
+    fcl_close_file(my_test_file, FALSE);
+
+    /* A file in memory has no file on disk to reference */
+    my_test_file = fcl_open_backend(fcl_backend_new_from_data((const guchar *) "0123456789", 10), NULL);
+    result = fcl_copy_range(my_test_file, 2, 5, 10);
+    size = 100;
+    buffer = fcl_read_bytes(my_test_file, 0, &size);
+    print_message(result == TRUE && size == 15 && memcmp(buffer, "012345678923456", size) == 0, Q_("Copying a range of a file in memory (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+    fcl_close_file(my_test_file, FALSE);
+
+    g_unlink(filename);
+    g_free(filename);
+}
+
+
+/**
+ * Tests pasting the clipboard in many files
+ */
+static void test_clipboard(void)
+{
+    fcl_file_t *first_file = NULL;
+    fcl_file_t *second_file = NULL;
+    gchar *first_name = NULL;
+    gchar *second_name = NULL;
+    guchar *buffer = NULL;
+    gsize size = 0;
+    gsize shared = 0;
+    gboolean result = FALSE;
+
+    first_name = create_test_file("libfcl_clipboard_test_1", "0123456789");
+    second_name = create_test_file("libfcl_clipboard_test_2", "abcdef");
+    first_file = fcl_open_file(first_name, LIBFCL_MODE_WRITE);
+    second_file = fcl_open_file(second_name, LIBFCL_MODE_WRITE);
+
+    fcl_clipboard_set((guchar *) "hello", 5);
+    result = fcl_clipboard_paste(first_file, 8) && fcl_clipboard_paste(first_file, 0) && fcl_clipboard_paste(second_file, 6);
+    shared = fcl_get_shared_memory();
+    print_message(result == TRUE && fcl_clipboard_size() == 5 && shared == 5, Q_("Pasting in many files (%" G_GSIZE_FORMAT " bytes shared)"), shared);
+
+    size = 2;
+    fcl_overwrite_bytes(first_file, (guchar *) "HE", 0, &size);
+
+    size = 100;
+    buffer = fcl_read_bytes(first_file, 0, &size);
+    result = size == 20 && memcmp(buffer, "HEllo01234567hello89", size) == 0;
+    g_free(buffer);
+    size = 100;
+    buffer = fcl_read_bytes(second_file, 0, &size);
+    print_message(result == TRUE && size == 11 && memcmp(buffer, "abcdefhello", size) == 0, Q_("Editing a pasted range leaves the other ones"));
+    g_free(buffer);
+
+    result = fcl_clipboard_cut(first_file, 5, 2) && fcl_clipboard_paste(second_file, 0);
+    size = 100;
+    buffer = fcl_read_bytes(second_file, 0, &size);
+    print_message(result == TRUE && size == 13 && memcmp(buffer, "01abcdefhello", size) == 0, Q_("Cutting and pasting (%" G_GSIZE_FORMAT " bytes)"), size);
+    g_free(buffer);
+
+    fcl_close_file(first_file, FALSE);
+    fcl_close_file(second_file, FALSE);
+    fcl_clipboard_clear();
+    print_message(fcl_clipboard_size() == 0 && fcl_get_shared_memory() == 0, Q_("Shared memory given back (%" G_GSIZE_FORMAT " bytes)"), fcl_get_shared_memory());
+
+    first_file = fcl_open_file(first_name, LIBFCL_MODE_WRITE);
+    fcl_clipboard_set((guchar *) "hello", 5);
+    fcl_clipboard_paste(first_file, 5);
+    fcl_clipboard_clear();
+    fcl_insert_bytes(first_file, (guchar *) "X", 7, 1);
+    fcl_insert_bytes(first_file, (guchar *) "Y", 8, 1);
+    size = 100;
+    buffer = fcl_read_bytes(first_file, 0, &size);
+    print_message(size == 17 && memcmp(buffer, "01234heXYllo56789", size) == 0 && fcl_get_shared_memory() == 0, Q_("Typing in a pasted range shares nothing (%" G_GSIZE_FORMAT " bytes)"), fcl_get_shared_memory());
+    g_free(buffer);
+    fcl_close_file(first_file, FALSE);
+
+    g_unlink(first_name);
+    g_unlink(second_name);
+    g_free(first_name);
+    g_free(second_name);
+}
+
+
+/**
+ * Tests the statistics kept on the buffers of a file
+ */
+static void test_buffer_statistics(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_stat_buf_t *stats = NULL;
+    gchar *filename = NULL;
+    guint64 n_bufs = 0;
+    guint class = 0;
+    gsize size = 0;
+
+    filename = create_test_file("libfcl_stats_test", "0123456789ABCDEF");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    stats = fcl_get_buffer_stats(my_test_file);
+    print_message(stats != NULL && stats->n_bufs == 0 && stats->logical_size == 16, Q_("Statistics of an untouched file (%" G_GOFFSET_FORMAT " bytes)"), stats->logical_size);
+    g_free(stats);
+
+    fcl_insert_bytes(my_test_file, (guchar *) "abc", 2, 3);
+    size = 2;
+    fcl_delete_bytes(my_test_file, 12, &size);
+
+    stats = fcl_get_buffer_stats(my_test_file);
+
+    for (class = 0; class < LIBFCL_STATS_HISTOGRAM_SIZE; class++)
+        {
+            n_bufs = n_bufs + stats->histogram[class];
+        }
+
+    print_message(stats->add_size == 3 && stats->del_size == 2 && stats->logical_size == 17, Q_("Statistics after edition (+%" G_GSSIZE_FORMAT ", -%" G_GSSIZE_FORMAT ", %" G_GOFFSET_FORMAT " bytes)"), stats->add_size, stats->del_size, stats->logical_size);
+    print_message(stats->n_bufs > 0 && n_bufs == stats->n_bufs && stats->min_buf_size <= stats->max_buf_size, Q_("Histogram of the buffers (%" G_GUINT64_FORMAT " buffers)"), n_bufs);
+    g_free(stats);
+
+    fcl_close_file(my_test_file, FALSE);
+    g_free(filename);
+}
+
+
+/**
+ * Tests the performance counters of a file
+ */
+static void test_performance_counters(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    fcl_perf_t *perf = NULL;
+    gchar *filename = NULL;
+    guchar *data = NULL;
+    guint64 n_ops = 0;
+    guint bucket = 0;
+    gsize size = 0;
+
+    filename = create_test_file("libfcl_perf_test", "0123456789ABCDEF");
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+
+    fcl_insert_bytes(my_test_file, (guchar *) "abc", 2, 3);
+    size = 4;
+    data = fcl_read_bytes(my_test_file, 0, &size);
+    g_free(data);
+    size = 4;
+    data = fcl_read_bytes(my_test_file, 12, &size);
+    g_free(data);
+
+    perf = fcl_get_perf(my_test_file);
+
+    for (bucket = 0; bucket < LIBFCL_PERF_LATENCY_BUCKETS; bucket++)
+        {
+            n_ops = n_ops + perf->latency[LIBFCL_PERF_READ][bucket];
+        }
+
+    print_message(perf->op_count[LIBFCL_PERF_READ] == 2 && perf->op_count[LIBFCL_PERF_INSERT] == 1 && n_ops == 2, Q_("Operations counted (%" G_GUINT64_FORMAT " reads)"), perf->op_count[LIBFCL_PERF_READ]);
+    print_message(perf->lookups == perf->cache_hits + perf->cache_misses && perf->cache_hits > 0 && perf->cache_misses > 0, Q_("Lookups counted (%" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses)"), perf->cache_hits, perf->cache_misses);
+    print_message(perf->disk_reads == perf->cache_misses && perf->disk_bytes_read > 0 && perf->allocations > 0, Q_("Disk reads counted (%" G_GUINT64_FORMAT " bytes)"), perf->disk_bytes_read);
+    g_free(perf);
+
+    fcl_reset_perf(my_test_file);
+    perf = fcl_get_perf(my_test_file);
+    print_message(perf->lookups == 0 && perf->op_count[LIBFCL_PERF_READ] == 0, Q_("Performance counters reset"));
+    g_free(perf);
+
+    fcl_close_file(my_test_file, FALSE);
+    g_free(filename);
+}
+
+
+/**
+ * This function tests recording the calls made to the library in a trace
+ */
+static void test_recording_calls(void)
+{
+    fcl_file_t *my_test_file = NULL;
+    gchar *filename = NULL;
+    gchar *trace_path = NULL;
+    gchar *trace = NULL;
+    gsize trace_size = 0;
+    gsize size = 0;
+    gboolean started = FALSE;
+
+    filename = create_test_file("libfcl_record_test", "0123456789ABCDEF");
+    trace_path = g_build_path(G_DIR_SEPARATOR_S, g_get_tmp_dir(), "libfcl_record_test.trace", NULL);
+
+    started = fcl_record_start(trace_path);
+    print_message(started == TRUE && fcl_record_start(trace_path) == FALSE, Q_("Recording started (only once)"));
+
+    my_test_file = fcl_open_file(filename, LIBFCL_MODE_WRITE);
+    fcl_insert_bytes(my_test_file, (guchar *) "abc", 2, 3);
+    size = 4;
+    g_free(fcl_read_bytes(my_test_file, 0, &size));
+    fcl_close_file(my_test_file, FALSE);
+
+    fcl_record_stop();
+
+    /* The trace begins with the OPEN record of file 0 and ends with the save
+     * argument of the CLOSE record */
+    g_file_get_contents(trace_path, &trace, &trace_size, NULL);
+    print_message(trace != NULL && trace_size > 7 && memcmp(trace, LIBFCL_RECORD_MAGIC, 4) == 0 && trace[4] == LIBFCL_RECORD_VERSION && trace[5] == LIBFCL_RECORD_OPEN && trace[6] == 0 && trace[trace_size - 1] == 0, Q_("Trace written (%" G_GSIZE_FORMAT " bytes)"), trace_size);
+
+    g_free(trace);
+    g_unlink(trace_path);
+    g_free(trace_path);
+    g_free(filename);
+}
 
 int main(int argc, char **argv)
 {
@@ -369,6 +1640,10 @@ int main(int argc, char **argv)
     test_openning_and_closing_files();
     fprintf(stdout,"\n\n");
 
+    fprintf(stdout, Q_("Testing opening files lazily :\n"));
+    test_lazy_openning_of_files();
+    fprintf(stdout,"\n\n");
+
     fprintf(stdout, Q_("Testing opening and reading files :\n"));
     test_openning_and_reading_files();
     fprintf(stdout,"\n\n");
@@ -385,6 +1660,83 @@ int main(int argc, char **argv)
     test_openning_and_deleting_in_files();
     fprintf(stdout,"\n\n");
 
+    fprintf(stdout, Q_("Testing opening and searching in files :\n"));
+    test_openning_and_searching_in_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing searching many patterns in files :\n"));
+    test_searching_many_patterns_in_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing searching regular expressions in files :\n"));
+    test_searching_regular_expressions_in_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing replacing in files :\n"));
+    test_replacing_in_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing checksums of files :\n"));
+    test_checksums_of_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing the distribution of the bytes :\n"));
+    test_byte_distribution_of_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing differences between files :\n"));
+    test_diffing_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing patches :\n"));
+    test_patching_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing rendering files :\n"));
+    test_rendering_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing the memory budget :\n"));
+    test_memory_budget();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing compressing the buffers :\n"));
+    test_compression();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing sessions :\n"));
+    test_sessions();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing the pool of open files :\n"));
+    test_open_files();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing storage backends :\n"));
+    test_backends();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing inserting ranges of other files :\n"));
+    test_inserting_ranges();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing copying and moving ranges :\n"));
+    test_copying_ranges();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing the clipboard :\n"));
+    test_clipboard();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing buffer statistics :\n"));
+    test_buffer_statistics();
+    test_performance_counters();
+    fprintf(stdout,"\n\n");
+
+    fprintf(stdout, Q_("Testing recording the calls :\n"));
+    test_recording_calls();
+    fprintf(stdout,"\n\n");
+
 
     return 0;
 }